@@ -2,82 +2,153 @@
 #include "ButtonControllerDirectInput.h"
 #include <windows.h>
 #include <dinput.h>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <sstream>
+#include <unordered_map>
 #include <vector>
-#include <nlohmann/json.hpp>
 
-using ordered_json = nlohmann::ordered_json;
+#include "../Common/ButtonEventBuffer.h"
+#include "../Common/ButtonPack.h"
+#include "../Common/DeviceNameIndex.h"
+#include "../Common/DirectInputDeviceJson.h"
+#include "../Common/EnumScratch.h"
+#include "../Common/HandleTable.h"
+#include "../Common/PollScheduler.h"
 
 #pragma comment(lib, "dinput8.lib")
 #pragma comment(lib, "dxguid.lib")
 
+struct JoystickHandle;
+
+// Buffered button changes of one device (DIPROP_BUFFERSIZE / GetDeviceData)
+class DirectInputEventBackend : public ButtonEventBackend {
+public:
+	explicit DirectInputEventBackend(JoystickHandle* handle) : m_handle(handle) {}
+
+	int ReadChanges(ButtonBufferedChange* changes, int maxChanges, bool& overflow) override;
+	bool ReadState(uint64_t (&words)[BUTTON_BUFFER_WORDS]) override;
+
+private:
+	JoystickHandle* m_handle;
+};
+
 struct JoystickHandle {
 	LPDIRECTINPUTDEVICE8 device;
 	DWORD capabilities;
 	DWORD deviceType;
+	DWORD buttonCount;
+	// Data format: button i is the byte at buttonOffset + i of a stateSize
+	// byte state. Normally only the buttons (see SetButtonDataFormat).
+	std::vector<DIOBJECTDATAFORMAT> formatObjects;
+	DIDATAFORMAT format;
+	DWORD stateSize;
+	DWORD buttonOffset;
+	DWORD stateButtons; // Buttons present in the state, at most BUTTONDI_MAX_BUTTONS
+	bool polled;        // Needs Poll before each read (DIDC_POLLEDDEVICE)
+	// Serializes device reads of the application and the polling thread
+	std::mutex deviceMutex;
+	std::unique_ptr<DirectInputEventBackend> backend;
+	// Guards pollId, buffered, events and notification against concurrent
+	// EnableButtonEvents and ReadButtonEvents calls; taken before deviceMutex
+	std::mutex eventsMutex;
+	// Registration with the polling scheduler (0 once buffered)
+	int pollId = 0;
+	// Buffered mode, set up by EnableButtonEvents
+	bool buffered = false;
+	ButtonEventMerger events;
+	HANDLE notification = NULL;
+
+	// Releases the device once the handle is closed and no call is using it
+	~JoystickHandle();
 };
 
-// Global DirectInput object
+// Global DirectInput object, created once by GetDirectInput
 static LPDIRECTINPUT8 g_pDI = nullptr;
+static std::once_flag g_pDIOnce;
+
+// Samples every open handle at a fixed rate once StartButtonPolling is
+// called. Never destroyed: joining its thread while the DLL unloads could
+// deadlock on the loader lock, so StopButtonPolling or
+// ShutdownButtonController stops it before FreeLibrary.
+static PollScheduler* g_scheduler = nullptr;
+static std::once_flag g_schedulerOnce;
+
+// Open handles; the exported void* is a HandleTable handle, not an address.
+// Every export holds a HandleRef while it uses the record, so a concurrent
+// CloseJoystick only releases the device after the call returns. Never
+// destroyed, like the scheduler, which may still sample the records.
+static HandleTable<JoystickHandle>& Handles() {
+	static HandleTable<JoystickHandle>* handles = new HandleTable<JoystickHandle>();
+	return *handles;
+}
 
-// Global Buffer for returning GUID string
-static char g_GUIDBuffer[40];
+typedef HandleTable<JoystickHandle>::Ref HandleRef;
 
-// HELPER FUNCTIONS
+// Per-thread buffer for the GUID string returned by the FindJoystickBy* calls
+static thread_local char g_GUIDBuffer[BUTTONDI_GUID_SIZE];
 
-// Helper function to convert WCHAR* to std::string
-std::string wchar_to_string(const WCHAR* wstr) {
-	if (wstr == nullptr)
-		return std::string();
-	int size_needed =
-		WideCharToMultiByte(CP_UTF8, 0, wstr, -1, NULL, 0, NULL, NULL);
-	std::string strTo(size_needed, 0);
-	WideCharToMultiByte(CP_UTF8, 0, wstr, -1, &strTo[0], size_needed, NULL, NULL);
-	return strTo;
-}
+// One device reported by EnumDevices
+struct DirectInputDeviceRecord : DirectInputDeviceInfo {
+	GUID productGUID;
+	GUID instanceGUID;
+};
+
+static_assert(BUTTONDI_MAX_NAME_DISTANCE == DEVICE_NAME_MAX_DISTANCE, "Fuzzy name distance limits differ");
 
-std::string trim_nulls(const std::string& str) {
-	size_t pos = str.find('\0');
-	return pos != std::string::npos ? str.substr(0, pos) : str;
+static uint64_t DeviceUsageKey(uint16_t vendorID, uint16_t productID, uint16_t usagePage, uint16_t usage) {
+	return (static_cast<uint64_t>(vendorID) << 48) | (static_cast<uint64_t>(productID) << 32) |
+		(static_cast<uint32_t>(usagePage) << 16) | usage;
 }
 
-std::string to_hex_string(unsigned int value) {
-	std::stringstream ss;
-	ss << "0x" << std::uppercase << std::setfill('0') << std::setw(4) << std::hex << value;
-	return ss.str();
+typedef DirectInputDeviceList<DirectInputDeviceRecord> DirectInputDevices;
+
+// Devices of one enumeration, in enumeration order, and their lookup
+// indexes. Built only for the FindJoystickBy* lookups.
+struct DirectInputSnapshot {
+	DirectInputDevices devices;
+	std::unordered_map<uint64_t, int> byUsage; // DeviceUsageKey to the first device
+	DeviceNameIndex names;                     // Normalized product names
+
+	void BuildIndex() {
+		for (size_t i = 0; i < devices.size(); i++) {
+			const DirectInputDeviceRecord& device = devices[i];
+			int index = static_cast<int>(i);
+			byUsage.emplace(DeviceUsageKey(device.vendorID, device.productID, device.usagePage, device.usage), index);
+			names.Add(device.name, device.usagePage, device.usage, index);
+		}
+		names.Finish();
+	}
+};
+
+// Devices of the last enumeration; lookups are served from it
+static std::mutex g_snapshotMutex;
+static std::shared_ptr<const DirectInputSnapshot> g_snapshot;
+
+// Storage GetDirectInputDeviceList enumerates into, reused by every call;
+// g_listMutex is taken before g_snapshotMutex
+static std::mutex g_listMutex;
+static DirectInputDevices g_list;
+
+// HELPER FUNCTIONS
+
+// Converts a null-terminated WCHAR array into value, allocating at most once
+template <size_t N>
+static void AssignUTF8(std::string& value, const WCHAR (&text)[N]) {
+	char converted[N * UTF8_BYTES_PER_UTF16_UNIT];
+	value.assign(converted, Utf16ToUtf8(text, N, converted));
 }
 
-// More detailed device type information
-std::string GetDetailedDeviceType(DWORD dwDevType) {
-	std::stringstream ss;
-	DWORD primaryType = dwDevType & 0xFF;
-	DWORD secondaryType = (dwDevType >> 8) & 0xFF;
-
-	// Primary type
-	ss << "Primary: ";
-	switch (primaryType) {
-	case 0x11: ss << "HID Device"; break;
-	case 0x12: ss << "Mouse"; break;
-	case 0x13: ss << "Keyboard"; break;
-	case 0x14: ss << "Joystick"; break;
-	case 0x15: ss << "Gamepad"; break;
-	case 0x16: ss << "Driving"; break;
-	case 0x17: ss << "Flight"; break;
-	default: ss << "Unknown (0x" << std::hex << primaryType << ")";
-	}
-
-	// Secondary type
-	ss << ", Secondary: ";
-	switch (secondaryType) {
-	case 0x00: ss << "None"; break;
-	case 0x01: ss << "Limited"; break;
-	case 0x02: ss << "Standard"; break;
-	case 0x03: ss << "Enhanced"; break;
-	default: ss << "Unknown (0x" << std::hex << secondaryType << ")";
-	}
-
-	return ss.str();
+// Writes the registry form of the GUID and a null into text
+static void GUIDToText(const GUID& guid, char (&text)[DIRECTINPUT_GUID_TEXT_SIZE]) {
+	OLECHAR guidString[40];
+	int units = StringFromGUID2(guid, guidString, sizeof(guidString) / sizeof(OLECHAR));
+	size_t length = 0;
+	// The registry form is plain ASCII
+	for (int i = 0; i < units && guidString[i] != 0 && length + 1 < DIRECTINPUT_GUID_TEXT_SIZE; i++) {
+		text[length++] = static_cast<char>(guidString[i]);
+	}
+	text[length] = '\0';
 }
 
 // Helper function to convert std::string to std::wstring
@@ -99,42 +170,306 @@ static bool StringToGUID(const char* str, GUID& guid) {
 	return SUCCEEDED(CLSIDFromString(wstr.c_str(), &guid));
 }
 
-// Callback function for device enumeration
-static BOOL CALLBACK EnumDevicesCallback(LPCDIDEVICEINSTANCE lpddi, LPVOID pvRef) {
-	ordered_json* deviceList = static_cast<ordered_json*>(pvRef);
+// Sets a data format holding only the device's buttons, one byte each, so
+// GetDeviceState copies a few bytes instead of the 272-byte DIJOYSTATE2.
+// Falls back to c_dfDIJoystick2 if DirectInput rejects it.
+static HRESULT SetButtonDataFormat(JoystickHandle* handle, DWORD buttons) {
+	if (buttons > BUTTONDI_MAX_BUTTONS) {
+		buttons = BUTTONDI_MAX_BUTTONS;
+	}
+	handle->formatObjects.resize(buttons);
+	for (DWORD i = 0; i < buttons; i++) {
+		DIOBJECTDATAFORMAT& object = handle->formatObjects[i];
+		object.pguid = NULL;
+		object.dwOfs = i;
+		// Like c_dfDIJoystick2: the next button of the device, whatever its instance
+		object.dwType = DIDFT_BUTTON | DIDFT_ANYINSTANCE | DIDFT_OPTIONAL;
+		object.dwFlags = 0;
+	}
+	handle->format.dwSize = sizeof(DIDATAFORMAT);
+	handle->format.dwObjSize = sizeof(DIOBJECTDATAFORMAT);
+	handle->format.dwFlags = DIDF_ABSAXIS;
+	handle->format.dwDataSize = (buttons + 3) & ~3u; // Must be a multiple of 4
+	handle->format.dwNumObjs = buttons;
+	handle->format.rgodf = handle->formatObjects.empty() ? NULL : handle->formatObjects.data();
+
+	HRESULT hr = buttons > 0 ? handle->device->SetDataFormat(&handle->format) : E_FAIL;
+	if (SUCCEEDED(hr)) {
+		handle->stateSize = handle->format.dwDataSize;
+		handle->buttonOffset = 0;
+		handle->stateButtons = buttons;
+		return hr;
+	}
+
+	hr = handle->device->SetDataFormat(&c_dfDIJoystick2);
+	handle->formatObjects.clear();
+	handle->stateSize = sizeof(DIJOYSTATE2);
+	handle->buttonOffset = DIJOFS_BUTTON(0);
+	handle->stateButtons = BUTTONDI_MAX_BUTTONS;
+	return hr;
+}
 
-	ordered_json device;
-	device["index"] = deviceList->size();
-	device["name"] = trim_nulls(wchar_to_string(lpddi->tszProductName));
-	device["instanceName"] = trim_nulls(wchar_to_string(lpddi->tszInstanceName));
+// Reads the device state, polling only devices that need it and
+// reacquiring the device once if needed
+static HRESULT ReadJoystickState(JoystickHandle* handle, BYTE* state) {
+	HRESULT hr = handle->polled ? handle->device->Poll() : DI_OK;
+	if (SUCCEEDED(hr)) {
+		hr = handle->device->GetDeviceState(handle->stateSize, state);
+	}
 
-	// VID/PID
-	device["vendorID"] = to_hex_string((lpddi->guidProduct.Data1 >> 16) & 0xFFFF);
-	device["productID"] = to_hex_string(lpddi->guidProduct.Data1 & 0xFFFF);
+	if (FAILED(hr)) {
+		// Device might need to be reacquired
+		hr = handle->device->Acquire();
+		if (FAILED(hr)) {
+			return hr;
+		}
+		if (handle->polled) {
+			hr = handle->device->Poll();
+			if (FAILED(hr)) {
+				return hr;
+			}
+		}
+		hr = handle->device->GetDeviceState(handle->stateSize, state);
+	}
+	return hr;
+}
 
-	// GUID information
-	OLECHAR guidString[40];
-	StringFromGUID2(lpddi->guidProduct, guidString, sizeof(guidString) / sizeof(OLECHAR));
-	device["productGUID"] = trim_nulls(wchar_to_string(guidString));
+// Reads all buttons, button i in bit i % 64 of words[i / 64]
+static HRESULT ReadButtonWords(JoystickHandle* handle, uint64_t (&words)[BUTTON_PACK_WORDS(BUTTONDI_MAX_BUTTONS)]) {
+	BYTE state[sizeof(DIJOYSTATE2)];
+	HRESULT hr;
+	{
+		std::lock_guard<std::mutex> lock(handle->deviceMutex);
+		hr = ReadJoystickState(handle, state);
+	}
+	if (FAILED(hr)) {
+		return hr;
+	}
+	words[0] = 0;
+	words[1] = 0;
+	PackButtonBytes(state + handle->buttonOffset, handle->stateButtons, words);
+	return hr;
+}
+
+int DirectInputEventBackend::ReadChanges(ButtonBufferedChange* changes, int maxChanges, bool& overflow) {
+	std::lock_guard<std::mutex> lock(m_handle->deviceMutex);
+	LPDIRECTINPUTDEVICE8 device = m_handle->device;
+	int count = 0;
+	while (count < maxChanges) {
+		DIDEVICEOBJECTDATA data[BUTTON_BUFFER_BATCH];
+		DWORD requested = static_cast<DWORD>(maxChanges - count);
+		if (requested > BUTTON_BUFFER_BATCH) {
+			requested = BUTTON_BUFFER_BATCH;
+		}
+		DWORD items = requested;
+		HRESULT hr = device->GetDeviceData(sizeof(DIDEVICEOBJECTDATA), data, &items, 0);
+		if (hr == DIERR_INPUTLOST || hr == DIERR_NOTACQUIRED) {
+			// Changes made while the device was lost are gone
+			overflow = true;
+			if (FAILED(device->Acquire())) {
+				return -1;
+			}
+			items = requested;
+			hr = device->GetDeviceData(sizeof(DIDEVICEOBJECTDATA), data, &items, 0);
+		}
+		if (FAILED(hr)) {
+			return -1;
+		}
+		if (hr == DI_BUFFEROVERFLOW) {
+			overflow = true;
+		}
+		// With the full joystick format, axes and POVs share the buffer;
+		// only buttons are kept
+		for (DWORD i = 0; i < items; i++) {
+			DWORD button = data[i].dwOfs - m_handle->buttonOffset;
+			if (data[i].dwOfs < m_handle->buttonOffset || button >= m_handle->stateButtons) {
+				continue;
+			}
+			ButtonBufferedChange& change = changes[count++];
+			change.button = button;
+			change.pressed = (data[i].dwData & 0x80) != 0;
+			change.timestamp = data[i].dwTimeStamp;
+			change.sequence = data[i].dwSequence;
+		}
+		if (items < requested) {
+			break; // Buffer drained
+		}
+	}
+	return count;
+}
 
-	StringFromGUID2(lpddi->guidInstance, guidString, sizeof(guidString) / sizeof(OLECHAR));
-	device["instanceGUID"] = trim_nulls(wchar_to_string(guidString));
+bool DirectInputEventBackend::ReadState(uint64_t (&words)[BUTTON_BUFFER_WORDS]) {
+	static_assert(BUTTON_PACK_WORDS(BUTTONDI_MAX_BUTTONS) == BUTTON_BUFFER_WORDS, "Buffered button words");
+	return SUCCEEDED(ReadButtonWords(m_handle, words));
+}
 
-	// Device type information
-	device["dwDevType"] = to_hex_string(lpddi->dwDevType);
-	device["dwDevType_primary"] = to_hex_string(lpddi->dwDevType & 0xFF);
-	device["dwDevType_secondary"] = to_hex_string((lpddi->dwDevType >> 8) & 0xFF);
-	device["typeName"] = GetDetailedDeviceType(lpddi->dwDevType);
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// Waitable timer of the polling thread. The high-resolution kind (Windows
+// 10 1803 and later) wakes within tens of microseconds instead of rounding
+// up to the next system timer tick.
+struct PollTimer {
+	HANDLE handle;
+	PollTimer() {
+		handle = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (!handle) {
+			handle = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+		}
+	}
+	~PollTimer() {
+		if (handle) CloseHandle(handle);
+	}
+};
 
-	// Usage information
-	device["usagePage"] = to_hex_string(lpddi->wUsagePage);
-	device["usage"] = to_hex_string(lpddi->wUsage);
+static void WaitForPollSlot(PollScheduler::Clock::time_point until) {
+	static thread_local PollTimer timer;
+	long long remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		until - PollScheduler::Clock::now()).count();
+	if (remaining <= 0) {
+		return;
+	}
+	LARGE_INTEGER due;
+	due.QuadPart = -(remaining + 99) / 100; // Relative, in 100 ns units
+	if (!timer.handle || !SetWaitableTimer(timer.handle, &due, 0, NULL, NULL, FALSE)) {
+		std::this_thread::sleep_until(until);
+		return;
+	}
+	WaitForSingleObject(timer.handle, INFINITE);
+}
 
+static PollScheduler& GetScheduler() {
+	std::call_once(g_schedulerOnce, [] {
+		g_scheduler = new PollScheduler(WaitForPollSlot, [] { return static_cast<uint32_t>(GetTickCount()); });
+	});
+	return *g_scheduler;
+}
 
-	deviceList->push_back(device);
+JoystickHandle::~JoystickHandle() {
+	if (pollId != 0) {
+		GetScheduler().Remove(pollId);
+	}
+	if (device) {
+		device->Unacquire();
+		if (notification) {
+			device->SetEventNotification(NULL);
+		}
+		device->Release();
+	}
+	if (notification) {
+		CloseHandle(notification);
+	}
+}
+
+// Creates the DirectInput object on first use; safe to call from any thread
+static LPDIRECTINPUT8 GetDirectInput() {
+	std::call_once(g_pDIOnce, [] {
+		HRESULT hr = DirectInput8Create(GetModuleHandle(NULL),
+			DIRECTINPUT_VERSION,
+			IID_IDirectInput8,
+			(void**)&g_pDI,
+			NULL);
+		if (FAILED(hr)) {
+			g_pDI = nullptr;
+		}
+	});
+	return g_pDI;
+}
+
+// Callback function for device enumeration
+static BOOL CALLBACK EnumDevicesCallback(LPCDIDEVICEINSTANCE lpddi, LPVOID pvRef) {
+	DirectInputDevices* devices = static_cast<DirectInputDevices*>(pvRef);
+
+	// Filled in place, reusing the strings of an earlier enumeration
+	DirectInputDeviceRecord& device = devices->Add();
+	AssignUTF8(device.name, lpddi->tszProductName);
+	AssignUTF8(device.instanceName, lpddi->tszInstanceName);
+	device.productGUID = lpddi->guidProduct;
+	device.instanceGUID = lpddi->guidInstance;
+	GUIDToText(device.productGUID, device.productGUIDText);
+	GUIDToText(device.instanceGUID, device.instanceGUIDText);
+	device.devType = lpddi->dwDevType;
+	device.vendorID = (lpddi->guidProduct.Data1 >> 16) & 0xFFFF;
+	device.productID = lpddi->guidProduct.Data1 & 0xFFFF;
+	device.usagePage = lpddi->wUsagePage;
+	device.usage = lpddi->wUsage;
 	return DIENUM_CONTINUE;
 }
 
+// Returns the cached snapshot, enumerating if there is none yet or if
+// stale is still the current one. Concurrent callers share one enumeration.
+static std::shared_ptr<const DirectInputSnapshot> GetDeviceSnapshot(
+	const DirectInputSnapshot* stale = nullptr) {
+	LPDIRECTINPUT8 directInput = GetDirectInput();
+	if (!directInput) {
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(g_snapshotMutex);
+	if (g_snapshot && g_snapshot.get() != stale) {
+		return g_snapshot;
+	}
+	auto snapshot = std::make_shared<DirectInputSnapshot>();
+	//HRESULT hr = directInput->EnumDevices(DI8DEVCLASS_GAMECTRL, EnumDevicesCallback, &snapshot->devices, DIEDFL_ATTACHEDONLY);
+	HRESULT hr = directInput->EnumDevices(DI8DEVCLASS_ALL, EnumDevicesCallback, &snapshot->devices, DIEDFL_ATTACHEDONLY);
+	if (FAILED(hr)) {
+		return nullptr;
+	}
+	snapshot->BuildIndex();
+	g_snapshot = snapshot;
+	return g_snapshot;
+}
+
+// Instance GUID of the device a snapshot lookup returns (an index, or -1).
+// A miss enumerates once more, in case the device was plugged in since.
+template <typename Lookup>
+static bool FindDeviceGUID(Lookup&& lookup, GUID& instanceGUID) {
+	std::shared_ptr<const DirectInputSnapshot> snapshot = GetDeviceSnapshot();
+	for (int attempt = 0; snapshot && attempt < 2; attempt++) {
+		int index = lookup(*snapshot);
+		if (index >= 0) {
+			instanceGUID = snapshot->devices[index].instanceGUID;
+			return true;
+		}
+		snapshot = GetDeviceSnapshot(snapshot.get());
+	}
+	return false;
+}
+
+// Writes the GUID string into a caller buffer: 0, -1 not found, -2 too small
+static int CopyGUIDString(bool found, const GUID& guid, char* buffer, int bufferSize) {
+	if (!found) {
+		return -1;
+	}
+	char text[DIRECTINPUT_GUID_TEXT_SIZE];
+	GUIDToText(guid, text);
+	size_t length = strlen(text);
+	if (length >= static_cast<size_t>(bufferSize)) {
+		return -2;
+	}
+	memcpy(buffer, text, length + 1);
+	return 0;
+}
+
+static bool FindByVendorAndProductIDAndUsage(unsigned short vendorID, unsigned short productID,
+	unsigned short usagePage, unsigned short usage, GUID& instanceGUID) {
+	uint64_t key = DeviceUsageKey(vendorID, productID, usagePage, usage);
+	return FindDeviceGUID([&](const DirectInputSnapshot& snapshot) {
+		auto it = snapshot.byUsage.find(key);
+		return it == snapshot.byUsage.end() ? -1 : it->second;
+		}, instanceGUID);
+}
+
+// Names are compared normalized (see DeviceNameIndex.h)
+static bool FindByProductStringAndUsage(const char* name, unsigned short usagePage,
+	unsigned short usage, GUID& instanceGUID) {
+	std::string searchName(name);
+	return FindDeviceGUID([&](const DirectInputSnapshot& snapshot) {
+		return snapshot.names.FindExact(searchName, usagePage, usage);
+		}, instanceGUID);
+}
+
 extern "C" {
 
 	int GetDirectInputDeviceList(char* buffer, int bufferSize) {
@@ -142,187 +477,114 @@ extern "C" {
 			return -1;  // Invalid parameters
 		}
 
-		// Initialize DirectInput if not already done
-		if (!g_pDI) {
-			HRESULT hr = DirectInput8Create(GetModuleHandle(NULL),
-				DIRECTINPUT_VERSION,
-				IID_IDirectInput8,
-				(void**)&g_pDI,
-				NULL);
-			if (FAILED(hr)) {
-				return -2;  // DirectInput initialization failed
-			}
+		if (!GetDirectInput()) {
+			return -2;  // DirectInput initialization failed
 		}
 
-		// Create JSON array for device list
-		ordered_json deviceList = ordered_json::array();
-
-		// Enumerate devices
-		//HRESULT hr = g_pDI->EnumDevices(DI8DEVCLASS_GAMECTRL, EnumDevicesCallback, &deviceList, DIEDFL_ATTACHEDONLY);
-		HRESULT hr = g_pDI->EnumDevices(DI8DEVCLASS_ALL, EnumDevicesCallback, &deviceList, DIEDFL_ATTACHEDONLY);
+		// Listing always enumerates again, into storage reused by every call
+		// and without building the lookup indexes. The lookups keep their
+		// snapshot unless the devices changed; then the next one enumerates.
+		std::lock_guard<std::mutex> listLock(g_listMutex);
+		g_list.Clear();
+		HRESULT hr = GetDirectInput()->EnumDevices(DI8DEVCLASS_ALL, EnumDevicesCallback, &g_list, DIEDFL_ATTACHEDONLY);
 		if (FAILED(hr)) {
 			return -3;  // Enumeration failed
 		}
+		{
+			std::lock_guard<std::mutex> lock(g_snapshotMutex);
+			if (g_snapshot && !SameDirectInputDevices(g_snapshot->devices, g_list)) {
+				g_snapshot.reset();
+			}
+		}
 
-		// Convert to string
-		std::string result = deviceList.dump();
-		if (result.length() >= static_cast<size_t>(bufferSize)) {
+		// Written straight into the buffer, without a json DOM or a copy
+		JsonBufferAdapter output(buffer, static_cast<size_t>(bufferSize));
+		WriteDirectInputDeviceList(output, g_list);
+		if (!output.Terminate()) {
+			buffer[0] = '\0';
 			return -4;  // Buffer too small
 		}
-
-		strncpy_s(buffer, bufferSize, result.c_str(), _TRUNCATE);
 		return 0;  // Success
 	}
 
 	const char* FindJoystickByVendorAndProductIDAndUsage(unsigned short vendorID, unsigned short productID, unsigned short usagePage, unsigned short usage)
 	{
-		if (!g_pDI) {
-			HRESULT hr = DirectInput8Create(GetModuleHandle(NULL),
-				DIRECTINPUT_VERSION,
-				IID_IDirectInput8,
-				(void**)&g_pDI,
-				NULL);
-			if (FAILED(hr)) {
-				return nullptr;
-			}
+		GUID instanceGUID;
+		bool found = FindByVendorAndProductIDAndUsage(vendorID, productID, usagePage, usage, instanceGUID);
+		if (CopyGUIDString(found, instanceGUID, g_GUIDBuffer, sizeof(g_GUIDBuffer)) != 0) {
+			return nullptr;
 		}
+		return g_GUIDBuffer;
+	}
 
-		struct FindContext {
-			unsigned short vendorID;
-			unsigned short productID;
-			unsigned short usagePage;
-			unsigned short usage;
-			bool found;
-			GUID instanceGUID;
-		};
-
-		FindContext context = {
-			vendorID,
-			productID,
-			usagePage,
-			usage,
-			false
-		};
-
-		auto enumCallback = [](LPCDIDEVICEINSTANCE lpddi, LPVOID pvRef) -> BOOL {
-			FindContext* ctx = static_cast<FindContext*>(pvRef);
-
-			// Check VID/PID
-			unsigned short vid = (lpddi->guidProduct.Data1 >> 16) & 0xFFFF;
-			unsigned short pid = lpddi->guidProduct.Data1 & 0xFFFF;
-
-			if (vid == ctx->vendorID &&
-				pid == ctx->productID &&
-				lpddi->wUsagePage == ctx->usagePage &&
-				lpddi->wUsage == ctx->usage)
-			{
-				ctx->instanceGUID = lpddi->guidInstance;
-				ctx->found = true;
-				return DIENUM_STOP;
-			}
-			return DIENUM_CONTINUE;
-			};
-
-		HRESULT hr = g_pDI->EnumDevices(DI8DEVCLASS_ALL,
-			enumCallback,
-			&context,
-			DIEDFL_ATTACHEDONLY);
+	const char* FindJoystickByProductStringAndUsage(const char* name, unsigned short usagePage, unsigned short usage)
+	{
+		if (!name) return nullptr;
 
-		if (FAILED(hr) || !context.found) {
+		GUID instanceGUID;
+		bool found = FindByProductStringAndUsage(name, usagePage, usage, instanceGUID);
+		if (CopyGUIDString(found, instanceGUID, g_GUIDBuffer, sizeof(g_GUIDBuffer)) != 0) {
 			return nullptr;
 		}
-
-		// Convert GUID to string
-		OLECHAR guidString[40];
-		StringFromGUID2(context.instanceGUID, guidString, sizeof(guidString) / sizeof(OLECHAR));
-		std::string result = wchar_to_string(guidString);
-		strncpy_s(g_GUIDBuffer, sizeof(g_GUIDBuffer), result.c_str(), _TRUNCATE);
-
 		return g_GUIDBuffer;
 	}
 
-	const char* FindJoystickByProductStringAndUsage(const char* name, unsigned short usagePage, unsigned short usage)
+	int FindJoystickGUIDByVendorAndProductIDAndUsage(unsigned short vendorID, unsigned short productID,
+		unsigned short usagePage, unsigned short usage, char* guid, int guidSize)
 	{
-		if (!g_pDI) {
-			HRESULT hr = DirectInput8Create(GetModuleHandle(NULL),
-				DIRECTINPUT_VERSION,
-				IID_IDirectInput8,
-				(void**)&g_pDI,
-				NULL);
-			if (FAILED(hr)) {
-				return nullptr;
-			}
+		if (guid == nullptr || guidSize <= 0) {
+			return -1;
 		}
+		GUID instanceGUID;
+		bool found = FindByVendorAndProductIDAndUsage(vendorID, productID, usagePage, usage, instanceGUID);
+		return CopyGUIDString(found, instanceGUID, guid, guidSize);
+	}
 
-		struct FindContext {
-			const char* name;
-			unsigned short usagePage;
-			unsigned short usage;
-			bool found;
-			GUID instanceGUID;
-		};
-
-		FindContext context = {
-			name,
-			usagePage,
-			usage,
-			false
-		};
-
-		auto enumCallback = [](LPCDIDEVICEINSTANCE lpddi, LPVOID pvRef) -> BOOL {
-			FindContext* ctx = static_cast<FindContext*>(pvRef);
-
-			std::string productName = trim_nulls(wchar_to_string(lpddi->tszProductName));
-			//trim spaces
-			productName.erase(0, productName.find_first_not_of(" "));
-			productName.erase(productName.find_last_not_of(" ") + 1);
-
-			// Get search name and trim it
-			std::string searchName = ctx->name;
-			searchName.erase(0, searchName.find_first_not_of(" "));
-			searchName.erase(searchName.find_last_not_of(" ") + 1);
-
-			if (productName == searchName &&
-				lpddi->wUsagePage == ctx->usagePage &&
-				lpddi->wUsage == ctx->usage)
-			{
-				ctx->instanceGUID = lpddi->guidInstance;
-				ctx->found = true;
-				return DIENUM_STOP;
-			}
-			return DIENUM_CONTINUE;
-			};
-
-		HRESULT hr = g_pDI->EnumDevices(DI8DEVCLASS_ALL,
-			enumCallback,
-			&context,
-			DIEDFL_ATTACHEDONLY);
-
-		if (FAILED(hr) || !context.found) {
-			return nullptr;
+	int FindJoystickGUIDByProductStringAndUsage(const char* name, unsigned short usagePage,
+		unsigned short usage, char* guid, int guidSize)
+	{
+		if (name == nullptr || guid == nullptr || guidSize <= 0) {
+			return -1;
 		}
+		GUID instanceGUID;
+		bool found = FindByProductStringAndUsage(name, usagePage, usage, instanceGUID);
+		return CopyGUIDString(found, instanceGUID, guid, guidSize);
+	}
 
-		// Convert GUID to string
-		OLECHAR guidString[40];
-		StringFromGUID2(context.instanceGUID, guidString, sizeof(guidString) / sizeof(OLECHAR));
-		std::string result = wchar_to_string(guidString);
-		strncpy_s(g_GUIDBuffer, sizeof(g_GUIDBuffer), result.c_str(), _TRUNCATE);
+	int FindJoystickGUIDByProductPrefixAndUsage(const char* prefix, unsigned short usagePage,
+		unsigned short usage, char* guid, int guidSize)
+	{
+		if (prefix == nullptr || guid == nullptr || guidSize <= 0) {
+			return -1;
+		}
+		std::string searchPrefix(prefix);
+		GUID instanceGUID;
+		bool found = FindDeviceGUID([&](const DirectInputSnapshot& snapshot) {
+			return snapshot.names.FindPrefix(searchPrefix, usagePage, usage);
+			}, instanceGUID);
+		return CopyGUIDString(found, instanceGUID, guid, guidSize);
+	}
 
-		return g_GUIDBuffer;
+	int FindJoystickGUIDByFuzzyProductStringAndUsage(const char* name, unsigned short usagePage,
+		unsigned short usage, int maxDistance, char* guid, int guidSize)
+	{
+		if (name == nullptr || guid == nullptr || guidSize <= 0 ||
+			maxDistance < 0 || maxDistance > BUTTONDI_MAX_NAME_DISTANCE) {
+			return -1;
+		}
+		std::string searchName(name);
+		GUID instanceGUID;
+		bool found = FindDeviceGUID([&](const DirectInputSnapshot& snapshot) {
+			return snapshot.names.FindFuzzy(searchName, usagePage, usage, maxDistance);
+			}, instanceGUID);
+		return CopyGUIDString(found, instanceGUID, guid, guidSize);
 	}
 
 	void* OpenJoystickByInstanceGUID(const char* instanceGUID) {
 		if (!instanceGUID) return nullptr;
 
-		// Initialize DirectInput if not already done
-		if (!g_pDI) {
-			HRESULT hr = DirectInput8Create(GetModuleHandle(NULL),
-				DIRECTINPUT_VERSION,
-				IID_IDirectInput8,
-				(void**)&g_pDI,
-				NULL);
-			if (FAILED(hr)) return nullptr;
-		}
+		LPDIRECTINPUT8 directInput = GetDirectInput();
+		if (!directInput) return nullptr;
 
 		// Convert string GUID to GUID structure
 		GUID guid;
@@ -333,94 +595,224 @@ extern "C" {
 
 		// Create device
 		LPDIRECTINPUTDEVICE8 device = nullptr;
-		HRESULT hr = g_pDI->CreateDevice(guid, &device, NULL);
+		HRESULT hr = directInput->CreateDevice(guid, &device, NULL);
 		if (FAILED(hr)) return nullptr;
 
-		// Set data format (we'll use gamepad format as it's most suitable for button controllers)
-		hr = device->SetDataFormat(&c_dfDIJoystick2);
+		// The button count sizes the data format
+		DIDEVCAPS caps;
+		caps.dwSize = sizeof(DIDEVCAPS);
+		hr = device->GetCapabilities(&caps);
 		if (FAILED(hr)) {
 			device->Release();
 			return nullptr;
 		}
 
-		// Set cooperative level
-		HWND hwnd = GetForegroundWindow();
-		hr = device->SetCooperativeLevel(hwnd, DISCL_BACKGROUND | DISCL_NONEXCLUSIVE);
-		if (FAILED(hr)) {
+		// Create and initialize our handle structure
+		JoystickHandle* handle = nullptr;
+		void* exported = Handles().Create(handle);
+		if (!exported) {
 			device->Release();
 			return nullptr;
 		}
+		handle->device = device;
+		handle->deviceType = caps.dwDevType;
+		handle->buttonCount = caps.dwButtons;
 
-		// Get device capabilities
-		DIDEVCAPS caps;
-		caps.dwSize = sizeof(DIDEVCAPS);
-		hr = device->GetCapabilities(&caps);
+		// Set data format (only the buttons, or the full joystick format)
+		hr = SetButtonDataFormat(handle, caps.dwButtons);
 		if (FAILED(hr)) {
-			device->Release();
+			Handles().Destroy(exported);  // Releases the device
 			return nullptr;
 		}
 
-		// Create and initialize our handle structure
-		JoystickHandle* handle = new JoystickHandle();
-		handle->device = device;
-		handle->capabilities = caps.dwFlags;
-		handle->deviceType = caps.dwDevType;
+		// Set cooperative level
+		HWND hwnd = GetForegroundWindow();
+		hr = device->SetCooperativeLevel(hwnd, DISCL_BACKGROUND | DISCL_NONEXCLUSIVE);
+		if (FAILED(hr)) {
+			Handles().Destroy(exported);  // Releases the device
+			return nullptr;
+		}
+
+		// Whether Poll is needed can depend on the data format, so ask again
+		if (SUCCEEDED(device->GetCapabilities(&caps))) {
+			handle->capabilities = caps.dwFlags;
+		}
+		else {
+			handle->capabilities = DIDC_POLLEDDEVICE;
+		}
+		handle->polled = (handle->capabilities & (DIDC_POLLEDDEVICE | DIDC_POLLEDDATAFORMAT)) != 0;
+		handle->backend.reset(new DirectInputEventBackend(handle));
 
 		// Acquire the device
 		device->Acquire();
 
-		return handle;
+		// Sampled by the polling thread while StartButtonPolling is active
+		handle->pollId = GetScheduler().Add(handle->backend.get());
+
+		return exported;
 	}
 
 	uint64_t ReadButtons(void* handle) {
-		JoystickHandle* joystickHandle = static_cast<JoystickHandle*>(handle);
+		HandleRef joystickHandle = Handles().Acquire(handle);
 		if (!joystickHandle || !joystickHandle->device) {
 			return BUTTONDI_ERROR_INVALID_HANDLE;
 		}
 
-		DIJOYSTATE2 js;
-		HRESULT hr = joystickHandle->device->Poll();
+		// Pack the button states into uint64_t. Bit 63 is the error bit,
+		// so buttons 0-62 are returned; ReadButtonsEx returns all 128.
+		uint64_t words[BUTTON_PACK_WORDS(BUTTONDI_MAX_BUTTONS)];
+		if (FAILED(ReadButtonWords(joystickHandle, words))) {
+			return BUTTONDI_ERROR_READ_FAILED;
+		}
 
-		if (FAILED(hr)) {
-			// Device might need to be reacquired
-			hr = joystickHandle->device->Acquire();
-			if (FAILED(hr)) {
-				return BUTTONDI_ERROR_READ_FAILED;
-			}
-			hr = joystickHandle->device->Poll();
-			if (FAILED(hr)) {
-				return BUTTONDI_ERROR_READ_FAILED;
-			}
+		return words[0] & ~BUTTONDI_ERROR_BIT;
+	}
+
+	int ReadButtonsEx(void* handle, ButtonDIState* state) {
+		HandleRef joystickHandle = Handles().Acquire(handle);
+		if (!joystickHandle || !joystickHandle->device || !state) {
+			return -1;  // Invalid parameters
 		}
 
-		hr = joystickHandle->device->GetDeviceState(sizeof(DIJOYSTATE2), &js);
+		static_assert(sizeof(DIJOYSTATE2().rgbButtons) == BUTTONDI_MAX_BUTTONS, "DIJOYSTATE2 layout");
+		if (FAILED(ReadButtonWords(joystickHandle, state->words))) {
+			return -2;  // Read failed
+		}
+		state->buttonCount = joystickHandle->buttonCount;
+		state->reserved = 0;
+		return 0;  // Success
+	}
+
+	int EnableButtonEvents(void* handle, int bufferSize) {
+		HandleRef joystickHandle = Handles().Acquire(handle);
+		if (!joystickHandle || !joystickHandle->device || bufferSize < 0) {
+			return -1;  // Invalid parameters
+		}
+		std::lock_guard<std::mutex> eventsLock(joystickHandle->eventsMutex);
+		if (joystickHandle->buffered) {
+			return 0;  // Already enabled
+		}
+		if (bufferSize == 0) {
+			bufferSize = BUTTONDI_DEFAULT_BUFFER_SIZE;
+		}
+
+		HANDLE notification = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (!notification) {
+			return -2;
+		}
+
+		// The buffer size and notification can only be set while unacquired
+		LPDIRECTINPUTDEVICE8 device = joystickHandle->device;
+		DIPROPDWORD property;
+		property.diph.dwSize = sizeof(DIPROPDWORD);
+		property.diph.dwHeaderSize = sizeof(DIPROPHEADER);
+		property.diph.dwObj = 0;
+		property.diph.dwHow = DIPH_DEVICE;
+		property.dwData = static_cast<DWORD>(bufferSize);
+		std::unique_lock<std::mutex> lock(joystickHandle->deviceMutex);
+		device->Unacquire();
+		HRESULT hr = device->SetProperty(DIPROP_BUFFERSIZE, &property.diph);
+		if (SUCCEEDED(hr)) {
+			hr = device->SetEventNotification(notification);
+		}
+		device->Acquire();
+		lock.unlock();
+
+		// Prime with the current state so held buttons do not report presses
+		joystickHandle->events.Reset();
+		if (SUCCEEDED(hr) && joystickHandle->events.Drain(*joystickHandle->backend) < 0) {
+			hr = E_FAIL;
+		}
 		if (FAILED(hr)) {
-			return BUTTONDI_ERROR_READ_FAILED;
+			// Back to sampling; the polling registration was never removed
+			lock.lock();
+			device->Unacquire();
+			device->SetEventNotification(NULL);
+			property.dwData = 0;
+			device->SetProperty(DIPROP_BUFFERSIZE, &property.diph);
+			device->Acquire();
+			lock.unlock();
+			CloseHandle(notification);
+			joystickHandle->events.Reset();
+			return -2;  // DirectInput rejected buffered mode or could not be read
 		}
+		ButtonBufferEvent discard[BUTTON_BUFFER_QUEUE_SIZE];
+		joystickHandle->events.Pop(discard, BUTTON_BUFFER_QUEUE_SIZE);
+
+		// The buffer replaces sampling by the polling thread
+		if (joystickHandle->pollId != 0) {
+			GetScheduler().Remove(joystickHandle->pollId);
+			joystickHandle->pollId = 0;
+		}
+		joystickHandle->notification = notification;
+		joystickHandle->buffered = true;
+		return 0;
+	}
 
-		// Pack the button states into uint64_t
-		uint64_t buttonStates = 0;
-		for (int i = 0; i < 32 && i < sizeof(js.rgbButtons); i++) {
-			if (js.rgbButtons[i] & 0x80) {
-				buttonStates |= (1ULL << i);
+	int ReadButtonEvents(void* handle, ButtonDIEvent* events, int maxEvents) {
+		HandleRef joystickHandle = Handles().Acquire(handle);
+		if (!joystickHandle || !joystickHandle->device || !events || maxEvents < 0) {
+			return -1;  // Invalid parameters
+		}
+
+		// One reader at a time, and not while EnableButtonEvents switches modes
+		std::lock_guard<std::mutex> eventsLock(joystickHandle->eventsMutex);
+		// Buffered events, or changes queued by the polling thread
+		auto pop = [&joystickHandle](ButtonBufferEvent& event) {
+			if (joystickHandle->buffered) {
+				return joystickHandle->events.Pop(&event, 1) == 1;
 			}
+			return GetScheduler().Pop(joystickHandle->pollId, &event, 1) == 1;
+		};
+		if (joystickHandle->buffered) {
+			if (joystickHandle->events.Drain(*joystickHandle->backend) < 0) {
+				return -2;  // Read failed
+			}
+		}
+		else if (!GetScheduler().Running()) {
+			return -3;  // Neither EnableButtonEvents nor StartButtonPolling was called
 		}
 
-		return buttonStates;
+		int count = 0;
+		ButtonBufferEvent event;
+		while (count < maxEvents && pop(event)) {
+			ButtonDIEvent& out = events[count++];
+			out.timestamp = event.timestamp;
+			out.sequence = event.sequence;
+			out.button = event.button;
+			out.pressed = event.pressed ? 1 : 0;
+			out.flags = event.resync ? BUTTONDI_EVENT_RESYNC : 0;
+		}
+		return count;
 	}
 
-	int CloseJoystick(void* handle) {
-		JoystickHandle* joystickHandle = static_cast<JoystickHandle*>(handle);
+	void* GetButtonEventHandle(void* handle) {
+		HandleRef joystickHandle = Handles().Acquire(handle);
 		if (!joystickHandle) {
-			return -1;
+			return nullptr;
 		}
+		std::lock_guard<std::mutex> eventsLock(joystickHandle->eventsMutex);
+		return joystickHandle->notification;
+	}
 
-		if (joystickHandle->device) {
-			joystickHandle->device->Unacquire();
-			joystickHandle->device->Release();
-		}
+	int StartButtonPolling(int rateHz) {
+		return GetScheduler().Start(rateHz) ? 0 : -1;
+	}
+
+	int StopButtonPolling(void) {
+		GetScheduler().Stop();
+		return 0;
+	}
+
+	int CloseJoystick(void* handle) {
+		// Safe while other threads still read; the last of them releases
+		// the device when its call returns
+		return Handles().Destroy(handle) ? 0 : -1;
+	}
 
-		delete joystickHandle;
+	int ShutdownButtonController(void) {
+		// The polling thread is the only one the library starts
+		GetScheduler().Stop();
 		return 0;
 	}
 
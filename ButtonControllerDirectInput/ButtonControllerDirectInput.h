@@ -14,6 +14,38 @@ extern "C" {
 // Helper macro to check for errors
 #define IS_BUTTONDI_ERROR(x) ((x) & BUTTONDI_ERROR_BIT)
 
+// Number of buttons in DIJOYSTATE2
+#define BUTTONDI_MAX_BUTTONS 128
+
+// All 128 buttons, button i in bit i % 64 of words[i / 64].
+// Errors are returned separately, so every bit is a button.
+typedef struct ButtonDIState {
+    uint64_t words[2];
+    uint32_t buttonCount; // Buttons reported by the device
+    uint32_t reserved;
+} ButtonDIState;
+
+// GUID string with braces, e.g. "{6F1D2B60-D5A0-11CF-BFC7-444553540000}", and terminator
+#define BUTTONDI_GUID_SIZE 39
+
+// Largest edit distance FindJoystickGUIDByFuzzyProductStringAndUsage accepts
+#define BUTTONDI_MAX_NAME_DISTANCE 8
+
+// Default DirectInput buffer size for EnableButtonEvents, in changes
+#define BUTTONDI_DEFAULT_BUFFER_SIZE 256
+
+// Event flags
+#define BUTTONDI_EVENT_RESYNC 0x01 // Recovered from a state read after the device buffer overflowed
+
+// One button transition from the DirectInput buffer
+typedef struct ButtonDIEvent {
+    uint32_t timestamp; // DirectInput time stamp in milliseconds
+    uint32_t sequence;  // DirectInput sequence number; simultaneous changes share it
+    uint16_t button;    // Button index (0-127)
+    uint8_t pressed;    // 1 pressed, 0 released
+    uint8_t flags;      // BUTTONDI_EVENT_*
+} ButtonDIEvent;
+
 __declspec(dllexport) int GetDirectInputDeviceList(char *buffer,
                                                    int bufferSize);
 
@@ -25,13 +57,51 @@ __declspec(dllexport) const char *
 FindJoystickByProductStringAndUsage(const char *name, unsigned short usagePage,
                                     unsigned short usage);
 
+__declspec(dllexport) int FindJoystickGUIDByVendorAndProductIDAndUsage(
+    unsigned short vendorID, unsigned short productID, unsigned short usagePage,
+    unsigned short usage, char *guid, int guidSize);
+
+__declspec(dllexport) int
+FindJoystickGUIDByProductStringAndUsage(const char *name,
+                                        unsigned short usagePage,
+                                        unsigned short usage, char *guid,
+                                        int guidSize);
+
+// First device with this usage whose name starts with prefix
+__declspec(dllexport) int
+FindJoystickGUIDByProductPrefixAndUsage(const char *prefix,
+                                        unsigned short usagePage,
+                                        unsigned short usage, char *guid,
+                                        int guidSize);
+
+// Device with this usage whose name is at most maxDistance edits
+// (0..BUTTONDI_MAX_NAME_DISTANCE) away; the closest, then the first
+__declspec(dllexport) int FindJoystickGUIDByFuzzyProductStringAndUsage(
+    const char *name, unsigned short usagePage, unsigned short usage,
+    int maxDistance, char *guid, int guidSize);
+
 __declspec(dllexport) void *
 OpenJoystickByInstanceGUID(const char *instanceGUID);
 
 __declspec(dllexport) uint64_t ReadButtons(void *handle);
 
+__declspec(dllexport) int ReadButtonsEx(void *handle, ButtonDIState *state);
+
+__declspec(dllexport) int EnableButtonEvents(void *handle, int bufferSize);
+
+__declspec(dllexport) int ReadButtonEvents(void *handle, ButtonDIEvent *events,
+                                           int maxEvents);
+
+__declspec(dllexport) void *GetButtonEventHandle(void *handle);
+
+__declspec(dllexport) int StartButtonPolling(int rateHz);
+
+__declspec(dllexport) int StopButtonPolling(void);
+
 __declspec(dllexport) int CloseJoystick(void *handle);
 
+__declspec(dllexport) int ShutdownButtonController(void);
+
 #ifdef __cplusplus
 }
 #endif
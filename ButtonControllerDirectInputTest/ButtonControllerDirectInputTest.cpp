@@ -2,6 +2,9 @@
 #include <windows.h>
 #include "CppUnitTest.h"
 #include "../ButtonControllerDirectInput/ButtonControllerDirectInput.h"
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -92,6 +95,49 @@ namespace ButtonControllerDirectInputTest
 			}
 		}
 
+		TEST_METHOD(TestConcurrentFindsUseOwnBuffers)
+		{
+			const int deviceCount = sizeof(g_TestDevices) / sizeof(g_TestDevices[0]);
+			int expected[deviceCount];
+			char expectedGUID[deviceCount][BUTTONDI_GUID_SIZE];
+			for (int d = 0; d < deviceCount; d++) {
+				const TestDeviceConfig& config = g_TestDevices[d];
+				expected[d] = FindJoystickGUIDByVendorAndProductIDAndUsage(config.vendorID,
+					config.productID, config.usagePage, config.usage, expectedGUID[d], BUTTONDI_GUID_SIZE);
+			}
+
+			// Every thread looks up a different device at the same time
+			std::atomic<int> mismatches{ 0 };
+			std::vector<std::thread> threads;
+			for (int t = 0; t < 8; t++) {
+				threads.emplace_back([&, t] {
+					for (int i = 0; i < 50; i++) {
+						int d = (t + i) % deviceCount;
+						const TestDeviceConfig& config = g_TestDevices[d];
+						char guid[BUTTONDI_GUID_SIZE];
+						int result = FindJoystickGUIDByProductStringAndUsage(config.name,
+							config.usagePage, config.usage, guid, sizeof(guid));
+						if (result != expected[d] || (result == 0 && strcmp(guid, expectedGUID[d]) != 0)) {
+							mismatches++;
+						}
+					}
+				});
+			}
+			for (auto& thread : threads) {
+				thread.join();
+			}
+			Assert::AreEqual(0, mismatches.load());
+
+			char small[8];
+			for (int d = 0; d < deviceCount; d++) {
+				if (expected[d] == 0) {
+					const TestDeviceConfig& config = g_TestDevices[d];
+					Assert::AreEqual(-2, FindJoystickGUIDByVendorAndProductIDAndUsage(config.vendorID,
+						config.productID, config.usagePage, config.usage, small, sizeof(small)));
+				}
+			}
+		}
+
 	};
 
 	// Base test class with common functionality
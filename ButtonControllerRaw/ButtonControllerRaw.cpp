@@ -2,19 +2,35 @@
 #include "ButtonControllerRaw.h"
 #include <windows.h>
 #include <wtypes.h>
+#include <cfgmgr32.h>
 #include <devguid.h>
 #include <hidpi.h>
 #include <hidsdi.h>
 #include <iomanip>
 #include <locale>
+#include <mutex>
 #include <setupapi.h>
 #include <sstream>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <nlohmann/json.hpp>
 
+#include "../Common/ButtonBroadcastRing.h"
+#include "../Common/ButtonDebounce.h"
+#include "../Common/ButtonDispatcher.h"
+#include "../Common/ButtonEdges.h"
+#include "../Common/ButtonGestures.h"
+#include "../Common/ButtonProfile.h"
+#include "../Common/EnumScratch.h"
+#include "../Common/HandleTable.h"
+#include "../Common/HidDeviceCache.h"
+#include "../Common/HidDeviceInfo.h"
+#include "../Common/HidDeviceJson.h"
+#include "../Common/HidDeviceStore.h"
+
 using json = nlohmann::json;
 
 //------------------------------ debug start ------------------------------
@@ -25,35 +41,488 @@ using json = nlohmann::json;
 
 #pragma comment(lib, "hid.lib")
 #pragma comment(lib, "setupapi.lib")
+#pragma comment(lib, "cfgmgr32.lib")
 
 //	HANDLE g_deviceHandle = INVALID_HANDLE_VALUE;
 struct JoystickHandle {
   HANDLE deviceHandle;
   DWORD inputReportLength;
   bool oversizedReport; // Flag for reports > 8 bytes
+  HIDD_ATTRIBUTES attributes;
+  ButtonProfile profile; // Baseline and active bits; all bits active by default
+  DWORD activeBytes;     // Leading report bytes that are decoded
+  // Held with captureMutex to change the profile, and alone to read it
+  // outside the capture path, which calibration keeps busy for seconds
+  std::mutex profileMutex;
+  uint32_t reportSequence; // Number of samples captured so far
+  uint64_t lastRawState;   // Last packed report before debouncing
+  BYTE lastReport[BUTTONRAW_MAX_WIDE_REPORT_SIZE]; // Leading bytes of the last report
+  DWORD lastReportBytes;
+  bool debounceEnabled;
+  bool debouncePrimed;
+  DebounceBank debounce;
+  EdgeDetector edges;
+  // Button events, written once and read by ReadButtonEvents and every
+  // SubscribeButtonEvents subscription, each from its own cursor
+  ButtonBroadcastRing<ButtonRawEvent, BUTTONRAW_EVENT_QUEUE_SIZE> events;
+  int eventsReader; // Subscription of ReadButtonEvents, all buttons
+  // Serializes the capture path: report reads and the debounce, edge and
+  // gesture stages. Reading events from the ring does not take it.
+  std::mutex captureMutex;
+  GestureRecognizer gestures;
+  EventQueue<ButtonRawGestureEvent, BUTTONRAW_GESTURE_QUEUE_SIZE> gestureEvents;
+
+  // SubscribeButtons callbacks: the dispatcher entry of each subscription
+  // (0 for none), and the thread capturing reports while there are any
+  std::mutex callbackMutex;
+  int callbackEntries[BUTTON_RING_MAX_CONSUMERS];
+  std::atomic<int> callbackCount;
+  std::thread captureThread;
+  HANDLE captureStopEvent = NULL; // Set to stop the capture thread
+
+  // The one overlapped read of the device. It stays outstanding across
+  // calls, a timed-out read is not cancelled, and it is collected under
+  // captureMutex, so reports are applied in order whoever waits for them.
+  OVERLAPPED readOverlapped = {};
+  std::vector<BYTE> readBuffer;
+  bool readPending = false;
+
+  // Runs once the handle is closed and no call is using it any more
+  ~JoystickHandle();
 };
 
-// Helper function to convert WCHAR* to std::string
-std::string wchar_to_string(const WCHAR *wstr) {
-  if (wstr == nullptr)
-    return std::string();
-  int size_needed =
-      WideCharToMultiByte(CP_UTF8, 0, wstr, -1, NULL, 0, NULL, NULL);
-  std::string strTo(size_needed, 0);
-  WideCharToMultiByte(CP_UTF8, 0, wstr, -1, &strTo[0], size_needed, NULL, NULL);
-  return strTo;
-}
-
-// Helper function to convert std::string to std::wstring
-std::wstring string_to_wstring(const std::string &str) {
-  if (str.empty())
-    return std::wstring();
-  int size_needed =
-      MultiByteToWideChar(CP_UTF8, 0, &str[0], (int)str.size(), NULL, 0);
-  std::wstring wstrTo(size_needed, 0);
-  MultiByteToWideChar(CP_UTF8, 0, &str[0], (int)str.size(), &wstrTo[0],
-                      size_needed);
-  return wstrTo;
+// Runs SubscribeButtons callbacks. Never destroyed: joining its thread
+// while the DLL unloads could deadlock on the loader lock, so
+// ShutdownButtonController stops it instead.
+static ButtonDispatcher &Dispatcher() {
+  static ButtonDispatcher *dispatcher = new ButtonDispatcher();
+  return *dispatcher;
+}
+
+// ReadButtonEvents takes one ring consumer, subscriptions the rest
+static_assert(BUTTONRAW_MAX_SUBSCRIPTIONS == BUTTON_RING_MAX_CONSUMERS - 1,
+              "one subscription per ring consumer");
+static_assert(BUTTONRAW_LATENCY_BUCKETS == BUTTON_DISPATCH_LATENCY_BUCKETS,
+              "latency histogram layout");
+
+// Open handles; the exported void* is a HandleTable handle, not an address.
+// Every export holds a HandleRef while it uses the record, so a concurrent
+// CloseJoystick only releases the device after the call returns. Never
+// destroyed, like the dispatcher, since records may own a capture thread.
+static HandleTable<JoystickHandle> &g_handles = *new HandleTable<JoystickHandle>();
+typedef HandleTable<JoystickHandle>::Ref HandleRef;
+
+// Calibration profiles shared by every handle, keyed by VID/PID/version
+static ProfileStore g_profiles;
+static std::mutex g_profilesMutex;
+
+// Restricts decoding to the active bits of a profile
+static void ApplyProfile(JoystickHandle *handle, const ButtonProfile &profile) {
+  std::lock_guard<std::mutex> lock(handle->profileMutex);
+  handle->profile = profile;
+  handle->activeBytes = ActiveReportBytes(profile.activeMask);
+}
+
+// Current QueryPerformanceCounter time in microseconds
+static uint64_t CaptureTimestamp() {
+  static const LONGLONG frequency = [] {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    return f.QuadPart;
+  }();
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  // Split to avoid overflowing the multiplication on long uptimes
+  uint64_t seconds = static_cast<uint64_t>(counter.QuadPart / frequency);
+  uint64_t remainder = static_cast<uint64_t>(counter.QuadPart % frequency);
+  return seconds * 1000000ULL + remainder * 1000000ULL / frequency;
+}
+
+// Issues the handle's overlapped read unless one is outstanding. Call with
+// captureMutex held. Returns false if the read could not be issued.
+static bool StartReportRead(JoystickHandle *handle) {
+  if (handle->readPending) {
+    return true;
+  }
+  if (!ReadFile(handle->deviceHandle, handle->readBuffer.data(),
+                handle->inputReportLength, NULL, &handle->readOverlapped) &&
+      GetLastError() != ERROR_IO_PENDING) {
+    return false;
+  }
+  handle->readPending = true;
+  return true;
+}
+
+// Collects the outstanding read without waiting. Call with captureMutex
+// held. Returns 1 with the report copied to buffer, 0 while it is still
+// pending or if no read is outstanding (another call collected it; its
+// event stays signalled until the next read is issued), -1 if it failed.
+static int FinishReportRead(JoystickHandle *handle, BYTE *buffer,
+                            DWORD length, DWORD *bytesRead) {
+  if (!handle->readPending) {
+    return 0;
+  }
+  DWORD transferred = 0;
+  if (!GetOverlappedResult(handle->deviceHandle, &handle->readOverlapped,
+                           &transferred, FALSE)) {
+    if (GetLastError() == ERROR_IO_INCOMPLETE) {
+      return 0;
+    }
+    handle->readPending = false;
+    return -1;
+  }
+  handle->readPending = false;
+  *bytesRead = transferred < length ? transferred : length;
+  memcpy(buffer, handle->readBuffer.data(), *bytesRead);
+  return 1;
+}
+
+// Waits up to timeoutMs for the handle's read to complete. Call with
+// captureMutex held. Returns 1 when a report was read, 0 on timeout, -1 on
+// error.
+static int ReadReport(JoystickHandle *handle, BYTE *buffer, DWORD length,
+                      DWORD timeoutMs, DWORD *bytesRead) {
+  *bytesRead = 0;
+  if (!StartReportRead(handle)) {
+    return -1;
+  }
+  if (timeoutMs != 0 &&
+      WaitForSingleObject(handle->readOverlapped.hEvent, timeoutMs) ==
+          WAIT_FAILED) {
+    return -1;
+  }
+  return FinishReportRead(handle, buffer, length, bytesRead);
+}
+
+// Queues a completed gesture
+static void EmitGesture(JoystickHandle *handle, int gestureId,
+                        uint64_t timestamp) {
+  ButtonRawGestureEvent event;
+  event.timestamp = timestamp;
+  event.gestureId = gestureId;
+  event.reserved = 0;
+  handle->gestureEvents.Push(event);
+}
+
+// Fires gesture timeouts that expired by the given time
+static void AdvanceGestures(JoystickHandle *handle, uint64_t timestamp) {
+  if (handle->gestures.Count() == 0) {
+    return;
+  }
+  handle->gestures.Advance(timestamp, [&](int id, uint64_t firedAt) {
+    EmitGesture(handle, id, firedAt);
+  });
+}
+
+// Packs up to 8 report bytes into uint64_t
+static uint64_t PackBytes(const BYTE *buffer, DWORD count) {
+  if (count > BUTTONRAW_MAX_REPORT_SIZE) {
+    count = BUTTONRAW_MAX_REPORT_SIZE; // Truncate to 8 bytes
+  }
+
+  uint64_t result = 0;
+  for (DWORD i = 0; i < count; i++) {
+    result |= (static_cast<uint64_t>(buffer[i]) << (i * 8));
+  }
+  return result;
+}
+
+// Packs a report into uint64_t. Only bytes with active bits are read;
+// constant bits are restored from the profile baseline.
+static uint64_t PackReport(const JoystickHandle *handle, const BYTE *buffer,
+                           DWORD bytesRead) {
+  DWORD count = bytesRead < handle->activeBytes ? bytesRead : handle->activeBytes;
+  uint64_t result = PackBytes(buffer, count);
+  const ButtonProfile &profile = handle->profile;
+  return (result & profile.activeMask) | (profile.baseline & ~profile.activeMask);
+}
+
+// Runs one packed sample through the debounce, edge and gesture stages.
+// Returns the debounced state.
+static uint64_t CaptureState(JoystickHandle *handle, uint64_t raw,
+                             uint64_t timestamp) {
+  handle->lastRawState = raw;
+
+  uint64_t state = raw;
+  if (handle->debounceEnabled) {
+    if (!handle->debouncePrimed) {
+      handle->debounce.Reset(0, &raw);
+      handle->debouncePrimed = true;
+    } else {
+      state = handle->debounce.Process(0, &raw)[0];
+    }
+  }
+
+  uint32_t sequence = handle->reportSequence++;
+  bool recognize = handle->gestures.Count() != 0;
+  bool published = false;
+  handle->edges.Process(state, [&](int bit, bool pressed) {
+    ButtonRawEvent event;
+    event.timestamp = timestamp;
+    event.sequence = sequence;
+    event.button = static_cast<uint16_t>(bit);
+    event.pressed = pressed ? 1 : 0;
+    event.flags = 0;
+    published |= handle->events.Publish(event, bit);
+
+    if (recognize) {
+      handle->gestures.OnEdge(bit, pressed, timestamp, [&](int id, uint64_t firedAt) {
+        EmitGesture(handle, id, firedAt);
+      });
+    }
+  });
+  AdvanceGestures(handle, timestamp);
+
+  // Wake the dispatcher for SubscribeButtons callbacks
+  if (published && handle->callbackCount.load(std::memory_order_relaxed) > 0) {
+    Dispatcher().Notify();
+  }
+  return state;
+}
+
+// Packs a report into uint64_t and runs it through the capture stages
+static uint64_t CaptureReport(JoystickHandle *handle, const BYTE *buffer,
+                              DWORD bytesRead, uint64_t timestamp) {
+  DWORD wideBytes = bytesRead < BUTTONRAW_MAX_WIDE_REPORT_SIZE
+                        ? bytesRead
+                        : BUTTONRAW_MAX_WIDE_REPORT_SIZE;
+  memcpy(handle->lastReport, buffer, wideBytes);
+  handle->lastReportBytes = wideBytes;
+  return CaptureState(handle, PackReport(handle, buffer, bytesRead), timestamp);
+}
+
+// Feeds every report already queued by the driver through the edge stage.
+// Returns false on read errors.
+static bool DrainPendingReports(JoystickHandle *handle,
+                                std::vector<BYTE> &buffer) {
+  DWORD bytesRead = 0;
+  int status;
+  while ((status = ReadReport(handle, buffer.data(), handle->inputReportLength,
+                              0, &bytesRead)) > 0) {
+    CaptureReport(handle, buffer.data(), bytesRead, CaptureTimestamp());
+  }
+  return status == 0;
+}
+
+// Runs the stages for a read timeout. Event-based devices stay silent while
+// a button is held, so the last report counts as another debounce sample.
+// Returns true with the new state if debouncing changed it.
+static bool CaptureIdle(JoystickHandle *handle, uint64_t *state) {
+  if (handle->debounceEnabled && handle->debouncePrimed) {
+    uint64_t previous = handle->edges.State();
+    uint64_t current =
+        CaptureState(handle, handle->lastRawState, CaptureTimestamp());
+    if (current != previous) {
+      *state = current;
+      return true;
+    }
+  }
+  AdvanceGestures(handle, CaptureTimestamp());
+  return false;
+}
+
+// Flushes queued reports, then waits up to 100 ms for a new one.
+// Returns 1 with the decoded state, 0 when nothing changed, -1 on read errors.
+static int WaitForButtons(JoystickHandle *handle, uint64_t *state) {
+  // HID reads need room for the full report, even if only 8 bytes are packed
+  std::vector<BYTE> buffer(handle->inputReportLength);
+
+  // First, flush old events. They still go through the edge stage so
+  // ReadButtonEvents sees every transition.
+  if (!DrainPendingReports(handle, buffer)) {
+    return -1;
+  }
+
+  // Now wait for a new event
+  DWORD bytesRead = 0;
+  int status = ReadReport(handle, buffer.data(), handle->inputReportLength,
+                          100, &bytesRead); // 100 ms timeout
+  if (status < 0) {
+    //------------------------------ debug start ------------------------------
+    // WriteToLog("ReadFile failed");
+    //------------------------------- debug end -------------------------------
+    return -1;
+  }
+  if (status == 0) {
+    return CaptureIdle(handle, state) ? 1 : 0;
+  }
+
+  //------------------------------ debug start ------------------------------
+  // Log the raw data
+  /*
+  std::stringstream ss;
+  ss << "Raw data (" << bytesRead << " bytes): ";
+  for (DWORD i = 0; i < bytesRead; i++) {
+          ss << std::hex << std::setfill('0') << std::setw(2)
+                  << static_cast<int>(buffer[i]) << " ";
+  }
+  WriteToLog(ss.str().c_str());
+  */
+  //------------------------------- debug end -------------------------------
+
+  *state = CaptureReport(handle, buffer.data(), bytesRead, CaptureTimestamp());
+  return 1;
+}
+
+// Picks up reports queued by the driver without waiting, unless another
+// call is capturing already (its events reach the ring either way), then
+// copies the events of one subscription. Returns the number copied, or -1
+// on read errors.
+static int ReadSubscription(JoystickHandle *handle, int subscription,
+                            ButtonRawEvent *events, int maxEvents) {
+  std::unique_lock<std::mutex> capture(handle->captureMutex, std::try_to_lock);
+  if (capture.owns_lock()) {
+    std::vector<BYTE> buffer(handle->inputReportLength);
+    if (!DrainPendingReports(handle, buffer)) {
+      return -1;
+    }
+    capture.unlock();
+  }
+
+  uint64_t lost = 0;
+  size_t count = handle->events.Read(subscription, events,
+                                     static_cast<size_t>(maxEvents), &lost);
+  if (lost != 0) {
+    events[0].flags |= BUTTONRAW_EVENT_LOST;
+  }
+  return static_cast<int>(count);
+}
+
+// Captures reports while the handle has SubscribeButtons callbacks, so
+// they fire without the application reading. Waits for the handle's read
+// and the stop event without holding the capture lock, and takes it only
+// to apply what arrived; ReadButtons calls collect the same read, so their
+// reports reach the callbacks too.
+static void RunCaptureThread(JoystickHandle *handle) {
+  std::vector<BYTE> buffer(handle->inputReportLength);
+  ULONGLONG idleSince = GetTickCount64();
+  bool failed = false;
+  for (;;) {
+    bool reading;
+    {
+      std::lock_guard<std::mutex> capture(handle->captureMutex);
+      reading = !failed && StartReportRead(handle);
+    }
+    HANDLE waits[2] = {handle->captureStopEvent, handle->readOverlapped.hEvent};
+    DWORD timeout = BUTTONRAW_CAPTURE_SLICE_MS; // Device gone; the handle is still open
+    if (reading) {
+      ULONGLONG idle = GetTickCount64() - idleSince;
+      timeout = idle < 100 ? static_cast<DWORD>(100 - idle) : 0;
+    }
+    DWORD wait = WaitForMultipleObjects(reading ? 2 : 1, waits, FALSE, timeout);
+    if (wait == WAIT_OBJECT_0 || wait == WAIT_FAILED) {
+      break;
+    }
+
+    std::lock_guard<std::mutex> capture(handle->captureMutex);
+    failed = false;
+    if (wait == WAIT_OBJECT_0 + 1) {
+      // Possibly collected already by a ReadButtons call, which leaves no
+      // read pending and the event signalled; FinishReportRead returns 0
+      DWORD bytesRead = 0;
+      int status = FinishReportRead(handle, buffer.data(),
+                                    handle->inputReportLength, &bytesRead);
+      if (status > 0) {
+        CaptureReport(handle, buffer.data(), bytesRead, CaptureTimestamp());
+        idleSince = GetTickCount64();
+      }
+      failed = status < 0;
+    } else if (reading) {
+      // The same 100 ms timeout sample WaitForButtons takes
+      uint64_t state = 0;
+      CaptureIdle(handle, &state);
+      idleSince = GetTickCount64();
+    }
+  }
+}
+
+JoystickHandle::~JoystickHandle() {
+  if (captureStopEvent) {
+    SetEvent(captureStopEvent);
+  }
+  if (captureThread.joinable()) {
+    captureThread.join();
+  }
+  for (int entry : callbackEntries) {
+    if (entry != 0) {
+      Dispatcher().Remove(entry);
+    }
+  }
+  if (deviceHandle != NULL && deviceHandle != INVALID_HANDLE_VALUE) {
+    if (readPending) {
+      // The driver writes into readBuffer until the read is cancelled
+      DWORD bytesRead = 0;
+      CancelIoEx(deviceHandle, &readOverlapped);
+      GetOverlappedResult(deviceHandle, &readOverlapped, &bytesRead, TRUE);
+    }
+    CloseHandle(deviceHandle);
+  }
+  if (readOverlapped.hEvent) {
+    CloseHandle(readOverlapped.hEvent);
+  }
+  if (captureStopEvent) {
+    CloseHandle(captureStopEvent);
+  }
+}
+
+// Reads a callback subscription in batches of up to BUTTONRAW_CALLBACK_BATCH
+// events and invokes the callback once per batch. Runs on the dispatcher
+// thread, holding a reference so a callback may close the handle.
+static void DispatchSubscription(void *exported, int subscription,
+                                 ButtonRawCallback callback, void *userData) {
+  HandleRef joystickHandle = g_handles.Acquire(exported);
+  if (!joystickHandle) {
+    return; // Closed; its destructor removes the entry
+  }
+  ButtonRawEvent events[BUTTONRAW_CALLBACK_BATCH];
+  size_t count;
+  do {
+    uint64_t lost = 0;
+    count = joystickHandle->events.Read(subscription, events,
+                                        BUTTONRAW_CALLBACK_BATCH, &lost);
+    if (count == 0) {
+      break;
+    }
+    if (lost != 0) {
+      events[0].flags |= BUTTONRAW_EVENT_LOST;
+    }
+    // From the capture of the oldest event in the batch to its callback
+    uint64_t now = CaptureTimestamp();
+    Dispatcher().Latency().Record(now > events[0].timestamp ? now - events[0].timestamp : 0);
+    callback(exported, events, static_cast<int>(count), userData);
+  } while (count == BUTTONRAW_CALLBACK_BATCH);
+}
+
+// Converts a null-terminated WCHAR array into value, allocating at most once
+template <size_t N>
+static void AssignUTF8(std::string &value, const WCHAR (&text)[N]) {
+  char converted[N * UTF8_BYTES_PER_UTF16_UNIT];
+  value.assign(converted, Utf16ToUtf8(text, N, converted));
+}
+
+// Converts a UTF-8 device path into a null-terminated wide string in
+// scratch. UTF-16 never needs more units than UTF-8 has bytes, so one
+// allocation of path.size() + 1 units is enough. Returns NULL if the path is
+// empty or not valid UTF-8.
+template <size_t N>
+static const WCHAR *WidePath(const std::string &path,
+                             MonotonicArena<N> &scratch) {
+  if (path.empty()) {
+    return NULL;
+  }
+  WCHAR *wide = static_cast<WCHAR *>(
+      scratch.Allocate((path.size() + 1) * sizeof(WCHAR), alignof(WCHAR)));
+  if (wide == NULL) {
+    return NULL;
+  }
+  int units = MultiByteToWideChar(CP_UTF8, 0, path.data(),
+                                  static_cast<int>(path.size()), wide,
+                                  static_cast<int>(path.size()));
+  if (units <= 0) {
+    return NULL;
+  }
+  wide[units] = L'\0';
+  return wide;
 }
 
 //------------------------------ debug start ------------------------------
@@ -113,356 +582,794 @@ void LogDeviceCapabilities(HANDLE deviceHandle) {
 
 // Helper function to convert unsigned int to hex string
 std::string UIntToHexString(unsigned int value) {
-  std::stringstream stream;
-  stream << "0x" << std::hex << std::setfill('0') << std::setw(8) << value;
-  return stream.str();
+  char text[HEX_TEXT_SIZE];
+  return std::string(text, FormatHex(text, value, 8, false));
 }
 //------------------------------ debug end ------------------------------
 
-// Helper function to trim whitespace from both ends of a string
-std::wstring trim(const std::wstring &str) {
-  auto start = str.find_first_not_of(L" \t\r\n");
-  if (start == std::wstring::npos)
-    return L"";
-  auto end = str.find_last_not_of(L" \t\r\n");
-  return str.substr(start, end - start + 1);
+// SetupDi and HidD access for the device cache
+class Win32HidEnumerator : public HidEnumerator {
+public:
+  bool EnumeratePaths(std::vector<std::string> &paths) override {
+    GUID hidGuid;
+    HidD_GetHidGuid(&hidGuid);
+
+    HDEVINFO deviceInfoSet = SetupDiGetClassDevs(
+        &hidGuid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (deviceInfoSet == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+
+    SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
+    deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // Detail data and path conversion of one interface at a time; rewound
+    // per interface, so the whole enumeration reuses one block
+    MonotonicArena<2048> scratch;
+
+    for (DWORD deviceIndex = 0;
+         SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &hidGuid, deviceIndex,
+                                     &deviceInterfaceData);
+         ++deviceIndex) {
+      scratch.Reset();
+      DWORD requiredSize = 0;
+      SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL,
+                                      0, &requiredSize, NULL);
+
+      PSP_DEVICE_INTERFACE_DETAIL_DATA detailData =
+          requiredSize >= sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA)
+              ? static_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA>(scratch.Allocate(
+                    requiredSize, alignof(SP_DEVICE_INTERFACE_DETAIL_DATA)))
+              : NULL;
+
+      // Keep the slot even if the detail query fails, so indexes stay
+      // aligned with SetupDi enumeration order
+      paths.emplace_back();
+      if (detailData == NULL) {
+        continue;
+      }
+      detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+      if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData,
+                                          detailData, requiredSize, NULL,
+                                          NULL)) {
+        size_t units = (requiredSize -
+                        offsetof(SP_DEVICE_INTERFACE_DETAIL_DATA, DevicePath)) /
+                       sizeof(WCHAR);
+        char *path = static_cast<char *>(
+            scratch.Allocate(units * UTF8_BYTES_PER_UTF16_UNIT, 1));
+        if (path != NULL) {
+          paths.back().assign(
+              path, Utf16ToUtf8(detailData->DevicePath, units, path));
+        }
+      }
+    }
+
+    SetupDiDestroyDeviceInfoList(deviceInfoSet);
+    return true;
+  }
+
+  void Probe(HidDeviceRecord &record, uint32_t fields) override {
+    fields &= ~record.fields;
+    if (record.path.empty() || (fields & HidFieldsOpened) == 0) {
+      return;
+    }
+    if ((record.fields & HidFieldsOpened) != 0 && !record.opened) {
+      return; // An earlier probe could not open it at all
+    }
+    ActiveProbe active(*this);
+    // Wide path and caps arrays of this probe. A gamepad's fit in the inline
+    // block; only a device with dozens of caps spills to the heap.
+    MonotonicArena<4096> scratch;
+    ProbeHandles handles(record, WidePath(record.path, scratch), active);
+    if (!handles.Open()) {
+      return;
+    }
+    record.opened = true;
+
+    if (fields & HidFieldAttributes) {
+      HIDD_ATTRIBUTES attributes;
+      attributes.Size = sizeof(HIDD_ATTRIBUTES);
+      if (handles.Query([&](HANDLE handle) {
+            return HidD_GetAttributes(handle, &attributes);
+          })) {
+        record.hasAttributes = true;
+        record.vendorID = attributes.VendorID;
+        record.productID = attributes.ProductID;
+        record.versionNumber = attributes.VersionNumber;
+      }
+    }
+
+    wchar_t text[256];
+    if ((fields & HidFieldProduct) && handles.Query([&](HANDLE handle) {
+          return HidD_GetProductString(handle, text, sizeof(text));
+        })) {
+      AssignUTF8(record.product, text);
+    }
+    if ((fields & HidFieldManufacturer) && handles.Query([&](HANDLE handle) {
+          return HidD_GetManufacturerString(handle, text, sizeof(text));
+        })) {
+      AssignUTF8(record.manufacturer, text);
+    }
+    if ((fields & HidFieldSerialNumber) && handles.Query([&](HANDLE handle) {
+          return HidD_GetSerialNumberString(handle, text, sizeof(text));
+        })) {
+      AssignUTF8(record.serialNumber, text);
+    }
+
+    PHIDP_PREPARSED_DATA preparsedData = NULL;
+    if ((fields & HidFieldsPreparsed) && handles.Query([&](HANDLE handle) {
+          return HidD_GetPreparsedData(handle, &preparsedData);
+        })) {
+      ProbeCaps(preparsedData, fields, record, scratch);
+      HidD_FreePreparsedData(preparsedData);
+    }
+  }
+
+  // Cancels the control transfer each running probe is blocked in, and makes
+  // the rest of their queries fail without starting another one
+  void CancelProbes() override {
+    std::lock_guard<std::mutex> lock(m_probingMutex);
+    m_cancels++;
+    for (HANDLE thread : m_probing) {
+      CancelSynchronousIo(thread);
+    }
+  }
+
+private:
+  // Registers the calling thread as probing, so CancelProbes can reach it
+  class ActiveProbe {
+  public:
+    explicit ActiveProbe(Win32HidEnumerator &owner)
+        : m_owner(owner),
+          m_thread(OpenThread(THREAD_TERMINATE, FALSE, GetCurrentThreadId())) {
+      std::lock_guard<std::mutex> lock(m_owner.m_probingMutex);
+      m_cancels = m_owner.m_cancels;
+      if (m_thread != NULL) {
+        m_owner.m_probing.push_back(m_thread);
+      }
+    }
+    ~ActiveProbe() {
+      if (m_thread == NULL) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_owner.m_probingMutex);
+        auto &probing = m_owner.m_probing;
+        probing.erase(std::find(probing.begin(), probing.end(), m_thread));
+      }
+      CloseHandle(m_thread);
+    }
+
+    bool Cancelled() const {
+      std::lock_guard<std::mutex> lock(m_owner.m_probingMutex);
+      return m_owner.m_cancels != m_cancels;
+    }
+
+  private:
+    Win32HidEnumerator &m_owner;
+    HANDLE m_thread;
+    uint64_t m_cancels = 0; // m_owner.m_cancels when the probe started
+
+    ActiveProbe(const ActiveProbe &) = delete;
+    ActiveProbe &operator=(const ActiveProbe &) = delete;
+  };
+
+  // Probing handles for one interface. Queries run on a zero-access handle,
+  // which needs no exclusive access (keyboards and mice held by the OS can
+  // still be queried) and does not contend with readers in other processes.
+  // A query that fails is retried once on a read/write handle, unless an
+  // earlier probe of this interface found read/write access denied.
+  class ProbeHandles {
+  public:
+    ProbeHandles(HidDeviceRecord &record, const WCHAR *widePath,
+                 const ActiveProbe &active)
+        : m_record(record), m_widePath(widePath), m_active(active) {}
+    ~ProbeHandles() {
+      if (m_zeroAccess != INVALID_HANDLE_VALUE)
+        CloseHandle(m_zeroAccess);
+      if (m_readWrite != INVALID_HANDLE_VALUE)
+        CloseHandle(m_readWrite);
+    }
+
+    bool Open() {
+      if (m_widePath == NULL) {
+        return false;
+      }
+      m_zeroAccess = OpenPath(0);
+      return m_zeroAccess != INVALID_HANDLE_VALUE;
+    }
+
+    template <typename QueryFn> bool Query(QueryFn &&query) {
+      if (m_active.Cancelled()) {
+        return false;
+      }
+      if (query(m_zeroAccess)) {
+        return true;
+      }
+      if (m_readWrite == INVALID_HANDLE_VALUE && !m_triedReadWrite &&
+          !m_record.readWriteDenied) {
+        m_triedReadWrite = true;
+        m_readWrite = OpenPath(GENERIC_READ | GENERIC_WRITE);
+        m_record.readWriteDenied = m_readWrite == INVALID_HANDLE_VALUE;
+      }
+      return m_readWrite != INVALID_HANDLE_VALUE && !m_active.Cancelled() &&
+             query(m_readWrite);
+    }
+
+  private:
+    HANDLE OpenPath(DWORD access) {
+      return CreateFile(m_widePath, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                        OPEN_EXISTING, 0, NULL);
+    }
+
+    HidDeviceRecord &m_record;
+    const WCHAR *m_widePath;
+    const ActiveProbe &m_active;
+    HANDLE m_zeroAccess = INVALID_HANDLE_VALUE;
+    HANDLE m_readWrite = INVALID_HANDLE_VALUE;
+    bool m_triedReadWrite = false;
+
+    ProbeHandles(const ProbeHandles &) = delete;
+    ProbeHandles &operator=(const ProbeHandles &) = delete;
+  };
+
+  template <size_t N>
+  static void ProbeCaps(PHIDP_PREPARSED_DATA preparsedData, uint32_t fields,
+                        HidDeviceRecord &record, MonotonicArena<N> &scratch) {
+    HIDP_CAPS capabilities;
+    if (HidP_GetCaps(preparsedData, &capabilities) != HIDP_STATUS_SUCCESS) {
+      return;
+    }
+    if (fields & HidFieldCaps) {
+      record.hasCaps = true;
+      record.usage = capabilities.Usage;
+      record.usagePage = capabilities.UsagePage;
+      record.inputReportByteLength = capabilities.InputReportByteLength;
+      record.outputReportByteLength = capabilities.OutputReportByteLength;
+      record.featureReportByteLength = capabilities.FeatureReportByteLength;
+      record.numberOfLinkCollectionNodes =
+          capabilities.NumberLinkCollectionNodes;
+      record.numberOfInputButtonCaps = capabilities.NumberInputButtonCaps;
+      record.numberOfInputValueCaps = capabilities.NumberInputValueCaps;
+      record.numberOfInputDataIndices = capabilities.NumberInputDataIndices;
+      record.numberOfOutputButtonCaps = capabilities.NumberOutputButtonCaps;
+      record.numberOfOutputValueCaps = capabilities.NumberOutputValueCaps;
+      record.numberOfOutputDataIndices = capabilities.NumberOutputDataIndices;
+      record.numberOfFeatureButtonCaps = capabilities.NumberFeatureButtonCaps;
+      record.numberOfFeatureValueCaps = capabilities.NumberFeatureValueCaps;
+      record.numberOfFeatureDataIndices =
+          capabilities.NumberFeatureDataIndices;
+    }
+
+    // Get value caps
+    USHORT valueCapLength = capabilities.NumberInputValueCaps;
+    HIDP_VALUE_CAPS *valueCaps =
+        (fields & HidFieldAxes) && valueCapLength != 0
+            ? static_cast<HIDP_VALUE_CAPS *>(
+                  scratch.Allocate(valueCapLength * sizeof(HIDP_VALUE_CAPS),
+                                   alignof(HIDP_VALUE_CAPS)))
+            : NULL;
+    if (valueCaps != NULL &&
+        HidP_GetValueCaps(HidP_Input, valueCaps, &valueCapLength,
+                          preparsedData) == HIDP_STATUS_SUCCESS) {
+      for (USHORT i = 0; i < valueCapLength; i++) {
+        const HIDP_VALUE_CAPS &cap = valueCaps[i];
+        if (cap.UsagePage == 0x01) { // Generic Desktop Controls
+          switch (cap.NotRange.Usage) {
+          case 0x30: // X
+          case 0x31: // Y
+          case 0x32: // Z
+          case 0x33: // Rx
+          case 0x34: // Ry
+          case 0x35: // Rz
+          case 0x36: // Slider
+          case 0x37: // Dial
+          case 0x38: // Wheel
+            record.axesTotal++;
+            break;
+          case 0x39: // Hat switch
+            record.povTotal++;
+            break;
+          }
+        }
+      }
+    }
+
+    // Get button caps for buttonsTotal
+    USHORT buttonCapLength = capabilities.NumberInputButtonCaps;
+    HIDP_BUTTON_CAPS *buttonCaps =
+        (fields & HidFieldButtons) && buttonCapLength != 0
+            ? static_cast<HIDP_BUTTON_CAPS *>(
+                  scratch.Allocate(buttonCapLength * sizeof(HIDP_BUTTON_CAPS),
+                                   alignof(HIDP_BUTTON_CAPS)))
+            : NULL;
+    if (buttonCaps != NULL &&
+        HidP_GetButtonCaps(HidP_Input, buttonCaps, &buttonCapLength,
+                           preparsedData) == HIDP_STATUS_SUCCESS) {
+      for (USHORT i = 0; i < buttonCapLength; i++) {
+        const HIDP_BUTTON_CAPS &cap = buttonCaps[i];
+        if (cap.IsRange) {
+          record.buttonsTotal += cap.Range.UsageMax - cap.Range.UsageMin + 1;
+        } else {
+          record.buttonsTotal++;
+        }
+      }
+    }
+  }
+
+  std::mutex m_probingMutex;
+  std::vector<HANDLE> m_probing; // Threads inside Probe
+  uint64_t m_cancels = 0;        // Incremented by CancelProbes
+};
+
+// Device snapshot shared by the list, find and open calls. It is
+// re-enumerated only after a HID interface arrives or goes away. Never
+// destroyed: its probe threads are stopped by ShutdownButtonController, not
+// under the loader lock at unload.
+static HidDeviceCache &g_deviceCache = *new HidDeviceCache();
+// Registered by the first snapshot call, unregistered by
+// ShutdownButtonController
+static std::mutex g_deviceNotificationMutex;
+static std::atomic<bool> g_deviceNotificationArmed{false};
+static HCMNOTIFICATION g_deviceNotification = NULL;
+
+static DWORD CALLBACK DeviceNotificationCallback(HCMNOTIFICATION notification,
+                                                 PVOID context,
+                                                 CM_NOTIFY_ACTION action,
+                                                 PCM_NOTIFY_EVENT_DATA eventData,
+                                                 DWORD eventDataSize) {
+  if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL ||
+      action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL) {
+    g_deviceCache.Invalidate();
+  }
+  return ERROR_SUCCESS;
+}
+
+static_assert(BUTTONRAW_FIELD_ALL == HidFieldAll &&
+                  BUTTONRAW_FIELD_BUTTONS == HidFieldButtons,
+              "GetHIDDeviceListEx field bits must match HidDeviceFields");
+static_assert(BUTTONRAW_INFO_OPENED == HidInfoOpened &&
+                  BUTTONRAW_INFO_HAS_ATTRIBUTES == HidInfoHasAttributes &&
+                  BUTTONRAW_INFO_HAS_CAPS == HidInfoHasCaps &&
+                  BUTTONRAW_INFO_INCOMPLETE == HidInfoIncomplete,
+              "ButtonRawDeviceInfo flags must match HidInfoFlags");
+static_assert(BUTTONRAW_FORMAT_CBOR == HidFormatCbor &&
+                  BUTTONRAW_FORMAT_MSGPACK == HidFormatMsgPack,
+              "GetHIDDeviceListBinary formats must match HidBinaryFormat");
+
+static void RegisterDeviceNotification() {
+  std::lock_guard<std::mutex> lock(g_deviceNotificationMutex);
+  if (g_deviceNotificationArmed) {
+    return;
+  }
+  CM_NOTIFY_FILTER filter = {0};
+  filter.cbSize = sizeof(filter);
+  filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+  HidD_GetHidGuid(&filter.u.DeviceInterface.ClassGuid);
+  // Without notifications the snapshot could go stale unnoticed
+  g_deviceCache.SetAlwaysRefresh(
+      CM_Register_Notification(&filter, NULL, DeviceNotificationCallback,
+                               &g_deviceNotification) != CR_SUCCESS);
+  g_deviceNotificationArmed = true;
+}
+
+// Waits for a callback in progress. A later snapshot call registers again;
+// the snapshot is invalidated since changes until then go unnoticed.
+static void UnregisterDeviceNotification() {
+  std::lock_guard<std::mutex> lock(g_deviceNotificationMutex);
+  if (g_deviceNotification != NULL) {
+    CM_Unregister_Notification(g_deviceNotification);
+    g_deviceNotification = NULL;
+  }
+  g_deviceNotificationArmed = false;
+  g_deviceCache.Invalidate();
+}
+
+// Current device snapshot with at least the requested field groups;
+// nullptr if enumeration has never succeeded
+static const std::shared_ptr<HidEnumerator> &DeviceEnumerator() {
+  // Shared with probes that outlive a call after missing their deadline
+  static const std::shared_ptr<HidEnumerator> enumerator =
+      std::make_shared<Win32HidEnumerator>();
+  return enumerator;
+}
+
+static std::shared_ptr<const HidSnapshot> GetDeviceSnapshot(uint32_t fields) {
+  if (!g_deviceNotificationArmed) {
+    RegisterDeviceNotification();
+  }
+  return g_deviceCache.Get(DeviceEnumerator(), fields);
+}
+
+// Runs a lookup on the snapshot. A record loaded with LoadDeviceCache is
+// checked against its device the first time a lookup returns it; if it
+// turned out stale, the lookup runs again on the corrected snapshot.
+template <typename Lookup>
+static int FindDevice(std::shared_ptr<const HidSnapshot> &snapshot,
+                      Lookup lookup) {
+  for (;;) {
+    int index = lookup(*snapshot);
+    if (index < 0 || !snapshot->devices[index].seeded) {
+      return index;
+    }
+    std::shared_ptr<const HidSnapshot> checked =
+        g_deviceCache.Verify(DeviceEnumerator(), snapshot->devices[index].path);
+    if (!checked || checked == snapshot) {
+      return index; // Could not be checked now; use it as loaded
+    }
+    snapshot = checked;
+  }
+}
+
+// Copies the path of a snapshot entry. Returns 0 on success, -1 if index is
+// not a device with a path, -2 if the buffer is too small.
+static int CopyDevicePath(const HidSnapshot &snapshot, int index, char *path,
+                          int pathSize) {
+  if (index < 0 || snapshot.devices[index].path.empty()) {
+    return -1;
+  }
+  const std::string &devicePath = snapshot.devices[index].path;
+  if (devicePath.length() >= static_cast<size_t>(pathSize)) {
+    return -2;
+  }
+  strncpy_s(path, pathSize, devicePath.c_str(), _TRUNCATE);
+  return 0;
+}
+
+// Opens a HID interface for reading and sets up its capture state.
+// Returns the exported handle.
+static void *OpenDevicePath(const std::string &path) {
+  MonotonicArena<512> scratch;
+  const WCHAR *widePath = WidePath(path, scratch);
+  HANDLE deviceHandle =
+      widePath == NULL
+          ? INVALID_HANDLE_VALUE
+          : CreateFile(widePath, GENERIC_READ | GENERIC_WRITE,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                       FILE_FLAG_OVERLAPPED, // Need this for timeout support
+                       NULL);
+  if (deviceHandle == INVALID_HANDLE_VALUE) {
+    //------------------------------ debug start ------------------------------
+    // WriteToLog("Failed to open the device.");
+    //------------------------------- debug end -------------------------------
+    return NULL; // Error: couldn't open the device
+  }
+  HIDD_ATTRIBUTES attributes;
+  attributes.Size = sizeof(HIDD_ATTRIBUTES);
+  if (!HidD_GetAttributes(deviceHandle, &attributes)) {
+    attributes.VendorID = 0;
+    attributes.ProductID = 0;
+    attributes.VersionNumber = 0;
+  }
+
+  // The snapshot (possibly loaded with LoadDeviceCache) usually knows the
+  // report length already; the attributes confirm it is the same device
+  USHORT inputReportLength = 0;
+  std::shared_ptr<const HidSnapshot> snapshot = g_deviceCache.Peek();
+  int index = snapshot ? snapshot->Find(path) : -1;
+  if (index >= 0) {
+    const HidDeviceRecord &known = snapshot->devices[index];
+    if (known.hasCaps && known.hasAttributes &&
+        known.vendorID == attributes.VendorID &&
+        known.productID == attributes.ProductID &&
+        known.versionNumber == attributes.VersionNumber) {
+      inputReportLength = known.inputReportByteLength;
+    } else if (known.seeded) {
+      g_deviceCache.Verify(DeviceEnumerator(), path); // Loaded for another device
+    } else if (known.hasAttributes) {
+      g_deviceCache.Invalidate(); // Stale entry for this path
+    }
+  }
+
+  if (inputReportLength == 0) {
+    // Get and log detailed capabilities
+    PHIDP_PREPARSED_DATA preparsedData = NULL;
+    if (!HidD_GetPreparsedData(deviceHandle, &preparsedData)) {
+      //------------------------------ debug start ------------------------------
+      // WriteToLog("Failed to get preparsed data");
+      //------------------------------- debug end -------------------------------
+      CloseHandle(deviceHandle);
+      return NULL;
+    }
+    HIDP_CAPS caps;
+    NTSTATUS status = HidP_GetCaps(preparsedData, &caps);
+    HidD_FreePreparsedData(preparsedData);
+    if (status != HIDP_STATUS_SUCCESS) {
+      //------------------------------ debug start ------------------------------
+      // WriteToLog("Failed to get capabilities");
+      //------------------------------- debug end -------------------------------
+      CloseHandle(deviceHandle);
+      return NULL;
+    }
+    inputReportLength = caps.InputReportByteLength;
+  }
+
+  JoystickHandle *handle = NULL;
+  void *exported = g_handles.Create(handle);
+  if (!exported) {
+    CloseHandle(deviceHandle);
+    //------------------------------ debug start ------------------------------
+    // WriteToLog("Memory allocation failed for JoystickHandle.");
+    //------------------------------- debug end -------------------------------
+    return NULL; // Error: the handle table is full
+  }
+
+  handle->deviceHandle = deviceHandle;
+  handle->inputReportLength = inputReportLength;
+  handle->readBuffer.resize(inputReportLength);
+  handle->readOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  handle->captureStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (!handle->readOverlapped.hEvent || !handle->captureStopEvent) {
+    g_handles.Destroy(exported); // Closes the device
+    return NULL;
+  }
+  handle->oversizedReport = (inputReportLength > BUTTONRAW_MAX_REPORT_SIZE);
+  handle->reportSequence = 0;
+  handle->attributes = attributes;
+  ButtonProfile profile;
+  profile.vendorID = handle->attributes.VendorID;
+  profile.productID = handle->attributes.ProductID;
+  profile.versionNumber = handle->attributes.VersionNumber;
+  profile.activeMask = ~0ULL;
+  {
+    // Use a learned profile for this VID/PID/version if there is one
+    std::lock_guard<std::mutex> lock(g_profilesMutex);
+    g_profiles.Find(profile.vendorID, profile.productID, profile.versionNumber, profile);
+  }
+  ApplyProfile(handle, profile);
+  handle->lastRawState = 0;
+  handle->debounceEnabled = false;
+  handle->debouncePrimed = false;
+  handle->lastReportBytes = 0;
+  handle->eventsReader = handle->events.Subscribe(~0ULL);
+  for (int &entry : handle->callbackEntries) {
+    entry = 0;
+  }
+  handle->callbackCount = 0;
+
+  //------------------------------ debug start ------------------------------
+  // Log the handle value
+  /*
+  std::stringstream ss;
+  ss << "Opened joystick with handle: " << handle->deviceHandle;
+  WriteToLog(ss.str().c_str());
+  LogDeviceCapabilities(deviceHandle);
+  if (handle->oversizedReport) {
+      std::stringstream ss;
+      ss << "Warning: Device reports " << caps.InputReportByteLength
+          << " bytes, but only " << MAX_REPORT_SIZE << " bytes will be
+  processed"; WriteToLog(ss.str().c_str());
+  }
+  */
+  //------------------------------- debug end -------------------------------
+
+  return exported;
 }
 
 extern "C" {
 
     //************************** GetHIDDeviceList *****************************
     int GetHIDDeviceList(char* buffer, int bufferSize) {
-        if (buffer == nullptr || bufferSize <= 0) {
+        return GetHIDDeviceListEx(buffer, bufferSize, BUTTONRAW_FIELD_ALL);
+    }
+
+    //************************** GetHIDDeviceListEx *****************************
+    int GetHIDDeviceListEx(char* buffer, int bufferSize, uint32_t fields) {
+        // A null buffer with size 0 asks for the required size
+        bool sizeQuery = buffer == nullptr && bufferSize == 0;
+        if (!sizeQuery && (buffer == nullptr || bufferSize <= 0)) {
             return -1; // Invalid parameters
         }
 
-        GUID hidGuid;
-        HidD_GetHidGuid(&hidGuid);
-
-        HDEVINFO deviceInfoSet = SetupDiGetClassDevs(
-            &hidGuid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-        if (deviceInfoSet == INVALID_HANDLE_VALUE) {
+        fields &= HidFieldAll;
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(fields);
+        if (!snapshot) {
             return -2; // Failed to get device info set
         }
 
-        json deviceList = json::array();
-        SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
-        deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
-
-        for (DWORD deviceIndex = 0; SetupDiEnumDeviceInterfaces(
-            deviceInfoSet, NULL, &hidGuid, deviceIndex, &deviceInterfaceData);
-            ++deviceIndex) {
-            DWORD requiredSize = 0;
-            SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL,
-                0, &requiredSize, NULL);
-
-            std::vector<BYTE> detailDataBuffer(requiredSize);
-            PSP_DEVICE_INTERFACE_DETAIL_DATA detailData =
-                reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA>(
-                    &detailDataBuffer[0]);
-            detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-
-            json device;
-            device["index"] = deviceIndex;
-            device["path"] = "";
-            device["vendorID"] = "";
-            device["productID"] = "";
-            device["versionNumber"] = "";
-            device["product"] = "";
-            device["manufacturer"] = "";
-            device["serialNumber"] = "";
-            device["usage"] = "";
-            device["usagePage"] = "";
-            device["inputReportByteLength"] = 0;
-            device["outputReportByteLength"] = 0;
-            device["featureReportByteLength"] = 0;
-            device["numberOfLinkCollectionNodes"] = 0;
-            device["numberOfInputButtonCaps"] = 0;
-            device["numberOfInputValueCaps"] = 0;
-            device["numberOfInputDataIndices"] = 0;
-            device["numberOfOutputButtonCaps"] = 0;
-            device["numberOfOutputValueCaps"] = 0;
-            device["numberOfOutputDataIndices"] = 0;
-            device["numberOfFeatureButtonCaps"] = 0;
-            device["numberOfFeatureValueCaps"] = 0;
-            device["numberOfFeatureDataIndices"] = 0;
-            device["axesTotal"] = 0;
-            device["buttonsTotal"] = 0;
-            device["povTotal"] = 0;
-
-            if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData,
-                detailData, requiredSize, NULL, NULL)) {
-                HANDLE deviceHandle = CreateFile(
-                    detailData->DevicePath, GENERIC_READ | GENERIC_WRITE,
-                    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-                if (deviceHandle != INVALID_HANDLE_VALUE) {
-                    device["path"] = wchar_to_string(detailData->DevicePath);
-
-                    HIDD_ATTRIBUTES attributes;
-                    if (HidD_GetAttributes(deviceHandle, &attributes)) {
-                        std::stringstream ss;
-                        ss << "0x" << std::hex << std::setw(4) << std::setfill('0')
-                            << attributes.VendorID;
-                        device["vendorID"] = ss.str();
-                        ss.str("");
-                        ss << "0x" << std::hex << std::setw(4) << std::setfill('0')
-                            << attributes.ProductID;
-                        device["productID"] = ss.str();
-                        ss.str("");
-                        ss << "0x" << std::hex << std::setw(4) << std::setfill('0')
-                            << attributes.VersionNumber;
-                        device["versionNumber"] = ss.str();
-                    }
-
-                    wchar_t productString[256] = L"";
-                    if (HidD_GetProductString(deviceHandle, productString,
-                        sizeof(productString))) {
-                        device["product"] = wchar_to_string(productString);
-                    }
-
-                    wchar_t manufacturerString[256] = L"";
-                    if (HidD_GetManufacturerString(deviceHandle, manufacturerString,
-                        sizeof(manufacturerString))) {
-                        device["manufacturer"] = wchar_to_string(manufacturerString);
-                    }
-
-                    wchar_t serialNumberString[256] = L"";
-                    if (HidD_GetSerialNumberString(deviceHandle, serialNumberString,
-                        sizeof(serialNumberString))) {
-                        device["serialNumber"] = wchar_to_string(serialNumberString);
-                    }
-
-                    PHIDP_PREPARSED_DATA preparsedData = NULL;
-                    if (HidD_GetPreparsedData(deviceHandle, &preparsedData)) {
-                        HIDP_CAPS capabilities;
-                        if (HidP_GetCaps(preparsedData, &capabilities) ==
-                            HIDP_STATUS_SUCCESS) {
-                            std::stringstream ss;
-                            ss << "0x" << std::hex << std::setw(4) << std::setfill('0')
-                                << capabilities.Usage;
-                            device["usage"] = ss.str();
-                            ss.str("");
-                            ss << "0x" << std::hex << std::setw(4) << std::setfill('0')
-                                << capabilities.UsagePage;
-                            device["usagePage"] = ss.str();
-                            device["inputReportByteLength"] =
-                                capabilities.InputReportByteLength;
-                            device["outputReportByteLength"] =
-                                capabilities.OutputReportByteLength;
-                            device["featureReportByteLength"] =
-                                capabilities.FeatureReportByteLength;
-                            device["numberOfLinkCollectionNodes"] =
-                                capabilities.NumberLinkCollectionNodes;
-                            device["numberOfInputButtonCaps"] =
-                                capabilities.NumberInputButtonCaps;
-                            device["numberOfInputValueCaps"] =
-                                capabilities.NumberInputValueCaps;
-                            device["numberOfInputDataIndices"] =
-                                capabilities.NumberInputDataIndices;
-                            device["numberOfOutputButtonCaps"] =
-                                capabilities.NumberOutputButtonCaps;
-                            device["numberOfOutputValueCaps"] =
-                                capabilities.NumberOutputValueCaps;
-                            device["numberOfOutputDataIndices"] =
-                                capabilities.NumberOutputDataIndices;
-                            device["numberOfFeatureButtonCaps"] =
-                                capabilities.NumberFeatureButtonCaps;
-                            device["numberOfFeatureValueCaps"] =
-                                capabilities.NumberFeatureValueCaps;
-                            device["numberOfFeatureDataIndices"] =
-                                capabilities.NumberFeatureDataIndices;
-
-                            // Get value caps
-                            USHORT valueCapLength = capabilities.NumberInputValueCaps;
-                            std::vector<HIDP_VALUE_CAPS> valueCaps(valueCapLength);
-
-                            if (HidP_GetValueCaps(HidP_Input, valueCaps.data(), &valueCapLength,
-                                preparsedData) == HIDP_STATUS_SUCCESS) {
-                                int axesTotal = 0;
-                                int povTotal = 0;
-
-                                for (const auto& cap : valueCaps) {
-                                    if (cap.UsagePage == 0x01) { // Generic Desktop Controls
-                                        switch (cap.NotRange.Usage) {
-                                        case 0x30: // X
-                                        case 0x31: // Y
-                                        case 0x32: // Z
-                                        case 0x33: // Rx
-                                        case 0x34: // Ry
-                                        case 0x35: // Rz
-                                        case 0x36: // Slider
-                                        case 0x37: // Dial
-                                        case 0x38: // Wheel
-                                            axesTotal++;
-                                            break;
-                                        case 0x39: // Hat switch
-                                            povTotal++;
-                                            break;
-                                        }
-                                    }
-                                }
-
-                                device["axesTotal"] = axesTotal;
-                                device["povTotal"] = povTotal;
-                            }
-
-                            // Get button caps for buttonsTotal
-                            USHORT buttonCapLength = capabilities.NumberInputButtonCaps;
-                            std::vector<HIDP_BUTTON_CAPS> buttonCaps(buttonCapLength);
-
-                            if (HidP_GetButtonCaps(HidP_Input, buttonCaps.data(),
-                                &buttonCapLength,
-                                preparsedData) == HIDP_STATUS_SUCCESS) {
-                                int buttonsTotal = 0;
-
-                                for (const auto& cap : buttonCaps) {
-                                    if (cap.IsRange) {
-                                        buttonsTotal += cap.Range.UsageMax - cap.Range.UsageMin + 1;
-                                    }
-                                    else {
-                                        buttonsTotal++;
-                                    }
-                                }
-
-                                device["buttonsTotal"] = buttonsTotal;
-                            }
-                        }
-                        HidD_FreePreparsedData(preparsedData);
-                    }
-                    CloseHandle(deviceHandle);
-                }
-            }
+        // Both calls of a size query read the same cached snapshot
+        JsonBufferAdapter output(buffer, sizeQuery ? 0 : static_cast<size_t>(bufferSize));
+        WriteHidDeviceList(output, *snapshot, fields);
+        if (sizeQuery) {
+            return static_cast<int>(output.Size() + 1); // Including the null
+        }
+        if (!output.Terminate()) {
+            buffer[0] = '\0';
+            return -3; // Buffer too small
+        }
+        return 0; // Success
+    }
 
-            deviceList.push_back(device);
+    //******************** GetHIDDeviceInfo ********************
+    int GetHIDDeviceInfo(ButtonRawDeviceInfo* devices, int capacity, int* count) {
+        if (count == nullptr || capacity < 0 || (devices == nullptr && capacity > 0)) {
+            return -1; // Invalid parameters
         }
+        *count = 0;
 
-        SetupDiDestroyDeviceInfoList(deviceInfoSet);
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldAll);
+        if (!snapshot) {
+            return -2; // Failed to get device info set
+        }
 
-        std::string result = deviceList.dump(-1); // -1 for no indentation
+        size_t total = snapshot->devices.size();
+        size_t filled = total < static_cast<size_t>(capacity) ? total : static_cast<size_t>(capacity);
+        for (size_t i = 0; i < filled; i++) {
+            FillHidDeviceInfo(snapshot->devices[i], i, devices[i]);
+        }
+        *count = static_cast<int>(total);
+        return filled < total ? -3 : 0; // -3: capacity too small, *count has the total
+    }
 
-        if (result.length() >= static_cast<size_t>(bufferSize)) {
-            return -3; // Buffer too small
+    //******************** GetHIDDeviceListBinary ********************
+    int GetHIDDeviceListBinary(char* buffer, int bufferSize, uint32_t fields, int format) {
+        // A null buffer with size 0 asks for the required size
+        bool sizeQuery = buffer == nullptr && bufferSize == 0;
+        if (!sizeQuery && (buffer == nullptr || bufferSize <= 0)) {
+            return -1; // Invalid parameters
+        }
+        if (format != BUTTONRAW_FORMAT_CBOR && format != BUTTONRAW_FORMAT_MSGPACK) {
+            return -1;
         }
 
-        strncpy_s(buffer, bufferSize, result.c_str(), _TRUNCATE);
-        return 0; // Success
+        fields &= HidFieldAll;
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(fields);
+        if (!snapshot) {
+            return -2; // Failed to get device info set
+        }
+
+        auto output = std::make_shared<JsonBufferAdapter>(
+            buffer, sizeQuery ? 0 : static_cast<size_t>(bufferSize));
+        WriteHidDeviceListBinary(output, *snapshot, fields, format);
+        if (!sizeQuery && output->Size() > static_cast<size_t>(bufferSize)) {
+            return -3; // Buffer too small
+        }
+        return static_cast<int>(output->Size()); // Bytes written (or needed)
     }
 
-    //******************** FindJoystickByVendorAndProductID ********************
-    int FindJoystickByVendorAndProductID(unsigned short vendorID,
-        unsigned short productID) {
-        GUID hidGuid;
-        HidD_GetHidGuid(&hidGuid);
+    //******************** GetDeviceListGeneration ********************
+    uint64_t GetDeviceListGeneration(void) {
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldAttributes);
+        return snapshot ? snapshot->generation : 0;
+    }
 
-        HDEVINFO deviceInfoSet = SetupDiGetClassDevs(
-            &hidGuid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-        if (deviceInfoSet == INVALID_HANDLE_VALUE) {
+    //******************** SetDeviceProbeTimeout ********************
+    int SetDeviceProbeTimeout(int timeoutMs) {
+        if (timeoutMs < 0) {
             return -1;
         }
+        g_deviceCache.SetProbeDeadline(static_cast<uint32_t>(timeoutMs));
+        return 0;
+    }
 
-        SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
-        deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
-
-        int deviceIndex = 0;
-        while (SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &hidGuid, deviceIndex,
-            &deviceInterfaceData)) {
-            DWORD requiredSize = 0;
-            SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL,
-                0, &requiredSize, NULL);
-
-            PSP_DEVICE_INTERFACE_DETAIL_DATA detailData =
-                (PSP_DEVICE_INTERFACE_DETAIL_DATA)malloc(requiredSize);
-            if (detailData == NULL) {
-                SetupDiDestroyDeviceInfoList(deviceInfoSet);
-                return -1; // Error: memory allocation failed
-            }
-            detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-
-            if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData,
-                detailData, requiredSize, NULL, NULL)) {
-                HANDLE deviceHandle = CreateFile(
-                    detailData->DevicePath, GENERIC_READ | GENERIC_WRITE,
-                    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-                if (deviceHandle != INVALID_HANDLE_VALUE) {
-                    HIDD_ATTRIBUTES attributes;
-                    if (HidD_GetAttributes(deviceHandle, &attributes)) {
-                        if (attributes.VendorID == vendorID &&
-                            attributes.ProductID == productID) {
-                            CloseHandle(deviceHandle);
-                            free(detailData);
-                            SetupDiDestroyDeviceInfoList(deviceInfoSet);
-                            return deviceIndex;
-                        }
-                    }
-                    CloseHandle(deviceHandle);
-                }
-            }
+    //******************** ReadDeviceChangeEvents ********************
+    int ReadDeviceChangeEvents(ButtonRawDeviceChange* events, int maxEvents) {
+        if (events == nullptr || maxEvents < 0) {
+            return -1;
+        }
 
-            free(detailData);
-            deviceIndex++;
+        // Picks up pending arrival/removal notifications
+        GetDeviceSnapshot(HidFieldAttributes);
+
+        int count = 0;
+        HidDeviceChange change;
+        while (count < maxEvents && g_deviceCache.PopChanges(&change, 1) == 1) {
+            ButtonRawDeviceChange& event = events[count++];
+            event.generation = change.generation;
+            event.kind = change.kind;
+            event.joystickId = change.index;
+            event.vendorID = change.device.vendorID;
+            event.productID = change.device.productID;
+            event.versionNumber = change.device.versionNumber;
+            event.reserved = 0;
+            strncpy_s(event.path, sizeof(event.path), change.device.path.c_str(), _TRUNCATE);
         }
+        return count;
+    }
 
-        SetupDiDestroyDeviceInfoList(deviceInfoSet);
-        return -1; // Device not found
+    //******************** FindJoystickByVendorAndProductID ********************
+    int FindJoystickByVendorAndProductID(unsigned short vendorID,
+        unsigned short productID) {
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldAttributes);
+        if (!snapshot) {
+            return -1;
+        }
+        return FindDevice(snapshot, [&](const HidSnapshot& devices) {
+            return devices.FindByVendorAndProductID(vendorID, productID);
+        });
     }
 
     //******************** FindJoystickByProductString ********************
     int FindJoystickByProductString(const char* name) {
-        GUID hidGuid;
-        HidD_GetHidGuid(&hidGuid);
-
-        HDEVINFO deviceInfoSet = SetupDiGetClassDevs(
-            &hidGuid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-        if (deviceInfoSet == INVALID_HANDLE_VALUE) {
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldProduct);
+        if (!snapshot || name == nullptr) {
             return -1;
         }
+        return FindDevice(snapshot, [&](const HidSnapshot& devices) {
+            return devices.FindByProductString(name);
+        });
+    }
 
-        SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
-        deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+    //******************** FindJoystickPathByVendorAndProductID ********************
+    int FindJoystickPathByVendorAndProductID(unsigned short vendorID,
+        unsigned short productID, char* path, int pathSize) {
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldAttributes);
+        if (!snapshot || path == nullptr || pathSize <= 0) {
+            return -1;
+        }
+        int index = FindDevice(snapshot, [&](const HidSnapshot& devices) {
+            return devices.FindByVendorAndProductID(vendorID, productID);
+        });
+        return CopyDevicePath(*snapshot, index, path, pathSize);
+    }
 
-        std::wstring wName = trim(string_to_wstring(name));
+    //******************** FindJoystickPathByProductString ********************
+    int FindJoystickPathByProductString(const char* name, char* path, int pathSize) {
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldProduct);
+        if (!snapshot || name == nullptr || path == nullptr || pathSize <= 0) {
+            return -1;
+        }
+        int index = FindDevice(snapshot, [&](const HidSnapshot& devices) {
+            return devices.FindByProductString(name);
+        });
+        return CopyDevicePath(*snapshot, index, path, pathSize);
+    }
 
-        int deviceIndex = 0;
-        while (SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &hidGuid, deviceIndex,
-            &deviceInterfaceData)) {
-            DWORD requiredSize = 0;
-            SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL,
-                0, &requiredSize, NULL);
+    //******************** ResolveDevices ********************
+    int ResolveDevices(const ButtonRawDeviceQuery* queries, int count,
+        ButtonRawDeviceMatch* results) {
+        if (queries == nullptr || results == nullptr || count < 0) {
+            return -1; // Invalid parameters
+        }
 
-            PSP_DEVICE_INTERFACE_DETAIL_DATA detailData =
-                (PSP_DEVICE_INTERFACE_DETAIL_DATA)malloc(requiredSize);
-            if (detailData == NULL) {
-                SetupDiDestroyDeviceInfoList(deviceInfoSet);
-                return -1; // Error: memory allocation failed
+        // Probe everything the batch needs at once, then answer from the indexes
+        uint32_t fields = HidFieldPath;
+        for (int i = 0; i < count; i++) {
+            switch (queries[i].kind) {
+            case BUTTONRAW_QUERY_VID_PID: fields |= HidFieldAttributes; break;
+            case BUTTONRAW_QUERY_VID_PID_USAGE: fields |= HidFieldAttributes | HidFieldCaps; break;
+            case BUTTONRAW_QUERY_PRODUCT: fields |= HidFieldProduct; break;
+            case BUTTONRAW_QUERY_SERIAL: fields |= HidFieldAttributes | HidFieldSerialNumber; break;
+            default: return -1;
             }
-            detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-
-            if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData,
-                detailData, requiredSize, NULL, NULL)) {
-                HANDLE deviceHandle = CreateFile(
-                    detailData->DevicePath, GENERIC_READ | GENERIC_WRITE,
-                    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-                if (deviceHandle != INVALID_HANDLE_VALUE) {
-                    wchar_t productString[256] = L"";
-                    if (HidD_GetProductString(deviceHandle, productString,
-                        sizeof(productString))) {
-                        if (trim(std::wstring(productString)) == wName) {
-                            CloseHandle(deviceHandle);
-                            free(detailData);
-                            SetupDiDestroyDeviceInfoList(deviceInfoSet);
-                            return deviceIndex;
-                        }
-                    }
-                    CloseHandle(deviceHandle);
-                }
+            if ((queries[i].kind == BUTTONRAW_QUERY_PRODUCT ||
+                 queries[i].kind == BUTTONRAW_QUERY_SERIAL) && queries[i].text == nullptr) {
+                return -1;
             }
-
-            free(detailData);
-            deviceIndex++;
+        }
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(fields);
+        if (!snapshot) {
+            return -2; // Failed to get device info set
         }
 
-        SetupDiDestroyDeviceInfoList(deviceInfoSet);
-        return -1; // Device not found
+        int resolved = 0;
+        for (int i = 0; i < count; i++) {
+            const ButtonRawDeviceQuery& query = queries[i];
+            int index = FindDevice(snapshot, [&](const HidSnapshot& devices) {
+                switch (query.kind) {
+                case BUTTONRAW_QUERY_VID_PID:
+                    return devices.FindByVendorAndProductID(query.vendorID, query.productID);
+                case BUTTONRAW_QUERY_VID_PID_USAGE:
+                    return devices.FindByUsage(query.vendorID, query.productID,
+                        query.usagePage, query.usage);
+                case BUTTONRAW_QUERY_PRODUCT:
+                    return devices.FindByProductString(query.text);
+                case BUTTONRAW_QUERY_SERIAL:
+                    return devices.FindBySerialNumber(query.vendorID, query.productID, query.text);
+                }
+                return -1;
+            });
+            ButtonRawDeviceMatch& result = results[i];
+            result.joystickId = index;
+            result.reserved = 0;
+            result.path[0] = '\0';
+            if (index >= 0) {
+                // The path stays empty if the interface has none or it does not fit
+                CopyDevicePath(*snapshot, index, result.path, sizeof(result.path));
+                resolved++;
+            }
+        }
+        return resolved;
     }
 
     //******************** OpenJoystick ********************
@@ -470,110 +1377,48 @@ extern "C" {
         //------------------------------ debug start ------------------------------
         // InitializeLog("c:\\temp\\buttons.log");
         //------------------------------- debug end -------------------------------
-        GUID hidGuid;
-        HidD_GetHidGuid(&hidGuid);
-
-        HDEVINFO deviceInfoSet = SetupDiGetClassDevs(
-            &hidGuid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-        if (deviceInfoSet == INVALID_HANDLE_VALUE) {
-            return NULL;
-        }
-
-        SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
-        deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
-        if (!SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &hidGuid, joystickId,
-            &deviceInterfaceData)) {
-            SetupDiDestroyDeviceInfoList(deviceInfoSet);
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldPath);
+        if (!snapshot || joystickId < 0 ||
+            static_cast<size_t>(joystickId) >= snapshot->devices.size()) {
             return NULL; // Error: couldn't find the specified joystick
         }
-        DWORD requiredSize = 0;
-        SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL, 0,
-            &requiredSize, NULL);
-
-        PSP_DEVICE_INTERFACE_DETAIL_DATA detailData =
-            (PSP_DEVICE_INTERFACE_DETAIL_DATA)malloc(requiredSize);
-        if (!detailData) {
-            SetupDiDestroyDeviceInfoList(deviceInfoSet);
-            return NULL; // Error: memory allocation failed
-        }
-        detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-        if (!SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData,
-            detailData, requiredSize, NULL, NULL)) {
-            free(detailData);
-            SetupDiDestroyDeviceInfoList(deviceInfoSet);
+        const std::string& path = snapshot->devices[joystickId].path;
+        if (path.empty()) {
             return NULL; // Error: couldn't get device interface detail
         }
-        HANDLE deviceHandle =
-            CreateFile(detailData->DevicePath, GENERIC_READ | GENERIC_WRITE,
-                FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
-                FILE_FLAG_OVERLAPPED, // Need this for timeout support
-                NULL);
-
-        free(detailData);
-
-        SetupDiDestroyDeviceInfoList(deviceInfoSet);
+        return OpenDevicePath(path);
+    }
 
-        if (deviceHandle == INVALID_HANDLE_VALUE) {
-            //------------------------------ debug start ------------------------------
-            // WriteToLog("Failed to open the device.");
-            //------------------------------- debug end -------------------------------
-            return NULL; // Error: couldn't open the device
+    //******************** OpenJoystickByPath ********************
+    void* OpenJoystickByPath(const char* path) {
+        if (path == nullptr || path[0] == '\0') {
+            return NULL;
         }
-        // Get and log detailed capabilities
-        PHIDP_PREPARSED_DATA preparsedData = NULL;
-        if (!HidD_GetPreparsedData(deviceHandle, &preparsedData)) {
-            //------------------------------ debug start ------------------------------
-            // WriteToLog("Failed to get preparsed data");
-            //------------------------------- debug end -------------------------------
-            CloseHandle(deviceHandle);
+        return OpenDevicePath(path);
+    }
+
+    //******************** OpenJoystickBySerial ********************
+    void* OpenJoystickBySerial(unsigned short vendorID, unsigned short productID,
+        const char* serialNumber) {
+        if (serialNumber == nullptr) {
             return NULL;
         }
-        HIDP_CAPS caps;
-        if (HidP_GetCaps(preparsedData, &caps) != HIDP_STATUS_SUCCESS) {
-            //------------------------------ debug start ------------------------------
-            // WriteToLog("Failed to get capabilities");
-            //------------------------------- debug end -------------------------------
-            HidD_FreePreparsedData(preparsedData);
-            CloseHandle(deviceHandle);
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldAttributes | HidFieldSerialNumber);
+        if (!snapshot) {
             return NULL;
         }
-
-        JoystickHandle* handle = new (std::nothrow) JoystickHandle();
-        if (!handle) {
-            HidD_FreePreparsedData(preparsedData);
-            CloseHandle(deviceHandle);
-            //------------------------------ debug start ------------------------------
-            // WriteToLog("Memory allocation failed for JoystickHandle.");
-            //------------------------------- debug end -------------------------------
-            return NULL; // Error: couldn't allocate memory for JoystickHandle
+        int index = FindDevice(snapshot, [&](const HidSnapshot& devices) {
+            return devices.FindBySerialNumber(vendorID, productID, serialNumber);
+        });
+        if (index < 0) {
+            return NULL; // Error: no device with this serial number
         }
-
-        handle->deviceHandle = deviceHandle;
-        handle->inputReportLength = caps.InputReportByteLength;
-        handle->oversizedReport = (caps.InputReportByteLength > BUTTONRAW_MAX_REPORT_SIZE);
-
-        //------------------------------ debug start ------------------------------
-        // Log the handle value
-        /*
-        std::stringstream ss;
-        ss << "Opened joystick with handle: " << handle->deviceHandle;
-        WriteToLog(ss.str().c_str());
-        LogDeviceCapabilities(deviceHandle);
-        if (handle->oversizedReport) {
-                std::stringstream ss;
-                ss << "Warning: Device reports " << caps.InputReportByteLength
-                        << " bytes, but only " << MAX_REPORT_SIZE << " bytes will be
-        processed"; WriteToLog(ss.str().c_str());
-        }
-        */
-        //------------------------------- debug end -------------------------------
-
-        return handle;
+        return OpenDevicePath(snapshot->devices[index].path);
     }
 
     //******************** ReadButtons ********************
     uint64_t ReadButtons(void* handle) {
-        JoystickHandle* joystickHandle = static_cast<JoystickHandle*>(handle);
+        HandleRef joystickHandle = g_handles.Acquire(handle);
         if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE) {
             //------------------------------ debug start ------------------------------
             // WriteToLog("Invalid handle in ReadButtons");
@@ -581,157 +1426,415 @@ extern "C" {
             return BUTTONRAW_ERROR_INVALID_HANDLE;
         }
 
-        // Determine buffer size
-        DWORD bufferSize = joystickHandle->inputReportLength;
-        if (bufferSize > BUTTONRAW_MAX_REPORT_SIZE) {
-            bufferSize = BUTTONRAW_MAX_REPORT_SIZE; // Truncate to 8 bytes
+        std::lock_guard<std::mutex> capture(joystickHandle->captureMutex);
+        uint64_t state = 0;
+        int status = WaitForButtons(joystickHandle, &state);
+        if (status < 0) {
+            return BUTTONRAW_ERROR_READ_FAILED;
+        }
+        return status > 0 ? state : BUTTONRAW_NO_NEW_DATA;
+    }
+
+    //******************** ReadButtonsEx ********************
+    int ReadButtonsEx(void* handle, ButtonRawState* state) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            state == nullptr) {
+            return -1;
         }
 
-        // First, flush old events
-        while (true) {
-            OVERLAPPED ol = { 0 };
-            ol.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-            if (!ol.hEvent) {
-                return BUTTONRAW_ERROR_READ_FAILED;
+        std::lock_guard<std::mutex> capture(joystickHandle->captureMutex);
+        uint64_t packed = 0;
+        int status = WaitForButtons(joystickHandle, &packed);
+        if (status < 0) {
+            return -2;
+        }
+
+        // Filled on timeouts too, from the last report
+        const BYTE* report = joystickHandle->lastReport;
+        DWORD reportBytes = joystickHandle->lastReportBytes;
+        state->words[0] = joystickHandle->edges.State();
+        for (DWORD w = 1; w < 4; w++) {
+            DWORD first = w * 8;
+            state->words[w] = first < reportBytes ? PackBytes(report + first, reportBytes - first) : 0;
+        }
+        state->reportBytes = reportBytes;
+        state->reserved = 0;
+        return status;
+    }
+
+    //******************** ReadButtonEvents ********************
+    int ReadButtonEvents(void* handle, ButtonRawEvent* events, int maxEvents) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            events == nullptr || maxEvents < 0) {
+            return -1;
+        }
+
+        // Pick up reports that arrived since the last call without waiting
+        int count = ReadSubscription(joystickHandle, joystickHandle->eventsReader, events, maxEvents);
+        return count < 0 ? -2 : count;
+    }
+
+    //******************** SubscribeButtonEvents ********************
+    int SubscribeButtonEvents(void* handle, uint64_t mask) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            mask == 0) {
+            return -1;
+        }
+        int subscription = joystickHandle->events.Subscribe(mask);
+        return subscription < 0 ? -2 : subscription; // -2: all subscriptions taken
+    }
+
+    //******************** ReadSubscribedButtonEvents ********************
+    int ReadSubscribedButtonEvents(void* handle, int subscription, ButtonRawEvent* events,
+        int maxEvents) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            subscription < 0 || subscription >= BUTTON_RING_MAX_CONSUMERS ||
+            subscription == joystickHandle->eventsReader || events == nullptr || maxEvents < 0) {
+            return -1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(joystickHandle->callbackMutex);
+            if (joystickHandle->callbackEntries[subscription] != 0) {
+                return -1; // Delivered to a SubscribeButtons callback
             }
+        }
+        int count = ReadSubscription(joystickHandle, subscription, events, maxEvents);
+        return count < 0 ? -2 : count;
+    }
 
-            std::vector<BYTE> buffer(bufferSize);
-            DWORD bytesRead = 0;
+    //******************** UnsubscribeButtonEvents ********************
+    int UnsubscribeButtonEvents(void* handle, int subscription) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || subscription < 0 || subscription >= BUTTON_RING_MAX_CONSUMERS ||
+            subscription == joystickHandle->eventsReader) {
+            return -1;
+        }
+        std::lock_guard<std::mutex> lock(joystickHandle->callbackMutex);
+        if (joystickHandle->callbackEntries[subscription] != 0 ||
+            !joystickHandle->events.Unsubscribe(subscription)) {
+            return -1; // Callback subscriptions end with UnsubscribeButtons
+        }
+        return 0;
+    }
 
-            if (!ReadFile(joystickHandle->deviceHandle, buffer.data(),
-                joystickHandle->inputReportLength, &bytesRead, &ol)) {
-                if (GetLastError() != ERROR_IO_PENDING) {
-                    CloseHandle(ol.hEvent);
-                    return BUTTONRAW_ERROR_READ_FAILED;
-                }
+    //******************** SubscribeButtons ********************
+    int SubscribeButtons(void* handle, ButtonRawCallback callback, void* userData, uint64_t mask) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            callback == nullptr || mask == 0) {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(joystickHandle->callbackMutex);
+        int subscription = joystickHandle->events.Subscribe(mask);
+        if (subscription < 0) {
+            return -2; // All subscriptions taken
+        }
+        joystickHandle->callbackEntries[subscription] = Dispatcher().Add([=] {
+            DispatchSubscription(handle, subscription, callback, userData);
+        });
+        Dispatcher().Start();
+        if (joystickHandle->callbackCount++ == 0) {
+            if (joystickHandle->captureThread.joinable()) {
+                joystickHandle->captureThread.join(); // Stopped by the last UnsubscribeButtons
             }
+            ResetEvent(joystickHandle->captureStopEvent);
+            JoystickHandle* record = joystickHandle;
+            joystickHandle->captureThread = std::thread([record] { RunCaptureThread(record); });
+        }
+        return subscription;
+    }
 
-            // Quick check for data (no real wait)
-            if (WaitForSingleObject(ol.hEvent, 0) != WAIT_OBJECT_0) {
-                CancelIo(joystickHandle->deviceHandle);
-                CloseHandle(ol.hEvent);
-                break; // No more old events
+    //******************** UnsubscribeButtons ********************
+    int UnsubscribeButtons(void* handle, int subscription) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || subscription < 0 || subscription >= BUTTON_RING_MAX_CONSUMERS) {
+            return -1;
+        }
+
+        int entry;
+        {
+            std::lock_guard<std::mutex> lock(joystickHandle->callbackMutex);
+            entry = joystickHandle->callbackEntries[subscription];
+            if (entry == 0) {
+                return -1;
             }
+            joystickHandle->callbackEntries[subscription] = 0;
+        }
+        // Waits for a running callback, unless called from one. Not under
+        // callbackMutex: that callback may be unsubscribing too.
+        Dispatcher().Remove(entry);
+        joystickHandle->events.Unsubscribe(subscription);
+        std::lock_guard<std::mutex> lock(joystickHandle->callbackMutex);
+        if (--joystickHandle->callbackCount == 0) {
+            SetEvent(joystickHandle->captureStopEvent); // Joined by the next SubscribeButtons or the close
+        }
+        return 0;
+    }
 
-            CloseHandle(ol.hEvent);
+    //******************** GetDispatchLatencyHistogram ********************
+    int GetDispatchLatencyHistogram(uint64_t* buckets, int bucketCount, int reset) {
+        if (buckets == nullptr || bucketCount < 0) {
+            return -1;
+        }
+        int copied = static_cast<int>(Dispatcher().Latency().Read(buckets, static_cast<size_t>(bucketCount)));
+        if (reset) {
+            Dispatcher().Latency().Reset();
         }
+        return copied;
+    }
 
-        // Now wait for a new event
-        // Set up overlapped structure for timeout support
-        OVERLAPPED ol = { 0 };
-        ol.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-        if (!ol.hEvent) {
-            //------------------------------ debug start ------------------------------
-            // WriteToLog("Failed to create event for overlapped I/O");
-            //------------------------------- debug end -------------------------------
-            return BUTTONRAW_ERROR_READ_FAILED;
+    //******************** SetButtonDebounce ********************
+    int SetButtonDebounce(void* handle, int button, int pressSamples, int releaseSamples) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE) {
+            return -1;
         }
 
-        std::vector<BYTE> buffer(bufferSize);
-        DWORD bytesRead = 0;
+        std::lock_guard<std::mutex> capture(joystickHandle->captureMutex);
+        if (button < 0) {
+            joystickHandle->debounce.SetAllThresholds(pressSamples, releaseSamples);
+        }
+        else if (!joystickHandle->debounce.SetThresholds(0, button, pressSamples,
+            releaseSamples)) {
+            return -2; // Button outside the packed report
+        }
 
-        // Start the read operation
-        if (!ReadFile(joystickHandle->deviceHandle, buffer.data(), bufferSize,
-            &bytesRead, &ol)) {
-            if (GetLastError() != ERROR_IO_PENDING) {
-                CloseHandle(ol.hEvent);
-                //------------------------------ debug start
-                //------------------------------ WriteToLog("ReadFile failed");
-                //------------------------------- debug end
-                //-------------------------------
-                return BUTTONRAW_ERROR_READ_FAILED;
+        if (!joystickHandle->debounceEnabled) {
+            joystickHandle->debounceEnabled = true;
+            // Start from the current state if reports were already captured
+            joystickHandle->debouncePrimed = joystickHandle->reportSequence > 0;
+            if (joystickHandle->debouncePrimed) {
+                joystickHandle->debounce.Reset(0, &joystickHandle->lastRawState);
             }
+        }
+        return 0;
+    }
 
-            // Wait for new data with timeout
-            if (WaitForSingleObject(ol.hEvent, 100) !=
-                WAIT_OBJECT_0) { // 100 ms timeout
-                CancelIo(joystickHandle->deviceHandle);
-                CloseHandle(ol.hEvent);
-                return BUTTONRAW_NO_NEW_DATA;
-            }
+    //******************** AddGesture ********************
+    int AddGesture(void* handle, int kind, uint64_t mask, int timeoutMs) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            timeoutMs <= 0) {
+            return -1;
+        }
+        std::lock_guard<std::mutex> capture(joystickHandle->captureMutex);
+        return joystickHandle->gestures.Add(kind, mask, static_cast<uint32_t>(timeoutMs));
+    }
+
+    //******************** ReadGestureEvents ********************
+    int ReadGestureEvents(void* handle, ButtonRawGestureEvent* events, int maxEvents) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            events == nullptr || maxEvents < 0) {
+            return -1;
+        }
+
+        // Pick up pending reports, then let hold and timeout timers catch up
+        std::lock_guard<std::mutex> capture(joystickHandle->captureMutex);
+        std::vector<BYTE> buffer(joystickHandle->inputReportLength);
+        if (!DrainPendingReports(joystickHandle, buffer)) {
+            return -2;
+        }
+        AdvanceGestures(joystickHandle, CaptureTimestamp());
 
-            // Get the results
-            if (!GetOverlappedResult(joystickHandle->deviceHandle, &ol, &bytesRead,
-                FALSE)) {
-                CloseHandle(ol.hEvent);
-                //------------------------------ debug start
-                //------------------------------ WriteToLog("Failed to get overlapped
-                // result");
-                //------------------------------- debug end
-                //-------------------------------
-                return BUTTONRAW_ERROR_READ_FAILED;
-                // pch.h: This is a precompiled header file.
-                // Files listed below are compiled only once, improving build performance for future builds.
-                // This also affects IntelliSense performance, including code completion and many code browsing features.
-                // However, files listed here are ALL re-compiled if any one of them is updated between builds.
-                // Do not add files here that you will be updating frequently as this negates the performance advantage.
-
-#ifndef PCH_H
-#define PCH_H
-
-// add headers that you want to pre-compile here
-#include "framework.h"
-
-#endif //PCH_H
-// pch.h: This is a precompiled header file.
-// Files listed below are compiled only once, improving build performance for future builds.
-// This also affects IntelliSense performance, including code completion and many code browsing features.
-// However, files listed here are ALL re-compiled if any one of them is updated between builds.
-// Do not add files here that you will be updating frequently as this negates the performance advantage.
-
-#ifndef PCH_H
-#define PCH_H
-
-// add headers that you want to pre-compile here
-#include "framework.h"
-
-#endif //PCH_H
+        return static_cast<int>(joystickHandle->gestureEvents.Pop(events, maxEvents));
+    }
+
+    //******************** CalibrateJoystick ********************
+    int CalibrateJoystick(void* handle, int durationMs) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            durationMs <= 0 || durationMs > BUTTONRAW_MAX_CALIBRATION_MS) {
+            return -1;
+        }
+
+        // Reports queued before calibration still belong to the normal stages
+        std::lock_guard<std::mutex> capture(joystickHandle->captureMutex);
+        std::vector<BYTE> buffer(joystickHandle->inputReportLength);
+        if (!DrainPendingReports(joystickHandle, buffer)) {
+            return -2;
+        }
+
+        ProfileLearner learner;
+        ULONGLONG deadline = GetTickCount64() + static_cast<ULONGLONG>(durationMs);
+        for (ULONGLONG now = GetTickCount64(); now < deadline; now = GetTickCount64()) {
+            DWORD bytesRead = 0;
+            int status = ReadReport(joystickHandle, buffer.data(),
+                joystickHandle->inputReportLength, static_cast<DWORD>(deadline - now),
+                &bytesRead);
+            if (status < 0) {
+                return -2;
+            }
+            if (status > 0) {
+                // Learn from every byte the library can pack, ignoring the current profile
+                learner.Add(PackBytes(buffer.data(), bytesRead));
             }
         }
+        if (learner.Samples() == 0) {
+            return -3; // No reports; event-based devices need buttons pressed
+        }
+        if (learner.ActiveMask() == 0) {
+            return 0; // Nothing changed; keep the current profile
+        }
 
-        CloseHandle(ol.hEvent);
+        ButtonProfile profile = joystickHandle->profile;
+        profile.baseline = learner.Baseline();
+        profile.activeMask = learner.ActiveMask();
+        profile.samples = learner.Samples();
+        ApplyProfile(joystickHandle, profile);
+        {
+            std::lock_guard<std::mutex> lock(g_profilesMutex);
+            g_profiles.Put(profile);
+        }
 
-        //------------------------------ debug start ------------------------------
-        // Log the raw data
-        /*
-        std::stringstream ss;
-        ss << "Raw data (" << bytesRead << " bytes): ";
-        for (DWORD i = 0; i < bytesRead; i++) {
-                ss << std::hex << std::setfill('0') << std::setw(2)
-                        << static_cast<int>(buffer[i]) << " ";
-        }
-        WriteToLog(ss.str().c_str());
-        */
-        //------------------------------- debug end -------------------------------
+        // Calibration presses are not button events; restart the stages from idle
+        joystickHandle->edges.Reset();
+        joystickHandle->debouncePrimed = false;
+        return CountBits64(profile.activeMask);
+    }
 
-        // Pack the bytes into uint64_t
-        uint64_t result = 0;
-        for (DWORD i = 0; i < bytesRead; i++) {
-            result |= (static_cast<uint64_t>(buffer[i]) << (i * 8));
+    //******************** GetJoystickProfile ********************
+    int GetJoystickProfile(void* handle, char* buffer, int bufferSize) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE ||
+            buffer == nullptr || bufferSize <= 0) {
+            return -1;
         }
-        //------------------------------ debug start ------------------------------
-        // Log the full state
-        /*
-        ss.str("");
-        ss << "Button states (64-bit): 0x" << std::hex << std::setfill('0')
-                << std::setw(16) << result;
-        WriteToLog(ss.str().c_str());
-        */
-        //------------------------------- debug end -------------------------------
 
-        return result;
+        ButtonProfile profile;
+        {
+            std::lock_guard<std::mutex> lock(joystickHandle->profileMutex);
+            profile = joystickHandle->profile;
+        }
+        std::string result = ProfileToJson(profile).dump();
+        if (result.length() >= static_cast<size_t>(bufferSize)) {
+            return -3; // Buffer too small
+        }
+
+        strncpy_s(buffer, bufferSize, result.c_str(), _TRUNCATE);
+        return 0;
+    }
+
+    //******************** CompactButtonState ********************
+    uint64_t CompactButtonState(void* handle, uint64_t state) {
+        HandleRef joystickHandle = g_handles.Acquire(handle);
+        if (!joystickHandle || joystickHandle->deviceHandle == INVALID_HANDLE_VALUE) {
+            return BUTTONRAW_ERROR_INVALID_HANDLE;
+        }
+        if (IS_BUTTONRAW_ERROR(state)) {
+            return state;
+        }
+        uint64_t activeMask;
+        {
+            std::lock_guard<std::mutex> lock(joystickHandle->profileMutex);
+            activeMask = joystickHandle->profile.activeMask;
+        }
+        return ExtractBits(state, activeMask & ~BUTTONRAW_ERROR_BIT);
+    }
+
+    //******************** SaveJoystickProfiles ********************
+    int SaveJoystickProfiles(const char* path) {
+        if (path == nullptr) {
+            return -1;
+        }
+
+        std::string text;
+        {
+            std::lock_guard<std::mutex> lock(g_profilesMutex);
+            text = g_profiles.ToJson();
+        }
+
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            return -2;
+        }
+        file << text;
+        return file.good() ? 0 : -2;
+    }
+
+    //******************** LoadJoystickProfiles ********************
+    int LoadJoystickProfiles(const char* path) {
+        if (path == nullptr) {
+            return -1;
+        }
+
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            return -2;
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+
+        std::lock_guard<std::mutex> lock(g_profilesMutex);
+        int loaded = g_profiles.FromJson(text.str());
+        return loaded < 0 ? -3 : loaded;
+    }
+
+    //******************** SaveDeviceCache ********************
+    int SaveDeviceCache(const char* path) {
+        if (path == nullptr) {
+            return -1;
+        }
+
+        std::shared_ptr<const HidSnapshot> snapshot = GetDeviceSnapshot(HidFieldAll);
+        if (!snapshot) {
+            return -3;
+        }
+        std::string data = SaveHidDeviceRecords(snapshot->devices);
+
+        std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!file.is_open()) {
+            return -2;
+        }
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return file.good() ? 0 : -2;
+    }
+
+    //******************** LoadDeviceCache ********************
+    int LoadDeviceCache(const char* path) {
+        if (path == nullptr) {
+            return -1;
+        }
+
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            return -2;
+        }
+        std::stringstream data;
+        data << file.rdbuf();
+
+        std::vector<HidDeviceRecord> records;
+        if (!LoadHidDeviceRecords(data.str(), records)) {
+            return -3;
+        }
+        int loaded = static_cast<int>(records.size());
+        g_deviceCache.Seed(records);
+        return loaded;
+    }
+
+    //******************** ShutdownButtonController ********************
+    int ShutdownButtonController(void) {
+        if (Dispatcher().OnDispatcherThread()) {
+            return -1; // Cannot join the thread running the callback
+        }
+        UnregisterDeviceNotification();
+        size_t hung = g_deviceCache.Shutdown();
+        Dispatcher().Stop();
+        return hung == 0 ? 0 : -2;
     }
 
     //******************** CloseJoystick ********************
     int CloseJoystick(void* handle) {
-        JoystickHandle* joystickHandle = static_cast<JoystickHandle*>(handle);
-        if (joystickHandle && joystickHandle->deviceHandle != INVALID_HANDLE_VALUE) {
+        // Safe while other threads still read; the last of them closes the
+        // device when its call returns
+        if (g_handles.Destroy(handle)) {
             //------------------------------ debug start ------------------------------
             // WriteToLog("Closing joystick handle.");
-            //------------------------------- debug end -------------------------------
-            CloseHandle(joystickHandle->deviceHandle);
-            delete joystickHandle;
-            //------------------------------ debug start ------------------------------
             // CloseLog();
             //------------------------------- debug end -------------------------------
             return 0;
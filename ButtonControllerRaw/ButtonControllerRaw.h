@@ -19,12 +19,201 @@ extern "C" {
 // Helper macro to check for errors
 #define IS_BUTTONRAW_ERROR(x) ((x) & BUTTONRAW_ERROR_BIT)
 
+// Largest report ReadButtonsEx returns in full
+#define BUTTONRAW_MAX_WIDE_REPORT_SIZE 32
+
+// Report as 256 bits, byte i in bits (i % 8) * 8 of words[i / 8].
+// words[0] is the decoded state ReadButtons returns, with bit 63 a regular bit;
+// words[1]-words[3] are report bytes 8-31 as received.
+typedef struct ButtonRawState {
+    uint64_t words[4];
+    uint32_t reportBytes; // Bytes of the last report, up to 32
+    uint32_t reserved;
+} ButtonRawState;
+
+// Number of button events buffered per handle; a reader that falls further
+// behind loses the oldest
+#define BUTTONRAW_EVENT_QUEUE_SIZE 256
+
+// SubscribeButtonEvents subscriptions per handle
+#define BUTTONRAW_MAX_SUBSCRIPTIONS 63
+
+// Event flags
+#define BUTTONRAW_EVENT_LOST 0x01 // Events were lost before this one; the reader fell too far behind
+
+// Press/release transition of a single bit in the packed report
+typedef struct ButtonRawEvent {
+    uint64_t timestamp; // Capture time in microseconds (QueryPerformanceCounter)
+    uint32_t sequence;  // Sample number; events from the same report share it
+    uint16_t button;    // Bit index in the packed report (0-62)
+    uint8_t pressed;    // 1 = bit went high, 0 = bit went low
+    uint8_t flags;      // BUTTONRAW_EVENT_*
+} ButtonRawEvent;
+
+// Called by SubscribeButtons on the library's dispatcher thread with a
+// batch of events; events is only valid during the call
+typedef void (*ButtonRawCallback)(void* handle, const ButtonRawEvent* events, int count, void* userData);
+
+// Most events passed to one callback; longer bursts take several calls
+#define BUTTONRAW_CALLBACK_BATCH 64
+// Wait of the capture thread before it retries a failed read, in ms
+#define BUTTONRAW_CAPTURE_SLICE_MS 10
+// Buckets of GetDispatchLatencyHistogram: bucket 0 counts latencies under
+// 1 us, bucket i those from 2^(i-1) up to 2^i us, the last everything longer
+#define BUTTONRAW_LATENCY_BUCKETS 32
+// Longest CalibrateJoystick window, in ms. Reads of the handle (and its
+// capture thread) wait for the calibration to end.
+#define BUTTONRAW_MAX_CALIBRATION_MS 10000
+
+// Gesture kinds for AddGesture
+#define BUTTONRAW_GESTURE_CHORD        1 // All mask buttons pressed within timeoutMs of the first
+#define BUTTONRAW_GESTURE_LONG_PRESS   2 // All mask buttons held for timeoutMs
+#define BUTTONRAW_GESTURE_DOUBLE_PRESS 3 // Mask pressed, released and pressed again within timeoutMs
+
+// Number of gesture events buffered per handle before the oldest are dropped
+#define BUTTONRAW_GESTURE_QUEUE_SIZE 64
+
+// Completed gesture
+typedef struct ButtonRawGestureEvent {
+    uint64_t timestamp; // Completion time in microseconds (same clock as ButtonRawEvent)
+    int32_t gestureId;  // Value returned by AddGesture
+    uint32_t reserved;
+} ButtonRawGestureEvent;
+
+// Field groups for GetHIDDeviceListEx. Each group costs extra queries per device.
+#define BUTTONRAW_FIELD_PATH          0x01 // path (no open needed)
+#define BUTTONRAW_FIELD_ATTRIBUTES    0x02 // vendorID, productID, versionNumber
+#define BUTTONRAW_FIELD_PRODUCT       0x04 // product string
+#define BUTTONRAW_FIELD_MANUFACTURER  0x08 // manufacturer string
+#define BUTTONRAW_FIELD_SERIAL_NUMBER 0x10 // serialNumber string
+#define BUTTONRAW_FIELD_CAPS          0x20 // usage, usagePage, report lengths and cap counts
+#define BUTTONRAW_FIELD_AXES          0x40 // axesTotal, povTotal
+#define BUTTONRAW_FIELD_BUTTONS       0x80 // buttonsTotal
+#define BUTTONRAW_FIELD_ALL           0xFF
+
+// Device change kinds for ReadDeviceChangeEvents
+#define BUTTONRAW_DEVICE_ARRIVAL 1
+#define BUTTONRAW_DEVICE_REMOVAL 2
+
+// Longest device path returned in a ButtonRawDeviceChange, including the terminator
+#define BUTTONRAW_MAX_PATH_SIZE 260
+
+// HID interface that arrived or went away
+typedef struct ButtonRawDeviceChange {
+    uint64_t generation;    // Device list generation that first reflects the change
+    int32_t kind;           // BUTTONRAW_DEVICE_ARRIVAL or BUTTONRAW_DEVICE_REMOVAL
+    int32_t joystickId;     // Index in that generation (arrival) or the one before (removal)
+    uint16_t vendorID;      // 0 if the attributes could not be read
+    uint16_t productID;
+    uint16_t versionNumber;
+    uint16_t reserved;
+    char path[BUTTONRAW_MAX_PATH_SIZE];
+} ButtonRawDeviceChange;
+
+// Longest string in a ButtonRawDeviceInfo, including the terminator
+#define BUTTONRAW_MAX_STRING_SIZE 256
+
+// ButtonRawDeviceInfo flags
+#define BUTTONRAW_INFO_OPENED         0x01 // The interface could be opened for probing
+#define BUTTONRAW_INFO_HAS_ATTRIBUTES 0x02 // vendorID, productID and versionNumber are valid
+#define BUTTONRAW_INFO_HAS_CAPS       0x04 // usage, usagePage, report lengths and cap counts are valid
+#define BUTTONRAW_INFO_INCOMPLETE     0x08 // Still being probed, see SetDeviceProbeTimeout
+
+// One GetHIDDeviceList entry as a fixed-layout struct. Strings are UTF-8,
+// truncated at a character boundary if they do not fit.
+typedef struct ButtonRawDeviceInfo {
+    int32_t index;
+    uint32_t flags;               // BUTTONRAW_INFO_* bits
+    uint16_t vendorID;
+    uint16_t productID;
+    uint16_t versionNumber;
+    uint16_t usage;
+    uint16_t usagePage;
+    uint16_t inputReportByteLength;
+    uint16_t outputReportByteLength;
+    uint16_t featureReportByteLength;
+    uint16_t numberOfLinkCollectionNodes;
+    uint16_t numberOfInputButtonCaps;
+    uint16_t numberOfInputValueCaps;
+    uint16_t numberOfInputDataIndices;
+    uint16_t numberOfOutputButtonCaps;
+    uint16_t numberOfOutputValueCaps;
+    uint16_t numberOfOutputDataIndices;
+    uint16_t numberOfFeatureButtonCaps;
+    uint16_t numberOfFeatureValueCaps;
+    uint16_t numberOfFeatureDataIndices;
+    int32_t axesTotal;
+    int32_t buttonsTotal;
+    int32_t povTotal;
+    char path[BUTTONRAW_MAX_PATH_SIZE]; // Empty if the interface could not be opened
+    char product[BUTTONRAW_MAX_STRING_SIZE];
+    char manufacturer[BUTTONRAW_MAX_STRING_SIZE];
+    char serialNumber[BUTTONRAW_MAX_STRING_SIZE];
+} ButtonRawDeviceInfo;
+
+// Lookup kinds for ResolveDevices
+#define BUTTONRAW_QUERY_VID_PID       1 // vendorID, productID
+#define BUTTONRAW_QUERY_VID_PID_USAGE 2 // vendorID, productID, usagePage, usage
+#define BUTTONRAW_QUERY_PRODUCT       3 // text is the product string
+#define BUTTONRAW_QUERY_SERIAL        4 // vendorID, productID, text is the serial number
+
+// One ResolveDevices lookup
+typedef struct ButtonRawDeviceQuery {
+    int32_t kind;         // BUTTONRAW_QUERY_*
+    uint16_t vendorID;
+    uint16_t productID;
+    uint16_t usagePage;
+    uint16_t usage;
+    const char* text;     // Product string or serial number, surrounding whitespace ignored
+} ButtonRawDeviceQuery;
+
+// Result of one ResolveDevices lookup
+typedef struct ButtonRawDeviceMatch {
+    int32_t joystickId;   // Device index, or -1 if nothing matched
+    uint32_t reserved;
+    char path[BUTTONRAW_MAX_PATH_SIZE]; // For OpenJoystickByPath; empty if nothing matched
+} ButtonRawDeviceMatch;
+
+// Formats for GetHIDDeviceListBinary
+#define BUTTONRAW_FORMAT_CBOR    1
+#define BUTTONRAW_FORMAT_MSGPACK 2
+
 __declspec(dllexport) int FindJoystickByVendorAndProductID(unsigned short vendorID, unsigned short productID);
 __declspec(dllexport) int FindJoystickByProductString(const char* name);
+__declspec(dllexport) int FindJoystickPathByVendorAndProductID(unsigned short vendorID, unsigned short productID, char* path, int pathSize);
+__declspec(dllexport) int FindJoystickPathByProductString(const char* name, char* path, int pathSize);
+__declspec(dllexport) int ResolveDevices(const ButtonRawDeviceQuery* queries, int count, ButtonRawDeviceMatch* results);
 __declspec(dllexport) void* OpenJoystick(int joystickId);
+__declspec(dllexport) void* OpenJoystickByPath(const char* path);
+__declspec(dllexport) void* OpenJoystickBySerial(unsigned short vendorID, unsigned short productID, const char* serialNumber);
 __declspec(dllexport) uint64_t ReadButtons(void* handle);
+__declspec(dllexport) int ReadButtonsEx(void* handle, ButtonRawState* state);
+__declspec(dllexport) int ReadButtonEvents(void* handle, ButtonRawEvent* events, int maxEvents);
+__declspec(dllexport) int SubscribeButtonEvents(void* handle, uint64_t mask);
+__declspec(dllexport) int ReadSubscribedButtonEvents(void* handle, int subscription, ButtonRawEvent* events, int maxEvents);
+__declspec(dllexport) int UnsubscribeButtonEvents(void* handle, int subscription);
+__declspec(dllexport) int SubscribeButtons(void* handle, ButtonRawCallback callback, void* userData, uint64_t mask);
+__declspec(dllexport) int UnsubscribeButtons(void* handle, int subscription);
+__declspec(dllexport) int GetDispatchLatencyHistogram(uint64_t* buckets, int bucketCount, int reset);
+__declspec(dllexport) int SetButtonDebounce(void* handle, int button, int pressSamples, int releaseSamples);
+__declspec(dllexport) int AddGesture(void* handle, int kind, uint64_t mask, int timeoutMs);
+__declspec(dllexport) int ReadGestureEvents(void* handle, ButtonRawGestureEvent* events, int maxEvents);
+__declspec(dllexport) int CalibrateJoystick(void* handle, int durationMs);
+__declspec(dllexport) int GetJoystickProfile(void* handle, char* buffer, int bufferSize);
+__declspec(dllexport) uint64_t CompactButtonState(void* handle, uint64_t state);
+__declspec(dllexport) int SaveJoystickProfiles(const char* path);
+__declspec(dllexport) int LoadJoystickProfiles(const char* path);
+__declspec(dllexport) int SaveDeviceCache(const char* path);
+__declspec(dllexport) int LoadDeviceCache(const char* path);
 __declspec(dllexport) int CloseJoystick(void* handle);
+__declspec(dllexport) int ShutdownButtonController(void);
 __declspec(dllexport) int GetHIDDeviceList(char* buffer, int bufferSize);
+__declspec(dllexport) int GetHIDDeviceListEx(char* buffer, int bufferSize, uint32_t fields);
+__declspec(dllexport) int GetHIDDeviceInfo(ButtonRawDeviceInfo* devices, int capacity, int* count);
+__declspec(dllexport) int GetHIDDeviceListBinary(char* buffer, int bufferSize, uint32_t fields, int format);
+__declspec(dllexport) uint64_t GetDeviceListGeneration(void);
+__declspec(dllexport) int ReadDeviceChangeEvents(ButtonRawDeviceChange* events, int maxEvents);
+__declspec(dllexport) int SetDeviceProbeTimeout(int timeoutMs);
 //------------------------------ debug start ------------------------------
 void InitializeLog(const char* logFilePath);
 void CloseLog();
@@ -0,0 +1,146 @@
+#include <windows.h>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ButtonControllerRaw.h"
+#include "ButtonControllerRawChecks.h"
+#include "../Common/HidDeviceInfo.h"
+
+static int g_failures = 0;
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cout << "  FAILED: " << what << "\n";
+    g_failures++;
+  }
+}
+
+// A null pointer and a pointer the library never handed out
+static void checkRejectedHandle(void *handle) {
+  ButtonRawState state;
+  ButtonRawEvent events[4];
+  char text[64];
+  check(ReadButtons(handle) == BUTTONRAW_ERROR_INVALID_HANDLE, "ReadButtons rejects the handle");
+  check(ReadButtonsEx(handle, &state) == -1, "ReadButtonsEx rejects the handle");
+  check(ReadButtonEvents(handle, events, 4) == -1, "ReadButtonEvents rejects the handle");
+  check(SubscribeButtonEvents(handle, 1) == -1, "SubscribeButtonEvents rejects the handle");
+  check(ReadSubscribedButtonEvents(handle, 1, events, 4) == -1,
+        "ReadSubscribedButtonEvents rejects the handle");
+  check(UnsubscribeButtonEvents(handle, 1) == -1, "UnsubscribeButtonEvents rejects the handle");
+  check(UnsubscribeButtons(handle, 1) == -1, "UnsubscribeButtons rejects the handle");
+  check(GetJoystickProfile(handle, text, sizeof(text)) == -1, "GetJoystickProfile rejects the handle");
+  check(CompactButtonState(handle, 1) == BUTTONRAW_ERROR_INVALID_HANDLE,
+        "CompactButtonState rejects the handle");
+  check(CloseJoystick(handle) == -1, "CloseJoystick rejects the handle");
+}
+
+static void checkHandles() {
+  std::cout << "Handle validation\n";
+  checkRejectedHandle(nullptr);
+  uint64_t notAHandle[4] = {};
+  checkRejectedHandle(notAHandle);
+}
+
+static void checkLatencyHistogram() {
+  std::cout << "Dispatch latency histogram\n";
+  uint64_t buckets[BUTTONRAW_LATENCY_BUCKETS + 8];
+  check(GetDispatchLatencyHistogram(nullptr, 4, 0) == -1, "a null buffer is rejected");
+  check(GetDispatchLatencyHistogram(buckets, -1, 0) == -1, "a negative count is rejected");
+  check(GetDispatchLatencyHistogram(buckets, 4, 0) == 4, "a short buffer gets what fits");
+  check(GetDispatchLatencyHistogram(buckets, BUTTONRAW_LATENCY_BUCKETS + 8, 1) ==
+            BUTTONRAW_LATENCY_BUCKETS,
+        "a long buffer gets every bucket");
+}
+
+// The Common headers use their own names for the values the export header
+// publishes
+static void checkSharedConstants() {
+  std::cout << "Shared constants\n";
+  check(HidFieldPath == BUTTONRAW_FIELD_PATH && HidFieldAttributes == BUTTONRAW_FIELD_ATTRIBUTES &&
+            HidFieldProduct == BUTTONRAW_FIELD_PRODUCT &&
+            HidFieldManufacturer == BUTTONRAW_FIELD_MANUFACTURER &&
+            HidFieldSerialNumber == BUTTONRAW_FIELD_SERIAL_NUMBER && HidFieldCaps == BUTTONRAW_FIELD_CAPS &&
+            HidFieldAxes == BUTTONRAW_FIELD_AXES && HidFieldButtons == BUTTONRAW_FIELD_BUTTONS &&
+            HidFieldAll == BUTTONRAW_FIELD_ALL,
+        "field bits match BUTTONRAW_FIELD_*");
+  check(HidInfoOpened == BUTTONRAW_INFO_OPENED && HidInfoHasAttributes == BUTTONRAW_INFO_HAS_ATTRIBUTES &&
+            HidInfoHasCaps == BUTTONRAW_INFO_HAS_CAPS && HidInfoIncomplete == BUTTONRAW_INFO_INCOMPLETE,
+        "info flags match BUTTONRAW_INFO_*");
+}
+
+static void checkDeviceInfoFill() {
+  std::cout << "Device info records\n";
+  HidDeviceRecord record;
+  record.path = "\\\\?\\hid#vid_0fc5&pid_b080#0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030}";
+  record.opened = true;
+  record.hasAttributes = true;
+  record.vendorID = 0x0fc5;
+  record.productID = 0xb080;
+  record.hasCaps = true;
+  record.usagePage = 0x01;
+  record.buttonsTotal = 3;
+
+  ButtonRawDeviceInfo info;
+  FillHidDeviceInfo(record, 2, info);
+  check(info.index == 2, "the index is copied");
+  check(info.flags == (BUTTONRAW_INFO_OPENED | BUTTONRAW_INFO_HAS_ATTRIBUTES | BUTTONRAW_INFO_HAS_CAPS),
+        "an opened interface has IDs and caps");
+  check(info.vendorID == 0x0fc5 && info.productID == 0xb080, "the IDs are copied");
+  check(info.usagePage == 0x01 && info.buttonsTotal == 3, "the caps are copied");
+  check(record.path == info.path, "the path is copied");
+
+  // Interfaces that could not be opened have no path and no IDs
+  record.opened = false;
+  record.hasAttributes = false;
+  record.hasCaps = false;
+  record.incomplete = true;
+  FillHidDeviceInfo(record, 3, info);
+  check(info.flags == BUTTONRAW_INFO_INCOMPLETE, "an unopened interface has only the incomplete flag");
+  check(info.vendorID == 0 && info.path[0] == '\0', "an unopened interface has no IDs or path");
+
+  // Truncation keeps whole UTF-8 characters
+  record.product = std::string(BUTTONRAW_MAX_STRING_SIZE - 2, 'x') + "\xc3\xa9";
+  FillHidDeviceInfo(record, 0, info);
+  check(std::string(info.product) == std::string(BUTTONRAW_MAX_STRING_SIZE - 2, 'x'),
+        "a long product string is cut before a split character");
+}
+
+// Needs no particular device, only whatever HID interfaces the machine has
+static void checkDeviceListSizing() {
+  std::cout << "Device list sizing\n";
+  int required = GetHIDDeviceListEx(nullptr, 0, BUTTONRAW_FIELD_PATH);
+  check(required > 0, "the size query succeeds");
+  if (required <= 0) {
+    return;
+  }
+  std::vector<char> buffer(required + 64, '#');
+  check(GetHIDDeviceListEx(buffer.data(), 1, BUTTONRAW_FIELD_PATH) == -3, "a short buffer is refused");
+  int result = GetHIDDeviceListEx(buffer.data(), static_cast<int>(buffer.size()), BUTTONRAW_FIELD_PATH);
+  check(result == 0, "the list fits the queried size");
+  check(result != 0 || buffer[0] == '[', "the list is a JSON array");
+
+  // No room for any record: -3 with the total, unless there are none
+  int count = -1;
+  int infoResult = GetHIDDeviceInfo(nullptr, 0, &count);
+  check((infoResult == 0 && count == 0) || (infoResult == -3 && count > 0),
+        "GetHIDDeviceInfo reports the count");
+  check(GetHIDDeviceInfo(nullptr, 0, nullptr) == -1, "GetHIDDeviceInfo needs a count");
+
+  // Everything is set up again by the next call
+  check(ShutdownButtonController() == 0, "ShutdownButtonController succeeds");
+  check(GetHIDDeviceListEx(nullptr, 0, BUTTONRAW_FIELD_PATH) > 0, "the list works after a shutdown");
+}
+
+int runChecks() {
+  std::cout << "Button Controller Checks\n";
+  std::cout << "========================\n";
+  g_failures = 0;
+  checkHandles();
+  checkLatencyHistogram();
+  checkSharedConstants();
+  checkDeviceInfoFill();
+  checkDeviceListSizing();
+  std::cout << (g_failures == 0 ? "All checks passed\n" : "Some checks failed\n");
+  return g_failures;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Checks of the ButtonControllerRaw exports that need no button controller:
+// argument and handle validation, and the layout shared with the Common
+// headers. Run with "ButtonControllerRawTest --check"; returns the number of
+// failed checks.
+int runChecks();
@@ -3,7 +3,9 @@
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <stdint.h>
+#include <string.h>
 #include "ButtonControllerRaw.h"
+#include "ButtonControllerRawChecks.h"
 
 using json = nlohmann::json;
 
@@ -60,35 +62,34 @@ const char *getErrorMessage(int error) {
   }
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+  // Checks that need no button controller
+  if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+    return runChecks() == 0 ? 0 : 1;
+  }
+
   std::cout << "Button Controller Test\n";
   std::cout << "=====================\n\n";
 
-  // Try with progressively larger buffer sizes
-  const int BUFFER_SIZES[] = {16384, 32768, 65536, 131072};
+  // Ask for the required size, then fill a buffer of exactly that size. A
+  // device arriving between the two calls can still make it too small.
   char *buffer = nullptr;
   int result = -3; // Initialize to buffer too small
 
-  for (int bufferSize : BUFFER_SIZES) {
-    buffer = new char[bufferSize];
-    if (!buffer) {
-      std::cout << "Failed to allocate buffer of size " << bufferSize
-                << std::endl;
-      continue;
+  for (int attempt = 0; attempt < 3 && result == -3; attempt++) {
+    int bufferSize = GetHIDDeviceList(nullptr, 0);
+    if (bufferSize < 0) {
+      result = bufferSize;
+      break;
     }
+    std::cout << "Device list needs " << bufferSize << " bytes\n";
 
-    std::cout << "Trying with buffer size: " << bufferSize << " bytes..."
-              << std::endl;
+    delete[] buffer;
+    buffer = new char[bufferSize];
     result = GetHIDDeviceList(buffer, bufferSize);
-
-    if (result == 0) {
-      std::cout << "Success with buffer size: " << bufferSize << " bytes\n";
-      break;
-    } else {
+    if (result != 0) {
       std::cout << "Failed with error: " << getErrorMessage(result)
                 << std::endl;
-      delete[] buffer;
-      buffer = nullptr;
     }
   }
 
@@ -110,7 +111,8 @@ int main() {
     }
     delete[] buffer;
   } else {
-    std::cout << "Failed to list HID devices with all buffer sizes.\n";
+    delete[] buffer;
+    std::cout << "Failed to list HID devices.\n";
     std::cout << "Last error: " << getErrorMessage(result) << std::endl;
     return 1;
   }
@@ -143,8 +145,18 @@ int main() {
     std::cout << "Joystick not found by vendor and product ID." << std::endl;
   }
 
+  // Resolve the device path, which stays valid if other devices come and go
+  char devicePath[BUTTONRAW_MAX_PATH_SIZE];
+  if (FindJoystickPathByVendorAndProductID(vendorID, productID, devicePath,
+                                           sizeof(devicePath)) != 0) {
+    std::cout << "Joystick path not found by vendor and product ID."
+              << std::endl;
+    return 1;
+  }
+  std::cout << "Joystick path: " << devicePath << std::endl;
+
   // Open and read from joystick
-  void *joystickHandle = OpenJoystick(joystickId);
+  void *joystickHandle = OpenJoystickByPath(devicePath);
   if (joystickHandle) {
     std::cout << "Successfully opened joystick." << std::endl;
 
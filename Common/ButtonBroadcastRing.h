@@ -0,0 +1,223 @@
+#pragma once
+
+// One event stream read by several consumers, each at its own pace.
+//
+// An EventQueue has one read position, so whoever pops first takes the
+// events away from everyone else. ButtonBroadcastRing keeps a cursor per
+// consumer instead: the producer writes each event once into a ring, and
+// every consumer reads forward from its own cursor without a lock and
+// without taking anything from the others. Consumers subscribe with a
+// mask of buttons; the producer looks up who wants the event's button when
+// it publishes and stores that set with the event, and events nobody wants
+// are not written at all.
+//
+// The producer never waits for a consumer. A consumer that falls more than
+// Capacity events behind skips ahead to the oldest event still in the ring
+// and is told how many it lost. Slots are guarded by a sequence stamp, so a
+// read that races a write of the same slot is detected and counted as lost
+// rather than returning a torn event.
+//
+// Publish must be called from one thread at a time (the capture path),
+// Read for a given consumer from one thread at a time. Subscribe and
+// Unsubscribe may be called from any thread.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+
+// Consumers per ring; each has a bit in the subscriber set of an event
+#define BUTTON_RING_MAX_CONSUMERS 64
+// Buttons a consumer mask can select, button i in bit i
+#define BUTTON_RING_MAX_BUTTONS 64
+#define BUTTON_RING_CACHE_LINE 64
+
+template <typename Event, size_t Capacity>
+class ButtonBroadcastRing {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+		"ButtonBroadcastRing capacity must be a power of two");
+	static_assert(std::is_trivially_copyable<Event>::value,
+		"ButtonBroadcastRing events are copied as words");
+
+public:
+	ButtonBroadcastRing() = default;
+	ButtonBroadcastRing(const ButtonBroadcastRing&) = delete;
+	ButtonBroadcastRing& operator=(const ButtonBroadcastRing&) = delete;
+
+	// Adds a consumer for the buttons in mask and returns its id, or -1 when
+	// the mask is empty or all consumers are taken. The consumer sees events
+	// published from now on.
+	int Subscribe(uint64_t mask) {
+		if (mask == 0) {
+			return -1;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (int id = 0; id < BUTTON_RING_MAX_CONSUMERS; id++) {
+			Consumer& consumer = m_consumers[id];
+			if (consumer.active) {
+				continue;
+			}
+			consumer.active = true;
+			consumer.mask.store(mask, std::memory_order_relaxed);
+			consumer.cursor.store(m_published.load(std::memory_order_acquire), std::memory_order_relaxed);
+			consumer.lost.store(0, std::memory_order_relaxed);
+			consumer.unreported = 0;
+			for (int button = 0; button < BUTTON_RING_MAX_BUTTONS; button++) {
+				if ((mask >> button) & 1ULL) {
+					m_wanted[button].fetch_or(1ULL << id, std::memory_order_release);
+				}
+			}
+			return id;
+		}
+		return -1;
+	}
+
+	bool Unsubscribe(int id) {
+		if (id < 0 || id >= BUTTON_RING_MAX_CONSUMERS) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Consumer& consumer = m_consumers[id];
+		if (!consumer.active) {
+			return false;
+		}
+		for (auto& wanted : m_wanted) {
+			wanted.fetch_and(~(1ULL << id), std::memory_order_release);
+		}
+		consumer.mask.store(0, std::memory_order_relaxed);
+		consumer.active = false;
+		return true;
+	}
+
+	// Writes an event for the consumers whose mask has button. Returns false
+	// (and writes nothing) if no consumer wants it.
+	bool Publish(const Event& event, int button) {
+		uint64_t subscribers = button >= 0 && button < BUTTON_RING_MAX_BUTTONS ?
+			m_wanted[button].load(std::memory_order_acquire) : 0;
+		if (subscribers == 0) {
+			m_filtered.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		uint64_t position = m_published.load(std::memory_order_relaxed);
+		Slot& slot = m_slots[position & (Capacity - 1)];
+		slot.stamp.store(2 * position + 1, std::memory_order_relaxed); // Odd while writing
+		std::atomic_thread_fence(std::memory_order_release);
+		uint64_t words[EventWords] = {};
+		memcpy(words, &event, sizeof(Event));
+		for (size_t i = 0; i < EventWords; i++) {
+			slot.words[i].store(words[i], std::memory_order_relaxed);
+		}
+		slot.subscribers.store(subscribers, std::memory_order_relaxed);
+		slot.button.store(static_cast<uint32_t>(button), std::memory_order_relaxed);
+		slot.stamp.store(2 * position + 2, std::memory_order_release);
+		m_published.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Copies up to maxEvents events for consumer id, oldest first, and moves
+	// its cursor past them. Returns the number copied; 0 for an unknown id.
+	// Events lost by falling behind are reported with the next events read:
+	// *lost, if given, receives how many were lost before them (0 when
+	// nothing was copied).
+	size_t Read(int id, Event* out, size_t maxEvents, uint64_t* lost = nullptr) {
+		if (id < 0 || id >= BUTTON_RING_MAX_CONSUMERS) {
+			return 0;
+		}
+		Consumer& consumer = m_consumers[id];
+		uint64_t mask = consumer.mask.load(std::memory_order_relaxed);
+		uint64_t cursor = consumer.cursor.load(std::memory_order_relaxed);
+		uint64_t missed = 0;
+		size_t count = 0;
+		while (count < maxEvents) {
+			uint64_t published = m_published.load(std::memory_order_acquire);
+			if (cursor == published) {
+				break;
+			}
+			if (published - cursor > Capacity) {
+				// Overwritten before this consumer got to them
+				missed += published - Capacity - cursor;
+				cursor = published - Capacity;
+			}
+			const Slot& slot = m_slots[cursor & (Capacity - 1)];
+			uint64_t stamp = slot.stamp.load(std::memory_order_acquire);
+			uint64_t words[EventWords];
+			for (size_t i = 0; i < EventWords; i++) {
+				words[i] = slot.words[i].load(std::memory_order_relaxed);
+			}
+			uint64_t subscribers = slot.subscribers.load(std::memory_order_relaxed);
+			uint32_t button = slot.button.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (stamp != 2 * cursor + 2 || slot.stamp.load(std::memory_order_relaxed) != stamp) {
+				missed++; // Being overwritten; the producer has lapped us
+				cursor++;
+				continue;
+			}
+			cursor++;
+			// The button check guards a reused id against events published
+			// for its previous owner while it was subscribing
+			if (((subscribers >> id) & 1ULL) && ((mask >> button) & 1ULL)) {
+				memcpy(&out[count++], words, sizeof(Event));
+			}
+		}
+		consumer.cursor.store(cursor, std::memory_order_relaxed);
+		if (missed != 0) {
+			consumer.lost.fetch_add(missed, std::memory_order_relaxed);
+			consumer.unreported += missed;
+		}
+		if (lost) {
+			*lost = count != 0 ? consumer.unreported : 0;
+		}
+		if (count != 0) {
+			consumer.unreported = 0;
+		}
+		return count;
+	}
+
+	// Events published and not yet read by consumer id
+	size_t Pending(int id) const {
+		if (id < 0 || id >= BUTTON_RING_MAX_CONSUMERS) {
+			return 0;
+		}
+		uint64_t published = m_published.load(std::memory_order_acquire);
+		uint64_t behind = published - m_consumers[id].cursor.load(std::memory_order_relaxed);
+		return static_cast<size_t>(behind < Capacity ? behind : Capacity);
+	}
+
+	// Events written into the ring
+	uint64_t Published() const { return m_published.load(std::memory_order_relaxed); }
+	// Events no consumer wanted, dropped at the source
+	uint64_t Filtered() const { return m_filtered.load(std::memory_order_relaxed); }
+	// Events consumer id lost by falling behind
+	uint64_t Lost(int id) const {
+		return id >= 0 && id < BUTTON_RING_MAX_CONSUMERS ? m_consumers[id].lost.load(std::memory_order_relaxed) : 0;
+	}
+
+private:
+	static const size_t EventWords = (sizeof(Event) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	struct Slot {
+		std::atomic<uint64_t> stamp{ 0 }; // 2 * position + 2 once written
+		std::atomic<uint64_t> subscribers{ 0 };
+		std::atomic<uint32_t> button{ 0 };
+		std::atomic<uint64_t> words[EventWords] = {};
+	};
+
+	// A cache line each, so consumers moving their cursors do not slow
+	// each other down
+	struct alignas(BUTTON_RING_CACHE_LINE) Consumer {
+		std::atomic<uint64_t> cursor{ 0 };
+		std::atomic<uint64_t> mask{ 0 };
+		std::atomic<uint64_t> lost{ 0 };
+		uint64_t unreported = 0; // Lost since events were last returned; reader only
+		bool active = false;     // Guarded by m_mutex
+	};
+
+	Slot m_slots[Capacity];
+	alignas(BUTTON_RING_CACHE_LINE) std::atomic<uint64_t> m_published{ 0 };
+	std::atomic<uint64_t> m_filtered{ 0 };
+	std::atomic<uint64_t> m_wanted[BUTTON_RING_MAX_BUTTONS] = {}; // Subscribers per button
+	Consumer m_consumers[BUTTON_RING_MAX_CONSUMERS];
+	std::mutex m_mutex;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+// Bit-parallel debounce for packed button states.
+//
+// Every button has a small integrator counting consecutive samples that
+// disagree with its debounced state. The counters are stored as bit planes
+// (plane k holds bit k of all 64 counters of a word), so one sample for 64
+// buttons costs a handful of word-wide operations instead of 64 branches.
+// A button flips once its counter reaches the press threshold (while
+// released) or the release threshold (while pressed).
+//
+// A bank holds any number of devices, each with the same number of 64-bit
+// words. All arrays are laid out structure-of-arrays so ProcessAll walks
+// contiguous memory across every device.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Thresholds are counted in samples, 1 (no filtering) to 15
+#define BUTTON_DEBOUNCE_COUNTER_BITS 4
+#define BUTTON_DEBOUNCE_MAX_SAMPLES ((1 << BUTTON_DEBOUNCE_COUNTER_BITS) - 1)
+
+class DebounceBank {
+public:
+	explicit DebounceBank(size_t devices = 1, size_t wordsPerDevice = 1)
+		: m_devices(devices), m_words(wordsPerDevice),
+		m_state(devices * wordsPerDevice, 0) {
+		for (int k = 0; k < kBits; k++) {
+			m_count[k].assign(devices * wordsPerDevice, 0);
+			m_press[k].assign(devices * wordsPerDevice, 0);
+			m_release[k].assign(devices * wordsPerDevice, 0);
+		}
+		SetAllThresholds(1, 1);
+	}
+
+	size_t Devices() const { return m_devices; }
+	size_t WordsPerDevice() const { return m_words; }
+
+	// Sets the thresholds of one button (bit index across the device's words)
+	bool SetThresholds(size_t device, int button, int pressSamples, int releaseSamples) {
+		if (device >= m_devices || button < 0 ||
+			static_cast<size_t>(button) >= m_words * 64) {
+			return false;
+		}
+		size_t i = device * m_words + button / 64;
+		uint64_t bit = 1ULL << (button % 64);
+		unsigned press = Clamp(pressSamples);
+		unsigned release = Clamp(releaseSamples);
+		for (int k = 0; k < kBits; k++) {
+			m_press[k][i] = ((press >> k) & 1) ? (m_press[k][i] | bit) : (m_press[k][i] & ~bit);
+			m_release[k][i] = ((release >> k) & 1) ? (m_release[k][i] | bit) : (m_release[k][i] & ~bit);
+		}
+		ClampCounters(i, bit);
+		return true;
+	}
+
+	// Sets the same thresholds on every button of every device
+	void SetAllThresholds(int pressSamples, int releaseSamples) {
+		unsigned press = Clamp(pressSamples);
+		unsigned release = Clamp(releaseSamples);
+		for (int k = 0; k < kBits; k++) {
+			m_press[k].assign(m_press[k].size(), ((press >> k) & 1) ? ~0ULL : 0);
+			m_release[k].assign(m_release[k].size(), ((release >> k) & 1) ? ~0ULL : 0);
+		}
+		for (size_t i = 0; i < m_state.size(); i++) {
+			ClampCounters(i, ~0ULL);
+		}
+	}
+
+	// Forces the debounced state of a device and clears its integrators
+	void Reset(size_t device, const uint64_t* state) {
+		for (size_t w = 0; w < m_words; w++) {
+			size_t i = device * m_words + w;
+			m_state[i] = state[w];
+			for (int k = 0; k < kBits; k++) {
+				m_count[k][i] = 0;
+			}
+		}
+	}
+
+	// Feeds one sample of a device. Returns the debounced words.
+	const uint64_t* Process(size_t device, const uint64_t* raw) {
+		size_t first = device * m_words;
+		for (size_t w = 0; w < m_words; w++) {
+			Step(first + w, raw[w]);
+		}
+		return &m_state[first];
+	}
+
+	// Feeds one sample for every device; raw holds Devices() * WordsPerDevice() words
+	const uint64_t* ProcessAll(const uint64_t* raw) {
+		size_t total = m_state.size();
+		for (size_t i = 0; i < total; i++) {
+			Step(i, raw[i]);
+		}
+		return m_state.data();
+	}
+
+	const uint64_t* State(size_t device) const { return &m_state[device * m_words]; }
+
+private:
+	static const int kBits = BUTTON_DEBOUNCE_COUNTER_BITS;
+
+	static unsigned Clamp(int samples) {
+		if (samples < 1) return 1;
+		if (samples > BUTTON_DEBOUNCE_MAX_SAMPLES) return BUTTON_DEBOUNCE_MAX_SAMPLES;
+		return static_cast<unsigned>(samples);
+	}
+
+	// A lowered threshold can leave counters at or above it, which the
+	// equality test in Step would not see until they wrapped. Such counters
+	// are set one sample short of the new threshold.
+	void ClampCounters(size_t i, uint64_t bits) {
+		uint64_t counting = 0;
+		for (int k = 0; k < kBits; k++) {
+			counting |= m_count[k][i];
+		}
+		bits &= counting;
+		for (int b = 0; bits != 0; b++, bits >>= 1) {
+			if ((bits & 1) == 0) {
+				continue;
+			}
+			uint64_t bit = 1ULL << b;
+			const std::vector<uint64_t>* limit = (m_state[i] & bit) ? m_release : m_press;
+			unsigned count = 0;
+			unsigned threshold = 0;
+			for (int k = 0; k < kBits; k++) {
+				count |= ((m_count[k][i] & bit) ? 1u : 0u) << k;
+				threshold |= ((limit[k][i] & bit) ? 1u : 0u) << k;
+			}
+			if (count < threshold) {
+				continue;
+			}
+			for (int k = 0; k < kBits; k++) {
+				m_count[k][i] = (((threshold - 1) >> k) & 1) ? (m_count[k][i] | bit) : (m_count[k][i] & ~bit);
+			}
+		}
+	}
+
+	void Step(size_t i, uint64_t raw) {
+		uint64_t state = m_state[i];
+		uint64_t disagree = raw ^ state;
+
+		// Increment counters of disagreeing buttons, clear the others
+		uint64_t carry = disagree;
+		uint64_t reached = disagree;
+		for (int k = 0; k < kBits; k++) {
+			uint64_t count = m_count[k][i];
+			uint64_t next = (count ^ carry) & disagree;
+			carry &= count;
+			m_count[k][i] = next;
+
+			// Released buttons compare against the press threshold and vice versa
+			uint64_t threshold = (state & m_release[k][i]) | (~state & m_press[k][i]);
+			reached &= ~(next ^ threshold);
+		}
+
+		m_state[i] = state ^ reached;
+		for (int k = 0; k < kBits; k++) {
+			m_count[k][i] &= ~reached;
+		}
+	}
+
+	size_t m_devices;
+	size_t m_words;
+	std::vector<uint64_t> m_state;
+	std::vector<uint64_t> m_count[BUTTON_DEBOUNCE_COUNTER_BITS];
+	std::vector<uint64_t> m_press[BUTTON_DEBOUNCE_COUNTER_BITS];
+	std::vector<uint64_t> m_release[BUTTON_DEBOUNCE_COUNTER_BITS];
+};
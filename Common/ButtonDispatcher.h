@@ -0,0 +1,236 @@
+#pragma once
+
+// Delivers button events to callbacks on one library-owned thread.
+//
+// Front ends that only want to hear about changes used to poll ReadButtons
+// in a loop. ButtonDispatcher instead sleeps until the capture path calls
+// Notify, then runs every registered drain once; a drain reads whatever its
+// subscription has pending (see ButtonBroadcastRing.h) and passes it to the
+// application's callback in one call. Notifications that arrive while a
+// round is pending or running are merged, so a burst of reports costs one
+// callback per batch rather than one per event.
+//
+// Callbacks run on the dispatcher thread, one at a time. Remove waits for a
+// running drain of the entry to return, except on the dispatcher thread
+// itself, so a callback may unsubscribe or close its own handle.
+//
+// DispatchLatencyHistogram counts how long events waited between capture
+// and the start of their callback, in power-of-two microsecond buckets.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bucket 0 counts latencies under 1 us, bucket i (1..30) those from
+// 2^(i-1) up to 2^i us, bucket 31 everything longer
+#define BUTTON_DISPATCH_LATENCY_BUCKETS 32
+
+class DispatchLatencyHistogram {
+public:
+	static size_t Bucket(uint64_t micros) {
+		size_t bucket = 0;
+		while (micros != 0 && bucket < BUTTON_DISPATCH_LATENCY_BUCKETS - 1) {
+			micros >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+	void Record(uint64_t micros) {
+		m_buckets[Bucket(micros)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Copies up to count buckets and returns how many were copied
+	size_t Read(uint64_t* buckets, size_t count) const {
+		if (count > BUTTON_DISPATCH_LATENCY_BUCKETS) {
+			count = BUTTON_DISPATCH_LATENCY_BUCKETS;
+		}
+		for (size_t i = 0; i < count; i++) {
+			buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+		}
+		return count;
+	}
+
+	void Reset() {
+		for (auto& bucket : m_buckets) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t Total() const {
+		uint64_t total = 0;
+		for (const auto& bucket : m_buckets) {
+			total += bucket.load(std::memory_order_relaxed);
+		}
+		return total;
+	}
+
+	// Upper bound in microseconds of the bucket holding the given fraction
+	// (0..1) of the samples; 0 when there are none
+	uint64_t Percentile(double fraction) const {
+		uint64_t total = Total();
+		if (total == 0) {
+			return 0;
+		}
+		uint64_t wanted = static_cast<uint64_t>(fraction * static_cast<double>(total));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUTTON_DISPATCH_LATENCY_BUCKETS; i++) {
+			seen += m_buckets[i].load(std::memory_order_relaxed);
+			if (seen > wanted || seen == total) {
+				return 1ULL << i;
+			}
+		}
+		return 1ULL << (BUTTON_DISPATCH_LATENCY_BUCKETS - 1);
+	}
+
+private:
+	std::atomic<uint64_t> m_buckets[BUTTON_DISPATCH_LATENCY_BUCKETS] = {};
+};
+
+class ButtonDispatcher {
+public:
+	// Reads one subscription and invokes its callback; runs on the
+	// dispatcher thread
+	typedef std::function<void()> DrainFunction;
+
+	ButtonDispatcher() = default;
+	ButtonDispatcher(const ButtonDispatcher&) = delete;
+	ButtonDispatcher& operator=(const ButtonDispatcher&) = delete;
+
+	~ButtonDispatcher() { Stop(); }
+
+	// Starts the thread if it is not running
+	void Start() {
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		if (!m_thread.joinable()) {
+			m_stop = false;
+			m_thread = std::thread([this] { Run(); });
+		}
+	}
+
+	// Stops the thread after the current round; not from a callback
+	void Stop() {
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		if (m_thread.joinable()) {
+			{
+				std::lock_guard<std::mutex> wakeLock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_one();
+			m_thread.join();
+		}
+	}
+
+	bool OnDispatcherThread() const { return std::this_thread::get_id() == m_threadId.load(); }
+
+	// Registers a drain and returns its id (never 0)
+	int Add(DrainFunction drain) {
+		auto entry = std::make_shared<Entry>();
+		entry->drain = std::move(drain);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int id = ++m_lastId;
+		m_entries[id] = entry;
+		return id;
+	}
+
+	// Unregisters a drain. Off the dispatcher thread, waits for a running
+	// call of it to return first.
+	bool Remove(int id) {
+		std::shared_ptr<Entry> entry;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_entries.find(id);
+			if (it == m_entries.end()) {
+				return false;
+			}
+			entry = it->second;
+			m_entries.erase(it);
+		}
+		if (OnDispatcherThread()) {
+			entry->removed = true; // Possibly the running one; it is not called again
+			return true;
+		}
+		std::lock_guard<std::mutex> lock(entry->mutex);
+		entry->removed = true;
+		return true;
+	}
+
+	// Called by the capture path after publishing events. Cheap while a
+	// round is already pending.
+	void Notify() {
+		if (!m_pending.exchange(true)) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_wake.notify_one();
+		}
+	}
+
+	// Runs every drain once. Called by the thread after a notification;
+	// tests call it directly.
+	void RunOnce() {
+		std::vector<std::shared_ptr<Entry>> entries;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			entries.reserve(m_entries.size());
+			for (const auto& entry : m_entries) {
+				entries.push_back(entry.second);
+			}
+		}
+		for (const auto& entry : entries) {
+			std::lock_guard<std::mutex> lock(entry->mutex);
+			if (!entry->removed) {
+				entry->drain();
+			}
+		}
+		m_rounds.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Rounds run so far; each serves any number of notifications
+	uint64_t Rounds() const { return m_rounds.load(std::memory_order_relaxed); }
+
+	DispatchLatencyHistogram& Latency() { return m_latency; }
+
+private:
+	struct Entry {
+		std::mutex mutex;
+		DrainFunction drain;
+		std::atomic<bool> removed{ false };
+	};
+
+	void Run() {
+		m_threadId = std::this_thread::get_id();
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this] { return m_stop || m_pending.load(); });
+				if (m_stop) {
+					break;
+				}
+			}
+			// Publishes before this exchange are visible to the round
+			m_pending.exchange(false);
+			RunOnce();
+		}
+		m_threadId = std::thread::id();
+	}
+
+	std::mutex m_threadMutex;
+	std::thread m_thread;
+	std::atomic<std::thread::id> m_threadId{ std::thread::id() };
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stop = false;
+	std::atomic<bool> m_pending{ false };
+	std::map<int, std::shared_ptr<Entry>> m_entries;
+	int m_lastId = 0;
+
+	std::atomic<uint64_t> m_rounds{ 0 };
+	DispatchLatencyHistogram m_latency;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+// Platform independent edge detection for packed button states.
+// Shared by both libraries and usable without Windows headers.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit. Value must not be zero.
+inline int CountTrailingZeros64(uint64_t value) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return static_cast<int>(index);
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanForward(&index, static_cast<unsigned long>(value))) {
+		return static_cast<int>(index);
+	}
+	_BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+	return static_cast<int>(index) + 32;
+#else
+	return __builtin_ctzll(value);
+#endif
+}
+
+// Calls fn(bit) for every set bit, lowest bit first
+template <typename Fn>
+inline void ForEachSetBit(uint64_t bits, Fn&& fn) {
+	while (bits) {
+		fn(CountTrailingZeros64(bits));
+		bits &= bits - 1;
+	}
+}
+
+// Fixed capacity FIFO. When full, the oldest entry is dropped and counted.
+template <typename T, size_t Capacity>
+class EventQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+		"EventQueue capacity must be a power of two");
+
+public:
+	void Push(const T& item) {
+		if (m_tail - m_head == Capacity) {
+			m_head++;
+			m_dropped++;
+		}
+		m_items[m_tail++ & (Capacity - 1)] = item;
+	}
+
+	// Copies up to maxItems entries into out and removes them from the queue
+	size_t Pop(T* out, size_t maxItems) {
+		size_t count = 0;
+		while (count < maxItems && m_head != m_tail) {
+			out[count++] = m_items[m_head++ & (Capacity - 1)];
+		}
+		return count;
+	}
+
+	size_t Size() const { return static_cast<size_t>(m_tail - m_head); }
+	bool Empty() const { return m_head == m_tail; }
+	uint64_t Dropped() const { return m_dropped; }
+	void Clear() { m_head = m_tail; }
+
+private:
+	T m_items[Capacity] = {};
+	uint64_t m_head = 0;
+	uint64_t m_tail = 0;
+	uint64_t m_dropped = 0;
+};
+
+// Turns successive button states into press/release transitions.
+// The first state only primes the detector, so bits that are constant
+// in every report (report IDs, idle patterns like 0xC0) never produce events.
+class EdgeDetector {
+public:
+	void Reset() {
+		m_state = 0;
+		m_primed = false;
+	}
+
+	// Calls emit(bit, pressed) for each changed bit, lowest bit first.
+	// Returns the mask of changed bits.
+	template <typename Fn>
+	uint64_t Process(uint64_t state, Fn&& emit) {
+		if (!m_primed) {
+			m_state = state;
+			m_primed = true;
+			return 0;
+		}
+		uint64_t changed = state ^ m_state;
+		m_state = state;
+		ForEachSetBit(changed, [&](int bit) {
+			emit(bit, ((state >> bit) & 1ULL) != 0);
+		});
+		return changed;
+	}
+
+	uint64_t State() const { return m_state; }
+	bool Primed() const { return m_primed; }
+
+private:
+	uint64_t m_state = 0;
+	bool m_primed = false;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+// Merges buffered button changes into press/release events.
+//
+// Polled state only shows the buttons down at the moment of the poll, so a
+// press released between two polls is lost. Buffered devices (DirectInput
+// GetDeviceData) instead queue every change with the device's own time
+// stamp and sequence number. ButtonEventMerger drains such a backend in
+// batches, drops changes that do not change the tracked state, and, when
+// the device buffer overflowed, compares the tracked state with a fresh
+// state read and emits resync events for whatever was missed. Devices
+// without a buffer are sampled instead (see PollScheduler.h), and each
+// sample is diffed against the tracked state the same way.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ButtonEdges.h"
+
+// Changes read from the backend per call
+#define BUTTON_BUFFER_BATCH 32
+// Buttons tracked per device, button i in bit i % 64 of word i / 64
+#define BUTTON_BUFFER_WORDS 2
+#define BUTTON_BUFFER_QUEUE_SIZE 256
+
+// One buffered change as reported by the device
+struct ButtonBufferedChange {
+	uint32_t button;
+	bool pressed;
+	uint32_t timestamp; // Device time stamp (milliseconds for DirectInput)
+	uint32_t sequence;  // Device sequence number; simultaneous changes share it
+};
+
+struct ButtonBufferEvent {
+	uint32_t timestamp;
+	uint32_t sequence;
+	uint16_t button;
+	bool pressed;
+	bool resync; // Recovered from a state read after changes were lost
+};
+
+// Device side of the merger; the Windows build wraps IDirectInputDevice8,
+// tests use a scripted fake
+class ButtonEventBackend {
+public:
+	virtual ~ButtonEventBackend() {}
+
+	// Reads up to maxChanges buffered changes, oldest first, and returns how
+	// many were read (fewer than maxChanges once the buffer is empty), or -1
+	// if the device cannot be read. Sets overflow when changes were lost.
+	virtual int ReadChanges(ButtonBufferedChange* changes, int maxChanges, bool& overflow) = 0;
+
+	// Reads the current state of all buttons
+	virtual bool ReadState(uint64_t (&words)[BUTTON_BUFFER_WORDS]) = 0;
+};
+
+class ButtonEventMerger {
+public:
+	void Reset() {
+		m_primed = false;
+		m_queue.Clear();
+	}
+
+	// Reads everything the backend has buffered into the event queue.
+	// Returns the number of events queued, or -1 if the device cannot be read.
+	int Drain(ButtonEventBackend& backend) {
+		if (!m_primed) {
+			if (!backend.ReadState(m_state)) {
+				return -1;
+			}
+			m_primed = true;
+		}
+
+		int queued = 0;
+		bool overflow = false;
+		ButtonBufferedChange changes[BUTTON_BUFFER_BATCH];
+		int count;
+		do {
+			count = backend.ReadChanges(changes, BUTTON_BUFFER_BATCH, overflow);
+			if (count < 0) {
+				return -1;
+			}
+			for (int i = 0; i < count; i++) {
+				queued += Apply(changes[i]);
+			}
+		} while (count == BUTTON_BUFFER_BATCH);
+
+		if (overflow) {
+			m_overflows++;
+			int resynced = Resync(backend);
+			if (resynced < 0) {
+				return -1;
+			}
+			queued += resynced;
+		}
+		return queued;
+	}
+
+	// Reads the current state and queues its differences from the tracked
+	// state. The first sample only primes. Returns the number of events
+	// queued, or -1 if the device cannot be read.
+	int Sample(ButtonEventBackend& backend, uint32_t timestamp, uint32_t sequence) {
+		uint64_t current[BUTTON_BUFFER_WORDS];
+		if (!backend.ReadState(current)) {
+			return -1;
+		}
+		m_lastTimestamp = timestamp;
+		m_lastSequence = sequence;
+		if (!m_primed) {
+			for (int w = 0; w < BUTTON_BUFFER_WORDS; w++) m_state[w] = current[w];
+			m_primed = true;
+			return 0;
+		}
+		return Diff(current, false);
+	}
+
+	size_t Pop(ButtonBufferEvent* events, size_t maxEvents) { return m_queue.Pop(events, maxEvents); }
+
+	bool Pressed(uint32_t button) const {
+		return button < BUTTON_BUFFER_WORDS * 64 && ((m_state[button / 64] >> (button % 64)) & 1ULL) != 0;
+	}
+
+	// Events dropped because the queue was full
+	uint64_t Dropped() const { return m_queue.Dropped(); }
+	// Device buffer overflows recovered with a state read
+	uint64_t Overflows() const { return m_overflows; }
+
+private:
+	int Apply(const ButtonBufferedChange& change) {
+		m_lastTimestamp = change.timestamp;
+		m_lastSequence = change.sequence;
+		if (change.button >= BUTTON_BUFFER_WORDS * 64 || Pressed(change.button) == change.pressed) {
+			return 0; // Out of range, or already reflected in the primed state
+		}
+		m_state[change.button / 64] ^= 1ULL << (change.button % 64);
+		Push(change.button, change.pressed, change.timestamp, change.sequence, false);
+		return 1;
+	}
+
+	// Emits the differences between the tracked and the current state,
+	// stamped like the last buffered change
+	int Resync(ButtonEventBackend& backend) {
+		uint64_t current[BUTTON_BUFFER_WORDS];
+		if (!backend.ReadState(current)) {
+			return -1;
+		}
+		return Diff(current, true);
+	}
+
+	int Diff(const uint64_t (&current)[BUTTON_BUFFER_WORDS], bool resync) {
+		int queued = 0;
+		for (int w = 0; w < BUTTON_BUFFER_WORDS; w++) {
+			ForEachSetBit(current[w] ^ m_state[w], [&](int bit) {
+				bool pressed = ((current[w] >> bit) & 1ULL) != 0;
+				Push(static_cast<uint32_t>(w * 64 + bit), pressed, m_lastTimestamp, m_lastSequence, resync);
+				queued++;
+			});
+			m_state[w] = current[w];
+		}
+		return queued;
+	}
+
+	void Push(uint32_t button, bool pressed, uint32_t timestamp, uint32_t sequence, bool resync) {
+		ButtonBufferEvent event;
+		event.timestamp = timestamp;
+		event.sequence = sequence;
+		event.button = static_cast<uint16_t>(button);
+		event.pressed = pressed;
+		event.resync = resync;
+		m_queue.Push(event);
+	}
+
+	EventQueue<ButtonBufferEvent, BUTTON_BUFFER_QUEUE_SIZE> m_queue;
+	uint64_t m_state[BUTTON_BUFFER_WORDS] = {};
+	bool m_primed = false;
+	uint32_t m_lastTimestamp = 0;
+	uint32_t m_lastSequence = 0;
+	uint64_t m_overflows = 0;
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+// Chord, long-press and double-press recognition on top of button edges.
+//
+// Each gesture definition is compiled into a small automaton: a transition
+// table indexed by [state][input] that yields the next state and the actions
+// to run (start/cancel the gesture timer, fire). Edges only visit gestures
+// whose mask contains the changed bit, and hold/timeout events come from a
+// TimerWheel with 1 ms ticks. Timestamps are passed in by the caller, so the
+// recognizer never reads a clock itself.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "ButtonEdges.h"
+#include "TimerWheel.h"
+
+enum GestureKind {
+	GestureChord = 1,       // All mask buttons pressed within the timeout of the first one
+	GestureLongPress = 2,   // All mask buttons held for the timeout
+	GestureDoublePress = 3, // Mask pressed, released and pressed again within the timeout
+};
+
+// Longest accepted timeout, well inside the reach of the timer wheel
+#define BUTTON_GESTURE_MAX_TIMEOUT_MS 600000
+
+class GestureRecognizer {
+public:
+	// Returns the gesture id (its index), or -1 for an invalid definition
+	int Add(int kind, uint64_t mask, uint32_t timeoutMs) {
+		if (kind < GestureChord || kind > GestureDoublePress || mask == 0 ||
+			timeoutMs == 0 || timeoutMs > BUTTON_GESTURE_MAX_TIMEOUT_MS) {
+			return -1;
+		}
+		Gesture gesture;
+		gesture.table = kTables[kind - 1];
+		gesture.mask = mask;
+		gesture.timeoutMs = timeoutMs;
+		int id = static_cast<int>(m_gestures.size());
+		m_gestures.push_back(gesture);
+		ForEachSetBit(mask, [&](int bit) { m_byBit[bit].push_back(id); });
+		return id;
+	}
+
+	size_t Count() const { return m_gestures.size(); }
+
+	// Fires expired timers up to timestampUs, calling emit(gestureId, timestampUs)
+	template <typename Fn>
+	void Advance(uint64_t timestampUs, Fn&& emit) {
+		m_wheel.Advance(timestampUs / 1000, [&](uint32_t id, uint64_t expiryMs) {
+			Gesture& gesture = m_gestures[id];
+			gesture.timer = 0;
+			Apply(static_cast<int>(id), InputTimeout, expiryMs * 1000, emit);
+		});
+	}
+
+	// Feeds one button transition, calling emit(gestureId, timestampUs) for completed gestures
+	template <typename Fn>
+	void OnEdge(int bit, bool pressed, uint64_t timestampUs, Fn&& emit) {
+		Advance(timestampUs, emit);
+
+		uint64_t bitMask = 1ULL << bit;
+		m_down = pressed ? (m_down | bitMask) : (m_down & ~bitMask);
+
+		for (int id : m_byBit[bit]) {
+			const Gesture& gesture = m_gestures[id];
+			uint64_t down = m_down & gesture.mask;
+			Input input;
+			if (pressed) {
+				input = (down == gesture.mask) ? InputAllDown : InputPress;
+			}
+			else {
+				input = (down == 0) ? InputAllUp : InputRelease;
+			}
+			Apply(id, input, timestampUs, emit);
+		}
+	}
+
+	size_t PendingTimers() const { return m_wheel.Pending(); }
+
+private:
+	enum Input { InputPress, InputAllDown, InputRelease, InputAllUp, InputTimeout, InputCount };
+	enum State { StateIdle, StateArmed, StateArmedUp, StateLatched, StateCount };
+	enum Action { ActNone = 0, ActStart = 1, ActCancel = 2, ActFire = 4 };
+
+	struct Transition {
+		uint8_t next;
+		uint8_t actions;
+	};
+	typedef Transition Table[StateCount][InputCount];
+
+	struct Gesture {
+		const Table* table = nullptr;
+		uint64_t mask = 0;
+		uint32_t timeoutMs = 0;
+		uint8_t state = StateIdle;
+		TimerWheel::TimerId timer = 0;
+	};
+
+	// Columns: Press, AllDown, Release, AllUp, Timeout
+	static constexpr Table kChord = {
+		/* Idle    */ { { StateArmed, ActStart }, { StateLatched, ActFire }, { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone } },
+		/* Armed   */ { { StateArmed, ActNone }, { StateLatched, ActCancel | ActFire }, { StateArmed, ActNone }, { StateIdle, ActCancel }, { StateLatched, ActNone } },
+		/* ArmedUp */ { { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone } },
+		/* Latched */ { { StateLatched, ActNone }, { StateLatched, ActNone }, { StateLatched, ActNone }, { StateIdle, ActNone }, { StateLatched, ActNone } },
+	};
+	static constexpr Table kLongPress = {
+		/* Idle    */ { { StateIdle, ActNone }, { StateArmed, ActStart }, { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone } },
+		/* Armed   */ { { StateArmed, ActNone }, { StateArmed, ActNone }, { StateIdle, ActCancel }, { StateIdle, ActCancel }, { StateLatched, ActFire } },
+		/* ArmedUp */ { { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone } },
+		/* Latched */ { { StateLatched, ActNone }, { StateLatched, ActNone }, { StateLatched, ActNone }, { StateIdle, ActNone }, { StateLatched, ActNone } },
+	};
+	static constexpr Table kDoublePress = {
+		/* Idle    */ { { StateIdle, ActNone }, { StateArmed, ActStart }, { StateIdle, ActNone }, { StateIdle, ActNone }, { StateIdle, ActNone } },
+		/* Armed   */ { { StateArmed, ActNone }, { StateArmed, ActNone }, { StateArmed, ActNone }, { StateArmedUp, ActNone }, { StateLatched, ActNone } },
+		/* ArmedUp */ { { StateArmedUp, ActNone }, { StateLatched, ActCancel | ActFire }, { StateArmedUp, ActNone }, { StateArmedUp, ActNone }, { StateIdle, ActNone } },
+		/* Latched */ { { StateLatched, ActNone }, { StateLatched, ActNone }, { StateLatched, ActNone }, { StateIdle, ActNone }, { StateLatched, ActNone } },
+	};
+	static constexpr const Table* kTables[] = { &kChord, &kLongPress, &kDoublePress };
+
+	template <typename Fn>
+	void Apply(int id, Input input, uint64_t timestampUs, Fn&& emit) {
+		Gesture& gesture = m_gestures[id];
+		const Transition& transition = (*gesture.table)[gesture.state][input];
+		gesture.state = transition.next;
+
+		if ((transition.actions & ActCancel) && gesture.timer != 0) {
+			m_wheel.Cancel(gesture.timer);
+			gesture.timer = 0;
+		}
+		if (transition.actions & ActStart) {
+			gesture.timer = m_wheel.Schedule(timestampUs / 1000 + gesture.timeoutMs,
+				static_cast<uint32_t>(id));
+		}
+		if (transition.actions & ActFire) {
+			emit(id, timestampUs);
+		}
+	}
+
+	std::vector<Gesture> m_gestures;
+	std::vector<int> m_byBit[64];
+	uint64_t m_down = 0;
+	TimerWheel m_wheel;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+// Packing of DirectInput style button arrays into bit words.
+//
+// DIJOYSTATE2 reports each of its 128 buttons as a byte whose high bit is set
+// while the button is down. With SSE2, _mm_movemask_epi8 gathers the high
+// bits of 16 bytes in one instruction; elsewhere a multiply gathers 8 at a
+// time. Both produce button i in bit i % 64 of word i / 64.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BUTTON_PACK_SSE2 1
+#else
+#define BUTTON_PACK_SSE2 0
+#endif
+
+// Number of 64-bit words needed for count buttons
+#define BUTTON_PACK_WORDS(count) (((count) + 63) / 64)
+
+// Gathers the high bits of 8 bytes, byte i into bit i
+inline uint64_t PackHighBits8(const uint8_t* bytes) {
+	uint64_t value;
+	memcpy(&value, bytes, sizeof(value));
+	value = (value >> 7) & 0x0101010101010101ULL;
+	return (value * 0x0102040810204080ULL) >> 56;
+}
+
+// Portable packer, also used for the tail the SIMD path does not cover
+inline void PackButtonBytesScalar(const uint8_t* bytes, size_t count, uint64_t* words) {
+	memset(words, 0, BUTTON_PACK_WORDS(count) * sizeof(uint64_t));
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		words[i / 64] |= PackHighBits8(bytes + i) << (i % 64);
+	}
+	for (; i < count; i++) {
+		words[i / 64] |= static_cast<uint64_t>(bytes[i] >> 7) << (i % 64);
+	}
+}
+
+// Packs count button bytes into BUTTON_PACK_WORDS(count) words
+inline void PackButtonBytes(const uint8_t* bytes, size_t count, uint64_t* words) {
+#if BUTTON_PACK_SSE2
+	size_t chunks = count / 16;
+	memset(words, 0, BUTTON_PACK_WORDS(count) * sizeof(uint64_t));
+	for (size_t c = 0; c < chunks; c++) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + c * 16));
+		uint64_t mask = static_cast<uint32_t>(_mm_movemask_epi8(v));
+		words[c / 4] |= mask << ((c % 4) * 16);
+	}
+	size_t done = chunks * 16;
+	if (done < count) {
+		uint64_t tail[BUTTON_PACK_WORDS(16)];
+		PackButtonBytesScalar(bytes + done, count - done, tail);
+		words[done / 64] |= tail[0] << (done % 64);
+	}
+#else
+	PackButtonBytesScalar(bytes, count, words);
+#endif
+}
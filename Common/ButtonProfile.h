@@ -0,0 +1,165 @@
+#pragma once
+
+// Idle baseline and active-bit learning for unknown devices.
+//
+// During calibration every report is added to a ProfileLearner. Bits that
+// never change are constant (report IDs, idle patterns such as the 0xC0 of
+// the Three Button Controller); only the remaining active bits need to be
+// decoded, diffed and stored. Profiles are kept per VID/PID/version and
+// persisted as JSON.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "ButtonEdges.h"
+
+struct ButtonProfile {
+	uint16_t vendorID = 0;
+	uint16_t productID = 0;
+	uint16_t versionNumber = 0;
+	uint64_t baseline = 0;    // Idle value of every bit
+	uint64_t activeMask = 0;  // Bits that changed during calibration
+	uint32_t samples = 0;     // Reports seen during calibration
+};
+
+class ProfileLearner {
+public:
+	void Reset() {
+		m_first = 0;
+		m_last = 0;
+		m_active = 0;
+		m_samples = 0;
+	}
+
+	void Add(uint64_t state) {
+		if (m_samples == 0) {
+			m_first = state;
+		}
+		m_active |= state ^ m_first;
+		m_last = state;
+		m_samples++;
+	}
+
+	uint32_t Samples() const { return m_samples; }
+	uint64_t ActiveMask() const { return m_active; }
+	// The last report is taken as idle, so calibration should end with all buttons released
+	uint64_t Baseline() const { return m_last; }
+
+private:
+	uint64_t m_first = 0;
+	uint64_t m_last = 0;
+	uint64_t m_active = 0;
+	uint32_t m_samples = 0;
+};
+
+// Gathers the masked bits of value into the low bits of the result (software PEXT)
+inline uint64_t ExtractBits(uint64_t value, uint64_t mask) {
+	uint64_t result = 0;
+	int position = 0;
+	ForEachSetBit(mask, [&](int bit) {
+		result |= ((value >> bit) & 1ULL) << position++;
+	});
+	return result;
+}
+
+// Number of leading report bytes that contain active bits
+inline int ActiveReportBytes(uint64_t mask) {
+	int bytes = 0;
+	while (bytes < 8 && (mask >> (bytes * 8)) != 0) {
+		bytes++;
+	}
+	return bytes;
+}
+
+inline int CountBits64(uint64_t value) {
+	int count = 0;
+	ForEachSetBit(value, [&](int) { count++; });
+	return count;
+}
+
+inline std::string ProfileHex(uint64_t value, int digits) {
+	char text[24];
+	snprintf(text, sizeof(text), "0x%0*llx", digits, static_cast<unsigned long long>(value));
+	return text;
+}
+
+// Profile key, e.g. "0x0fc5:0xb080:0x0100"
+inline std::string ProfileKey(uint16_t vendorID, uint16_t productID, uint16_t versionNumber) {
+	return ProfileHex(vendorID, 4) + ":" + ProfileHex(productID, 4) + ":" + ProfileHex(versionNumber, 4);
+}
+
+inline nlohmann::json ProfileToJson(const ButtonProfile& profile) {
+	nlohmann::json j;
+	j["vendorID"] = ProfileHex(profile.vendorID, 4);
+	j["productID"] = ProfileHex(profile.productID, 4);
+	j["versionNumber"] = ProfileHex(profile.versionNumber, 4);
+	j["baseline"] = ProfileHex(profile.baseline, 16);
+	j["activeMask"] = ProfileHex(profile.activeMask, 16);
+	j["activeBits"] = CountBits64(profile.activeMask);
+	j["activeBytes"] = ActiveReportBytes(profile.activeMask);
+	j["samples"] = profile.samples;
+	return j;
+}
+
+// Returns false if a required field is missing or malformed
+inline bool ProfileFromJson(const nlohmann::json& j, ButtonProfile& profile) {
+	try {
+		profile.vendorID = static_cast<uint16_t>(std::stoul(j.at("vendorID").get<std::string>(), nullptr, 16));
+		profile.productID = static_cast<uint16_t>(std::stoul(j.at("productID").get<std::string>(), nullptr, 16));
+		profile.versionNumber = static_cast<uint16_t>(std::stoul(j.at("versionNumber").get<std::string>(), nullptr, 16));
+		profile.baseline = std::stoull(j.at("baseline").get<std::string>(), nullptr, 16);
+		profile.activeMask = std::stoull(j.at("activeMask").get<std::string>(), nullptr, 16);
+		profile.samples = j.value("samples", 0u);
+		return true;
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+}
+
+// Profiles keyed by VID/PID/version
+class ProfileStore {
+public:
+	void Put(const ButtonProfile& profile) {
+		m_profiles[ProfileKey(profile.vendorID, profile.productID, profile.versionNumber)] = profile;
+	}
+
+	bool Find(uint16_t vendorID, uint16_t productID, uint16_t versionNumber, ButtonProfile& profile) const {
+		auto it = m_profiles.find(ProfileKey(vendorID, productID, versionNumber));
+		if (it == m_profiles.end()) return false;
+		profile = it->second;
+		return true;
+	}
+
+	size_t Size() const { return m_profiles.size(); }
+
+	std::string ToJson() const {
+		nlohmann::json j = nlohmann::json::object();
+		for (const auto& entry : m_profiles) {
+			j[entry.first] = ProfileToJson(entry.second);
+		}
+		return j.dump(2);
+	}
+
+	// Merges profiles from a JSON document. Returns the number loaded, or -1 on a parse error.
+	int FromJson(const std::string& text) {
+		nlohmann::json j = nlohmann::json::parse(text, nullptr, false);
+		if (j.is_discarded() || !j.is_object()) return -1;
+		int loaded = 0;
+		for (const auto& item : j.items()) {
+			ButtonProfile profile;
+			if (ProfileFromJson(item.value(), profile)) {
+				Put(profile);
+				loaded++;
+			}
+		}
+		return loaded;
+	}
+
+private:
+	std::map<std::string, ButtonProfile> m_profiles;
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+// Product-name lookups over an enumerated device list.
+//
+// Names are normalized once, when the list is indexed: surrounding
+// whitespace is dropped, inner runs of whitespace become one space, and
+// letters are case-folded (ASCII and Latin-1). Some devices pad their
+// product string (the Kinesis controller reports trailing spaces), and
+// operators type names with their own capitalization; both now match.
+// Exact matches are served from a hash map keyed by usage and name,
+// prefix matches from the names in sorted order, and fuzzy matches by a
+// bounded edit distance. Every lookup returns the first device in
+// enumeration order among the best matches.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Largest edit distance FindFuzzy accepts
+#define DEVICE_NAME_MAX_DISTANCE 8
+
+inline bool IsDeviceNameSpace(unsigned char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0';
+}
+
+// Trimmed, whitespace-collapsed, case-folded UTF-8
+inline std::string NormalizeDeviceName(const char* name, size_t length) {
+	std::string normalized;
+	normalized.reserve(length);
+	bool space = false;
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = static_cast<unsigned char>(name[i]);
+		if (IsDeviceNameSpace(c)) {
+			space = !normalized.empty();
+			continue;
+		}
+		if (space) {
+			normalized.push_back(' ');
+			space = false;
+		}
+		if (c >= 'A' && c <= 'Z') {
+			c = static_cast<unsigned char>(c + ('a' - 'A'));
+		}
+		else if (c == 0xC3 && i + 1 < length) {
+			// U+00C0..U+00DE except U+00D7 (multiplication sign)
+			unsigned char next = static_cast<unsigned char>(name[i + 1]);
+			if (next >= 0x80 && next <= 0x9E && next != 0x97) {
+				next = static_cast<unsigned char>(next + 0x20);
+			}
+			normalized.push_back(static_cast<char>(c));
+			normalized.push_back(static_cast<char>(next));
+			i++;
+			continue;
+		}
+		normalized.push_back(static_cast<char>(c));
+	}
+	return normalized;
+}
+
+inline std::string NormalizeDeviceName(const std::string& name) {
+	return NormalizeDeviceName(name.data(), name.size());
+}
+
+// Levenshtein distance of a and b, or maxDistance + 1 once it is known to
+// be larger
+inline int BoundedEditDistance(const std::string& a, const std::string& b, int maxDistance) {
+	size_t lengthDifference = a.size() > b.size() ? a.size() - b.size() : b.size() - a.size();
+	if (lengthDifference > static_cast<size_t>(maxDistance)) {
+		return maxDistance + 1;
+	}
+	std::vector<int> row(b.size() + 1);
+	for (size_t j = 0; j <= b.size(); j++) {
+		row[j] = static_cast<int>(j);
+	}
+	for (size_t i = 1; i <= a.size(); i++) {
+		int diagonal = row[0];
+		row[0] = static_cast<int>(i);
+		int rowMinimum = row[0];
+		for (size_t j = 1; j <= b.size(); j++) {
+			int above = row[j];
+			int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+			row[j] = (std::min)((std::min)(above + 1, row[j - 1] + 1), diagonal + cost);
+			diagonal = above;
+			rowMinimum = (std::min)(rowMinimum, row[j]);
+		}
+		if (rowMinimum > maxDistance) {
+			return maxDistance + 1;
+		}
+	}
+	return (std::min)(row[b.size()], maxDistance + 1);
+}
+
+class DeviceNameIndex {
+public:
+	void Clear() {
+		m_exact.clear();
+		m_sorted.clear();
+	}
+
+	// Adds a device; call in enumeration order, then Finish
+	void Add(const std::string& name, uint16_t usagePage, uint16_t usage, int id) {
+		Entry entry;
+		entry.name = NormalizeDeviceName(name);
+		entry.usageKey = UsageKey(usagePage, usage);
+		entry.id = id;
+		m_exact.emplace(ExactKey(entry.name, entry.usageKey), id); // Keeps the first device
+		m_sorted.push_back(std::move(entry));
+	}
+
+	void Finish() {
+		std::sort(m_sorted.begin(), m_sorted.end(), [](const Entry& a, const Entry& b) {
+			return a.name != b.name ? a.name < b.name : a.id < b.id;
+		});
+	}
+
+	// First device with this name and usage, or -1
+	int FindExact(const std::string& name, uint16_t usagePage, uint16_t usage) const {
+		auto it = m_exact.find(ExactKey(NormalizeDeviceName(name), UsageKey(usagePage, usage)));
+		return it == m_exact.end() ? -1 : it->second;
+	}
+
+	// First device with this usage whose name starts with prefix, or -1. An
+	// empty prefix matches nothing.
+	int FindPrefix(const std::string& prefix, uint16_t usagePage, uint16_t usage) const {
+		std::string wanted = NormalizeDeviceName(prefix);
+		if (wanted.empty()) {
+			return -1;
+		}
+		uint32_t usageKey = UsageKey(usagePage, usage);
+		int found = -1;
+		auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), wanted,
+			[](const Entry& entry, const std::string& value) { return entry.name < value; });
+		for (; it != m_sorted.end() && it->name.compare(0, wanted.size(), wanted) == 0; ++it) {
+			if (it->usageKey == usageKey && (found < 0 || it->id < found)) {
+				found = it->id;
+			}
+		}
+		return found;
+	}
+
+	// Device with this usage whose name is the fewest edits (insertions,
+	// deletions, substitutions) away, at most maxDistance; the first device
+	// among equally close ones. Returns -1 if none is close enough.
+	int FindFuzzy(const std::string& name, uint16_t usagePage, uint16_t usage, int maxDistance) const {
+		if (maxDistance < 0 || maxDistance > DEVICE_NAME_MAX_DISTANCE) {
+			return -1;
+		}
+		std::string wanted = NormalizeDeviceName(name);
+		uint32_t usageKey = UsageKey(usagePage, usage);
+		int found = -1;
+		int best = maxDistance;
+		for (const Entry& entry : m_sorted) {
+			if (entry.usageKey != usageKey) {
+				continue;
+			}
+			int distance = BoundedEditDistance(wanted, entry.name, best);
+			if (distance < best || (distance == best && (found < 0 || entry.id < found))) {
+				best = distance;
+				found = entry.id;
+			}
+		}
+		return found;
+	}
+
+	size_t Size() const { return m_sorted.size(); }
+
+private:
+	struct Entry {
+		std::string name; // Normalized
+		uint32_t usageKey;
+		int id;
+	};
+
+	static uint32_t UsageKey(uint16_t usagePage, uint16_t usage) {
+		return (static_cast<uint32_t>(usagePage) << 16) | usage;
+	}
+
+	static std::string ExactKey(const std::string& name, uint32_t usageKey) {
+		char prefix[4] = { static_cast<char>(usageKey >> 24), static_cast<char>(usageKey >> 16),
+			static_cast<char>(usageKey >> 8), static_cast<char>(usageKey) };
+		return std::string(prefix, sizeof(prefix)) + name;
+	}
+
+	std::unordered_map<std::string, int> m_exact;
+	std::vector<Entry> m_sorted; // By name, then enumeration order
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+// GetDirectInputDeviceList serialization straight into the caller's buffer.
+//
+// The list used to be an ordered_json object per device, filled from
+// stringstream-formatted hex values and dumped into a std::string that was
+// then copied out. It is now written token by token with JsonTokenWriter,
+// in the same key order and with the same value formats, so the text is
+// unchanged. GUIDs are kept as text in the record, formatted once when the
+// device is enumerated.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "EnumScratch.h"
+#include "JsonTokenWriter.h"
+
+// "{XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX}" and a null
+#define DIRECTINPUT_GUID_TEXT_SIZE 39
+// Longest typeName, "Primary: Unknown (0xff), Secondary: Unknown (0xff)"
+#define DIRECTINPUT_TYPE_NAME_SIZE 64
+
+// The listed fields of an enumerated device
+struct DirectInputDeviceInfo {
+	std::string name;
+	std::string instanceName;
+	char productGUIDText[DIRECTINPUT_GUID_TEXT_SIZE] = {};
+	char instanceGUIDText[DIRECTINPUT_GUID_TEXT_SIZE] = {};
+	uint32_t devType = 0;
+	uint16_t vendorID = 0;
+	uint16_t productID = 0;
+	uint16_t usagePage = 0;
+	uint16_t usage = 0;
+};
+
+// Devices of one enumeration, in storage kept between enumerations. Clear
+// keeps the records and Add hands them out again, so their strings keep
+// their capacity: listing the same devices again allocates nothing.
+template <typename Record>
+class DirectInputDeviceList {
+public:
+	void Clear() { m_count = 0; }
+
+	// The next record; the caller sets every field, as it may hold an
+	// earlier enumeration's values
+	Record& Add() {
+		if (m_count == m_records.size()) {
+			m_records.emplace_back();
+		}
+		return m_records[m_count++];
+	}
+
+	size_t size() const { return m_count; }
+	const Record& operator[](size_t i) const { return m_records[i]; }
+	const Record* begin() const { return m_records.data(); }
+	const Record* end() const { return m_records.data() + m_count; }
+
+private:
+	std::vector<Record> m_records;
+	size_t m_count = 0;
+};
+
+// Whether two enumerations listed the same devices with the same fields
+template <typename Devices, typename OtherDevices>
+inline bool SameDirectInputDevices(const Devices& devices, const OtherDevices& other) {
+	if (devices.size() != other.size()) {
+		return false;
+	}
+	auto it = other.begin();
+	for (const DirectInputDeviceInfo& device : devices) {
+		const DirectInputDeviceInfo& same = *it++;
+		if (device.name != same.name || device.instanceName != same.instanceName ||
+			strcmp(device.productGUIDText, same.productGUIDText) != 0 ||
+			strcmp(device.instanceGUIDText, same.instanceGUIDText) != 0 ||
+			device.devType != same.devType || device.vendorID != same.vendorID ||
+			device.productID != same.productID || device.usagePage != same.usagePage ||
+			device.usage != same.usage) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline const char* DirectInputPrimaryTypeName(uint32_t primaryType) {
+	switch (primaryType) {
+	case 0x11: return "HID Device";
+	case 0x12: return "Mouse";
+	case 0x13: return "Keyboard";
+	case 0x14: return "Joystick";
+	case 0x15: return "Gamepad";
+	case 0x16: return "Driving";
+	case 0x17: return "Flight";
+	default: return nullptr;
+	}
+}
+
+inline const char* DirectInputSecondaryTypeName(uint32_t secondaryType) {
+	switch (secondaryType) {
+	case 0x00: return "None";
+	case 0x01: return "Limited";
+	case 0x02: return "Standard";
+	case 0x03: return "Enhanced";
+	default: return nullptr;
+	}
+}
+
+// Writes "Primary: <name>, Secondary: <name>" into text
+// (DIRECTINPUT_TYPE_NAME_SIZE chars), with "Unknown (0x<hex>)" for types
+// without a name. Returns the length written, without a null.
+inline size_t FormatDirectInputTypeName(char* text, uint32_t devType) {
+	size_t length = 0;
+	auto append = [&](const char* part) {
+		size_t partLength = strlen(part);
+		memcpy(text + length, part, partLength);
+		length += partLength;
+	};
+	auto appendType = [&](const char* name, uint32_t type) {
+		if (name) {
+			append(name);
+			return;
+		}
+		append("Unknown (");
+		length += FormatHex(text + length, type, 1, false);
+		append(")");
+	};
+	append("Primary: ");
+	appendType(DirectInputPrimaryTypeName(devType & 0xFF), devType & 0xFF);
+	append(", Secondary: ");
+	appendType(DirectInputSecondaryTypeName((devType >> 8) & 0xFF), (devType >> 8) & 0xFF);
+	return length;
+}
+
+// "0x" and at least 4 uppercase hex digits
+inline void WriteDirectInputHex(JsonTokenWriter& writer, uint32_t value) {
+	char text[HEX_TEXT_SIZE];
+	writer.String(text, FormatHex(text, value, 4, true));
+}
+
+// One device, keys in the order the ordered_json object had them
+inline void WriteDirectInputDeviceJson(JsonTokenWriter& writer, const DirectInputDeviceInfo& device,
+	size_t index) {
+	writer.BeginObject();
+	writer.Key("index");
+	writer.Int(static_cast<int64_t>(index));
+	writer.Key("name");
+	writer.String(device.name);
+	writer.Key("instanceName");
+	writer.String(device.instanceName);
+
+	writer.Key("vendorID");
+	WriteDirectInputHex(writer, device.vendorID);
+	writer.Key("productID");
+	WriteDirectInputHex(writer, device.productID);
+
+	writer.Key("productGUID");
+	writer.String(device.productGUIDText, strlen(device.productGUIDText));
+	writer.Key("instanceGUID");
+	writer.String(device.instanceGUIDText, strlen(device.instanceGUIDText));
+
+	writer.Key("dwDevType");
+	WriteDirectInputHex(writer, device.devType);
+	writer.Key("dwDevType_primary");
+	WriteDirectInputHex(writer, device.devType & 0xFF);
+	writer.Key("dwDevType_secondary");
+	WriteDirectInputHex(writer, (device.devType >> 8) & 0xFF);
+	char typeName[DIRECTINPUT_TYPE_NAME_SIZE];
+	writer.Key("typeName");
+	writer.String(typeName, FormatDirectInputTypeName(typeName, device.devType));
+
+	writer.Key("usagePage");
+	WriteDirectInputHex(writer, device.usagePage);
+	writer.Key("usage");
+	WriteDirectInputHex(writer, device.usage);
+	writer.EndObject();
+}
+
+// The whole device list as a JSON array; Devices is a container of
+// DirectInputDeviceInfo or of records derived from it
+template <typename Devices>
+inline void WriteDirectInputDeviceList(JsonOutput& out, const Devices& devices) {
+	JsonTokenWriter writer(out);
+	writer.BeginArray();
+	size_t index = 0;
+	for (const DirectInputDeviceInfo& device : devices) {
+		WriteDirectInputDeviceJson(writer, device, index++);
+	}
+	writer.EndArray();
+}
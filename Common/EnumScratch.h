@@ -0,0 +1,202 @@
+#pragma once
+
+// Allocation-free building blocks for the enumeration and list paths.
+//
+// Listing devices used to allocate for every token: a stringstream per hex
+// value, two std::string copies per converted name (one with the null, one
+// without), and a buffer per SetupDi interface. These helpers format into
+// caller storage instead. FormatHex reads digit pairs from a table built at
+// compile time, Utf16ToUtf8 converts into a scratch buffer up to the null,
+// and MonotonicArena serves the per-interface buffers of one enumeration
+// from a single block that is rewound rather than freed.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstddef>
+#include <new>
+
+// "0x", up to 8 digits and a null
+#define HEX_TEXT_SIZE 11
+// UTF-8 bytes needed per UTF-16 unit in the worst case
+#define UTF8_BYTES_PER_UTF16_UNIT 3
+
+struct HexPairTable {
+	char upper[512];
+	char lower[512];
+};
+
+constexpr HexPairTable MakeHexPairTable() {
+	HexPairTable table = {};
+	const char upper[] = "0123456789ABCDEF";
+	const char lower[] = "0123456789abcdef";
+	for (int i = 0; i < 256; i++) {
+		table.upper[2 * i] = upper[i >> 4];
+		table.upper[2 * i + 1] = upper[i & 0xF];
+		table.lower[2 * i] = lower[i >> 4];
+		table.lower[2 * i + 1] = lower[i & 0xF];
+	}
+	return table;
+}
+
+inline constexpr HexPairTable g_hexPairs = MakeHexPairTable();
+
+// Writes "0x" and at least minDigits hex digits (at most 8), without a
+// null, into text (HEX_TEXT_SIZE chars). Returns the length written.
+inline size_t FormatHex(char* text, uint32_t value, int minDigits, bool upper) {
+	int digits = 1;
+	while (digits < 8 && (value >> (4 * digits)) != 0) {
+		digits++;
+	}
+	if (digits < minDigits) {
+		digits = minDigits < 8 ? minDigits : 8;
+	}
+	const char* pairs = upper ? g_hexPairs.upper : g_hexPairs.lower;
+	text[0] = '0';
+	text[1] = 'x';
+	char* p = text + 2 + digits;
+	int left = digits;
+	for (; left >= 2; left -= 2, value >>= 8) {
+		p -= 2;
+		p[0] = pairs[2 * (value & 0xFF)];
+		p[1] = pairs[2 * (value & 0xFF) + 1];
+	}
+	if (left != 0) {
+		*--p = pairs[2 * (value & 0xF) + 1];
+	}
+	return static_cast<size_t>(2 + digits);
+}
+
+// Converts UTF-16 text up to its null, or maxUnits units, into text (room
+// for maxUnits * UTF8_BYTES_PER_UTF16_UNIT bytes). Unpaired surrogates
+// become U+FFFD, as WideCharToMultiByte does. Returns the bytes written,
+// without a null.
+template <typename Unit>
+inline size_t Utf16ToUtf8(const Unit* units, size_t maxUnits, char* text) {
+	size_t length = 0;
+	for (size_t i = 0; i < maxUnits && units[i] != 0; i++) {
+		uint32_t c = static_cast<uint16_t>(units[i]);
+		if (c >= 0xD800 && c <= 0xDFFF) {
+			uint32_t low = i + 1 < maxUnits ? static_cast<uint16_t>(units[i + 1]) : 0;
+			if (c <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				i++;
+			}
+			else {
+				c = 0xFFFD;
+			}
+		}
+		if (c < 0x80) {
+			text[length++] = static_cast<char>(c);
+		}
+		else if (c < 0x800) {
+			text[length++] = static_cast<char>(0xC0 | (c >> 6));
+			text[length++] = static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			text[length++] = static_cast<char>(0xE0 | (c >> 12));
+			text[length++] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			text[length++] = static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else {
+			text[length++] = static_cast<char>(0xF0 | (c >> 18));
+			text[length++] = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			text[length++] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			text[length++] = static_cast<char>(0x80 | (c & 0x3F));
+		}
+	}
+	return length;
+}
+
+// Bump allocator for the scratch memory of one call. Allocations come from
+// the inline block first, then from heap blocks that double in size.
+// Reset rewinds and keeps only the largest block, so a loop that resets per
+// item allocates at most a few times in total.
+template <size_t InlineSize>
+class MonotonicArena {
+public:
+	MonotonicArena() = default;
+	MonotonicArena(const MonotonicArena&) = delete;
+	MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+	~MonotonicArena() { FreeBlocks(nullptr); }
+
+	// Returns size bytes aligned to align (a power of two), or nullptr if the
+	// heap is exhausted
+	void* Allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+		void* memory = Bump(size, align);
+		if (memory == nullptr && Grow(size + align)) {
+			memory = Bump(size, align);
+		}
+		return memory;
+	}
+
+	// Rewinds; earlier allocations must no longer be used
+	void Reset() {
+		if (m_blocks != nullptr) {
+			FreeBlocks(m_blocks);
+			m_base = reinterpret_cast<unsigned char*>(m_blocks + 1);
+			m_capacity = m_blocks->capacity;
+		}
+		m_used = 0;
+	}
+
+	// Heap blocks allocated so far
+	size_t HeapBlocks() const { return m_heapBlocks; }
+
+private:
+	struct alignas(std::max_align_t) Block {
+		Block* next;
+		size_t capacity;
+	};
+
+	void* Bump(size_t size, size_t align) {
+		uintptr_t start = reinterpret_cast<uintptr_t>(m_base) + m_used;
+		size_t offset = static_cast<size_t>(((start + align - 1) & ~static_cast<uintptr_t>(align - 1)) -
+			reinterpret_cast<uintptr_t>(m_base));
+		if (offset + size > m_capacity) {
+			return nullptr;
+		}
+		m_used = offset + size;
+		return m_base + offset;
+	}
+
+	bool Grow(size_t needed) {
+		size_t capacity = m_capacity * 2 < needed ? needed : m_capacity * 2;
+		Block* block = static_cast<Block*>(::operator new(sizeof(Block) + capacity, std::nothrow));
+		if (block == nullptr) {
+			return false;
+		}
+		block->next = m_blocks;
+		block->capacity = capacity;
+		m_blocks = block;
+		m_heapBlocks++;
+		m_base = reinterpret_cast<unsigned char*>(block + 1);
+		m_capacity = capacity;
+		m_used = 0;
+		return true;
+	}
+
+	// Frees every block after keep (all of them for nullptr). The newest
+	// block is the largest, so Reset keeps the head.
+	void FreeBlocks(Block* keep) {
+		Block* block = keep ? keep->next : m_blocks;
+		while (block != nullptr) {
+			Block* next = block->next;
+			::operator delete(block);
+			block = next;
+		}
+		if (keep) {
+			keep->next = nullptr;
+		}
+		else {
+			m_blocks = nullptr;
+		}
+	}
+
+	alignas(std::max_align_t) unsigned char m_inline[InlineSize];
+	unsigned char* m_base = m_inline;
+	size_t m_capacity = InlineSize;
+	size_t m_used = 0;
+	Block* m_blocks = nullptr;
+	size_t m_heapBlocks = 0;
+};
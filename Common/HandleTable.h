@@ -0,0 +1,263 @@
+#pragma once
+
+// Generation-checked handles for the records behind the exported void*.
+//
+// The exports used to hand out the record's address, so a second
+// CloseJoystick, or a read after close, touched freed memory. HandleTable
+// hands out an index and a generation packed into the pointer value
+// instead. Looking a handle up checks the index and compares the
+// generation with the slot's, which changes every time the slot is freed,
+// so stale or made-up handles are rejected in O(1). Records live in
+// cache-line aligned slots of fixed-size chunks that are never freed or
+// moved while the table exists: opening and closing devices reuses slots
+// instead of going through the heap, and a record's address is stable.
+//
+// A handle may be closed while other threads still use it. Acquire counts
+// a reference in the slot's state word with a compare-and-swap, without a
+// lock; Destroy only marks the slot closed, so no new reference can be
+// taken, and the record is destroyed by whichever of Destroy and the last
+// Ref releasing it comes last. The record's destructor therefore releases
+// the device, possibly on a reading thread.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#define HANDLE_TABLE_CHUNK_SLOTS 64
+#define HANDLE_TABLE_MAX_CHUNKS 1024
+#define HANDLE_TABLE_CACHE_LINE 64
+
+// Index bits of a handle; the generation takes the rest of the pointer
+#define HANDLE_TABLE_INDEX_BITS (sizeof(void*) >= 8 ? 32 : 16)
+
+template <typename T>
+class HandleTable {
+public:
+	HandleTable() {
+		for (auto& chunk : m_chunks) {
+			chunk.store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	HandleTable(const HandleTable&) = delete;
+	HandleTable& operator=(const HandleTable&) = delete;
+
+	~HandleTable() {
+		for (auto& chunkPointer : m_chunks) {
+			Slot* chunk = chunkPointer.load(std::memory_order_relaxed);
+			if (chunk == nullptr) {
+				continue;
+			}
+			for (size_t i = 0; i < HANDLE_TABLE_CHUNK_SLOTS; i++) {
+				if (chunk[i].state.load(std::memory_order_relaxed) & LiveBit) {
+					chunk[i].Record()->~T();
+				}
+			}
+			delete[] chunk;
+		}
+	}
+
+	// A counted reference to a record; empty for an invalid handle. The
+	// record is not destroyed before the last Ref to it is gone.
+	class Ref {
+	public:
+		Ref() = default;
+		Ref(Ref&& other) noexcept : m_table(other.m_table), m_index(other.m_index), m_record(other.m_record) {
+			other.m_record = nullptr;
+		}
+		Ref(const Ref&) = delete;
+		Ref& operator=(const Ref&) = delete;
+		~Ref() {
+			if (m_record) {
+				m_table->Release(m_index);
+			}
+		}
+
+		T* get() const { return m_record; }
+		T* operator->() const { return m_record; }
+		operator T*() const { return m_record; }
+
+	private:
+		friend class HandleTable;
+		Ref(HandleTable* table, uint32_t index, T* record) : m_table(table), m_index(index), m_record(record) {}
+
+		HandleTable* m_table = nullptr;
+		uint32_t m_index = 0;
+		T* m_record = nullptr;
+	};
+
+	// Constructs a record in a free slot and returns its handle (never
+	// nullptr), or nullptr when the table is full or out of memory
+	template <typename... Args>
+	void* Create(T*& record, Args&&... args) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		uint32_t index;
+		if (!m_free.empty()) {
+			index = m_free.back();
+			m_free.pop_back();
+		}
+		else {
+			if (!Grow()) {
+				record = nullptr;
+				return nullptr;
+			}
+			index = m_slots++;
+		}
+		Slot& slot = At(index);
+		record = new (slot.storage) T(std::forward<Args>(args)...);
+		uint64_t generation = slot.state.load(std::memory_order_relaxed) >> 32;
+		slot.state.store((generation << 32) | LiveBit, std::memory_order_release);
+		m_live++;
+		return Encode(index, static_cast<uint32_t>(generation));
+	}
+
+	// A reference to the record of a handle; empty for a closed, stale or
+	// made-up one. Lock-free.
+	Ref Acquire(void* handle) {
+		uint32_t index;
+		uint32_t generation;
+		if (!Decode(handle, index, generation)) {
+			return Ref();
+		}
+		Slot& slot = At(index);
+		uint64_t state = slot.state.load(std::memory_order_acquire);
+		do {
+			if ((state >> 32) != generation || (state & LiveBit) == 0 || (state & RefMask) == RefMask) {
+				return Ref();
+			}
+		} while (!slot.state.compare_exchange_weak(state, state + 1, std::memory_order_acquire));
+		return Ref(this, index, slot.Record());
+	}
+
+	// Closes the handle: every copy of it is rejected from now on, and the
+	// record is destroyed now, or when the last Ref to it is released.
+	// Returns false if the handle was not valid.
+	bool Destroy(void* handle) {
+		uint32_t index;
+		uint32_t generation;
+		if (!Decode(handle, index, generation)) {
+			return false;
+		}
+		Slot& slot = At(index);
+		uint64_t state = slot.state.load(std::memory_order_acquire);
+		do {
+			if ((state >> 32) != generation || (state & LiveBit) == 0) {
+				return false; // Closed already, by this or another thread
+			}
+		} while (!slot.state.compare_exchange_weak(state, state & ~LiveBit, std::memory_order_acq_rel));
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_live--;
+		}
+		if ((state & RefMask) == 0) {
+			Reclaim(index, generation);
+		}
+		return true;
+	}
+
+	// Open handles (records of closed handles may still be referenced)
+	size_t Live() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_live;
+	}
+
+	// Slots ever used; only grows when more records are open at once
+	size_t Slots() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_slots;
+	}
+
+	static size_t MaxSlots() {
+		size_t indexLimit = (static_cast<size_t>(1) << HANDLE_TABLE_INDEX_BITS) - 1;
+		size_t chunkLimit = static_cast<size_t>(HANDLE_TABLE_MAX_CHUNKS) * HANDLE_TABLE_CHUNK_SLOTS;
+		return indexLimit < chunkLimit ? indexLimit : chunkLimit;
+	}
+
+private:
+	// Slot state: generation in the high 32 bits, LiveBit while the handle
+	// is open, and the number of Refs in the bits below
+	static const uint64_t LiveBit = 1ULL << 31;
+	static const uint64_t RefMask = LiveBit - 1;
+
+	struct alignas(HANDLE_TABLE_CACHE_LINE) Slot {
+		alignas(T) unsigned char storage[sizeof(T)];
+		std::atomic<uint64_t> state{ 1ULL << 32 };
+
+		T* Record() { return std::launder(reinterpret_cast<T*>(storage)); }
+	};
+
+	void Release(uint32_t index) {
+		Slot& slot = At(index);
+		uint64_t state = slot.state.fetch_sub(1, std::memory_order_acq_rel);
+		if ((state & RefMask) == 1 && (state & LiveBit) == 0) {
+			Reclaim(index, static_cast<uint32_t>(state >> 32)); // Closed meanwhile; last user
+		}
+	}
+
+	// Destroys the record of a closed slot nobody references any more and
+	// makes the slot available with the next generation
+	void Reclaim(uint32_t index, uint32_t generation) {
+		Slot& slot = At(index);
+		slot.Record()->~T();
+		slot.state.store(static_cast<uint64_t>(NextGeneration(generation)) << 32, std::memory_order_release);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.push_back(index);
+	}
+
+	static const uint32_t GenerationMask = HANDLE_TABLE_INDEX_BITS >= 32 ? 0xFFFFFFFFu :
+		static_cast<uint32_t>((static_cast<uint64_t>(1) << (sizeof(void*) * 8 - HANDLE_TABLE_INDEX_BITS)) - 1);
+
+	// Never 0, so a handle is never a small integer or nullptr
+	static uint32_t NextGeneration(uint32_t generation) {
+		generation = (generation + 1) & GenerationMask;
+		return generation == 0 ? 1 : generation;
+	}
+
+	static void* Encode(uint32_t index, uint32_t generation) {
+		uintptr_t value = (static_cast<uintptr_t>(generation) << HANDLE_TABLE_INDEX_BITS) | (index + 1);
+		return reinterpret_cast<void*>(value);
+	}
+
+	bool Decode(void* handle, uint32_t& index, uint32_t& generation) const {
+		uintptr_t value = reinterpret_cast<uintptr_t>(handle);
+		uintptr_t indexMask = (static_cast<uintptr_t>(1) << HANDLE_TABLE_INDEX_BITS) - 1;
+		uintptr_t slot = value & indexMask;
+		index = static_cast<uint32_t>(slot - 1);
+		generation = static_cast<uint32_t>(value >> HANDLE_TABLE_INDEX_BITS);
+		return slot != 0 && index < m_published.load(std::memory_order_acquire);
+	}
+
+	Slot& At(uint32_t index) const {
+		Slot* chunk = m_chunks[index / HANDLE_TABLE_CHUNK_SLOTS].load(std::memory_order_acquire);
+		return chunk[index % HANDLE_TABLE_CHUNK_SLOTS];
+	}
+
+	// Makes sure slot m_slots exists; called with m_mutex held
+	bool Grow() {
+		if (m_slots >= MaxSlots()) {
+			return false;
+		}
+		size_t chunkIndex = m_slots / HANDLE_TABLE_CHUNK_SLOTS;
+		if (m_chunks[chunkIndex].load(std::memory_order_relaxed) == nullptr) {
+			Slot* chunk = new (std::nothrow) Slot[HANDLE_TABLE_CHUNK_SLOTS];
+			if (chunk == nullptr) {
+				return false;
+			}
+			m_chunks[chunkIndex].store(chunk, std::memory_order_release);
+			m_published.store(static_cast<uint32_t>((chunkIndex + 1) * HANDLE_TABLE_CHUNK_SLOTS),
+				std::memory_order_release);
+		}
+		return true;
+	}
+
+	mutable std::mutex m_mutex;
+	std::atomic<Slot*> m_chunks[HANDLE_TABLE_MAX_CHUNKS];
+	std::atomic<uint32_t> m_published{ 0 }; // Slots whose chunk exists
+	uint32_t m_slots = 0;
+	size_t m_live = 0;
+	std::vector<uint32_t> m_free;           // Freed slots, reused last in first out
+};
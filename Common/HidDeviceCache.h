@@ -0,0 +1,978 @@
+#pragma once
+
+// Process-wide snapshot of the HID interfaces.
+//
+// Enumerating HID devices walks SetupDi and opens every interface, which
+// takes hundreds of milliseconds on machines with many devices. The cache
+// keeps the last result and only enumerates again after Invalidate() (called
+// from the device arrival/removal notification). A refresh probes only the
+// interfaces that are new, and records arrivals and removals as events tagged
+// with the snapshot generation. The platform part is behind HidEnumerator,
+// so the cache can be driven by a scripted enumerator in tests.
+//
+// Probing is dominated by synchronous USB control transfers, so the devices
+// of a refresh are queued to a fixed pool of threads that the cache starts
+// on first use and stops in Shutdown. Every probe writes only its own
+// record, which keeps the enumeration order intact. A probe that misses its
+// deadline (a hung composite device, say) is left running on its thread:
+// its record is marked incomplete and the late result is merged into the
+// snapshot on a later Get. The other threads carry on with the queue; if
+// none of them gets to a device within a deadline, it is reported
+// incomplete too rather than holding up the caller. Incomplete records are
+// queued again by later Gets once no probe of theirs is running, waiting
+// twice as long after each miss.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ButtonEdges.h"
+
+// Default number of threads probing devices concurrently
+#define HID_PROBE_THREADS 8
+
+// Default time one device probe may take before it is reported incomplete
+#define HID_PROBE_DEADLINE_MS 500
+
+// Default wait before an incomplete record is probed again; doubled after
+// every further miss, up to HID_PROBE_RETRY_MAX_MS
+#define HID_PROBE_RETRY_MS 1000
+#define HID_PROBE_RETRY_MAX_MS 60000
+
+// Field groups of a device record. Each group costs its own queries, so a
+// caller that only needs VID/PID does not pay for strings or capabilities.
+enum HidDeviceFields : uint32_t {
+	HidFieldPath = 1u << 0,         // Interface path (no open needed)
+	HidFieldAttributes = 1u << 1,   // vendorID, productID, versionNumber
+	HidFieldProduct = 1u << 2,      // Product string
+	HidFieldManufacturer = 1u << 3, // Manufacturer string
+	HidFieldSerialNumber = 1u << 4, // Serial number string
+	HidFieldCaps = 1u << 5,         // usage, usagePage, report lengths and cap counts
+	HidFieldAxes = 1u << 6,         // axesTotal and povTotal (value caps)
+	HidFieldButtons = 1u << 7,      // buttonsTotal (button caps)
+	HidFieldAll = 0xFFu,
+	// Groups that need the interface opened
+	HidFieldsOpened = HidFieldAll & ~HidFieldPath,
+	// Groups that need the preparsed data
+	HidFieldsPreparsed = HidFieldCaps | HidFieldAxes | HidFieldButtons,
+};
+
+// Everything GetHIDDeviceList reports about one interface
+struct HidDeviceRecord {
+	std::string path;           // Interface path, always set
+	uint32_t fields = HidFieldPath; // Field groups already probed (successfully or not)
+	bool incomplete = false;    // A probe missed its deadline or never ran; retried later
+	bool seeded = false;        // Taken from Seed and not yet checked against the device
+	bool opened = false;        // The interface could be opened for probing
+	bool readWriteDenied = false; // A read/write open failed; later probes only use zero-access handles
+	bool hasAttributes = false; // vendorID, productID and versionNumber are valid
+	bool hasCaps = false;       // usage, usagePage and the counts below are valid
+	uint16_t vendorID = 0;
+	uint16_t productID = 0;
+	uint16_t versionNumber = 0;
+	std::string product;        // UTF-8, empty if the query failed
+	std::string manufacturer;
+	std::string serialNumber;
+	uint16_t usage = 0;
+	uint16_t usagePage = 0;
+	uint16_t inputReportByteLength = 0;
+	uint16_t outputReportByteLength = 0;
+	uint16_t featureReportByteLength = 0;
+	uint16_t numberOfLinkCollectionNodes = 0;
+	uint16_t numberOfInputButtonCaps = 0;
+	uint16_t numberOfInputValueCaps = 0;
+	uint16_t numberOfInputDataIndices = 0;
+	uint16_t numberOfOutputButtonCaps = 0;
+	uint16_t numberOfOutputValueCaps = 0;
+	uint16_t numberOfOutputDataIndices = 0;
+	uint16_t numberOfFeatureButtonCaps = 0;
+	uint16_t numberOfFeatureValueCaps = 0;
+	uint16_t numberOfFeatureDataIndices = 0;
+	int axesTotal = 0;
+	int buttonsTotal = 0;
+	int povTotal = 0;
+};
+
+// Platform access used by the cache
+class HidEnumerator {
+public:
+	virtual ~HidEnumerator() {}
+
+	// Lists the interface paths in enumeration order. Returns false on failure.
+	virtual bool EnumeratePaths(std::vector<std::string>& paths) = 0;
+
+	// Opens one interface and queries the requested field groups.
+	// record.path is already set; groups in record.fields are skipped.
+	// Called concurrently for different records, and may still be running
+	// after the cache gave up on it.
+	virtual void Probe(HidDeviceRecord& record, uint32_t fields) = 0;
+
+	// Asks the probes now running to give up, e.g. by cancelling their
+	// pending I/O. Called by HidDeviceCache::Shutdown from another thread.
+	virtual void CancelProbes() {}
+};
+
+// Strips spaces, tabs and line breaks from both ends
+inline std::string TrimDeviceString(const std::string& str) {
+	size_t start = str.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos) return std::string();
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(start, end - start + 1);
+}
+
+// Lookup keys for the snapshot indexes
+inline uint32_t HidVendorProductKey(uint16_t vendorID, uint16_t productID) {
+	return (static_cast<uint32_t>(vendorID) << 16) | productID;
+}
+
+inline uint64_t HidUsageKey(uint16_t vendorID, uint16_t productID, uint16_t usagePage, uint16_t usage) {
+	return (static_cast<uint64_t>(HidVendorProductKey(vendorID, productID)) << 32) |
+		(static_cast<uint32_t>(usagePage) << 16) | usage;
+}
+
+inline std::string HidSerialKey(uint16_t vendorID, uint16_t productID, const std::string& serialNumber) {
+	char prefix[4] = { static_cast<char>(vendorID >> 8), static_cast<char>(vendorID),
+		static_cast<char>(productID >> 8), static_cast<char>(productID) };
+	return std::string(prefix, sizeof(prefix)) + TrimDeviceString(serialNumber);
+}
+
+struct HidSnapshot {
+	uint64_t generation = 0;
+	uint32_t fields = HidFieldPath;       // Field groups probed on every device
+	std::vector<HidDeviceRecord> devices; // Enumeration order; the index is the device id
+
+	// Hash indexes over devices, each mapping a key to the first matching
+	// interface. The cache builds them before publishing a snapshot; an
+	// unindexed snapshot is searched linearly.
+	bool indexed = false;
+	std::unordered_map<std::string, int> byPath;
+	std::unordered_map<uint32_t, int> byVendorAndProduct;
+	std::unordered_map<uint64_t, int> byUsage;       // VID, PID, usage page, usage
+	std::unordered_map<std::string, int> byProduct;  // Trimmed product string
+	std::unordered_map<std::string, int> bySerial;   // HidSerialKey
+
+	void BuildIndex() {
+		byPath.clear();
+		byVendorAndProduct.clear();
+		byUsage.clear();
+		byProduct.clear();
+		bySerial.clear();
+		for (size_t i = 0; i < devices.size(); i++) {
+			const HidDeviceRecord& device = devices[i];
+			int index = static_cast<int>(i);
+			// emplace keeps the first interface for each key
+			byPath.emplace(device.path, index);
+			if (device.opened) {
+				byProduct.emplace(TrimDeviceString(device.product), index);
+			}
+			if (!device.hasAttributes) {
+				continue;
+			}
+			byVendorAndProduct.emplace(HidVendorProductKey(device.vendorID, device.productID), index);
+			if (device.hasCaps) {
+				byUsage.emplace(HidUsageKey(device.vendorID, device.productID, device.usagePage, device.usage), index);
+			}
+			if (!device.serialNumber.empty()) {
+				bySerial.emplace(HidSerialKey(device.vendorID, device.productID, device.serialNumber), index);
+			}
+		}
+		indexed = true;
+	}
+
+	// Index of the interface with this path, or -1
+	int Find(const std::string& path) const {
+		if (indexed) return Lookup(byPath, path);
+		for (size_t i = 0; i < devices.size(); i++) {
+			if (devices[i].path == path) return static_cast<int>(i);
+		}
+		return -1;
+	}
+
+	// First interface with this VID/PID, or -1
+	int FindByVendorAndProductID(uint16_t vendorID, uint16_t productID) const {
+		if (indexed) return Lookup(byVendorAndProduct, HidVendorProductKey(vendorID, productID));
+		for (size_t i = 0; i < devices.size(); i++) {
+			const HidDeviceRecord& device = devices[i];
+			if (device.hasAttributes && device.vendorID == vendorID && device.productID == productID) {
+				return static_cast<int>(i);
+			}
+		}
+		return -1;
+	}
+
+	// First interface with this VID/PID and top-level collection usage, or -1
+	int FindByUsage(uint16_t vendorID, uint16_t productID, uint16_t usagePage, uint16_t usage) const {
+		if (indexed) return Lookup(byUsage, HidUsageKey(vendorID, productID, usagePage, usage));
+		for (size_t i = 0; i < devices.size(); i++) {
+			const HidDeviceRecord& device = devices[i];
+			if (device.hasAttributes && device.hasCaps && device.vendorID == vendorID &&
+				device.productID == productID && device.usagePage == usagePage && device.usage == usage) {
+				return static_cast<int>(i);
+			}
+		}
+		return -1;
+	}
+
+	// First interface whose product string matches, ignoring surrounding whitespace, or -1
+	int FindByProductString(const std::string& name) const {
+		std::string wanted = TrimDeviceString(name);
+		if (indexed) return Lookup(byProduct, wanted);
+		for (size_t i = 0; i < devices.size(); i++) {
+			if (devices[i].opened && TrimDeviceString(devices[i].product) == wanted) {
+				return static_cast<int>(i);
+			}
+		}
+		return -1;
+	}
+
+	// First interface with this VID/PID and serial number, or -1
+	int FindBySerialNumber(uint16_t vendorID, uint16_t productID, const std::string& serialNumber) const {
+		if (indexed) return Lookup(bySerial, HidSerialKey(vendorID, productID, serialNumber));
+		std::string wanted = TrimDeviceString(serialNumber);
+		for (size_t i = 0; i < devices.size(); i++) {
+			const HidDeviceRecord& device = devices[i];
+			if (device.hasAttributes && device.vendorID == vendorID && device.productID == productID &&
+				!device.serialNumber.empty() && TrimDeviceString(device.serialNumber) == wanted) {
+				return static_cast<int>(i);
+			}
+		}
+		return -1;
+	}
+
+private:
+	template <typename Map, typename Key>
+	static int Lookup(const Map& map, const Key& key) {
+		auto it = map.find(key);
+		return it != map.end() ? it->second : -1;
+	}
+};
+
+enum HidDeviceChangeKind {
+	HidDeviceArrival = 1,
+	HidDeviceRemoval = 2,
+};
+
+struct HidDeviceChange {
+	int kind = 0;
+	uint64_t generation = 0; // Generation of the snapshot that first reflects the change
+	int index = -1;          // Index in that snapshot (arrival) or the previous one (removal)
+	HidDeviceRecord device;
+};
+
+// Number of arrival/removal events kept before the oldest are dropped
+#define HID_DEVICE_CHANGE_QUEUE_SIZE 64
+
+class HidDeviceCache {
+public:
+	// Marks the snapshot stale; safe to call from any thread
+	void Invalidate() { m_dirty.store(true, std::memory_order_release); }
+
+	// Enumerate on every Get, for when change notifications are unavailable
+	void SetAlwaysRefresh(bool alwaysRefresh) { m_alwaysRefresh.store(alwaysRefresh); }
+
+	// Number of probe threads. Takes effect when they start: on the first
+	// probe, or the first one after Shutdown.
+	void SetProbeThreads(unsigned threads) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_probeThreads = threads < 1 ? 1 : threads;
+	}
+
+	// Time one device probe may take before its record is returned incomplete.
+	// 0 waits for every probe; with one thread it then probes on the caller's thread.
+	void SetProbeDeadline(uint32_t deadlineMs) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_probeDeadline = std::chrono::milliseconds(deadlineMs);
+	}
+
+	// First wait before an incomplete record is probed again
+	void SetProbeRetryDelay(uint32_t delayMs) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_retryDelay = std::chrono::milliseconds(delayMs);
+	}
+
+	// Returns the current snapshot with at least the requested field groups,
+	// enumerating first if it is stale and probing only what is missing
+	// (incomplete records included, once their retry is due).
+	// Returns nullptr only if no enumeration has ever succeeded.
+	std::shared_ptr<const HidSnapshot> Get(const std::shared_ptr<HidEnumerator>& enumerator,
+		uint32_t fields = HidFieldAll) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		MergeLateProbes();
+		if (m_dirty.exchange(false, std::memory_order_acq_rel) || m_alwaysRefresh.load() || !m_snapshot) {
+			if (!Refresh(enumerator, fields)) {
+				m_dirty.store(true, std::memory_order_release); // Try again next time
+			}
+		}
+		if (m_snapshot && ((m_snapshot->fields & fields) != fields || RetryDue())) {
+			Complete(enumerator, m_snapshot->fields | fields);
+		}
+		return m_snapshot;
+	}
+
+	// Current snapshot as is, without enumerating or probing; may be nullptr.
+	// Does not wait for a Get that is enumerating or probing.
+	std::shared_ptr<const HidSnapshot> Peek() const {
+		return std::atomic_load(&m_snapshot);
+	}
+
+	// Generation of the current snapshot, 0 before the first enumeration
+	uint64_t Generation() const {
+		std::shared_ptr<const HidSnapshot> snapshot = Peek();
+		return snapshot ? snapshot->generation : 0;
+	}
+
+	// Removes up to maxEvents queued changes, oldest first
+	size_t PopChanges(HidDeviceChange* out, size_t maxEvents) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_changes.Pop(out, maxEvents);
+	}
+
+	uint64_t DroppedChanges() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_changes.Dropped();
+	}
+
+	// Number of Probe calls so far
+	uint64_t Probes() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_probes;
+	}
+
+	// Records saved by an earlier run (see HidDeviceStore.h). The next
+	// enumerations use the record for a path instead of probing it, without
+	// opening the device; Verify checks it when a lookup first returns it.
+	void Seed(const std::vector<HidDeviceRecord>& records) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_seeds.clear();
+		for (const auto& record : records) {
+			if (!record.incomplete && !record.path.empty()) {
+				m_seeds[record.path] = record;
+			}
+		}
+	}
+
+	// Number of seeded records adopted so far
+	uint64_t SeedsAdopted() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_seedsAdopted;
+	}
+
+	// Checks a record taken from Seed before a lookup or open relies on it:
+	// an attributes probe must find the same VID/PID/version, or the record
+	// is probed again in full at the same index. Returns the current
+	// snapshot, which is unchanged if there was nothing to check or the
+	// check missed its deadline (the record then stays unchecked).
+	std::shared_ptr<const HidSnapshot> Verify(const std::shared_ptr<HidEnumerator>& enumerator,
+		const std::string& path) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int index = m_snapshot ? m_snapshot->Find(path) : -1;
+		if (index < 0 || !m_snapshot->devices[index].seeded) {
+			return m_snapshot;
+		}
+		std::vector<HidDeviceRecord> check(1);
+		check[0].path = path;
+		ProbeMissing(enumerator, check, HidFieldAttributes);
+		if (check[0].incomplete) {
+			m_retries.erase(path); // Checked again on its next use instead
+			return m_snapshot;
+		}
+		auto next = std::make_shared<HidSnapshot>(*m_snapshot);
+		HidDeviceRecord& record = next->devices[index];
+		if (SameDevice(check[0], record)) {
+			record.seeded = false;
+		}
+		else {
+			// Another device took the path; probe it like a new arrival
+			ProbeMissing(enumerator, check, next->fields);
+			record = check[0];
+		}
+		Publish(next);
+		return m_snapshot;
+	}
+
+	// Number of probes that missed their deadline and have not finished yet
+	size_t LateProbes() const {
+		std::lock_guard<std::mutex> lock(m_late->mutex);
+		return m_late->running.size();
+	}
+
+	// Stops the probe threads without taking the lock Get holds while it
+	// probes. Probes still running are asked to cancel (HidEnumerator::
+	// CancelProbes) and given up to waitMs to return; a probe that already
+	// missed its deadline is not waited for. Returns the number of threads
+	// left inside a probe: each exits once its probe returns (a late result
+	// still reaches the next Get), and runs the enumerator's code until
+	// then. The next probe starts a new set of threads.
+	size_t Shutdown(uint32_t waitMs = HID_PROBE_DEADLINE_MS) {
+		return m_pool.Stop(std::chrono::milliseconds(waitMs));
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// Results of probes that missed their deadline. Shared with the probe
+	// threads, which finish them after the call that queued them returned.
+	struct LateResults {
+		std::mutex mutex;
+		std::unordered_multiset<std::string> running; // Paths
+		std::vector<HidDeviceRecord> records;
+	};
+
+	// When an incomplete record is probed next
+	struct ProbeRetry {
+		Clock::time_point due;
+		Clock::duration delay;
+	};
+
+	enum TaskState { TaskQueued, TaskRunning, TaskDone, TaskAbandoned, TaskWithdrawn };
+
+	struct ProbeTask {
+		HidDeviceRecord record;
+		TaskState state = TaskQueued;
+		Clock::time_point started;
+	};
+
+	// One set of probes, owned jointly by the caller and the pool
+	struct ProbeBatch {
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::vector<ProbeTask> tasks;
+		Clock::time_point progress; // Last time a task started or finished
+		uint32_t fields = 0;
+		std::shared_ptr<HidEnumerator> enumerator;
+		std::shared_ptr<LateResults> late;
+	};
+
+	// Runs one task of a batch unless the caller withdrew it
+	static void RunTask(const std::shared_ptr<ProbeBatch>& batch, size_t i) {
+		std::unique_lock<std::mutex> lock(batch->mutex);
+		ProbeTask& task = batch->tasks[i];
+		if (task.state != TaskQueued) {
+			return;
+		}
+		task.state = TaskRunning;
+		task.started = Clock::now();
+		batch->progress = task.started;
+		HidDeviceRecord record = task.record;
+		batch->changed.notify_all(); // The caller now has a deadline to wait for
+		lock.unlock();
+
+		batch->enumerator->Probe(record, batch->fields);
+		record.fields |= batch->fields;
+
+		lock.lock();
+		if (task.state == TaskAbandoned) {
+			// The caller moved on; hand the result to the next Get
+			std::lock_guard<std::mutex> lateLock(batch->late->mutex);
+			batch->late->running.erase(batch->late->running.find(record.path));
+			batch->late->records.push_back(record);
+			return;
+		}
+		task.record = record;
+		task.state = TaskDone;
+		batch->progress = Clock::now();
+		batch->changed.notify_all();
+	}
+
+	// Fixed set of threads running the tasks of every batch in turn. The
+	// threads keep their state alive through a shared_ptr, so one that Stop
+	// leaves inside a hung probe can still return and exit on its own later.
+	class ProbePool {
+	public:
+		ProbePool() = default;
+		ProbePool(const ProbePool&) = delete;
+		ProbePool& operator=(const ProbePool&) = delete;
+
+		~ProbePool() { Stop(std::chrono::milliseconds(HID_PROBE_DEADLINE_MS)); }
+
+		// Starts count threads if none are running
+		void Start(size_t count) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_threads.empty()) {
+				return;
+			}
+			m_shared = std::make_shared<Shared>();
+			m_shared->workers.resize(count);
+			for (size_t t = 0; t < count; t++) {
+				std::shared_ptr<Shared> shared = m_shared;
+				m_threads.emplace_back([shared, t] { Run(shared, t); });
+			}
+		}
+
+		// Queues every task of the batch. Tasks posted after Stop are withdrawn.
+		void Post(const std::shared_ptr<ProbeBatch>& batch) {
+			std::shared_ptr<Shared> shared;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				shared = m_shared;
+			}
+			if (shared) {
+				std::lock_guard<std::mutex> lock(shared->mutex);
+				if (!shared->stop) {
+					for (size_t i = 0; i < batch->tasks.size(); i++) {
+						shared->queue.push_back(Job{ batch, i });
+					}
+					shared->wake.notify_all();
+					return;
+				}
+			}
+			for (size_t i = 0; i < batch->tasks.size(); i++) {
+				Withdraw(Job{ batch, i });
+			}
+		}
+
+		// Stops the threads and returns how many were left running. Queued
+		// tasks are withdrawn and the enumerators of running probes are asked
+		// to cancel them. Stop then waits up to wait for the threads to return,
+		// except those in a probe the caller already gave up on; threads still
+		// in a probe after that are detached and exit when it returns.
+		size_t Stop(Clock::duration wait) {
+			std::shared_ptr<Shared> shared;
+			std::vector<std::thread> threads;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				shared.swap(m_shared);
+				threads.swap(m_threads);
+			}
+			if (!shared) {
+				return 0;
+			}
+
+			std::deque<Job> dropped;
+			std::vector<std::shared_ptr<HidEnumerator>> probing;
+			{
+				std::lock_guard<std::mutex> lock(shared->mutex);
+				shared->stop = true;
+				dropped.swap(shared->queue);
+				for (const auto& worker : shared->workers) {
+					if (worker.job.batch && std::find(probing.begin(), probing.end(),
+						worker.job.batch->enumerator) == probing.end()) {
+						probing.push_back(worker.job.batch->enumerator);
+					}
+				}
+			}
+			shared->wake.notify_all();
+			for (const auto& job : dropped) {
+				Withdraw(job);
+			}
+			for (const auto& enumerator : probing) {
+				enumerator->CancelProbes();
+			}
+
+			// Abandoning a task does not wake this wait, so look again now and then
+			Clock::time_point until = Clock::now() + wait;
+			std::unique_lock<std::mutex> lock(shared->mutex);
+			while (!Settled(*shared) && Clock::now() < until) {
+				shared->exited.wait_until(lock, (std::min)(until, Clock::now() + std::chrono::milliseconds(10)));
+			}
+			std::vector<bool> exited;
+			for (const auto& worker : shared->workers) {
+				exited.push_back(worker.exited);
+			}
+			lock.unlock();
+
+			size_t left = 0;
+			for (size_t t = 0; t < threads.size(); t++) {
+				if (exited[t]) {
+					threads[t].join();
+				}
+				else {
+					threads[t].detach();
+					left++;
+				}
+			}
+			return left;
+		}
+
+	private:
+		struct Job {
+			std::shared_ptr<ProbeBatch> batch;
+			size_t task = 0;
+		};
+
+		struct Worker {
+			Job job; // Task being probed, if any
+			bool exited = false;
+		};
+
+		// State of one set of threads, shared by them and the pool
+		struct Shared {
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::condition_variable exited;
+			std::deque<Job> queue;
+			std::vector<Worker> workers;
+			bool stop = false;
+		};
+
+		static void Run(const std::shared_ptr<Shared>& shared, size_t t) {
+			std::unique_lock<std::mutex> lock(shared->mutex);
+			for (;;) {
+				shared->wake.wait(lock, [&] { return shared->stop || !shared->queue.empty(); });
+				if (shared->stop) {
+					break;
+				}
+				Job job = std::move(shared->queue.front());
+				shared->queue.pop_front();
+				shared->workers[t].job = job;
+				lock.unlock();
+				RunTask(job.batch, job.task);
+				lock.lock();
+				shared->workers[t].job = Job();
+			}
+			shared->workers[t].exited = true;
+			shared->exited.notify_all();
+		}
+
+		// Whether Stop is done waiting: every thread has exited or is in a
+		// probe that missed its deadline
+		static bool Settled(const Shared& shared) {
+			for (const auto& worker : shared.workers) {
+				if (worker.exited) {
+					continue;
+				}
+				if (!worker.job.batch) {
+					return false;
+				}
+				std::lock_guard<std::mutex> lock(worker.job.batch->mutex);
+				if (worker.job.batch->tasks[worker.job.task].state != TaskAbandoned) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Tells the caller waiting for a batch that a task will not run
+		static void Withdraw(const Job& job) {
+			std::lock_guard<std::mutex> lock(job.batch->mutex);
+			ProbeTask& task = job.batch->tasks[job.task];
+			if (task.state == TaskQueued) {
+				task.state = TaskWithdrawn;
+			}
+			job.batch->changed.notify_all();
+		}
+
+		std::mutex m_mutex; // Guards m_shared and m_threads
+		std::shared_ptr<Shared> m_shared;
+		std::vector<std::thread> m_threads;
+	};
+
+	// Folds finished late probes into the snapshot, keeping its generation
+	void MergeLateProbes() {
+		std::vector<HidDeviceRecord> records;
+		{
+			std::lock_guard<std::mutex> lock(m_late->mutex);
+			records.swap(m_late->records);
+		}
+		if (records.empty() || !m_snapshot) {
+			return;
+		}
+		auto next = std::make_shared<HidSnapshot>(*m_snapshot);
+		for (auto& record : records) {
+			m_retries.erase(record.path);
+			int index = next->Find(record.path);
+			if (index >= 0 && next->devices[index].incomplete) {
+				next->devices[index] = record;
+				// Groups requested while the probe was hung are still missing
+				next->fields &= record.fields;
+			}
+		}
+		Publish(next);
+	}
+
+	// True if some incomplete record may be probed again now
+	bool RetryDue() const {
+		if (m_retries.empty()) {
+			return false;
+		}
+		Clock::time_point now = Clock::now();
+		std::lock_guard<std::mutex> lock(m_late->mutex);
+		for (const auto& retry : m_retries) {
+			if (retry.second.due <= now && m_late->running.count(retry.first) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Whether an incomplete record is probed now: not while a late probe of
+	// it is still running, nor before its retry is due
+	bool Retry(const std::string& path, Clock::time_point now) const {
+		auto it = m_retries.find(path);
+		if (it != m_retries.end() && now < it->second.due) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_late->mutex);
+		return m_late->running.count(path) == 0;
+	}
+
+	// Puts off the next probe of an incomplete record, twice as long as the last time
+	void ScheduleRetry(const std::string& path, Clock::time_point now) {
+		Clock::duration limit = std::chrono::milliseconds(HID_PROBE_RETRY_MAX_MS);
+		auto it = m_retries.find(path);
+		Clock::duration delay = it == m_retries.end() ? Clock::duration(m_retryDelay) : it->second.delay * 2;
+		if (delay > limit) {
+			delay = limit;
+		}
+		ProbeRetry& retry = m_retries[path];
+		retry.delay = delay;
+		retry.due = now + delay;
+	}
+
+	// Probes the records that lack some of the requested groups. Incomplete
+	// records are probed again only when their retry is due.
+	void ProbeMissing(const std::shared_ptr<HidEnumerator>& enumerator,
+		std::vector<HidDeviceRecord>& records, uint32_t fields) {
+		std::vector<size_t> pending;
+		Clock::time_point now = Clock::now();
+		for (size_t i = 0; i < records.size(); i++) {
+			if ((records[i].fields & fields) != fields &&
+				(!records[i].incomplete || Retry(records[i].path, now))) {
+				pending.push_back(i);
+			}
+		}
+		m_probes += pending.size();
+		if (pending.empty()) {
+			return;
+		}
+
+		if (m_probeThreads == 1 && m_probeDeadline.count() == 0) {
+			for (size_t i : pending) {
+				records[i].incomplete = false;
+				enumerator->Probe(records[i], fields);
+				records[i].fields |= fields;
+				m_retries.erase(records[i].path);
+			}
+			return;
+		}
+
+		auto batch = std::make_shared<ProbeBatch>();
+		batch->fields = fields;
+		batch->enumerator = enumerator;
+		batch->late = m_late;
+		batch->tasks.resize(pending.size());
+		for (size_t t = 0; t < pending.size(); t++) {
+			batch->tasks[t].record = records[pending[t]];
+			batch->tasks[t].record.incomplete = false;
+		}
+		batch->progress = Clock::now();
+		m_pool.Start(m_probeThreads);
+		m_pool.Post(batch);
+
+		bool timed = m_probeDeadline.count() != 0;
+		std::unique_lock<std::mutex> lock(batch->mutex);
+		for (;;) {
+			bool waiting = false;
+			bool queued = false;
+			Clock::time_point wake = (Clock::time_point::max)();
+			Clock::time_point now = Clock::now();
+			for (auto& task : batch->tasks) {
+				if (task.state == TaskQueued) {
+					queued = true;
+				}
+				else if (task.state == TaskRunning) {
+					Clock::time_point deadline = task.started + m_probeDeadline;
+					if (timed && deadline <= now) {
+						// Give up on this one; its thread finishes it for a later Get
+						task.state = TaskAbandoned;
+						std::lock_guard<std::mutex> lateLock(m_late->mutex);
+						m_late->running.insert(task.record.path);
+					}
+					else {
+						waiting = true;
+						if (timed && deadline < wake) {
+							wake = deadline;
+						}
+					}
+				}
+			}
+			if (queued) {
+				Clock::time_point stalled = batch->progress + m_probeDeadline;
+				if (timed && stalled <= now) {
+					// Every thread is stuck on something slower; stop waiting for the rest
+					for (auto& task : batch->tasks) {
+						if (task.state == TaskQueued) {
+							task.state = TaskWithdrawn;
+						}
+					}
+				}
+				else {
+					waiting = true;
+					if (timed && stalled < wake) {
+						wake = stalled;
+					}
+				}
+			}
+			if (!waiting) {
+				break;
+			}
+			if (wake == (Clock::time_point::max)()) {
+				batch->changed.wait(lock);
+			}
+			else {
+				batch->changed.wait_until(lock, wake);
+			}
+		}
+
+		now = Clock::now();
+		for (size_t t = 0; t < pending.size(); t++) {
+			const ProbeTask& task = batch->tasks[t];
+			if (task.state == TaskDone) {
+				records[pending[t]] = task.record;
+				m_retries.erase(task.record.path);
+			}
+			else {
+				records[pending[t]].incomplete = true;
+				ScheduleRetry(task.record.path, now);
+			}
+		}
+	}
+
+	// Whether an attributes probe found the device a saved record describes
+	static bool SameDevice(const HidDeviceRecord& check, const HidDeviceRecord& seed) {
+		return !check.incomplete && check.opened == seed.opened &&
+			check.hasAttributes == seed.hasAttributes &&
+			(!check.hasAttributes || (check.vendorID == seed.vendorID &&
+				check.productID == seed.productID && check.versionNumber == seed.versionNumber));
+	}
+
+	// Replaces arrived records with saved ones from Seed, unchecked; Verify
+	// checks each when it is first used
+	void AdoptSeeds(std::vector<HidDeviceRecord>& records, const std::vector<size_t>& arrived) {
+		if (m_seeds.empty()) {
+			return;
+		}
+		for (size_t index : arrived) {
+			auto it = m_seeds.find(records[index].path);
+			if (it == m_seeds.end()) {
+				continue;
+			}
+			records[index] = it->second;
+			records[index].seeded = true;
+			m_seeds.erase(it);
+			m_seedsAdopted++;
+		}
+	}
+
+	// Probes field groups the current snapshot lacks, keeping its generation
+	void Complete(const std::shared_ptr<HidEnumerator>& enumerator, uint32_t fields) {
+		auto next = std::make_shared<HidSnapshot>(*m_snapshot);
+		ProbeMissing(enumerator, next->devices, fields);
+		next->fields |= fields;
+		Publish(next);
+	}
+
+	bool Refresh(const std::shared_ptr<HidEnumerator>& enumerator, uint32_t fields) {
+		std::vector<std::string> paths;
+		if (!enumerator->EnumeratePaths(paths)) {
+			return false;
+		}
+
+		std::unordered_map<std::string, size_t> previous;
+		if (m_snapshot) {
+			for (size_t i = 0; i < m_snapshot->devices.size(); i++) {
+				previous.emplace(m_snapshot->devices[i].path, i);
+			}
+		}
+
+		// New devices get the groups existing ones already have
+		if (m_snapshot) {
+			fields |= m_snapshot->fields;
+		}
+		auto next = std::make_shared<HidSnapshot>();
+		next->fields = fields | HidFieldPath;
+		next->devices.resize(paths.size());
+		std::vector<size_t> arrived;
+		for (size_t i = 0; i < paths.size(); i++) {
+			HidDeviceRecord& record = next->devices[i];
+			auto it = previous.find(paths[i]);
+			if (it != previous.end()) {
+				record = m_snapshot->devices[it->second];
+				previous.erase(it);
+			}
+			else {
+				record.path = paths[i];
+				arrived.push_back(i);
+			}
+		}
+		uint64_t probes = m_probes;
+		AdoptSeeds(next->devices, arrived);
+		ProbeMissing(enumerator, next->devices, fields);
+		for (const auto& entry : previous) {
+			m_retries.erase(entry.first); // Gone; nothing to retry
+		}
+
+		if (!m_snapshot) {
+			// The first snapshot is the starting point, not a set of arrivals
+			next->generation = 1;
+			Publish(next);
+			return true;
+		}
+		if (arrived.empty() && previous.empty()) {
+			// Nothing changed, keep the generation
+			if (next->fields != m_snapshot->fields || m_probes != probes) {
+				next->generation = m_snapshot->generation;
+				Publish(next);
+			}
+			return true;
+		}
+
+		next->generation = m_snapshot->generation + 1;
+		std::vector<size_t> removed;
+		for (const auto& entry : previous) {
+			removed.push_back(entry.second);
+		}
+		std::sort(removed.begin(), removed.end());
+		for (size_t index : removed) {
+			PushChange(HidDeviceRemoval, next->generation, index, m_snapshot->devices[index]);
+		}
+		for (size_t index : arrived) {
+			PushChange(HidDeviceArrival, next->generation, index, next->devices[index]);
+		}
+		Publish(next);
+		return true;
+	}
+
+	// Indexes a finished snapshot and makes it current
+	void Publish(const std::shared_ptr<HidSnapshot>& next) {
+		next->BuildIndex();
+		std::atomic_store(&m_snapshot, std::shared_ptr<const HidSnapshot>(next));
+	}
+
+	void PushChange(int kind, uint64_t generation, size_t index, const HidDeviceRecord& device) {
+		HidDeviceChange change;
+		change.kind = kind;
+		change.generation = generation;
+		change.index = static_cast<int>(index);
+		change.device = device;
+		m_changes.Push(change);
+	}
+
+	mutable std::mutex m_mutex;
+	std::atomic<bool> m_dirty{ true };
+	std::atomic<bool> m_alwaysRefresh{ false };
+	// Replaced only under m_mutex, and always with atomic_store, so Peek can
+	// read it with atomic_load without the lock
+	std::shared_ptr<const HidSnapshot> m_snapshot;
+	EventQueue<HidDeviceChange, HID_DEVICE_CHANGE_QUEUE_SIZE> m_changes;
+	uint64_t m_probes = 0;
+	std::unordered_map<std::string, HidDeviceRecord> m_seeds;
+	uint64_t m_seedsAdopted = 0;
+	size_t m_probeThreads = HID_PROBE_THREADS;
+	std::chrono::milliseconds m_probeDeadline{ HID_PROBE_DEADLINE_MS };
+	std::chrono::milliseconds m_retryDelay{ HID_PROBE_RETRY_MS };
+	std::unordered_map<std::string, ProbeRetry> m_retries; // Incomplete records by path
+	std::shared_ptr<LateResults> m_late = std::make_shared<LateResults>();
+	ProbePool m_pool; // Last, so its threads are stopped before the rest goes
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+// Fixed-layout device entries for GetHIDDeviceInfo.
+//
+// A struct array lets callers read integer VID/PID/usage values directly
+// instead of parsing JSON and hex strings. The fill is a template over the
+// struct type so this header does not depend on the library's C header.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "HidDeviceCache.h"
+
+// Flags of a filled entry (BUTTONRAW_INFO_* in ButtonControllerRaw.h)
+enum HidInfoFlags : uint32_t {
+	HidInfoOpened = 0x01,
+	HidInfoHasAttributes = 0x02,
+	HidInfoHasCaps = 0x04,
+	HidInfoIncomplete = 0x08,
+};
+
+// Copies value into a fixed buffer, truncating at a UTF-8 character boundary
+template <size_t N>
+inline void CopyDeviceString(char (&dest)[N], const std::string& value) {
+	size_t length = value.size();
+	if (length >= N) {
+		length = N - 1;
+		// Do not leave half of a multi-byte sequence behind
+		while (length > 0 && (static_cast<unsigned char>(value[length]) & 0xC0) == 0x80) {
+			length--;
+		}
+	}
+	memcpy(dest, value.data(), length);
+	dest[length] = '\0';
+}
+
+// Fills one entry from a snapshot record. Groups the snapshot was not
+// probed for are left zero or empty, as in the JSON list.
+template <typename Info>
+inline void FillHidDeviceInfo(const HidDeviceRecord& record, size_t index, Info& info) {
+	memset(&info, 0, sizeof(info));
+	info.index = static_cast<int32_t>(index);
+	if (record.opened) info.flags |= HidInfoOpened;
+	if (record.hasAttributes) info.flags |= HidInfoHasAttributes;
+	if (record.hasCaps) info.flags |= HidInfoHasCaps;
+	if (record.incomplete) info.flags |= HidInfoIncomplete;
+	if (record.hasAttributes) {
+		info.vendorID = record.vendorID;
+		info.productID = record.productID;
+		info.versionNumber = record.versionNumber;
+	}
+	if (record.hasCaps) {
+		info.usage = record.usage;
+		info.usagePage = record.usagePage;
+	}
+	info.inputReportByteLength = record.inputReportByteLength;
+	info.outputReportByteLength = record.outputReportByteLength;
+	info.featureReportByteLength = record.featureReportByteLength;
+	info.numberOfLinkCollectionNodes = record.numberOfLinkCollectionNodes;
+	info.numberOfInputButtonCaps = record.numberOfInputButtonCaps;
+	info.numberOfInputValueCaps = record.numberOfInputValueCaps;
+	info.numberOfInputDataIndices = record.numberOfInputDataIndices;
+	info.numberOfOutputButtonCaps = record.numberOfOutputButtonCaps;
+	info.numberOfOutputValueCaps = record.numberOfOutputValueCaps;
+	info.numberOfOutputDataIndices = record.numberOfOutputDataIndices;
+	info.numberOfFeatureButtonCaps = record.numberOfFeatureButtonCaps;
+	info.numberOfFeatureValueCaps = record.numberOfFeatureValueCaps;
+	info.numberOfFeatureDataIndices = record.numberOfFeatureDataIndices;
+	info.axesTotal = record.axesTotal;
+	info.buttonsTotal = record.buttonsTotal;
+	info.povTotal = record.povTotal;
+	if (record.opened) {
+		CopyDeviceString(info.path, record.path);
+	}
+	CopyDeviceString(info.product, record.product);
+	CopyDeviceString(info.manufacturer, record.manufacturer);
+	CopyDeviceString(info.serialNumber, record.serialNumber);
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+// GetHIDDeviceList serialization straight into the caller's buffer.
+//
+// The device list is written through an nlohmann output adapter, one token
+// at a time, without building a json DOM or an intermediate std::string.
+// Keys are written in the order nlohmann::json (a std::map) dumps them, so
+// the text is byte for byte what json::dump(-1) produced before. The buffer
+// adapter (JsonTokenWriter.h) also takes the CBOR and MessagePack encodings
+// of the list.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "HidDeviceCache.h"
+#include "JsonTokenWriter.h"
+
+// Attribute and usage values are empty strings when they could not be read
+inline void WriteHex4OrEmpty(JsonTokenWriter& writer, bool valid, uint16_t value) {
+	if (valid) {
+		writer.Hex4(value);
+	}
+	else {
+		writer.String(std::string());
+	}
+}
+
+// One device with the keys of the requested field groups, in key order.
+// Fields that could not be queried are left empty or zero.
+inline void WriteHidDeviceJson(JsonTokenWriter& writer, const HidDeviceRecord& record,
+	size_t index, uint32_t fields) {
+	writer.BeginObject();
+	if (fields & HidFieldAxes) {
+		writer.Key("axesTotal");
+		writer.Int(record.axesTotal);
+	}
+	if (fields & HidFieldButtons) {
+		writer.Key("buttonsTotal");
+		writer.Int(record.buttonsTotal);
+	}
+	if (fields & HidFieldCaps) {
+		writer.Key("featureReportByteLength");
+		writer.Int(record.featureReportByteLength);
+	}
+	if (record.incomplete) {
+		// Still being probed in the background; the missing fields are empty
+		writer.Key("incomplete");
+		writer.Bool(true);
+	}
+	writer.Key("index");
+	writer.Int(static_cast<int64_t>(index));
+	if (fields & HidFieldCaps) {
+		writer.Key("inputReportByteLength");
+		writer.Int(record.inputReportByteLength);
+	}
+	if (fields & HidFieldManufacturer) {
+		writer.Key("manufacturer");
+		writer.String(record.manufacturer);
+	}
+	if (fields & HidFieldCaps) {
+		writer.Key("numberOfFeatureButtonCaps");
+		writer.Int(record.numberOfFeatureButtonCaps);
+		writer.Key("numberOfFeatureDataIndices");
+		writer.Int(record.numberOfFeatureDataIndices);
+		writer.Key("numberOfFeatureValueCaps");
+		writer.Int(record.numberOfFeatureValueCaps);
+		writer.Key("numberOfInputButtonCaps");
+		writer.Int(record.numberOfInputButtonCaps);
+		writer.Key("numberOfInputDataIndices");
+		writer.Int(record.numberOfInputDataIndices);
+		writer.Key("numberOfInputValueCaps");
+		writer.Int(record.numberOfInputValueCaps);
+		writer.Key("numberOfLinkCollectionNodes");
+		writer.Int(record.numberOfLinkCollectionNodes);
+		writer.Key("numberOfOutputButtonCaps");
+		writer.Int(record.numberOfOutputButtonCaps);
+		writer.Key("numberOfOutputDataIndices");
+		writer.Int(record.numberOfOutputDataIndices);
+		writer.Key("numberOfOutputValueCaps");
+		writer.Int(record.numberOfOutputValueCaps);
+		writer.Key("outputReportByteLength");
+		writer.Int(record.outputReportByteLength);
+	}
+	if (fields & HidFieldPath) {
+		// Unopened interfaces have no path in the full list
+		static const std::string unknown;
+		bool known = record.opened || (fields & HidFieldsOpened) == 0;
+		writer.Key("path");
+		writer.String(known ? record.path : unknown);
+	}
+	if (fields & HidFieldAxes) {
+		writer.Key("povTotal");
+		writer.Int(record.povTotal);
+	}
+	if (fields & HidFieldProduct) {
+		writer.Key("product");
+		writer.String(record.product);
+	}
+	if (fields & HidFieldAttributes) {
+		writer.Key("productID");
+		WriteHex4OrEmpty(writer, record.hasAttributes, record.productID);
+	}
+	if (fields & HidFieldSerialNumber) {
+		writer.Key("serialNumber");
+		writer.String(record.serialNumber);
+	}
+	if (fields & HidFieldCaps) {
+		writer.Key("usage");
+		WriteHex4OrEmpty(writer, record.hasCaps, record.usage);
+		writer.Key("usagePage");
+		WriteHex4OrEmpty(writer, record.hasCaps, record.usagePage);
+	}
+	if (fields & HidFieldAttributes) {
+		writer.Key("vendorID");
+		WriteHex4OrEmpty(writer, record.hasAttributes, record.vendorID);
+		writer.Key("versionNumber");
+		WriteHex4OrEmpty(writer, record.hasAttributes, record.versionNumber);
+	}
+	writer.EndObject();
+}
+
+// The whole device list as a JSON array
+inline void WriteHidDeviceList(JsonOutput& out, const HidSnapshot& snapshot, uint32_t fields) {
+	JsonTokenWriter writer(out);
+	writer.BeginArray();
+	for (size_t i = 0; i < snapshot.devices.size(); i++) {
+		WriteHidDeviceJson(writer, snapshot.devices[i], i, fields);
+	}
+	writer.EndArray();
+}
+
+// Binary encodings of the device list
+enum HidBinaryFormat {
+	HidFormatCbor = 1,
+	HidFormatMsgPack = 2,
+};
+
+// The device list for the binary encodings. Same keys as the JSON text, but
+// IDs, usages and counts stay integers (null when they could not be read).
+inline nlohmann::json HidDeviceListDocument(const HidSnapshot& snapshot, uint32_t fields) {
+	nlohmann::json list = nlohmann::json::array();
+	for (size_t i = 0; i < snapshot.devices.size(); i++) {
+		const HidDeviceRecord& record = snapshot.devices[i];
+		nlohmann::json device;
+		device["index"] = i;
+		if (record.incomplete) {
+			device["incomplete"] = true;
+		}
+		if (fields & HidFieldPath) {
+			bool known = record.opened || (fields & HidFieldsOpened) == 0;
+			device["path"] = known ? record.path : std::string();
+		}
+		if (fields & HidFieldAttributes) {
+			device["vendorID"] = record.hasAttributes ? nlohmann::json(record.vendorID) : nlohmann::json();
+			device["productID"] = record.hasAttributes ? nlohmann::json(record.productID) : nlohmann::json();
+			device["versionNumber"] = record.hasAttributes ? nlohmann::json(record.versionNumber) : nlohmann::json();
+		}
+		if (fields & HidFieldProduct) {
+			device["product"] = record.product;
+		}
+		if (fields & HidFieldManufacturer) {
+			device["manufacturer"] = record.manufacturer;
+		}
+		if (fields & HidFieldSerialNumber) {
+			device["serialNumber"] = record.serialNumber;
+		}
+		if (fields & HidFieldCaps) {
+			device["usage"] = record.hasCaps ? nlohmann::json(record.usage) : nlohmann::json();
+			device["usagePage"] = record.hasCaps ? nlohmann::json(record.usagePage) : nlohmann::json();
+			device["inputReportByteLength"] = record.inputReportByteLength;
+			device["outputReportByteLength"] = record.outputReportByteLength;
+			device["featureReportByteLength"] = record.featureReportByteLength;
+			device["numberOfLinkCollectionNodes"] = record.numberOfLinkCollectionNodes;
+			device["numberOfInputButtonCaps"] = record.numberOfInputButtonCaps;
+			device["numberOfInputValueCaps"] = record.numberOfInputValueCaps;
+			device["numberOfInputDataIndices"] = record.numberOfInputDataIndices;
+			device["numberOfOutputButtonCaps"] = record.numberOfOutputButtonCaps;
+			device["numberOfOutputValueCaps"] = record.numberOfOutputValueCaps;
+			device["numberOfOutputDataIndices"] = record.numberOfOutputDataIndices;
+			device["numberOfFeatureButtonCaps"] = record.numberOfFeatureButtonCaps;
+			device["numberOfFeatureValueCaps"] = record.numberOfFeatureValueCaps;
+			device["numberOfFeatureDataIndices"] = record.numberOfFeatureDataIndices;
+		}
+		if (fields & HidFieldAxes) {
+			device["axesTotal"] = record.axesTotal;
+			device["povTotal"] = record.povTotal;
+		}
+		if (fields & HidFieldButtons) {
+			device["buttonsTotal"] = record.buttonsTotal;
+		}
+		list.push_back(std::move(device));
+	}
+	return list;
+}
+
+// Encodes the device list with nlohmann's binary_writer. Returns false for
+// an unknown format.
+inline bool WriteHidDeviceListBinary(const std::shared_ptr<JsonOutput>& out, const HidSnapshot& snapshot,
+	uint32_t fields, int format) {
+	if (format != HidFormatCbor && format != HidFormatMsgPack) {
+		return false;
+	}
+	nlohmann::detail::binary_writer<nlohmann::json, char> writer(out);
+	nlohmann::json document = HidDeviceListDocument(snapshot, fields);
+	if (format == HidFormatCbor) {
+		writer.write_cbor(document);
+	}
+	else {
+		writer.write_msgpack(document);
+	}
+	return true;
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+// Compact binary file of device records, for a fast cold start.
+//
+// Probing strings and preparsed data of every interface dominates the first
+// enumeration. The records of a previous run are saved in a small
+// little-endian format and fed to HidDeviceCache::Seed on the next start;
+// the cache adopts a saved record without opening the interface, and a
+// cheap attributes probe confirms the same VID/PID/version is still at that
+// path the first time a lookup uses it (HidDeviceCache::Verify).
+//
+// Layout: "BCHD", format version, record count, FNV-1a hash of the payload,
+// then per record the path, probed field groups, flags, attributes,
+// strings (16-bit length prefixed), usages, report lengths, cap counts and
+// axis/button/POV totals.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "HidDeviceCache.h"
+
+#define HID_DEVICE_STORE_VERSION 1
+
+class HidStoreWriter {
+public:
+	void U8(uint8_t value) { m_data.push_back(static_cast<char>(value)); }
+	void U16(uint16_t value) { U8(static_cast<uint8_t>(value)); U8(static_cast<uint8_t>(value >> 8)); }
+	void U32(uint32_t value) { U16(static_cast<uint16_t>(value)); U16(static_cast<uint16_t>(value >> 16)); }
+	void String(const std::string& value) {
+		size_t length = value.size() < 0xFFFF ? value.size() : 0xFFFF;
+		U16(static_cast<uint16_t>(length));
+		m_data.append(value, 0, length);
+	}
+	std::string& Data() { return m_data; }
+
+private:
+	std::string m_data;
+};
+
+// Bounds-checked reader; every read fails once the data runs out
+class HidStoreReader {
+public:
+	HidStoreReader(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+	bool U8(uint8_t& value) {
+		if (m_offset + 1 > m_size) return false;
+		value = static_cast<uint8_t>(m_data[m_offset++]);
+		return true;
+	}
+	bool U16(uint16_t& value) {
+		uint8_t low, high;
+		if (!U8(low) || !U8(high)) return false;
+		value = static_cast<uint16_t>(low | (high << 8));
+		return true;
+	}
+	bool U32(uint32_t& value) {
+		uint16_t low, high;
+		if (!U16(low) || !U16(high)) return false;
+		value = low | (static_cast<uint32_t>(high) << 16);
+		return true;
+	}
+	bool I32(int& value) {
+		uint32_t bits;
+		if (!U32(bits)) return false;
+		value = static_cast<int>(static_cast<int32_t>(bits));
+		return true;
+	}
+	bool String(std::string& value) {
+		uint16_t length;
+		if (!U16(length) || m_offset + length > m_size) return false;
+		value.assign(m_data + m_offset, length);
+		m_offset += length;
+		return true;
+	}
+	bool AtEnd() const { return m_offset == m_size; }
+
+private:
+	const char* m_data;
+	size_t m_size;
+	size_t m_offset = 0;
+};
+
+inline uint32_t HidStoreHash(const char* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+	}
+	return hash;
+}
+
+enum HidStoreFlags : uint8_t {
+	HidStoreOpened = 0x01,
+	HidStoreReadWriteDenied = 0x02,
+	HidStoreHasAttributes = 0x04,
+	HidStoreHasCaps = 0x08,
+};
+
+// Serializes the records; incomplete ones are left out
+inline std::string SaveHidDeviceRecords(const std::vector<HidDeviceRecord>& records) {
+	HidStoreWriter payload;
+	uint32_t count = 0;
+	for (const auto& record : records) {
+		if (record.incomplete || record.path.empty()) {
+			continue;
+		}
+		count++;
+		payload.String(record.path);
+		payload.U32(record.fields);
+		uint8_t flags = 0;
+		if (record.opened) flags |= HidStoreOpened;
+		if (record.readWriteDenied) flags |= HidStoreReadWriteDenied;
+		if (record.hasAttributes) flags |= HidStoreHasAttributes;
+		if (record.hasCaps) flags |= HidStoreHasCaps;
+		payload.U8(flags);
+		payload.U16(record.vendorID);
+		payload.U16(record.productID);
+		payload.U16(record.versionNumber);
+		payload.String(record.product);
+		payload.String(record.manufacturer);
+		payload.String(record.serialNumber);
+		const uint16_t values[] = { record.usage, record.usagePage,
+			record.inputReportByteLength, record.outputReportByteLength, record.featureReportByteLength,
+			record.numberOfLinkCollectionNodes,
+			record.numberOfInputButtonCaps, record.numberOfInputValueCaps, record.numberOfInputDataIndices,
+			record.numberOfOutputButtonCaps, record.numberOfOutputValueCaps, record.numberOfOutputDataIndices,
+			record.numberOfFeatureButtonCaps, record.numberOfFeatureValueCaps, record.numberOfFeatureDataIndices };
+		for (uint16_t value : values) {
+			payload.U16(value);
+		}
+		payload.U32(static_cast<uint32_t>(record.axesTotal));
+		payload.U32(static_cast<uint32_t>(record.buttonsTotal));
+		payload.U32(static_cast<uint32_t>(record.povTotal));
+	}
+
+	HidStoreWriter file;
+	file.Data() = "BCHD";
+	file.U32(HID_DEVICE_STORE_VERSION);
+	file.U32(count);
+	file.U32(HidStoreHash(payload.Data().data(), payload.Data().size()));
+	file.Data() += payload.Data();
+	return file.Data();
+}
+
+// Parses a file written by SaveHidDeviceRecords. Returns false, leaving
+// records empty, if the data is truncated, corrupt or from another version.
+inline bool LoadHidDeviceRecords(const std::string& data, std::vector<HidDeviceRecord>& records) {
+	records.clear();
+	const size_t headerSize = 16;
+	if (data.size() < headerSize || data.compare(0, 4, "BCHD") != 0) {
+		return false;
+	}
+	HidStoreReader header(data.data() + 4, headerSize - 4);
+	uint32_t version, count, hash;
+	header.U32(version);
+	header.U32(count);
+	header.U32(hash);
+	const char* payload = data.data() + headerSize;
+	size_t payloadSize = data.size() - headerSize;
+	if (version != HID_DEVICE_STORE_VERSION || hash != HidStoreHash(payload, payloadSize)) {
+		return false;
+	}
+
+	HidStoreReader reader(payload, payloadSize);
+	std::vector<HidDeviceRecord> loaded;
+	for (uint32_t i = 0; i < count; i++) {
+		HidDeviceRecord record;
+		uint8_t flags = 0;
+		uint16_t* values[] = { &record.usage, &record.usagePage,
+			&record.inputReportByteLength, &record.outputReportByteLength, &record.featureReportByteLength,
+			&record.numberOfLinkCollectionNodes,
+			&record.numberOfInputButtonCaps, &record.numberOfInputValueCaps, &record.numberOfInputDataIndices,
+			&record.numberOfOutputButtonCaps, &record.numberOfOutputValueCaps, &record.numberOfOutputDataIndices,
+			&record.numberOfFeatureButtonCaps, &record.numberOfFeatureValueCaps, &record.numberOfFeatureDataIndices };
+		bool ok = reader.String(record.path) && reader.U32(record.fields) && reader.U8(flags) &&
+			reader.U16(record.vendorID) && reader.U16(record.productID) && reader.U16(record.versionNumber) &&
+			reader.String(record.product) && reader.String(record.manufacturer) &&
+			reader.String(record.serialNumber);
+		for (uint16_t* value : values) {
+			ok = ok && reader.U16(*value);
+		}
+		ok = ok && reader.I32(record.axesTotal) && reader.I32(record.buttonsTotal) && reader.I32(record.povTotal);
+		if (!ok) {
+			return false;
+		}
+		record.fields = (record.fields & HidFieldAll) | HidFieldPath;
+		record.opened = (flags & HidStoreOpened) != 0;
+		record.readWriteDenied = (flags & HidStoreReadWriteDenied) != 0;
+		record.hasAttributes = (flags & HidStoreHasAttributes) != 0;
+		record.hasCaps = (flags & HidStoreHasCaps) != 0;
+		loaded.push_back(std::move(record));
+	}
+	if (!reader.AtEnd()) {
+		return false;
+	}
+	records.swap(loaded);
+	return true;
+}
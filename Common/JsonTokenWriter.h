@@ -0,0 +1,164 @@
+#pragma once
+
+// Token-at-a-time JSON output through an nlohmann output adapter.
+//
+// JsonTokenWriter writes compact JSON without a json DOM or an intermediate
+// std::string, escaping strings the way json::dump does. JsonBufferAdapter
+// writes into a caller buffer and keeps counting past its end, which gives
+// the size needed for a second call.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "EnumScratch.h"
+
+typedef nlohmann::detail::output_adapter_protocol<char> JsonOutput;
+
+// Writes into a fixed buffer, counting everything that did not fit
+class JsonBufferAdapter : public JsonOutput {
+public:
+	JsonBufferAdapter(char* buffer, size_t capacity) : m_buffer(buffer), m_capacity(capacity) {}
+
+	void write_character(char c) override {
+		if (m_size < m_capacity) {
+			m_buffer[m_size] = c;
+		}
+		m_size++;
+	}
+
+	void write_characters(const char* s, size_t length) override {
+		if (m_size < m_capacity) {
+			size_t room = m_capacity - m_size;
+			memcpy(m_buffer + m_size, s, length < room ? length : room);
+		}
+		m_size += length;
+	}
+
+	// Characters written so far, including those that did not fit
+	size_t Size() const { return m_size; }
+
+	// Appends the terminating null; false if the text and null do not fit
+	bool Terminate() {
+		if (m_size >= m_capacity) {
+			return false;
+		}
+		m_buffer[m_size] = '\0';
+		return true;
+	}
+
+private:
+	char* m_buffer;
+	size_t m_capacity;
+	size_t m_size = 0;
+};
+
+// Compact JSON token writer, escaping strings the way json::dump does
+class JsonTokenWriter {
+public:
+	explicit JsonTokenWriter(JsonOutput& out) : m_out(out) {}
+
+	void BeginArray() { Separate(); m_out.write_character('['); m_first = true; }
+	void EndArray() { m_out.write_character(']'); m_first = false; }
+	void BeginObject() { Separate(); m_out.write_character('{'); m_first = true; }
+	void EndObject() { m_out.write_character('}'); m_first = false; }
+
+	void Key(const char* name) {
+		Separate();
+		m_out.write_character('"');
+		m_out.write_characters(name, strlen(name));
+		m_out.write_characters("\":", 2);
+		m_first = true; // The value follows without a comma
+	}
+
+	void String(const std::string& value) { String(value.data(), value.size()); }
+
+	void String(const char* value, size_t length) {
+		Separate();
+		m_out.write_character('"');
+		size_t run = 0;
+		for (size_t i = 0; i < length; i++) {
+			unsigned char c = static_cast<unsigned char>(value[i]);
+			if (c >= 0x20 && c != '"' && c != '\\') {
+				continue;
+			}
+			m_out.write_characters(value + run, i - run);
+			run = i + 1;
+			WriteEscape(c);
+		}
+		m_out.write_characters(value + run, length - run);
+		m_out.write_character('"');
+	}
+
+	// "0x" followed by 4 lowercase hex digits
+	void Hex4(uint16_t value) {
+		char text[HEX_TEXT_SIZE + 1];
+		text[0] = '"';
+		size_t length = FormatHex(text + 1, value, 4, false);
+		text[length + 1] = '"';
+		Separate();
+		m_out.write_characters(text, length + 2);
+	}
+
+	void Int(int64_t value) {
+		Separate();
+		if (value < 0) {
+			m_out.write_character('-');
+			WriteDigits(0 - static_cast<uint64_t>(value));
+		}
+		else {
+			WriteDigits(static_cast<uint64_t>(value));
+		}
+	}
+
+	void Bool(bool value) {
+		Separate();
+		if (value) {
+			m_out.write_characters("true", 4);
+		}
+		else {
+			m_out.write_characters("false", 5);
+		}
+	}
+
+private:
+	void Separate() {
+		if (!m_first) {
+			m_out.write_character(',');
+		}
+		m_first = false;
+	}
+
+	void WriteDigits(uint64_t value) {
+		char text[20];
+		size_t length = 0;
+		do {
+			text[sizeof(text) - ++length] = static_cast<char>('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		m_out.write_characters(text + sizeof(text) - length, length);
+	}
+
+	void WriteEscape(unsigned char c) {
+		switch (c) {
+		case '"': m_out.write_characters("\\\"", 2); break;
+		case '\\': m_out.write_characters("\\\\", 2); break;
+		case '\b': m_out.write_characters("\\b", 2); break;
+		case '\f': m_out.write_characters("\\f", 2); break;
+		case '\n': m_out.write_characters("\\n", 2); break;
+		case '\r': m_out.write_characters("\\r", 2); break;
+		case '\t': m_out.write_characters("\\t", 2); break;
+		default: {
+			static const char digits[] = "0123456789abcdef";
+			char text[6] = { '\\', 'u', '0', '0', digits[c >> 4], digits[c & 0xF] };
+			m_out.write_characters(text, sizeof(text));
+		}
+		}
+	}
+
+	JsonOutput& m_out;
+	bool m_first = true;
+};
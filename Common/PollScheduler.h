@@ -0,0 +1,206 @@
+#pragma once
+
+// Fixed-rate polling of many devices on one thread.
+//
+// Devices without an input buffer only show the state at the moment they
+// are read, so reading them from the application's frame loop ties the
+// sample rate to the frame rate. PollScheduler samples every registered
+// device once per period and queues only the changes (ButtonEventMerger::
+// Sample), ready for the application to pop at its own pace.
+//
+// With n devices, device k is sampled at k/n of the period rather than all
+// at its start, so reads (and the USB traffic they cause) are spread out.
+// Waiting is injected: Windows passes a high-resolution waitable timer,
+// tests a recording fake. A period that falls behind is skipped rather
+// than run back to back.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ButtonEventBuffer.h"
+
+#define POLL_SCHEDULER_MAX_RATE 8000
+
+class PollScheduler {
+public:
+	typedef std::chrono::steady_clock Clock;
+	// Blocks until the time point; may return early or late
+	typedef std::function<void(Clock::time_point)> WaitFunction;
+	// Time stamp of an event (milliseconds on Windows, like DirectInput)
+	typedef std::function<uint32_t()> TimestampFunction;
+
+	PollScheduler(const PollScheduler&) = delete;
+	PollScheduler& operator=(const PollScheduler&) = delete;
+
+	explicit PollScheduler(WaitFunction wait = WaitFunction(), TimestampFunction timestamp = TimestampFunction())
+		: m_wait(wait ? wait : WaitFunction([](Clock::time_point until) { std::this_thread::sleep_until(until); })),
+		m_timestamp(timestamp ? timestamp : TimestampFunction([] {
+			return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+				Clock::now().time_since_epoch()).count());
+		})) {}
+
+	~PollScheduler() { Stop(); }
+
+	// Starts the polling thread, or changes the rate of a running one.
+	// Returns false for a rate outside 1..POLL_SCHEDULER_MAX_RATE Hz.
+	bool Start(int rateHz) {
+		if (rateHz < 1 || rateHz > POLL_SCHEDULER_MAX_RATE) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		m_periodNs.store(1000000000LL / rateHz);
+		if (!m_thread.joinable()) {
+			m_stop = false;
+			m_thread = std::thread([this] { Run(); });
+		}
+		return true;
+	}
+
+	// Stops the thread; it finishes at most one wait first
+	void Stop() {
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		if (m_thread.joinable()) {
+			m_stop = true;
+			m_thread.join();
+		}
+	}
+
+	bool Running() const {
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		return m_thread.joinable();
+	}
+
+	std::chrono::nanoseconds Period() const { return std::chrono::nanoseconds(m_periodNs.load()); }
+
+	// Registers a device and returns its id (never 0). The device must stay
+	// valid until Remove returns.
+	int Add(ButtonEventBackend* backend) {
+		auto device = std::make_shared<Device>();
+		device->backend = backend;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int id = ++m_lastId;
+		m_devices[id] = device;
+		return id;
+	}
+
+	// Unregisters a device, waiting for a poll in progress to finish
+	bool Remove(int id) {
+		std::shared_ptr<Device> device;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_devices.find(id);
+			if (it == m_devices.end()) {
+				return false;
+			}
+			device = it->second;
+			m_devices.erase(it);
+		}
+		std::lock_guard<std::mutex> lock(device->mutex);
+		device->backend = nullptr;
+		return true;
+	}
+
+	// Copies queued changes of a device; -1 for an unknown id
+	int Pop(int id, ButtonBufferEvent* events, size_t maxEvents) {
+		std::shared_ptr<Device> device = Find(id);
+		if (!device) {
+			return -1;
+		}
+		std::lock_guard<std::mutex> lock(device->mutex);
+		return static_cast<int>(device->events.Pop(events, maxEvents));
+	}
+
+	// Samples every device once, device k at start + k/n of the period.
+	// Called by the polling thread; tests call it directly.
+	void RunPeriod(Clock::time_point start) {
+		std::vector<std::shared_ptr<Device>> devices;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			devices.reserve(m_devices.size());
+			for (const auto& entry : m_devices) {
+				devices.push_back(entry.second);
+			}
+		}
+		std::chrono::nanoseconds period = Period();
+		for (size_t k = 0; k < devices.size() && !m_stop; k++) {
+			Clock::time_point slot = start + period * static_cast<long long>(k) / static_cast<long long>(devices.size());
+			if (Clock::now() < slot) {
+				m_wait(slot);
+			}
+			Poll(*devices[k]);
+		}
+	}
+
+	uint64_t Polls() const { return m_polls.load(); }
+	// Polls whose device could not be read
+	uint64_t Failures() const { return m_failures.load(); }
+	// Periods skipped because polling fell behind
+	uint64_t SkippedPeriods() const { return m_skipped.load(); }
+
+private:
+	struct Device {
+		std::mutex mutex;
+		ButtonEventBackend* backend = nullptr;
+		ButtonEventMerger events;
+		uint32_t sequence = 0;
+	};
+
+	std::shared_ptr<Device> Find(int id) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_devices.find(id);
+		return it == m_devices.end() ? nullptr : it->second;
+	}
+
+	void Poll(Device& device) {
+		std::lock_guard<std::mutex> lock(device.mutex);
+		if (!device.backend) {
+			return; // Removed meanwhile
+		}
+		if (device.events.Sample(*device.backend, m_timestamp(), ++device.sequence) < 0) {
+			m_failures++;
+		}
+		m_polls++;
+	}
+
+	void Run() {
+		Clock::time_point start = Clock::now();
+		while (!m_stop) {
+			RunPeriod(start);
+			std::chrono::nanoseconds period = Period();
+			start += period;
+			Clock::time_point now = Clock::now();
+			if (now >= start + period) {
+				// Behind by a whole period; start over instead of bursting
+				m_skipped += static_cast<uint64_t>((now - start) / period);
+				start = now;
+			}
+			else if (now < start) {
+				m_wait(start);
+			}
+		}
+	}
+
+	WaitFunction m_wait;
+	TimestampFunction m_timestamp;
+
+	mutable std::mutex m_threadMutex;
+	std::thread m_thread;
+	std::atomic<bool> m_stop{ false };
+	std::atomic<long long> m_periodNs{ 1000000 };
+
+	std::mutex m_mutex;
+	std::map<int, std::shared_ptr<Device>> m_devices;
+	int m_lastId = 0;
+
+	std::atomic<uint64_t> m_polls{ 0 };
+	std::atomic<uint64_t> m_failures{ 0 };
+	std::atomic<uint64_t> m_skipped{ 0 };
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+// Hierarchical timer wheel.
+//
+// Level 0 has 256 one-tick slots, levels 1-3 have 64 slots each and cover
+// 2^14, 2^20 and 2^26 ticks. Timers live in a pooled node array linked into
+// their slot, so scheduling and cancelling are O(1) no matter how many are
+// pending; a timer is moved down a level at most three times before it fires.
+// Time only moves when Advance is called, so tests can drive it with an
+// injected clock.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class TimerWheel {
+public:
+	typedef uint64_t TimerId; // 0 is never a valid id
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	explicit TimerWheel(uint64_t now = 0) : m_current(now) {
+		for (auto& head : m_level0) head = kNone;
+		for (auto& level : m_levels) {
+			for (auto& head : level) head = kNone;
+		}
+	}
+
+	// Schedules a timer at an absolute tick. Expiries in the past fire on the next Advance.
+	TimerId Schedule(uint64_t expiry, uint32_t payload) {
+		int32_t index;
+		if (m_free != kNone) {
+			index = m_free;
+			m_free = m_nodes[index].next;
+		}
+		else {
+			index = static_cast<int32_t>(m_nodes.size());
+			m_nodes.push_back(Node());
+		}
+		Node& node = m_nodes[index];
+		node.expiry = expiry;
+		node.payload = payload;
+		node.active = true;
+		Link(index);
+		m_pending++;
+		return (static_cast<uint64_t>(node.generation) << 32) | static_cast<uint32_t>(index + 1);
+	}
+
+	// Returns false if the timer already fired or was cancelled
+	bool Cancel(TimerId id) {
+		int32_t index = static_cast<int32_t>(id & 0xFFFFFFFFu) - 1;
+		if (index < 0 || index >= static_cast<int32_t>(m_nodes.size())) return false;
+		Node& node = m_nodes[index];
+		if (!node.active || node.generation != static_cast<uint32_t>(id >> 32)) return false;
+		Unlink(index);
+		Release(index);
+		return true;
+	}
+
+	// Runs every timer with expiry <= now, in expiry order, calling onExpire(payload, expiry).
+	// Callbacks may schedule or cancel timers.
+	template <typename Fn>
+	void Advance(uint64_t now, Fn&& onExpire) {
+		while (m_current <= now) {
+			if (m_pending == 0) {
+				m_current = now + 1;
+				return;
+			}
+			size_t slot = m_current & (kLevel0Slots - 1);
+			if (slot == 0) {
+				for (int level = 0; level < kUpperLevels; level++) {
+					size_t upper = (m_current >> (kLevel0Bits + level * kLevelBits)) & (kLevelSlots - 1);
+					Cascade(m_levels[level][upper]);
+					if (upper != 0) break;
+				}
+			}
+
+			// Collect due timers first so callbacks can freely cancel or schedule
+			int32_t index = m_level0[slot];
+			m_level0[slot] = kNone;
+			uint64_t tick = m_current++;
+			m_due.clear();
+			while (index != kNone) {
+				int32_t next = m_nodes[index].next;
+				Node& node = m_nodes[index];
+				if (node.expiry > tick) {
+					Link(index); // Clamped timer that is not due yet
+				}
+				else {
+					m_due.push_back(Due{ node.payload, node.expiry });
+					Release(index);
+				}
+				index = next;
+			}
+			for (size_t i = 0; i < m_due.size(); i++) {
+				onExpire(m_due[i].payload, m_due[i].expiry);
+			}
+		}
+	}
+
+	size_t Pending() const { return m_pending; }
+	uint64_t Now() const { return m_current; }
+
+private:
+	static const int32_t kNone = -1;
+	static const int kLevel0Bits = 8;
+	static const int kLevelBits = 6;
+	static const int kUpperLevels = 3;
+	static const size_t kLevel0Slots = size_t(1) << kLevel0Bits;
+	static const size_t kLevelSlots = size_t(1) << kLevelBits;
+
+	struct Node {
+		uint64_t expiry = 0;
+		uint32_t payload = 0;
+		uint32_t generation = 1;
+		int32_t prev = kNone;
+		int32_t next = kNone;
+		int32_t* head = nullptr;
+		bool active = false;
+	};
+
+	struct Due {
+		uint32_t payload;
+		uint64_t expiry;
+	};
+
+	int32_t* SlotFor(uint64_t expiry) {
+		if (expiry < m_current) expiry = m_current;
+		uint64_t delta = expiry - m_current;
+		if (delta < kLevel0Slots) {
+			return &m_level0[expiry & (kLevel0Slots - 1)];
+		}
+		for (int level = 0; level < kUpperLevels; level++) {
+			int shift = kLevel0Bits + level * kLevelBits;
+			if (delta < (uint64_t(1) << (shift + kLevelBits)) || level == kUpperLevels - 1) {
+				if (delta >= (uint64_t(1) << (shift + kLevelBits))) {
+					// Beyond the wheel: park in the furthest slot and re-check when it comes up
+					expiry = m_current + (uint64_t(1) << (shift + kLevelBits)) - 1;
+				}
+				return &m_levels[level][(expiry >> shift) & (kLevelSlots - 1)];
+			}
+		}
+		return nullptr; // Not reached
+	}
+
+	void Link(int32_t index) {
+		Node& node = m_nodes[index];
+		int32_t* head = SlotFor(node.expiry);
+		node.head = head;
+		node.prev = kNone;
+		node.next = *head;
+		if (*head != kNone) m_nodes[*head].prev = index;
+		*head = index;
+	}
+
+	void Unlink(int32_t index) {
+		Node& node = m_nodes[index];
+		if (node.prev != kNone) m_nodes[node.prev].next = node.next;
+		else *node.head = node.next;
+		if (node.next != kNone) m_nodes[node.next].prev = node.prev;
+	}
+
+	void Release(int32_t index) {
+		Node& node = m_nodes[index];
+		node.active = false;
+		node.generation++;
+		node.head = nullptr;
+		node.next = m_free;
+		m_free = index;
+		m_pending--;
+	}
+
+	// Moves every timer of an upper-level slot to the level it now belongs to
+	void Cascade(int32_t& head) {
+		int32_t index = head;
+		head = kNone;
+		while (index != kNone) {
+			int32_t next = m_nodes[index].next;
+			Link(index);
+			index = next;
+		}
+	}
+
+	uint64_t m_current;
+	size_t m_pending = 0;
+	int32_t m_free = kNone;
+	std::vector<Node> m_nodes;
+	std::vector<Due> m_due;
+	int32_t m_level0[kLevel0Slots];
+	int32_t m_levels[kUpperLevels][kLevelSlots];
+};
@@ -0,0 +1,38 @@
+#include "pch.h"
+#include "AllocationCounter.h"
+#include <stdlib.h>
+#include <new>
+
+static thread_local AllocationScope* t_scope = nullptr;
+
+AllocationScope::AllocationScope() : m_outer(t_scope) {
+	t_scope = this;
+}
+
+AllocationScope::~AllocationScope() {
+	t_scope = m_outer;
+}
+
+void AllocationScope::Record() {
+	if (t_scope != nullptr) {
+		t_scope->m_count++;
+	}
+}
+
+void* operator new(size_t size) {
+	AllocationScope::Record();
+	for (;;) {
+		void* memory = malloc(size != 0 ? size : 1);
+		if (memory != nullptr) {
+			return memory;
+		}
+		std::new_handler handler = std::get_new_handler();
+		if (handler == nullptr) {
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+}
+
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
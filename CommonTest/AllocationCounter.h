@@ -0,0 +1,27 @@
+#pragma once
+
+// Counts heap allocations made on the calling thread while a scope is open.
+//
+// operator new is replaced for this test module only, and counts nothing
+// unless the allocating thread has an AllocationScope open, so other tests
+// and threads are unaffected. Scopes nest; each counts the allocations made
+// while it is the innermost one.
+
+#include <stddef.h>
+
+class AllocationScope {
+public:
+	AllocationScope();
+	~AllocationScope();
+	AllocationScope(const AllocationScope&) = delete;
+	AllocationScope& operator=(const AllocationScope&) = delete;
+
+	size_t Count() const { return m_count; }
+
+	// Called by operator new
+	static void Record();
+
+private:
+	size_t m_count = 0;
+	AllocationScope* m_outer;
+};
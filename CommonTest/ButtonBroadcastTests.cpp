@@ -0,0 +1,568 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Common/ButtonBroadcastRing.h"
+#include "../Common/ButtonDispatcher.h"
+#include "../Common/ButtonEdges.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace CommonTest
+{
+	// Test event whose two halves must match, to catch torn reads
+	struct RingTestEvent {
+		uint64_t value;
+		uint32_t check;
+		uint16_t button;
+		uint16_t reserved;
+	};
+
+	static RingTestEvent MakeRingEvent(uint64_t value, int button) {
+		RingTestEvent event;
+		event.value = value;
+		event.check = static_cast<uint32_t>(~value);
+		event.button = static_cast<uint16_t>(button);
+		event.reserved = 0;
+		return event;
+	}
+
+	TEST_CLASS(ButtonBroadcastRingTests)
+	{
+	public:
+		TEST_METHOD(TestEveryConsumerSeesEveryEvent)
+		{
+			ButtonBroadcastRing<RingTestEvent, 64> ring;
+			int ids[3];
+			for (int& id : ids) {
+				id = ring.Subscribe(~0ULL);
+				Assert::IsTrue(id >= 0);
+			}
+			for (uint64_t i = 0; i < 10; i++) {
+				Assert::IsTrue(ring.Publish(MakeRingEvent(i, static_cast<int>(i % 4)), static_cast<int>(i % 4)));
+			}
+
+			// Reading does not take events away from the other consumers
+			for (int id : ids) {
+				RingTestEvent events[16];
+				uint64_t lost = 99;
+				Assert::AreEqual(static_cast<size_t>(4), ring.Read(id, events, 4, &lost));
+				Assert::AreEqual(static_cast<uint64_t>(0), lost);
+				Assert::AreEqual(static_cast<size_t>(6), ring.Read(id, events + 4, 16, &lost));
+				for (uint64_t i = 0; i < 10; i++) {
+					Assert::AreEqual(i, events[i].value);
+				}
+				Assert::AreEqual(static_cast<size_t>(0), ring.Read(id, events, 16));
+			}
+			Assert::AreEqual(static_cast<uint64_t>(10), ring.Published());
+		}
+
+		TEST_METHOD(TestMasksFilterAtPublish)
+		{
+			ButtonBroadcastRing<RingTestEvent, 64> ring;
+			int left = ring.Subscribe(0x1);
+			int right = ring.Subscribe(0x2);
+			int both = ring.Subscribe(0x3);
+			Assert::AreEqual(-1, ring.Subscribe(0));
+
+			for (uint64_t i = 0; i < 9; i++) {
+				int button = static_cast<int>(i % 3);
+				ring.Publish(MakeRingEvent(i, button), button);
+			}
+			// Nobody wants button 2, so its events were never written
+			Assert::AreEqual(static_cast<uint64_t>(6), ring.Published());
+			Assert::AreEqual(static_cast<uint64_t>(3), ring.Filtered());
+
+			RingTestEvent events[16];
+			Assert::AreEqual(static_cast<size_t>(3), ring.Read(left, events, 16));
+			for (int i = 0; i < 3; i++) {
+				Assert::AreEqual(static_cast<uint16_t>(0), events[i].button);
+			}
+			Assert::AreEqual(static_cast<size_t>(3), ring.Read(right, events, 16));
+			for (int i = 0; i < 3; i++) {
+				Assert::AreEqual(static_cast<uint16_t>(1), events[i].button);
+			}
+			Assert::AreEqual(static_cast<size_t>(6), ring.Read(both, events, 16));
+		}
+
+		TEST_METHOD(TestSlowConsumerLosesOldest)
+		{
+			ButtonBroadcastRing<RingTestEvent, 8> ring;
+			int slow = ring.Subscribe(~0ULL);
+			int fast = ring.Subscribe(~0ULL);
+			RingTestEvent events[16];
+			for (uint64_t i = 0; i < 20; i++) {
+				ring.Publish(MakeRingEvent(i, 0), 0);
+				Assert::AreEqual(static_cast<size_t>(1), ring.Read(fast, events, 16));
+			}
+			Assert::AreEqual(static_cast<size_t>(8), ring.Pending(slow));
+
+			// The producer did not wait; the slow consumer gets the newest 8
+			uint64_t lost = 0;
+			Assert::AreEqual(static_cast<size_t>(8), ring.Read(slow, events, 16, &lost));
+			Assert::AreEqual(static_cast<uint64_t>(12), lost);
+			Assert::AreEqual(static_cast<uint64_t>(12), events[0].value);
+			Assert::AreEqual(static_cast<uint64_t>(19), events[7].value);
+			Assert::AreEqual(static_cast<uint64_t>(12), ring.Lost(slow));
+			Assert::AreEqual(static_cast<uint64_t>(0), ring.Lost(fast));
+
+			// Reported once, with the first events after the gap
+			ring.Publish(MakeRingEvent(20, 0), 0);
+			Assert::AreEqual(static_cast<size_t>(1), ring.Read(slow, events, 16, &lost));
+			Assert::AreEqual(static_cast<uint64_t>(0), lost);
+		}
+
+		TEST_METHOD(TestUnsubscribeAndReuse)
+		{
+			ButtonBroadcastRing<RingTestEvent, 16> ring;
+			int first = ring.Subscribe(0x1);
+			ring.Publish(MakeRingEvent(1, 0), 0);
+			Assert::IsTrue(ring.Unsubscribe(first));
+			Assert::IsFalse(ring.Unsubscribe(first));
+			Assert::IsFalse(ring.Unsubscribe(BUTTON_RING_MAX_CONSUMERS));
+
+			// The id is reused; the new consumer starts at the current event
+			// and only sees its own buttons
+			int second = ring.Subscribe(0x2);
+			Assert::AreEqual(first, second);
+			ring.Publish(MakeRingEvent(2, 0), 0);
+			ring.Publish(MakeRingEvent(3, 1), 1);
+			RingTestEvent events[4];
+			Assert::AreEqual(static_cast<size_t>(1), ring.Read(second, events, 4));
+			Assert::AreEqual(static_cast<uint64_t>(3), events[0].value);
+
+			for (int i = 1; i < BUTTON_RING_MAX_CONSUMERS; i++) {
+				Assert::IsTrue(ring.Subscribe(~0ULL) >= 0);
+			}
+			Assert::AreEqual(-1, ring.Subscribe(~0ULL));
+		}
+
+		TEST_METHOD(StressConcurrentConsumers)
+		{
+			const int consumers = 4;
+			const uint64_t total = 200000;
+			ButtonBroadcastRing<RingTestEvent, 1024> ring;
+			int ids[consumers];
+			for (int c = 0; c < consumers; c++) {
+				// Consumer 0 wants buttons 0-3, the others one of them each
+				ids[c] = ring.Subscribe(c == 0 ? 0xFULL : 1ULL << c);
+			}
+
+			std::atomic<bool> done{ false };
+			std::atomic<uint64_t> torn{ 0 }, disordered{ 0 }, foreign{ 0 };
+			uint64_t received[consumers] = {}, lost[consumers] = {};
+			std::vector<std::thread> threads;
+			for (int c = 0; c < consumers; c++) {
+				threads.emplace_back([&, c] {
+					RingTestEvent events[64];
+					uint64_t last = 0;
+					bool first = true;
+					for (;;) {
+						bool finished = done.load();
+						uint64_t gap = 0;
+						size_t count = ring.Read(ids[c], events, 64, &gap);
+						lost[c] += gap;
+						for (size_t i = 0; i < count; i++) {
+							if (events[i].check != static_cast<uint32_t>(~events[i].value)) {
+								torn++;
+							}
+							if (!first && events[i].value <= last) {
+								disordered++;
+							}
+							if (c != 0 && events[i].button != c) {
+								foreign++;
+							}
+							last = events[i].value;
+							first = false;
+						}
+						received[c] += count;
+						if (count == 0) {
+							if (finished) {
+								break;
+							}
+							std::this_thread::yield();
+						}
+					}
+				});
+			}
+			for (uint64_t i = 0; i < total; i++) {
+				int button = static_cast<int>(i % 8);
+				ring.Publish(MakeRingEvent(i, button), button);
+				if ((i & 255) == 0) {
+					std::this_thread::yield();
+				}
+			}
+			done = true;
+			for (auto& thread : threads) {
+				thread.join();
+			}
+
+			Assert::AreEqual(static_cast<uint64_t>(0), torn.load());
+			Assert::AreEqual(static_cast<uint64_t>(0), disordered.load());
+			Assert::AreEqual(static_cast<uint64_t>(0), foreign.load());
+			// Nothing published for consumer 0 went missing unaccounted
+			Assert::AreEqual(ring.Published(), received[0] + ring.Lost(ids[0]));
+			Assert::AreEqual(ring.Lost(ids[0]), lost[0]);
+			// Buttons 4-7 had no subscriber
+			Assert::AreEqual(total / 2, ring.Filtered());
+
+			std::string report = "Broadcast stress: " + std::to_string(ring.Published()) + " events, consumer 0 read " +
+				std::to_string(received[0]) + " and lost " + std::to_string(lost[0]);
+			Logger::WriteMessage(report.c_str());
+		}
+	};
+	// A callback subscription wired like SubscribeButtons: the drain reads
+	// the ring in batches and records the latency of the oldest event
+	struct DispatchFixture {
+		ButtonBroadcastRing<RingTestEvent, 1024> ring;
+		ButtonDispatcher dispatcher;
+		std::mutex mutex;
+		std::condition_variable delivered;
+		std::vector<uint64_t> values;
+		std::vector<size_t> batches;
+		std::function<void()> onCallback;
+
+		static uint64_t Now() {
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+
+		int Subscribe(uint64_t mask) {
+			int id = ring.Subscribe(mask);
+			return dispatcher.Add([this, id] {
+				RingTestEvent events[64];
+				size_t count;
+				do {
+					count = ring.Read(id, events, 64);
+					if (count == 0) {
+						break;
+					}
+					uint64_t now = Now();
+					dispatcher.Latency().Record(now > events[0].value ? now - events[0].value : 0);
+					if (onCallback) {
+						onCallback();
+					}
+					std::lock_guard<std::mutex> lock(mutex);
+					for (size_t i = 0; i < count; i++) {
+						values.push_back(events[i].value);
+					}
+					batches.push_back(count);
+					delivered.notify_all();
+				} while (count == 64);
+			});
+		}
+
+		// Publishes an event stamped with the current time and notifies
+		void Capture(int button) {
+			ring.Publish(MakeRingEvent(Now(), button), button);
+			dispatcher.Notify();
+		}
+
+		bool WaitFor(size_t count) {
+			std::unique_lock<std::mutex> lock(mutex);
+			return delivered.wait_for(lock, std::chrono::seconds(5), [&] { return values.size() >= count; });
+		}
+	};
+
+	TEST_CLASS(ButtonDispatcherTests)
+	{
+	public:
+		TEST_METHOD(TestLatencyBuckets)
+		{
+			Assert::AreEqual(static_cast<size_t>(0), DispatchLatencyHistogram::Bucket(0));
+			Assert::AreEqual(static_cast<size_t>(1), DispatchLatencyHistogram::Bucket(1));
+			Assert::AreEqual(static_cast<size_t>(2), DispatchLatencyHistogram::Bucket(3));
+			Assert::AreEqual(static_cast<size_t>(10), DispatchLatencyHistogram::Bucket(1000));
+			Assert::AreEqual(static_cast<size_t>(BUTTON_DISPATCH_LATENCY_BUCKETS - 1),
+				DispatchLatencyHistogram::Bucket(~0ULL));
+
+			DispatchLatencyHistogram histogram;
+			for (int i = 0; i < 90; i++) histogram.Record(5);   // Bucket 3, up to 8 us
+			for (int i = 0; i < 10; i++) histogram.Record(700); // Bucket 10, up to 1024 us
+			Assert::AreEqual(static_cast<uint64_t>(8), histogram.Percentile(0.5));
+			Assert::AreEqual(static_cast<uint64_t>(1024), histogram.Percentile(0.99));
+			uint64_t buckets[BUTTON_DISPATCH_LATENCY_BUCKETS + 4] = {};
+			Assert::AreEqual(static_cast<size_t>(BUTTON_DISPATCH_LATENCY_BUCKETS),
+				histogram.Read(buckets, BUTTON_DISPATCH_LATENCY_BUCKETS + 4));
+			Assert::AreEqual(static_cast<uint64_t>(90), buckets[3]);
+			histogram.Reset();
+			Assert::AreEqual(static_cast<uint64_t>(0), histogram.Total());
+		}
+
+		TEST_METHOD(TestBurstCostsOneCallback)
+		{
+			DispatchFixture fixture;
+			fixture.Subscribe(~0ULL);
+			for (int i = 0; i < 50; i++) {
+				fixture.Capture(0);
+			}
+			// Fifty notifications, one round, one callback
+			fixture.dispatcher.RunOnce();
+			Assert::AreEqual(static_cast<size_t>(1), fixture.batches.size());
+			Assert::AreEqual(static_cast<size_t>(50), fixture.batches[0]);
+
+			// Longer bursts are split into batches of 64
+			for (int i = 0; i < 150; i++) {
+				fixture.Capture(0);
+			}
+			fixture.dispatcher.RunOnce();
+			Assert::AreEqual(static_cast<size_t>(4), fixture.batches.size());
+			Assert::AreEqual(static_cast<size_t>(22), fixture.batches[3]);
+		}
+
+		TEST_METHOD(TestThreadBatchesWhileCallbackRuns)
+		{
+			DispatchFixture fixture;
+			std::mutex gateMutex;
+			std::condition_variable gateChanged;
+			bool entered = false, open = false;
+			fixture.onCallback = [&] {
+				std::unique_lock<std::mutex> lock(gateMutex);
+				entered = true;
+				gateChanged.notify_all();
+				gateChanged.wait(lock, [&] { return open; });
+			};
+			fixture.Subscribe(0x1);
+			fixture.dispatcher.Start();
+
+			fixture.Capture(0);
+			{
+				std::unique_lock<std::mutex> lock(gateMutex);
+				Assert::IsTrue(gateChanged.wait_for(lock, std::chrono::seconds(5), [&] { return entered; }));
+			}
+			// Captured while the first callback is still running
+			for (int i = 0; i < 40; i++) {
+				fixture.Capture(0);
+				fixture.Capture(1); // Not subscribed; filtered at the source
+			}
+			{
+				std::lock_guard<std::mutex> lock(gateMutex);
+				open = true;
+			}
+			gateChanged.notify_all();
+
+			Assert::IsTrue(fixture.WaitFor(41));
+			fixture.dispatcher.Stop();
+			Assert::AreEqual(static_cast<size_t>(41), fixture.values.size());
+			Assert::AreEqual(static_cast<size_t>(2), fixture.batches.size());
+			Assert::AreEqual(static_cast<uint64_t>(40), fixture.ring.Filtered());
+			Assert::AreEqual(static_cast<uint64_t>(2), fixture.dispatcher.Latency().Total());
+		}
+
+		TEST_METHOD(TestRemoveWaitsForRunningCallback)
+		{
+			DispatchFixture fixture;
+			std::atomic<bool> inCallback{ false }, finished{ false };
+			fixture.onCallback = [&] {
+				inCallback = true;
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				finished = true;
+			};
+			int entry = fixture.Subscribe(~0ULL);
+			fixture.dispatcher.Start();
+			fixture.Capture(0);
+			while (!inCallback) {
+				std::this_thread::yield();
+			}
+			Assert::IsTrue(fixture.dispatcher.Remove(entry));
+			Assert::IsTrue(finished.load());
+			Assert::IsFalse(fixture.dispatcher.Remove(entry));
+
+			// Not called any more
+			fixture.Capture(0);
+			fixture.dispatcher.Stop();
+			fixture.dispatcher.RunOnce();
+			Assert::AreEqual(static_cast<size_t>(1), fixture.values.size());
+		}
+
+		TEST_METHOD(TestCallbackMayRemoveItself)
+		{
+			DispatchFixture fixture;
+			int entry = 0;
+			bool removed = false;
+			fixture.onCallback = [&] {
+				removed = fixture.dispatcher.Remove(entry);
+			};
+			entry = fixture.Subscribe(~0ULL);
+			fixture.dispatcher.Start();
+			fixture.Capture(0);
+			Assert::IsTrue(fixture.WaitFor(1));
+			fixture.dispatcher.Stop();
+			Assert::IsTrue(removed);
+		}
+	};
+
+#ifdef BUTTON_BENCHMARKS
+	// Fan-out throughput and dispatch latency
+	TEST_CLASS(ButtonBroadcastBenchmarks)
+	{
+	public:
+		TEST_METHOD(BenchmarkFanOut)
+		{
+			// Broadcast ring against a queue per consumer filled under a
+			// mutex. The producer publishes in batches and waits for every
+			// consumer to catch up, so nothing is lost and both deliver
+			// every event to every consumer.
+			const uint64_t total = 1 << 18;
+			const uint64_t batch = 256;
+			std::string report = "Fan-out (events delivered per second):";
+			for (int consumers : { 1, 4, 16 }) {
+				double ringRate = 0;
+				{
+					auto ring = std::make_unique<ButtonBroadcastRing<RingTestEvent, 1024>>();
+					std::vector<int> ids;
+					for (int c = 0; c < consumers; c++) {
+						ids.push_back(ring->Subscribe(~0ULL));
+					}
+					std::vector<std::atomic<uint64_t>> progress(consumers);
+					std::vector<std::thread> threads;
+					auto start = std::chrono::steady_clock::now();
+					for (int c = 0; c < consumers; c++) {
+						threads.emplace_back([&, c] {
+							RingTestEvent events[64];
+							uint64_t read = 0;
+							while (read < total) {
+								size_t count = ring->Read(ids[c], events, 64);
+								read += count;
+								progress[c].store(read, std::memory_order_release);
+								if (count == 0) {
+									std::this_thread::yield();
+								}
+							}
+						});
+					}
+					for (uint64_t i = 0; i < total; i++) {
+						ring->Publish(MakeRingEvent(i, 0), 0);
+						if ((i + 1) % batch == 0) {
+							for (auto& done : progress) {
+								while (done.load(std::memory_order_acquire) + batch < i + 1) {
+									std::this_thread::yield();
+								}
+							}
+						}
+					}
+					for (auto& thread : threads) {
+						thread.join();
+					}
+					auto end = std::chrono::steady_clock::now();
+					for (int id : ids) {
+						Assert::AreEqual(static_cast<uint64_t>(0), ring->Lost(id));
+					}
+					ringRate = static_cast<double>(total) * consumers / std::chrono::duration<double>(end - start).count();
+				}
+
+				double queueRate = 0;
+				{
+					std::mutex mutex;
+					std::vector<std::unique_ptr<EventQueue<RingTestEvent, 1024>>> queues;
+					for (int c = 0; c < consumers; c++) {
+						queues.push_back(std::make_unique<EventQueue<RingTestEvent, 1024>>());
+					}
+					std::vector<std::atomic<uint64_t>> progress(consumers);
+					std::vector<std::thread> threads;
+					auto start = std::chrono::steady_clock::now();
+					for (int c = 0; c < consumers; c++) {
+						threads.emplace_back([&, c] {
+							RingTestEvent events[64];
+							uint64_t read = 0;
+							while (read < total) {
+								size_t count;
+								{
+									std::lock_guard<std::mutex> lock(mutex);
+									count = queues[c]->Pop(events, 64);
+								}
+								read += count;
+								progress[c].store(read, std::memory_order_release);
+								if (count == 0) {
+									std::this_thread::yield();
+								}
+							}
+						});
+					}
+					for (uint64_t i = 0; i < total; i++) {
+						{
+							std::lock_guard<std::mutex> lock(mutex);
+							RingTestEvent event = MakeRingEvent(i, 0);
+							for (auto& queue : queues) {
+								queue->Push(event);
+							}
+						}
+						if ((i + 1) % batch == 0) {
+							for (auto& done : progress) {
+								while (done.load(std::memory_order_acquire) + batch < i + 1) {
+									std::this_thread::yield();
+								}
+							}
+						}
+					}
+					for (auto& thread : threads) {
+						thread.join();
+					}
+					auto end = std::chrono::steady_clock::now();
+					queueRate = static_cast<double>(total) * consumers / std::chrono::duration<double>(end - start).count();
+				}
+
+				std::ostringstream line;
+				line << std::fixed << std::setprecision(1) << " " << consumers << " consumers: ring " << ringRate / 1e6
+					<< "M, locked queues " << queueRate / 1e6 << "M;";
+				report += line.str();
+			}
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkDispatchLatency)
+		{
+			DispatchFixture fixture;
+			fixture.Subscribe(~0ULL);
+			fixture.dispatcher.Start();
+
+			// Single presses: capture to callback
+			const size_t presses = 2000;
+			for (size_t i = 0; i < presses; i++) {
+				fixture.Capture(0);
+				Assert::IsTrue(fixture.WaitFor(i + 1));
+			}
+			DispatchLatencyHistogram& latency = fixture.dispatcher.Latency();
+			uint64_t p50 = latency.Percentile(0.5);
+			uint64_t p99 = latency.Percentile(0.99);
+
+			// Bursts: events per callback
+			const size_t burst = 20000;
+			size_t callbacksBefore;
+			{
+				std::lock_guard<std::mutex> lock(fixture.mutex);
+				callbacksBefore = fixture.batches.size();
+			}
+			for (size_t i = 0; i < burst; i++) {
+				fixture.Capture(0);
+				if ((i & 255) == 255) {
+					std::this_thread::yield(); // Let the dispatcher keep up with the ring
+				}
+			}
+			{
+				// Everything arrives, less what a slow dispatcher lost
+				std::unique_lock<std::mutex> lock(fixture.mutex);
+				Assert::IsTrue(fixture.delivered.wait_for(lock, std::chrono::seconds(5), [&] {
+					return fixture.values.size() + fixture.ring.Lost(0) >= presses + burst;
+				}));
+			}
+			fixture.dispatcher.Stop();
+			size_t callbacks = fixture.batches.size() - callbacksBefore;
+
+			std::ostringstream report;
+			report << "Dispatch: single press latency p50 <= " << p50 << " us, p99 <= " << p99 << " us; burst of "
+				<< burst << " events in " << callbacks << " callbacks (" << std::fixed << std::setprecision(1)
+				<< static_cast<double>(burst) / static_cast<double>(callbacks) << " events per callback)";
+			Logger::WriteMessage(report.str().c_str());
+		}
+	};
+#endif
+}
@@ -0,0 +1,294 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Common/ButtonEventBuffer.h"
+#include "../Common/PollScheduler.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace CommonTest
+{
+	// Scripted buffered device: queued changes, overflow and read failures
+	class FakeButtonDevice : public ButtonEventBackend {
+	public:
+		std::vector<ButtonBufferedChange> pending;
+		uint64_t state[BUTTON_BUFFER_WORDS] = {};
+		bool overflow = false;
+		bool fail = false;
+		int reads = 0;
+
+		// Queues a change and applies it to the state, like the device would
+		void Change(uint32_t button, bool pressed, uint32_t sequence) {
+			pending.push_back({ button, pressed, sequence * 10, sequence });
+			if (pressed) state[button / 64] |= 1ULL << (button % 64);
+			else state[button / 64] &= ~(1ULL << (button % 64));
+		}
+
+		int ReadChanges(ButtonBufferedChange* changes, int maxChanges, bool& lost) override {
+			reads++;
+			if (fail) return -1;
+			int count = 0;
+			while (count < maxChanges && !pending.empty()) {
+				changes[count++] = pending.front();
+				pending.erase(pending.begin());
+			}
+			if (overflow) {
+				lost = true;
+				overflow = false;
+			}
+			return count;
+		}
+
+		bool ReadState(uint64_t (&words)[BUTTON_BUFFER_WORDS]) override {
+			if (fail) return false;
+			for (int w = 0; w < BUTTON_BUFFER_WORDS; w++) words[w] = state[w];
+			return true;
+		}
+	};
+
+	// Buffered DirectInput events, merged against a fake device
+	TEST_CLASS(ButtonEventBufferTests)
+	{
+	public:
+		TEST_METHOD(TestTapBetweenPollsIsKept)
+		{
+			FakeButtonDevice device;
+			ButtonEventMerger merger;
+			Assert::AreEqual(0, merger.Drain(device));
+
+			// Pressed and released before the next read; a state poll sees nothing
+			device.Change(3, true, 1);
+			device.Change(3, false, 2);
+			device.Change(100, true, 3);
+			Assert::AreEqual(3, merger.Drain(device));
+
+			ButtonBufferEvent events[8];
+			Assert::AreEqual((size_t)3, merger.Pop(events, 8));
+			Assert::AreEqual((uint16_t)3, events[0].button);
+			Assert::IsTrue(events[0].pressed);
+			Assert::AreEqual((uint32_t)1, events[0].sequence);
+			Assert::AreEqual((uint32_t)10, events[0].timestamp);
+			Assert::IsFalse(events[1].pressed);
+			Assert::AreEqual((uint32_t)2, events[1].sequence);
+			Assert::AreEqual((uint16_t)100, events[2].button);
+			Assert::IsFalse(events[2].resync);
+			Assert::IsTrue(merger.Pressed(100));
+		}
+
+		TEST_METHOD(TestDrainsInBatches)
+		{
+			FakeButtonDevice device;
+			ButtonEventMerger merger;
+			merger.Drain(device);
+			device.reads = 0;
+			for (uint32_t i = 0; i < 100; i++) {
+				device.Change(i % 128, true, i);
+			}
+			Assert::AreEqual(100, merger.Drain(device));
+			Assert::AreEqual(4, device.reads); // 32 + 32 + 32 + 4
+			Assert::IsTrue(device.pending.empty());
+		}
+
+		TEST_METHOD(TestPrimedStateSuppressesStaleChanges)
+		{
+			FakeButtonDevice device;
+			device.Change(5, true, 1); // Buffered before the first read, already in the state
+			ButtonEventMerger merger;
+			Assert::AreEqual(0, merger.Drain(device));
+			Assert::IsTrue(merger.Pressed(5));
+
+			device.pending.push_back({ 5, true, 20, 2 }); // Repeated value
+			device.pending.push_back({ 500, true, 30, 3 }); // Not a button
+			Assert::AreEqual(0, merger.Drain(device));
+		}
+
+		TEST_METHOD(TestOverflowIsResynced)
+		{
+			FakeButtonDevice device;
+			ButtonEventMerger merger;
+			merger.Drain(device);
+
+			device.Change(1, true, 7);
+			// These changes never make it into the device buffer
+			device.state[0] |= 1ULL << 9;
+			device.state[1] |= 1ULL << 2;
+			device.overflow = true;
+			Assert::AreEqual(3, merger.Drain(device));
+			Assert::AreEqual((uint64_t)1, merger.Overflows());
+
+			ButtonBufferEvent events[8];
+			Assert::AreEqual((size_t)3, merger.Pop(events, 8));
+			Assert::IsFalse(events[0].resync);
+			Assert::AreEqual((uint16_t)9, events[1].button);
+			Assert::IsTrue(events[1].resync);
+			Assert::AreEqual((uint32_t)7, events[1].sequence);
+			Assert::AreEqual((uint16_t)66, events[2].button);
+			Assert::IsTrue(events[2].pressed);
+		}
+
+		TEST_METHOD(TestReadFailure)
+		{
+			FakeButtonDevice device;
+			ButtonEventMerger merger;
+			device.fail = true;
+			Assert::AreEqual(-1, merger.Drain(device));
+			device.fail = false;
+			Assert::AreEqual(0, merger.Drain(device));
+		}
+
+		TEST_METHOD(TestQueueDropsOldest)
+		{
+			FakeButtonDevice device;
+			ButtonEventMerger merger;
+			merger.Drain(device);
+			for (uint32_t i = 0; i < BUTTON_BUFFER_QUEUE_SIZE + 10; i++) {
+				device.Change(0, i % 2 == 0, i);
+			}
+			merger.Drain(device);
+			Assert::AreEqual((uint64_t)10, merger.Dropped());
+			ButtonBufferEvent event = {};
+			Assert::AreEqual((size_t)1, merger.Pop(&event, 1));
+			Assert::AreEqual((uint32_t)10, event.sequence);
+		}
+	};
+
+	// Fake device that records when it was sampled
+	class TimedButtonDevice : public FakeButtonDevice {
+	public:
+		std::vector<std::chrono::steady_clock::time_point> samples;
+
+		bool ReadState(uint64_t (&words)[BUTTON_BUFFER_WORDS]) override {
+			samples.push_back(std::chrono::steady_clock::now());
+			return FakeButtonDevice::ReadState(words);
+		}
+	};
+
+	// Fixed-rate sampling of devices without a buffer
+	TEST_CLASS(PollSchedulerTests)
+	{
+	public:
+		TEST_METHOD(TestPollsAreSpreadOverThePeriod)
+		{
+			std::vector<PollScheduler::Clock::time_point> waits;
+			PollScheduler scheduler([&](PollScheduler::Clock::time_point until) { waits.push_back(until); });
+			FakeButtonDevice devices[4];
+			for (auto& device : devices) {
+				scheduler.Add(&device);
+			}
+			// Default rate: 1 kHz
+			Assert::AreEqual((long long)1000000, (long long)scheduler.Period().count());
+
+			auto start = PollScheduler::Clock::now() + std::chrono::seconds(10);
+			scheduler.RunPeriod(start);
+			Assert::AreEqual((size_t)4, waits.size());
+			for (size_t k = 0; k < waits.size(); k++) {
+				long long offset = std::chrono::duration_cast<std::chrono::microseconds>(waits[k] - start).count();
+				Assert::AreEqual((long long)(k * 250), offset);
+			}
+			Assert::IsFalse(scheduler.Start(0));
+			Assert::IsFalse(scheduler.Start(POLL_SCHEDULER_MAX_RATE + 1));
+		}
+
+		TEST_METHOD(TestOnlyChangesAreQueued)
+		{
+			PollScheduler scheduler([](PollScheduler::Clock::time_point) {}, [] { return 42u; });
+			FakeButtonDevice first, second;
+			first.state[0] = 0x1; // Held before polling starts: not an event
+			int firstId = scheduler.Add(&first);
+			int secondId = scheduler.Add(&second);
+
+			auto now = PollScheduler::Clock::now();
+			scheduler.RunPeriod(now);
+			scheduler.RunPeriod(now);
+			first.state[0] = 0x3;
+			second.state[1] = 0x8;
+			scheduler.RunPeriod(now);
+			scheduler.RunPeriod(now);
+			Assert::AreEqual((uint64_t)8, scheduler.Polls());
+
+			ButtonBufferEvent events[8];
+			Assert::AreEqual(1, scheduler.Pop(firstId, events, 8));
+			Assert::AreEqual((uint16_t)1, events[0].button);
+			Assert::IsTrue(events[0].pressed);
+			Assert::AreEqual((uint32_t)3, events[0].sequence);
+			Assert::AreEqual((uint32_t)42, events[0].timestamp);
+			Assert::AreEqual(1, scheduler.Pop(secondId, events, 8));
+			Assert::AreEqual((uint16_t)67, events[0].button);
+			Assert::AreEqual(0, scheduler.Pop(secondId, events, 8));
+		}
+
+		TEST_METHOD(TestRemovedDeviceIsNotPolled)
+		{
+			PollScheduler scheduler([](PollScheduler::Clock::time_point) {});
+			TimedButtonDevice kept, removed;
+			scheduler.Add(&kept);
+			int removedId = scheduler.Add(&removed);
+			scheduler.RunPeriod(PollScheduler::Clock::now());
+			Assert::IsTrue(scheduler.Remove(removedId));
+			Assert::IsFalse(scheduler.Remove(removedId));
+			scheduler.RunPeriod(PollScheduler::Clock::now());
+			Assert::AreEqual((size_t)2, kept.samples.size());
+			Assert::AreEqual((size_t)1, removed.samples.size());
+			ButtonBufferEvent event;
+			Assert::AreEqual(-1, scheduler.Pop(removedId, &event, 1));
+
+			kept.fail = true;
+			scheduler.RunPeriod(PollScheduler::Clock::now());
+			Assert::AreEqual((uint64_t)1, scheduler.Failures());
+		}
+	};
+
+#ifdef BUTTON_BENCHMARKS
+	// Sampling jitter of the poll scheduler
+	TEST_CLASS(ButtonEventBenchmarks)
+	{
+	public:
+		TEST_METHOD(BenchmarkFixedRate)
+		{
+			const int rate = 1000;
+			const int deviceCount = 8;
+			PollScheduler scheduler;
+			TimedButtonDevice devices[deviceCount];
+			for (auto& device : devices) {
+				scheduler.Add(&device);
+			}
+			Assert::IsTrue(scheduler.Start(rate));
+			std::this_thread::sleep_for(std::chrono::milliseconds(300));
+			scheduler.Stop();
+
+			// Per-device sample intervals, and the closest two polls of different devices
+			double worstIntervalUs = 0, sumIntervalUs = 0;
+			size_t intervals = 0, polls = 0;
+			std::vector<PollScheduler::Clock::time_point> all;
+			for (auto& device : devices) {
+				polls += device.samples.size();
+				for (size_t i = 1; i < device.samples.size(); i++) {
+					double us = std::chrono::duration<double, std::micro>(device.samples[i] - device.samples[i - 1]).count();
+					sumIntervalUs += us;
+					worstIntervalUs = us > worstIntervalUs ? us : worstIntervalUs;
+					intervals++;
+				}
+				all.insert(all.end(), device.samples.begin(), device.samples.end());
+			}
+			std::sort(all.begin(), all.end());
+			size_t closeGaps = 0;
+			for (size_t i = 1; i < all.size(); i++) {
+				if (all[i] - all[i - 1] < std::chrono::microseconds(20)) closeGaps++;
+			}
+
+			Assert::IsTrue(intervals > 0);
+			Assert::AreEqual((uint64_t)polls, scheduler.Polls());
+			std::string report = std::to_string(deviceCount) + " devices at " + std::to_string(rate) +
+				" Hz for 300 ms: " + std::to_string(polls / deviceCount) + " samples per device, mean interval " +
+				std::to_string(sumIntervalUs / intervals) + " us, worst " + std::to_string(worstIntervalUs) +
+				" us, " + std::to_string(closeGaps) + " polls within 20 us of another, " +
+				std::to_string(scheduler.SkippedPeriods()) + " periods skipped";
+			Logger::WriteMessage(report.c_str());
+		}
+	};
+#endif
+}
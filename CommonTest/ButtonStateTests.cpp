@@ -0,0 +1,651 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Common/ButtonDebounce.h"
+#include "../Common/ButtonEdges.h"
+#include "../Common/ButtonGestures.h"
+#include "../Common/ButtonPack.h"
+#include "../Common/ButtonProfile.h"
+#include "../Common/TimerWheel.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace CommonTest
+{
+	// Edge detection stage, runs without a device
+	TEST_CLASS(ButtonEdgeTests)
+	{
+	public:
+		struct Edge {
+			int bit;
+			bool pressed;
+		};
+
+		TEST_METHOD(TestFirstStateOnlyPrimes)
+		{
+			// Three Button Controller idles at 0xC0 in byte 1
+			EdgeDetector edges;
+			std::vector<Edge> seen;
+			auto collect = [&](int bit, bool pressed) { seen.push_back({ bit, pressed }); };
+
+			Assert::AreEqual(0ULL, (unsigned long long)edges.Process(0xC000, collect));
+			Assert::IsTrue(seen.empty());
+
+			edges.Process(0xD000, collect); // Left button (0xC0 | 0x10)
+			Assert::AreEqual((size_t)1, seen.size());
+			Assert::AreEqual(12, seen[0].bit);
+			Assert::IsTrue(seen[0].pressed);
+		}
+
+		TEST_METHOD(TestChordInOneReportIsOrdered)
+		{
+			// USB FS IO reports Left+Middle as 0x18 in byte 1
+			EdgeDetector edges;
+			std::vector<Edge> seen;
+			auto collect = [&](int bit, bool pressed) { seen.push_back({ bit, pressed }); };
+
+			edges.Process(0x00DD, collect);
+			edges.Process(0x18DD, collect);
+			edges.Process(0x08DD, collect);
+
+			Assert::AreEqual((size_t)3, seen.size());
+			Assert::AreEqual(11, seen[0].bit);
+			Assert::IsTrue(seen[0].pressed);
+			Assert::AreEqual(12, seen[1].bit);
+			Assert::IsTrue(seen[1].pressed);
+			Assert::AreEqual(12, seen[2].bit);
+			Assert::IsFalse(seen[2].pressed);
+		}
+
+		TEST_METHOD(TestHighBitsAndCountTrailingZeros)
+		{
+			Assert::AreEqual(0, CountTrailingZeros64(1ULL));
+			Assert::AreEqual(31, CountTrailingZeros64(1ULL << 31));
+			Assert::AreEqual(32, CountTrailingZeros64(1ULL << 32));
+			Assert::AreEqual(62, CountTrailingZeros64(1ULL << 62));
+
+			std::vector<int> bits;
+			ForEachSetBit(0x8000000100000005ULL, [&](int bit) { bits.push_back(bit); });
+			Assert::AreEqual((size_t)4, bits.size());
+			Assert::AreEqual(0, bits[0]);
+			Assert::AreEqual(2, bits[1]);
+			Assert::AreEqual(32, bits[2]);
+			Assert::AreEqual(63, bits[3]);
+		}
+
+		TEST_METHOD(TestEventQueueDropsOldest)
+		{
+			EventQueue<int, 4> queue;
+			for (int i = 0; i < 6; i++) {
+				queue.Push(i);
+			}
+			Assert::AreEqual((size_t)4, queue.Size());
+			Assert::AreEqual(2ULL, (unsigned long long)queue.Dropped());
+
+			int out[8];
+			Assert::AreEqual((size_t)3, queue.Pop(out, 3));
+			Assert::AreEqual(2, out[0]);
+			Assert::AreEqual(4, out[2]);
+			Assert::AreEqual((size_t)1, queue.Pop(out, 8));
+			Assert::AreEqual(5, out[0]);
+			Assert::IsTrue(queue.Empty());
+		}
+	};
+
+	// One integer counter per button, the way application code does it
+	struct NaiveDebouncer {
+		std::vector<int> count, press, release;
+		std::vector<bool> state;
+
+		explicit NaiveDebouncer(size_t buttons)
+			: count(buttons, 0), press(buttons, 1), release(buttons, 1), state(buttons, false) {}
+
+		void Process(const uint64_t* raw, uint64_t* out) {
+			for (size_t b = 0; b < state.size(); b++) {
+				bool level = ((raw[b / 64] >> (b % 64)) & 1ULL) != 0;
+				if (level != state[b]) {
+					if (++count[b] >= (state[b] ? release[b] : press[b])) {
+						state[b] = level;
+						count[b] = 0;
+					}
+				}
+				else {
+					count[b] = 0;
+				}
+				if (state[b]) out[b / 64] |= 1ULL << (b % 64);
+				else out[b / 64] &= ~(1ULL << (b % 64));
+			}
+		}
+	};
+
+	// Square waves per button with random chatter around every edge
+	struct BouncySignal {
+		uint32_t seed = 12345;
+		std::vector<bool> level;
+		std::vector<int> untilToggle, bounce;
+
+		explicit BouncySignal(size_t buttons) : level(buttons, false), untilToggle(buttons), bounce(buttons, 0) {
+			for (auto& t : untilToggle) t = 20 + Next() % 200;
+		}
+
+		uint32_t Next() {
+			seed = seed * 1664525u + 1013904223u;
+			return seed >> 8;
+		}
+
+		void Sample(uint64_t* words) {
+			for (size_t b = 0; b < level.size(); b++) {
+				if (--untilToggle[b] == 0) {
+					level[b] = !level[b];
+					untilToggle[b] = 20 + Next() % 200;
+					bounce[b] = 1 + Next() % 8;
+				}
+				bool value = level[b];
+				if (bounce[b] > 0) {
+					bounce[b]--;
+					if (Next() & 1) value = !value;
+				}
+				if (value) words[b / 64] |= 1ULL << (b % 64);
+				else words[b / 64] &= ~(1ULL << (b % 64));
+			}
+		}
+	};
+
+	// Debounce engine, checked against a naive per-button implementation
+	TEST_CLASS(ButtonDebounceTests)
+	{
+	public:
+		TEST_METHOD(TestChatterIsFiltered)
+		{
+			DebounceBank bank;
+			bank.SetAllThresholds(3, 2);
+			uint64_t zero = 0;
+			bank.Reset(0, &zero);
+
+			const uint64_t samples[] = { 1, 0, 1, 1, 1, 0, 1, 0, 0 };
+			const uint64_t expected[] = { 0, 0, 0, 0, 1, 1, 1, 1, 0 };
+			for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+				Assert::AreEqual((unsigned long long)expected[i],
+					(unsigned long long)bank.Process(0, &samples[i])[0]);
+			}
+		}
+
+		TEST_METHOD(TestPerButtonThresholds)
+		{
+			DebounceBank bank(1, 2);
+			bank.SetThresholds(0, 0, 1, 1);
+			bank.SetThresholds(0, 100, 4, 1);
+			Assert::IsFalse(bank.SetThresholds(0, 128, 1, 1));
+
+			uint64_t raw[2] = { 1, 1ULL << 36 };
+			const uint64_t* state = bank.Process(0, raw);
+			Assert::AreEqual(1ULL, (unsigned long long)state[0]);
+			Assert::AreEqual(0ULL, (unsigned long long)state[1]);
+			bank.Process(0, raw);
+			bank.Process(0, raw);
+			state = bank.Process(0, raw);
+			Assert::AreEqual((unsigned long long)(1ULL << 36), (unsigned long long)state[1]);
+		}
+
+		TEST_METHOD(TestLoweredThresholdsDoNotWrapCounters)
+		{
+			// Six samples into a press of ten, then button 0's threshold drops to three
+			DebounceBank bank(1, 1);
+			bank.SetAllThresholds(10, 10);
+			uint64_t pressed = 0x5;
+			for (int i = 0; i < 6; i++) {
+				Assert::AreEqual(0ULL, (unsigned long long)bank.Process(0, &pressed)[0]);
+			}
+			bank.SetThresholds(0, 0, 3, 10);
+			Assert::AreEqual(0x1ULL, (unsigned long long)bank.Process(0, &pressed)[0]);
+
+			// Button 2 is at seven; every threshold drops to four
+			bank.SetAllThresholds(4, 4);
+			Assert::AreEqual(0x5ULL, (unsigned long long)bank.Process(0, &pressed)[0]);
+
+			// The same on the release side
+			bank.SetAllThresholds(10, 10);
+			uint64_t released = 0;
+			for (int i = 0; i < 6; i++) {
+				Assert::AreEqual(0x5ULL, (unsigned long long)bank.Process(0, &released)[0]);
+			}
+			bank.SetAllThresholds(2, 2);
+			Assert::AreEqual(0ULL, (unsigned long long)bank.Process(0, &released)[0]);
+
+			// A counter below the new threshold keeps counting
+			bank.SetAllThresholds(5, 5);
+			bank.Process(0, &pressed);
+			bank.SetAllThresholds(3, 3);
+			Assert::AreEqual(0ULL, (unsigned long long)bank.Process(0, &pressed)[0]);
+			Assert::AreEqual(0x5ULL, (unsigned long long)bank.Process(0, &pressed)[0]);
+		}
+	};
+
+	// Gesture recognizer and timer wheel, driven by an injected clock
+	TEST_CLASS(ButtonGestureTests)
+	{
+	public:
+		struct Fired {
+			int id;
+			uint64_t timestamp;
+		};
+
+		// Wraps the recognizer with a fake clock in milliseconds
+		struct Harness {
+			GestureRecognizer recognizer;
+			std::vector<Fired> fired;
+			uint64_t nowMs = 1000;
+
+			void Edge(int bit, bool pressed) {
+				recognizer.OnEdge(bit, pressed, nowMs * 1000,
+					[&](int id, uint64_t ts) { fired.push_back({ id, ts }); });
+			}
+
+			void Wait(uint64_t ms) {
+				nowMs += ms;
+				recognizer.Advance(nowMs * 1000,
+					[&](int id, uint64_t ts) { fired.push_back({ id, ts }); });
+			}
+		};
+
+		TEST_METHOD(TestChordWithinWindow)
+		{
+			// USB FS IO Left+Middle (0x18 in byte 1)
+			Harness h;
+			int chord = h.recognizer.Add(GestureChord, 0x1800, 50);
+			Assert::AreEqual(0, chord);
+
+			h.Edge(12, true);
+			h.Wait(30);
+			h.Edge(11, true);
+			Assert::AreEqual((size_t)1, h.fired.size());
+			Assert::AreEqual(chord, h.fired[0].id);
+			Assert::AreEqual((size_t)0, h.recognizer.PendingTimers());
+
+			// Must fully release before it can fire again
+			h.Edge(12, false);
+			h.Edge(12, true);
+			Assert::AreEqual((size_t)1, h.fired.size());
+			h.Edge(12, false);
+			h.Edge(11, false);
+			h.Edge(11, true);
+			h.Edge(12, true);
+			Assert::AreEqual((size_t)2, h.fired.size());
+		}
+
+		TEST_METHOD(TestChordTooSlow)
+		{
+			Harness h;
+			h.recognizer.Add(GestureChord, 0x1800, 50);
+			h.Edge(12, true);
+			h.Wait(80);
+			h.Edge(11, true);
+			Assert::IsTrue(h.fired.empty());
+		}
+
+		TEST_METHOD(TestLongPressFiresAtExpiry)
+		{
+			Harness h;
+			int hold = h.recognizer.Add(GestureLongPress, 1ULL << 3, 500);
+			h.Edge(3, true);
+			h.Wait(499);
+			Assert::IsTrue(h.fired.empty());
+			h.Wait(10);
+			Assert::AreEqual((size_t)1, h.fired.size());
+			Assert::AreEqual(hold, h.fired[0].id);
+			Assert::AreEqual((uint64_t)1500000, h.fired[0].timestamp);
+
+			// Short press does not fire and leaves no timer behind
+			h.Edge(3, false);
+			h.Edge(3, true);
+			h.Wait(100);
+			h.Edge(3, false);
+			h.Wait(1000);
+			Assert::AreEqual((size_t)1, h.fired.size());
+			Assert::AreEqual((size_t)0, h.recognizer.PendingTimers());
+		}
+
+		TEST_METHOD(TestDoublePress)
+		{
+			Harness h;
+			int twice = h.recognizer.Add(GestureDoublePress, 1ULL << 5, 300);
+			h.Edge(5, true);
+			h.Wait(50);
+			h.Edge(5, false);
+			h.Wait(50);
+			h.Edge(5, true);
+			Assert::AreEqual((size_t)1, h.fired.size());
+			Assert::AreEqual(twice, h.fired[0].id);
+			h.Edge(5, false);
+
+			// Second press after the timeout does not count
+			h.Edge(5, true);
+			h.Edge(5, false);
+			h.Wait(400);
+			h.Edge(5, true);
+			Assert::AreEqual((size_t)1, h.fired.size());
+		}
+
+		TEST_METHOD(TestInvalidDefinitions)
+		{
+			GestureRecognizer recognizer;
+			Assert::AreEqual(-1, recognizer.Add(0, 1, 10));
+			Assert::AreEqual(-1, recognizer.Add(GestureChord, 0, 10));
+			Assert::AreEqual(-1, recognizer.Add(GestureChord, 1, 0));
+		}
+
+		TEST_METHOD(TestTimerWheelOrderAndCancel)
+		{
+			TimerWheel wheel(0);
+			const int count = 5000;
+			std::vector<TimerWheel::TimerId> ids;
+			uint32_t seed = 1;
+			for (int i = 0; i < count; i++) {
+				seed = seed * 1664525u + 1013904223u;
+				ids.push_back(wheel.Schedule(1 + (seed >> 8) % 3000000, (uint32_t)i));
+			}
+			// Cancel every third timer
+			size_t cancelled = 0;
+			for (int i = 0; i < count; i += 3) {
+				Assert::IsTrue(wheel.Cancel(ids[i]));
+				Assert::IsFalse(wheel.Cancel(ids[i]));
+				cancelled++;
+			}
+			Assert::AreEqual(count - cancelled, wheel.Pending());
+
+			uint64_t last = 0;
+			size_t fired = 0;
+			bool ordered = true;
+			for (uint64_t now = 0; now <= 3000000; now += 997) {
+				wheel.Advance(now, [&](uint32_t payload, uint64_t expiry) {
+					ordered = ordered && expiry >= last && expiry <= now && payload % 3 != 0;
+					last = expiry;
+					fired++;
+				});
+			}
+			Assert::IsTrue(ordered, L"Timers fired out of order or after cancel");
+			Assert::AreEqual(count - cancelled, fired);
+			Assert::AreEqual((size_t)0, wheel.Pending());
+		}
+	};
+
+	// Calibration profile learning and persistence
+	TEST_CLASS(ButtonProfileTests)
+	{
+	public:
+		TEST_METHOD(TestLearnThreeButtonController)
+		{
+			// Idle 0xC0 in byte 1, each button pressed once, then released
+			ProfileLearner learner;
+			const uint64_t reports[] = { 0xC000, 0xD000, 0xC000, 0xC800, 0xC000, 0xE000, 0xC000 };
+			for (uint64_t report : reports) {
+				learner.Add(report);
+			}
+			Assert::AreEqual((uint32_t)7, learner.Samples());
+			Assert::AreEqual(0x3800ULL, (unsigned long long)learner.ActiveMask());
+			Assert::AreEqual(0xC000ULL, (unsigned long long)learner.Baseline());
+			Assert::AreEqual(2, ActiveReportBytes(learner.ActiveMask()));
+			Assert::AreEqual(3, CountBits64(learner.ActiveMask()));
+		}
+
+		TEST_METHOD(TestExtractBits)
+		{
+			Assert::AreEqual(2ULL, (unsigned long long)ExtractBits(0xD000, 0x3800)); // Left
+			Assert::AreEqual(1ULL, (unsigned long long)ExtractBits(0xC800, 0x3800)); // Middle
+			Assert::AreEqual(7ULL, (unsigned long long)ExtractBits(0xF8DD, 0x3800));
+			Assert::AreEqual(0x5ULL, (unsigned long long)ExtractBits(0x8000000000000001ULL, 0x8000000000000003ULL));
+		}
+
+		TEST_METHOD(TestStoreRoundTrip)
+		{
+			ButtonProfile profile;
+			profile.vendorID = 0x04D8;
+			profile.productID = 0x005E;
+			profile.versionNumber = 0x0100;
+			profile.baseline = 0xC000;
+			profile.activeMask = 0x3800;
+			profile.samples = 7;
+
+			ProfileStore store;
+			store.Put(profile);
+			std::string text = store.ToJson();
+			Logger::WriteMessage(text.c_str());
+			Assert::IsTrue(text.find("\"0x04d8:0x005e:0x0100\"") != std::string::npos);
+
+			ProfileStore loaded;
+			Assert::AreEqual(1, loaded.FromJson(text));
+			ButtonProfile found;
+			Assert::IsTrue(loaded.Find(0x04D8, 0x005E, 0x0100, found));
+			Assert::AreEqual(0x3800ULL, (unsigned long long)found.activeMask);
+			Assert::AreEqual(0xC000ULL, (unsigned long long)found.baseline);
+			Assert::IsFalse(loaded.Find(0x04D8, 0x005E, 0x0200, found));
+			Assert::AreEqual(-1, loaded.FromJson("not json"));
+		}
+	};
+
+	// Same layout as DIJOYSTATE2 (272 bytes), without the DirectInput headers
+	struct SyntheticJoyState2 {
+		int32_t axes[8];
+		uint32_t pov[4];
+		uint8_t rgbButtons[128];
+		int32_t extended[24];
+	};
+
+	// The loop ReadButtons used before, extended to all buttons
+	static void NaivePack(const uint8_t* bytes, size_t count, uint64_t* words) {
+		for (size_t w = 0; w < BUTTON_PACK_WORDS(count); w++) {
+			words[w] = 0;
+		}
+		for (size_t i = 0; i < count; i++) {
+			if (bytes[i] & 0x80) {
+				words[i / 64] |= (1ULL << (i % 64));
+			}
+		}
+	}
+
+	static void FillRandom(SyntheticJoyState2& js, uint32_t& seed) {
+		for (auto& button : js.rgbButtons) {
+			seed = seed * 1664525u + 1013904223u;
+			// Pressed buttons are 0x80; other low bits must be ignored
+			button = static_cast<uint8_t>(((seed >> 24) & 0x80) | ((seed >> 8) & 0x7F));
+		}
+	}
+
+	// Button byte packing, checked and timed on synthetic DIJOYSTATE2 buffers
+	TEST_CLASS(ButtonPackTests)
+	{
+	public:
+		TEST_METHOD(TestMatchesNaiveForAllLengths)
+		{
+			static_assert(sizeof(SyntheticJoyState2) == 272, "DIJOYSTATE2 is 272 bytes");
+			SyntheticJoyState2 js = {};
+			uint32_t seed = 1;
+			for (int round = 0; round < 50; round++) {
+				FillRandom(js, seed);
+				for (size_t count = 0; count <= 128; count++) {
+					uint64_t expected[2] = { 0, 0 };
+					uint64_t packed[2] = { 0, 0 };
+					uint64_t scalar[2] = { 0, 0 };
+					NaivePack(js.rgbButtons, count, expected);
+					PackButtonBytes(js.rgbButtons, count, packed);
+					PackButtonBytesScalar(js.rgbButtons, count, scalar);
+					for (size_t w = 0; w < BUTTON_PACK_WORDS(count); w++) {
+						Assert::AreEqual(expected[w], packed[w]);
+						Assert::AreEqual(expected[w], scalar[w]);
+					}
+				}
+			}
+		}
+
+		TEST_METHOD(TestButtonPositions)
+		{
+			SyntheticJoyState2 js = {};
+			js.rgbButtons[0] = 0x80;
+			js.rgbButtons[63] = 0x80;
+			js.rgbButtons[64] = 0xFF;
+			js.rgbButtons[127] = 0x80;
+			js.rgbButtons[5] = 0x7F; // High bit clear: released
+			uint64_t words[2];
+			PackButtonBytes(js.rgbButtons, 128, words);
+			Assert::AreEqual(0x8000000000000001ULL, (unsigned long long)words[0]);
+			Assert::AreEqual(0x8000000000000001ULL, (unsigned long long)words[1]);
+		}
+	};
+
+#ifdef BUTTON_BENCHMARKS
+	// Debounce and packing timed against the loops they replaced
+	TEST_CLASS(ButtonStateBenchmarks)
+	{
+	public:
+		TEST_METHOD(BenchmarkAgainstNaiveOnBouncySignals)
+		{
+			const size_t devices = 16;
+			const size_t words = 2; // 128 buttons per device
+			const size_t buttons = devices * words * 64;
+			const int samples = 20000;
+
+			DebounceBank bank(devices, words);
+			NaiveDebouncer naive(buttons);
+			for (size_t d = 0; d < devices; d++) {
+				for (int b = 0; b < (int)(words * 64); b++) {
+					int press = 1 + (b * 7 + (int)d) % 6;
+					int release = 1 + (b * 3 + (int)d) % 4;
+					bank.SetThresholds(d, b, press, release);
+					naive.press[d * words * 64 + b] = press;
+					naive.release[d * words * 64 + b] = release;
+				}
+			}
+
+			// Generate the signal up front so only the filters are timed
+			BouncySignal signal(buttons);
+			std::vector<uint64_t> input(samples * devices * words, 0);
+			for (int i = 0; i < samples; i++) {
+				signal.Sample(&input[i * devices * words]);
+			}
+
+			std::vector<uint64_t> naiveOut(samples * devices * words, 0);
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < samples; i++) {
+				naive.Process(&input[i * devices * words], &naiveOut[i * devices * words]);
+			}
+			auto naiveTime = std::chrono::steady_clock::now() - start;
+
+			std::vector<uint64_t> bankOut(samples * devices * words, 0);
+			start = std::chrono::steady_clock::now();
+			for (int i = 0; i < samples; i++) {
+				const uint64_t* state = bank.ProcessAll(&input[i * devices * words]);
+				std::copy(state, state + devices * words, &bankOut[i * devices * words]);
+			}
+			auto bankTime = std::chrono::steady_clock::now() - start;
+
+			Assert::IsTrue(naiveOut == bankOut, L"Bit-parallel debounce differs from naive");
+
+			auto ns = [](std::chrono::steady_clock::duration d) {
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+			};
+			std::string report = "Debounce " + std::to_string(buttons) + " buttons x " +
+				std::to_string(samples) + " samples: naive " +
+				std::to_string(ns(naiveTime) / samples) + " ns/sample, bit-parallel " +
+				std::to_string(ns(bankTime) / samples) + " ns/sample";
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkAgainstNaive)
+		{
+			const int states = 4096;
+			const int passes = 200;
+			std::vector<SyntheticJoyState2> input(states);
+			uint32_t seed = 7;
+			for (auto& js : input) {
+				FillRandom(js, seed);
+			}
+
+			auto run = [&](void (*pack)(const uint8_t*, size_t, uint64_t*), uint64_t& checksum) {
+				checksum = 0;
+				auto start = std::chrono::steady_clock::now();
+				for (int p = 0; p < passes; p++) {
+					for (const auto& js : input) {
+						uint64_t words[2];
+						pack(js.rgbButtons, 128, words);
+						checksum += words[0] ^ (words[1] * 31);
+					}
+				}
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count();
+			};
+
+			uint64_t naiveSum, scalarSum, packSum;
+			long long naiveNs = run(NaivePack, naiveSum);
+			long long scalarNs = run(PackButtonBytesScalar, scalarSum);
+			long long packNs = run(PackButtonBytes, packSum);
+			Assert::AreEqual(naiveSum, scalarSum);
+			Assert::AreEqual(naiveSum, packSum);
+
+			double samples = double(states) * passes;
+			std::string report = "Pack 128 buttons: naive " + std::to_string(naiveNs / samples) +
+				" ns, multiply " + std::to_string(scalarNs / samples) +
+				" ns, " + (BUTTON_PACK_SSE2 ? "SSE2 " : "default ") +
+				std::to_string(packNs / samples) + " ns per state";
+			Logger::WriteMessage(report.c_str());
+		}
+
+		// Per-read cost on our side of GetDeviceState: the state copy into the
+		// caller's buffer plus packing, for DIJOYSTATE2 and for a buttons-only
+		// data format (one byte per button, padded to a multiple of 4)
+		TEST_METHOD(BenchmarkFullVersusButtonOnlyState)
+		{
+			const int states = 4096;
+			const int passes = 200;
+			const size_t buttonCounts[] = { 3, 12, 32 };
+			std::vector<SyntheticJoyState2> input(states);
+			uint32_t seed = 11;
+			for (auto& js : input) {
+				FillRandom(js, seed);
+			}
+
+			std::string report = "Read and pack per state:";
+			for (size_t buttons : buttonCounts) {
+				size_t minimalSize = (buttons + 3) & ~static_cast<size_t>(3);
+				std::vector<uint8_t> minimal(states * minimalSize);
+				for (int i = 0; i < states; i++) {
+					memcpy(&minimal[i * minimalSize], input[i].rgbButtons, minimalSize);
+				}
+
+				uint64_t fullSum = 0, minimalSum = 0;
+				SyntheticJoyState2 full;
+				auto start = std::chrono::steady_clock::now();
+				for (int p = 0; p < passes; p++) {
+					for (const auto& js : input) {
+						memcpy(&full, &js, sizeof(full));
+						uint64_t words[2];
+						PackButtonBytes(full.rgbButtons, 128, words);
+						fullSum += words[0] & ((1ULL << buttons) - 1);
+					}
+				}
+				auto middle = std::chrono::steady_clock::now();
+				uint8_t state[sizeof(SyntheticJoyState2)];
+				for (int p = 0; p < passes; p++) {
+					for (int i = 0; i < states; i++) {
+						memcpy(state, &minimal[i * minimalSize], minimalSize);
+						uint64_t words[2];
+						PackButtonBytes(state, buttons, words);
+						minimalSum += words[0];
+					}
+				}
+				auto end = std::chrono::steady_clock::now();
+				Assert::AreEqual(fullSum, minimalSum);
+
+				double samples = double(states) * passes;
+				double fullNs = std::chrono::duration<double, std::nano>(middle - start).count() / samples;
+				double minimalNs = std::chrono::duration<double, std::nano>(end - middle).count() / samples;
+				report += " " + std::to_string(buttons) + " buttons: DIJOYSTATE2 (272 bytes) " +
+					std::to_string(fullNs) + " ns, buttons only (" + std::to_string(minimalSize) +
+					" bytes) " + std::to_string(minimalNs) + " ns;";
+			}
+			Logger::WriteMessage(report.c_str());
+		}
+	};
+#endif
+}
@@ -0,0 +1,435 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "AllocationCounter.h"
+#include "../Common/DeviceNameIndex.h"
+#include "../Common/DirectInputDeviceJson.h"
+#include "../Common/EnumScratch.h"
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace CommonTest
+{
+	// The list as GetDirectInputDeviceList built it before: stringstream
+	// hex, a converted string that still had its null, and an ordered_json
+	// object per device
+	static std::string LegacyHexString(unsigned int value) {
+		std::stringstream ss;
+		ss << "0x" << std::uppercase << std::setfill('0') << std::setw(4) << std::hex << value;
+		return ss.str();
+	}
+
+	static std::string LegacyTypeName(uint32_t devType) {
+		std::stringstream ss;
+		const char* primary = DirectInputPrimaryTypeName(devType & 0xFF);
+		const char* secondary = DirectInputSecondaryTypeName((devType >> 8) & 0xFF);
+		ss << "Primary: ";
+		if (primary) ss << primary; else ss << "Unknown (0x" << std::hex << (devType & 0xFF) << ")";
+		ss << ", Secondary: ";
+		if (secondary) ss << secondary; else ss << "Unknown (0x" << std::hex << ((devType >> 8) & 0xFF) << ")";
+		return ss.str();
+	}
+
+	static std::string LegacyConvert(const char16_t* text, size_t units) {
+		std::string converted(units * UTF8_BYTES_PER_UTF16_UNIT + 1, '\0');
+		converted.resize(Utf16ToUtf8(text, units, &converted[0]) + 1);
+		size_t pos = converted.find('\0');
+		return pos != std::string::npos ? converted.substr(0, pos) : converted;
+	}
+
+	struct SyntheticDevice {
+		char16_t name[64];
+		char16_t instanceName[64];
+		char16_t productGUID[40];
+		char16_t instanceGUID[40];
+		uint32_t devType;
+		uint16_t vid, pid, usagePage, usage;
+	};
+
+	static std::vector<SyntheticDevice> MakeSyntheticDevices(int count) {
+		std::vector<SyntheticDevice> devices(count);
+		for (int i = 0; i < count; i++) {
+			SyntheticDevice& d = devices[i];
+			// ASCII, a control character, and a character outside ASCII
+			const char16_t name[] = u"Stick é中 \"Pro\"\t#";
+			memcpy(d.name, name, sizeof(name));
+			memcpy(d.instanceName, name, sizeof(name));
+			d.instanceName[sizeof(name) / 2 - 2] = static_cast<char16_t>(u'0' + i % 10);
+			const char16_t guid[] = u"{6F1D2B60-D5A0-11CF-BFC7-444553540000}";
+			memcpy(d.productGUID, guid, sizeof(guid));
+			memcpy(d.instanceGUID, guid, sizeof(guid));
+			d.instanceGUID[1] = static_cast<char16_t>(u'0' + i % 10);
+			const uint32_t types[] = { 0x00010215, 0x00000113, 0x0001FF99, 0x00000314 };
+			d.devType = types[i % 4];
+			d.vid = static_cast<uint16_t>(0xB080 + i);
+			d.pid = static_cast<uint16_t>(0x0FC5 * (i + 1));
+			d.usagePage = 1;
+			d.usage = static_cast<uint16_t>(4 + i % 2);
+		}
+		return devices;
+	}
+
+	static std::string LegacyDeviceList(const std::vector<SyntheticDevice>& devices) {
+		nlohmann::ordered_json list = nlohmann::ordered_json::array();
+		for (size_t i = 0; i < devices.size(); i++) {
+			const SyntheticDevice& d = devices[i];
+			nlohmann::ordered_json device;
+			device["index"] = i;
+			device["name"] = LegacyConvert(d.name, 64);
+			device["instanceName"] = LegacyConvert(d.instanceName, 64);
+			device["vendorID"] = LegacyHexString(d.vid);
+			device["productID"] = LegacyHexString(d.pid);
+			device["productGUID"] = LegacyConvert(d.productGUID, 40);
+			device["instanceGUID"] = LegacyConvert(d.instanceGUID, 40);
+			device["dwDevType"] = LegacyHexString(d.devType);
+			device["dwDevType_primary"] = LegacyHexString(d.devType & 0xFF);
+			device["dwDevType_secondary"] = LegacyHexString((d.devType >> 8) & 0xFF);
+			device["typeName"] = LegacyTypeName(d.devType);
+			device["usagePage"] = LegacyHexString(d.usagePage);
+			device["usage"] = LegacyHexString(d.usage);
+			list.push_back(device);
+		}
+		return list.dump();
+	}
+
+	// Enumeration as the DLL does it now: each name converted once into a
+	// reused record, GUIDs kept as text
+	static void FillDeviceInfo(const SyntheticDevice& d, DirectInputDeviceInfo& info) {
+		char converted[64 * UTF8_BYTES_PER_UTF16_UNIT];
+		info.name.assign(converted, Utf16ToUtf8(d.name, 64, converted));
+		info.instanceName.assign(converted, Utf16ToUtf8(d.instanceName, 64, converted));
+		info.productGUIDText[Utf16ToUtf8(d.productGUID, DIRECTINPUT_GUID_TEXT_SIZE - 1, info.productGUIDText)] = '\0';
+		info.instanceGUIDText[Utf16ToUtf8(d.instanceGUID, DIRECTINPUT_GUID_TEXT_SIZE - 1, info.instanceGUIDText)] = '\0';
+		info.devType = d.devType;
+		info.vendorID = d.vid;
+		info.productID = d.pid;
+		info.usagePage = d.usagePage;
+		info.usage = d.usage;
+	}
+
+	typedef DirectInputDeviceList<DirectInputDeviceInfo> SyntheticDeviceList;
+
+	// Stands in for IDirectInput8::EnumDevices: one callback per device
+	typedef bool (*SyntheticEnumCallback)(const SyntheticDevice& device, void* context);
+
+	static void EnumSyntheticDevices(const std::vector<SyntheticDevice>& devices,
+		SyntheticEnumCallback callback, void* context) {
+		for (const SyntheticDevice& device : devices) {
+			if (!callback(device, context)) {
+				break;
+			}
+		}
+	}
+
+	// The DLL's EnumDevicesCallback: fills the next record of the list in place
+	static bool AddSyntheticDevice(const SyntheticDevice& device, void* context) {
+		FillDeviceInfo(device, static_cast<SyntheticDeviceList*>(context)->Add());
+		return true;
+	}
+
+	// GetDirectInputDeviceList: enumerate into the reused list, check it
+	// against the lookup snapshot, write it out
+	static bool ListSyntheticDevices(const std::vector<SyntheticDevice>& devices, SyntheticDeviceList& list,
+		const SyntheticDeviceList& snapshot, bool& changed, std::vector<char>& buffer, size_t& size) {
+		list.Clear();
+		EnumSyntheticDevices(devices, AddSyntheticDevice, &list);
+		changed = !SameDirectInputDevices(snapshot, list);
+		JsonBufferAdapter output(buffer.data(), buffer.size());
+		WriteDirectInputDeviceList(output, list);
+		size = output.Size();
+		return output.Terminate();
+	}
+
+	TEST_CLASS(EnumScratchTests)
+	{
+	public:
+		TEST_METHOD(TestFormatHexMatchesStream)
+		{
+			const uint32_t values[] = { 0, 0x5, 0xAB, 0xFC5, 0xB080, 0x10215, 0x1234567, 0xFFFFFFFF };
+			for (uint32_t value : values) {
+				char text[HEX_TEXT_SIZE];
+				Assert::AreEqual(LegacyHexString(value), std::string(text, FormatHex(text, value, 4, true)));
+
+				std::stringstream lower;
+				lower << "0x" << std::hex << value;
+				Assert::AreEqual(lower.str(), std::string(text, FormatHex(text, value, 1, false)));
+
+				std::stringstream padded;
+				padded << "0x" << std::hex << std::setfill('0') << std::setw(8) << value;
+				Assert::AreEqual(padded.str(), std::string(text, FormatHex(text, value, 8, false)));
+			}
+		}
+
+		TEST_METHOD(TestUtf16ToUtf8)
+		{
+			const char16_t text[] = { u'A', 0x00E9, 0x4E2D, 0xD83D, 0xDE00, 0xDC00, u'Z', 0, u'X' };
+			char converted[sizeof(text) / 2 * UTF8_BYTES_PER_UTF16_UNIT];
+			size_t length = Utf16ToUtf8(text, sizeof(text) / 2, converted);
+			// Stops at the null; the lone low surrogate becomes U+FFFD
+			Assert::AreEqual(std::string("A\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80\xEF\xBF\xBDZ"), std::string(converted, length));
+
+			// A high surrogate cut off by maxUnits
+			Assert::AreEqual(std::string("\xEF\xBF\xBD"), std::string(converted, Utf16ToUtf8(text + 3, 1, converted)));
+		}
+
+		TEST_METHOD(TestArenaReusesBlockAfterReset)
+		{
+			MonotonicArena<64> arena;
+			void* small = arena.Allocate(16, 8);
+			Assert::IsNotNull(small);
+			Assert::AreEqual(static_cast<size_t>(0), arena.HeapBlocks());
+
+			for (int i = 0; i < 100; i++) {
+				arena.Reset();
+				void* detail = arena.Allocate(300, 8);
+				void* path = arena.Allocate(450, 1);
+				Assert::IsNotNull(detail);
+				Assert::IsNotNull(path);
+				Assert::AreEqual(static_cast<uintptr_t>(0), reinterpret_cast<uintptr_t>(detail) % 8);
+				memset(detail, 0xAA, 300);
+				memset(path, 0x55, 450);
+				Assert::AreEqual(0xAA, static_cast<int>(static_cast<unsigned char*>(detail)[299]));
+			}
+			// Grown until one block holds a whole round, then reused
+			Assert::IsTrue(arena.HeapBlocks() <= 3);
+		}
+
+		TEST_METHOD(TestDirectInputListMatchesOrderedJson)
+		{
+			std::vector<SyntheticDevice> devices = MakeSyntheticDevices(9);
+			std::vector<DirectInputDeviceInfo> infos(devices.size());
+			for (size_t i = 0; i < devices.size(); i++) {
+				FillDeviceInfo(devices[i], infos[i]);
+			}
+			std::string expected = LegacyDeviceList(devices);
+
+			std::vector<char> buffer(expected.size() + 1);
+			JsonBufferAdapter output(buffer.data(), buffer.size());
+			WriteDirectInputDeviceList(output, infos);
+			Assert::IsTrue(output.Terminate());
+			Assert::AreEqual(expected, std::string(buffer.data()));
+
+			// One byte short: the size is still counted
+			JsonBufferAdapter small(buffer.data(), expected.size());
+			WriteDirectInputDeviceList(small, infos);
+			Assert::IsFalse(small.Terminate());
+			Assert::AreEqual(expected.size(), small.Size());
+		}
+
+		TEST_METHOD(TestListWritingDoesNotAllocate)
+		{
+			std::vector<SyntheticDevice> devices = MakeSyntheticDevices(32);
+			std::vector<DirectInputDeviceInfo> infos(devices.size());
+			std::vector<char> buffer(64 * 1024);
+			for (int pass = 0; pass < 3; pass++) {
+				for (size_t i = 0; i < devices.size(); i++) {
+					FillDeviceInfo(devices[i], infos[i]);
+				}
+				AllocationScope allocations;
+				JsonBufferAdapter output(buffer.data(), buffer.size());
+				WriteDirectInputDeviceList(output, infos);
+				Assert::IsTrue(output.Terminate());
+				Assert::AreEqual(static_cast<size_t>(0), allocations.Count());
+			}
+
+			// Refilling reused records allocates nothing once their strings have grown
+			AllocationScope allocations;
+			for (size_t i = 0; i < devices.size(); i++) {
+				FillDeviceInfo(devices[i], infos[i]);
+			}
+			Assert::AreEqual(static_cast<size_t>(0), allocations.Count());
+		}
+
+		TEST_METHOD(TestRepeatedListingDoesNotAllocate)
+		{
+			std::vector<SyntheticDevice> devices = MakeSyntheticDevices(32);
+			SyntheticDeviceList snapshot;
+			EnumSyntheticDevices(devices, AddSyntheticDevice, &snapshot);
+			SyntheticDeviceList list;
+			std::vector<char> buffer(64 * 1024);
+			bool changed = true;
+			size_t size = 0;
+			Assert::IsTrue(ListSyntheticDevices(devices, list, snapshot, changed, buffer, size));
+			Assert::IsFalse(changed);
+			Assert::AreEqual(LegacyDeviceList(devices), std::string(buffer.data()));
+
+			for (int pass = 0; pass < 3; pass++) {
+				AllocationScope allocations;
+				Assert::IsTrue(ListSyntheticDevices(devices, list, snapshot, changed, buffer, size));
+				Assert::AreEqual(static_cast<size_t>(0), allocations.Count());
+			}
+			Assert::IsFalse(changed);
+
+			// A device that went away, or changed, makes the snapshot stale
+			std::vector<SyntheticDevice> fewer(devices.begin(), devices.end() - 1);
+			Assert::IsTrue(ListSyntheticDevices(fewer, list, snapshot, changed, buffer, size));
+			Assert::IsTrue(changed);
+			Assert::AreEqual(LegacyDeviceList(fewer), std::string(buffer.data()));
+			devices[5].instanceGUID[3] = u'E';
+			Assert::IsTrue(ListSyntheticDevices(devices, list, snapshot, changed, buffer, size));
+			Assert::IsTrue(changed);
+		}
+	};
+
+	static DeviceNameIndex MakeIndex(const std::vector<std::string>& names, uint16_t usage = 4) {
+		DeviceNameIndex index;
+		for (size_t i = 0; i < names.size(); i++) {
+			index.Add(names[i], 1, usage, static_cast<int>(i));
+		}
+		index.Finish();
+		return index;
+	}
+
+	TEST_CLASS(DeviceNameIndexTests)
+	{
+	public:
+		TEST_METHOD(TestNormalizeDeviceName)
+		{
+			Assert::AreEqual(std::string("kinesis joystick controller"),
+				NormalizeDeviceName(std::string("  Kinesis  JoyStick\tController   ")));
+			// Trailing nulls count as padding too
+			Assert::AreEqual(std::string("usb fs io"), NormalizeDeviceName("USB FS IO\0\0", 11));
+			// Latin-1 letters fold, the multiplication sign does not
+			Assert::AreEqual(std::string("\xC3\xA9" "cran \xC3\x97"), NormalizeDeviceName(std::string("\xC3\x89" "CRAN \xC3\x97")));
+			Assert::AreEqual(std::string(), NormalizeDeviceName(std::string(" \t ")));
+		}
+
+		TEST_METHOD(TestExactLookup)
+		{
+			DeviceNameIndex index = MakeIndex({ "USB FS IO", "Kinesis JoyStick Controller  ", "kinesis joystick controller" });
+			Assert::AreEqual(1, index.FindExact("KINESIS JOYSTICK CONTROLLER", 1, 4));
+			Assert::AreEqual(0, index.FindExact(" usb  fs io ", 1, 4));
+			Assert::AreEqual(-1, index.FindExact("USB FS IO", 1, 5));
+			Assert::AreEqual(-1, index.FindExact("USB FS", 1, 4));
+		}
+
+		TEST_METHOD(TestPrefixLookup)
+		{
+			DeviceNameIndex index = MakeIndex({ "Zeta Pad", "Kinesis Pedal", "Kinesis JoyStick Controller", "Kin" });
+			// First in enumeration order, not in name order
+			Assert::AreEqual(1, index.FindPrefix("kinesis", 1, 4));
+			Assert::AreEqual(2, index.FindPrefix("Kinesis Joy", 1, 4));
+			Assert::AreEqual(1, index.FindPrefix("kin", 1, 4));
+			Assert::AreEqual(-1, index.FindPrefix("Kinesis Joy", 1, 5));
+			Assert::AreEqual(-1, index.FindPrefix("  ", 1, 4));
+			Assert::AreEqual(-1, index.FindPrefix("Kinesis JoyStick Controller 2", 1, 4));
+		}
+
+		TEST_METHOD(TestFuzzyLookup)
+		{
+			DeviceNameIndex index = MakeIndex({ "USB FS IO", "Kinesis JoyStick Controller", "Kinesis JoyStick Controler" });
+			// A typo: the exact name is one edit away, the other one two
+			Assert::AreEqual(1, index.FindFuzzy("Kinesis Joystik Controller", 1, 4, 2));
+			// Equally close: the first device wins
+			Assert::AreEqual(1, index.FindFuzzy("Kinesis JoyStick Controlter", 1, 4, 2));
+			Assert::AreEqual(2, index.FindFuzzy("Kinesis JoyStick Controle", 1, 4, 1));
+			Assert::AreEqual(0, index.FindFuzzy("USB FS 10", 1, 4, 2));
+			Assert::AreEqual(-1, index.FindFuzzy("USB HS IO X", 1, 4, 1));
+			Assert::AreEqual(-1, index.FindFuzzy("USB FS IO", 1, 4, DEVICE_NAME_MAX_DISTANCE + 1));
+			Assert::AreEqual(3, BoundedEditDistance("kitten", "sitting", 8));
+			Assert::AreEqual(3, BoundedEditDistance("kitten", "sitting", 2));
+		}
+	};
+
+#ifdef BUTTON_BENCHMARKS
+	// Enumeration allocations and name lookups against the code they replaced
+	TEST_CLASS(DeviceListBenchmarks)
+	{
+	public:
+		TEST_METHOD(BenchmarkEnumerationAllocations)
+		{
+			const int deviceCount = 32;
+			const int passes = 200;
+			std::vector<SyntheticDevice> devices = MakeSyntheticDevices(deviceCount);
+			SyntheticDeviceList snapshot;
+			EnumSyntheticDevices(devices, AddSyntheticDevice, &snapshot);
+			SyntheticDeviceList list;
+			std::vector<char> buffer(64 * 1024);
+
+			auto start = std::chrono::steady_clock::now();
+			size_t legacySize = 0;
+			size_t legacyAllocations = 0;
+			{
+				AllocationScope legacy;
+				for (int p = 0; p < passes; p++) {
+					std::string list = LegacyDeviceList(devices);
+					legacySize = list.size();
+					memcpy(buffer.data(), list.c_str(), list.size() + 1);
+				}
+				legacyAllocations = legacy.Count();
+			}
+			auto middle = std::chrono::steady_clock::now();
+
+			// Callback, reused list, snapshot check and write, as the DLL lists
+			size_t allocations = 0;
+			size_t size = 0;
+			bool changed = false;
+			{
+				AllocationScope scratch;
+				for (int p = 0; p < passes; p++) {
+					Assert::IsTrue(ListSyntheticDevices(devices, list, snapshot, changed, buffer, size));
+				}
+				allocations = scratch.Count();
+			}
+			Assert::IsFalse(changed);
+			auto end = std::chrono::steady_clock::now();
+
+			Assert::AreEqual(legacySize, size);
+			Assert::IsTrue(allocations * 10 < legacyAllocations);
+
+			double lists = double(passes);
+			std::string report = "Enumerate and list " + std::to_string(deviceCount) + " devices: legacy " +
+				std::to_string(legacyAllocations / passes) + " allocations, " +
+				std::to_string(std::chrono::duration<double, std::micro>(middle - start).count() / lists) +
+				" us; scratch " + std::to_string(allocations / passes) + " allocations, " +
+				std::to_string(std::chrono::duration<double, std::micro>(end - middle).count() / lists) + " us";
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkNameLookup)
+		{
+			const int deviceCount = 64;
+			const int lookups = 20000;
+			std::vector<std::string> names;
+			for (int i = 0; i < deviceCount; i++) {
+				names.push_back("Generic Controller " + std::to_string(i) + "  ");
+			}
+			DeviceNameIndex index = MakeIndex(names);
+			auto trimSpaces = [](std::string value) {
+				value.erase(0, value.find_first_not_of(" "));
+				value.erase(value.find_last_not_of(" ") + 1);
+				return value;
+			};
+
+			int scanFound = 0, indexFound = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < lookups; i++) {
+				std::string wanted = trimSpaces("Generic Controller " + std::to_string(i % deviceCount));
+				for (const std::string& name : names) {
+					if (trimSpaces(name) == wanted) {
+						scanFound++;
+						break;
+					}
+				}
+			}
+			auto middle = std::chrono::steady_clock::now();
+			for (int i = 0; i < lookups; i++) {
+				indexFound += index.FindExact("Generic Controller " + std::to_string(i % deviceCount), 1, 4) >= 0;
+			}
+			auto end = std::chrono::steady_clock::now();
+			Assert::AreEqual(lookups, scanFound);
+			Assert::AreEqual(lookups, indexFound);
+
+			std::string report = "Name lookup over " + std::to_string(deviceCount) + " devices: scan " +
+				std::to_string(std::chrono::duration<double, std::nano>(middle - start).count() / lookups) +
+				" ns, index " + std::to_string(std::chrono::duration<double, std::nano>(end - middle).count() / lookups) + " ns";
+			Logger::WriteMessage(report.c_str());
+		}
+	};
+#endif
+}
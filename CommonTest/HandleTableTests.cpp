@@ -0,0 +1,275 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Common/HandleTable.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace CommonTest
+{
+	struct CountedRecord {
+		static int live;
+		int value;
+		explicit CountedRecord(int v = 0) : value(v) { live++; }
+		~CountedRecord() { live--; }
+	};
+	int CountedRecord::live = 0;
+
+	TEST_CLASS(HandleTableTests)
+	{
+	public:
+		TEST_METHOD(TestCreateAcquireDestroy)
+		{
+			CountedRecord::live = 0;
+			{
+				HandleTable<CountedRecord> table;
+				CountedRecord* record = nullptr;
+				void* handle = table.Create(record, 42);
+				Assert::IsNotNull(handle);
+				Assert::IsTrue(table.Acquire(handle).get() == record);
+				Assert::AreEqual(42, table.Acquire(handle)->value);
+				Assert::AreEqual(1, CountedRecord::live);
+
+				Assert::IsTrue(table.Destroy(handle));
+				Assert::AreEqual(0, CountedRecord::live);
+				Assert::IsNull(table.Acquire(handle).get());
+				// A second close is rejected instead of freeing twice
+				Assert::IsFalse(table.Destroy(handle));
+
+				// Records still open are destroyed with the table
+				table.Create(record, 7);
+				Assert::AreEqual(1, CountedRecord::live);
+			}
+			Assert::AreEqual(0, CountedRecord::live);
+		}
+
+		TEST_METHOD(TestStaleHandleAfterSlotReuse)
+		{
+			HandleTable<CountedRecord> table;
+			CountedRecord* first = nullptr;
+			void* stale = table.Create(first, 1);
+			table.Destroy(stale);
+
+			CountedRecord* second = nullptr;
+			void* fresh = table.Create(second, 2);
+			// Same slot and address, different generation
+			Assert::IsTrue(first == second);
+			Assert::IsTrue(stale != fresh);
+			Assert::IsNull(table.Acquire(stale).get());
+			Assert::IsFalse(table.Destroy(stale));
+			Assert::AreEqual(2, table.Acquire(fresh)->value);
+		}
+
+		TEST_METHOD(TestRejectsMadeUpHandles)
+		{
+			HandleTable<CountedRecord> table;
+			CountedRecord* record = nullptr;
+			void* handle = table.Create(record, 1);
+			int local = 0;
+			void* madeUp[] = { nullptr, reinterpret_cast<void*>(1), &local, record,
+				reinterpret_cast<void*>(~static_cast<uintptr_t>(0)),
+				reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(handle) + 1) };
+			for (void* candidate : madeUp) {
+				Assert::IsNull(table.Acquire(candidate).get());
+				Assert::IsFalse(table.Destroy(candidate));
+			}
+			Assert::IsNotNull(table.Acquire(handle).get());
+		}
+
+		TEST_METHOD(TestSlotsArePooledAlignedAndStable)
+		{
+			HandleTable<CountedRecord> table;
+			std::vector<void*> open;
+			std::vector<CountedRecord*> records;
+			for (int i = 0; i < 200; i++) {
+				CountedRecord* record = nullptr;
+				open.push_back(table.Create(record, i));
+				records.push_back(record);
+				Assert::AreEqual(static_cast<uintptr_t>(0), reinterpret_cast<uintptr_t>(record) % HANDLE_TABLE_CACHE_LINE);
+			}
+			// Growing the table did not move earlier records
+			for (int i = 0; i < 200; i++) {
+				Assert::IsTrue(table.Acquire(open[i]).get() == records[i]);
+				table.Destroy(open[i]);
+			}
+
+			// Thousands of open/close cycles with a few devices reuse the slots
+			uint32_t seed = 5;
+			open.clear();
+			for (int i = 0; i < 10000; i++) {
+				seed = seed * 1103515245u + 12345u;
+				if (open.size() < 8 && (open.empty() || (seed >> 16) % 2 == 0)) {
+					CountedRecord* record = nullptr;
+					open.push_back(table.Create(record, i));
+				}
+				else {
+					size_t victim = (seed >> 8) % open.size();
+					Assert::IsTrue(table.Destroy(open[victim]));
+					open.erase(open.begin() + victim);
+				}
+			}
+			Assert::AreEqual(open.size(), table.Live());
+			Assert::AreEqual(static_cast<size_t>(200), table.Slots());
+		}
+	};
+	// A record that notices use after destruction
+	struct GuardedRecord {
+		static std::atomic<int> live;
+		std::atomic<uint32_t> magic{ 0x600DF00D };
+		std::atomic<uint64_t> reads{ 0 };
+		GuardedRecord() { live++; }
+		~GuardedRecord() {
+			magic = 0xDEADBEEF;
+			live--;
+		}
+	};
+	std::atomic<int> GuardedRecord::live{ 0 };
+
+	TEST_CLASS(HandleReclamationTests)
+	{
+	public:
+		TEST_METHOD(TestCloseWhileReferencedDefersDestruction)
+		{
+			HandleTable<GuardedRecord> table;
+			GuardedRecord* record = nullptr;
+			void* handle = table.Create(record);
+			{
+				HandleTable<GuardedRecord>::Ref reader = table.Acquire(handle);
+				Assert::IsTrue(reader.get() == record);
+
+				Assert::IsTrue(table.Destroy(handle));
+				// Closed: no new references, a second close fails
+				Assert::IsNull(table.Acquire(handle).get());
+				Assert::IsFalse(table.Destroy(handle));
+				// but the reader's record is still intact
+				Assert::AreEqual(0x600DF00Du, reader->magic.load());
+				Assert::AreEqual(1, GuardedRecord::live.load());
+			}
+			// Destroyed when the last reference went away
+			Assert::AreEqual(0, GuardedRecord::live.load());
+
+			// and the slot is reused with a new generation
+			GuardedRecord* reused = nullptr;
+			void* fresh = table.Create(reused);
+			Assert::IsTrue(reused == record);
+			Assert::IsTrue(fresh != handle);
+			Assert::IsTrue(table.Destroy(fresh));
+		}
+
+		TEST_METHOD(StressConcurrentReadAndClose)
+		{
+			const int slots = 8;
+			const int readers = 4;
+			const int closers = 2;
+			const int cyclesPerCloser = 5000;
+			HandleTable<GuardedRecord> table;
+			std::atomic<void*> handles[slots];
+			for (auto& handle : handles) {
+				GuardedRecord* record = nullptr;
+				handle = table.Create(record);
+			}
+
+			std::atomic<bool> done{ false };
+			std::atomic<uint64_t> reads{ 0 }, misses{ 0 }, corrupt{ 0 }, cycles{ 0 };
+			std::vector<std::thread> threads;
+			for (int r = 0; r < readers; r++) {
+				threads.emplace_back([&, r] {
+					uint32_t seed = 17 + r;
+					while (!done) {
+						seed = seed * 1103515245u + 12345u;
+						void* handle = handles[(seed >> 16) % slots].load();
+						HandleTable<GuardedRecord>::Ref record = table.Acquire(handle);
+						if (!record) {
+							misses++;
+							continue;
+						}
+						// Use the record for a while, as a device read would
+						for (int i = 0; i < 16; i++) {
+							if (record->magic.load() != 0x600DF00D) {
+								corrupt++;
+							}
+							record->reads++;
+						}
+						reads++;
+					}
+				});
+			}
+			for (int c = 0; c < closers; c++) {
+				threads.emplace_back([&, c] {
+					uint32_t seed = 91 + c;
+					for (int i = 0; i < cyclesPerCloser; i++) {
+						seed = seed * 1103515245u + 12345u;
+						std::atomic<void*>& slot = handles[(seed >> 16) % slots];
+						void* old = slot.load();
+						// Close whatever is there and open a replacement, racing
+						// the readers and the other closer
+						table.Destroy(old);
+						GuardedRecord* record = nullptr;
+						void* fresh = table.Create(record);
+						if (!slot.compare_exchange_strong(old, fresh)) {
+							table.Destroy(fresh);
+						}
+						cycles++;
+					}
+				});
+			}
+			for (int i = readers; i < readers + closers; i++) {
+				threads[i].join();
+			}
+			done = true;
+			for (int i = 0; i < readers; i++) {
+				threads[i].join();
+			}
+
+			Assert::AreEqual(static_cast<uint64_t>(0), corrupt.load());
+			Assert::IsTrue(reads.load() > 0);
+			for (auto& handle : handles) {
+				table.Destroy(handle.load());
+			}
+			Assert::AreEqual(0, GuardedRecord::live.load());
+			Assert::AreEqual(static_cast<size_t>(0), table.Live());
+			// Deferred records were reclaimed into a handful of slots
+			Assert::IsTrue(table.Slots() <= static_cast<size_t>(slots + closers + readers));
+
+			std::string report = "Read/close stress: " + std::to_string(cycles.load()) + " open/close cycles, " +
+				std::to_string(reads.load()) + " reads, " + std::to_string(misses.load()) + " reads of closed handles";
+			Logger::WriteMessage(report.c_str());
+		}
+	};
+
+#ifdef BUTTON_BENCHMARKS
+	// Handle lookup against a locked map
+	TEST_CLASS(HandleTableBenchmarks)
+	{
+	public:
+		TEST_METHOD(BenchmarkHandleLookup)
+		{
+			const int handles = 16;
+			const int lookups = 4000000;
+			HandleTable<CountedRecord> table;
+			std::vector<void*> open;
+			for (int i = 0; i < handles; i++) {
+				CountedRecord* record = nullptr;
+				open.push_back(table.Create(record, i));
+			}
+
+			int64_t sum = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < lookups; i++) {
+				HandleTable<CountedRecord>::Ref record = table.Acquire(open[i % handles]);
+				sum += record ? record->value : -1;
+			}
+			auto end = std::chrono::steady_clock::now();
+			Assert::AreEqual(static_cast<int64_t>(lookups / handles) * (handles * (handles - 1) / 2), sum);
+
+			std::string report = "Checked handle lookup: " +
+				std::to_string(std::chrono::duration<double, std::nano>(end - start).count() / lookups) + " ns";
+			Logger::WriteMessage(report.c_str());
+		}
+	};
+#endif
+}
@@ -0,0 +1,1113 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Common/HidDeviceCache.h"
+#include "../Common/HidDeviceInfo.h"
+#include "../Common/HidDeviceJson.h"
+#include "../Common/HidDeviceStore.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace CommonTest
+{
+	// Enumerator whose device list is set by the test
+	class ScriptedHidEnumerator : public HidEnumerator {
+	public:
+		std::vector<std::string> paths;
+		std::vector<std::string> locked; // Interfaces whose read/write opens fail, like a keyboard
+		bool fail = false;
+		int enumerations = 0;
+		std::atomic<int> readWriteOpens{ 0 };
+		std::atomic<int> probes{ 0 };
+
+		bool EnumeratePaths(std::vector<std::string>& out) override {
+			enumerations++;
+			if (fail) return false;
+			out = paths;
+			return true;
+		}
+
+		void Probe(HidDeviceRecord& record, uint32_t fields) override {
+			probes++;
+			record.opened = true;
+			// Strings need the read/write fallback, which is tried once per interface
+			if ((fields & (HidFieldProduct | HidFieldManufacturer)) && !record.readWriteDenied &&
+				std::find(locked.begin(), locked.end(), record.path) != locked.end()) {
+				readWriteOpens++;
+				record.readWriteDenied = true;
+			}
+			// Derive stable attributes from the path, e.g. "hid#04d8&005e#1"
+			if (fields & HidFieldAttributes) {
+				record.hasAttributes = true;
+				record.vendorID = static_cast<uint16_t>(std::stoul(record.path.substr(4, 4), nullptr, 16));
+				record.productID = static_cast<uint16_t>(std::stoul(record.path.substr(9, 4), nullptr, 16));
+			}
+			if (fields & HidFieldProduct) {
+				record.product = "Device " + record.path;
+			}
+			if (fields & HidFieldSerialNumber) {
+				record.serialNumber = record.path.substr(record.path.rfind('#') + 1);
+			}
+		}
+	};
+
+	// Enumerator that spends a fixed time per simulated Win32 call
+	class SimulatedHidEnumerator : public HidEnumerator {
+	public:
+		int devices = 0;
+		int openUs = 40;       // CreateFile
+		int attributesUs = 10; // HidD_GetAttributes
+		int stringUs = 60;     // Each string query, a USB control transfer
+		int preparsedUs = 30;  // HidD_GetPreparsedData and HidP_* calls
+		bool blocking = false; // Sleep like a thread waiting on USB instead of spinning
+		std::atomic<int> calls{ 0 };
+
+		bool EnumeratePaths(std::vector<std::string>& out) override {
+			for (int i = 0; i < devices; i++) {
+				out.push_back("hid#" + std::to_string(1000 + i) + "&0001#" + std::to_string(i));
+			}
+			return true;
+		}
+
+		void Probe(HidDeviceRecord& record, uint32_t fields) override {
+			fields &= ~record.fields;
+			if ((fields & HidFieldsOpened) == 0) return;
+			Spend(openUs);
+			record.opened = true;
+			if (fields & HidFieldAttributes) {
+				Spend(attributesUs);
+				record.hasAttributes = true;
+				record.vendorID = static_cast<uint16_t>(std::stoul(record.path.substr(4, 4), nullptr, 16));
+			}
+			if (fields & HidFieldProduct) { Spend(stringUs); record.product = "Device"; }
+			if (fields & HidFieldManufacturer) { Spend(stringUs); record.manufacturer = "Vendor"; }
+			if (fields & HidFieldSerialNumber) { Spend(stringUs); record.serialNumber = record.path; }
+			if (fields & HidFieldsPreparsed) { Spend(preparsedUs); record.hasCaps = (fields & HidFieldCaps) != 0; }
+		}
+
+		void Spend(int us) {
+			calls++;
+			if (blocking) {
+				std::this_thread::sleep_for(std::chrono::microseconds(us));
+				return;
+			}
+			auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+			while (std::chrono::steady_clock::now() < until) {
+			}
+		}
+	};
+
+	// Scripted enumerator whose probes can be slowed down or hung until released
+	class StallingHidEnumerator : public ScriptedHidEnumerator {
+	public:
+		std::vector<std::string> hung; // Paths whose probes block until Release
+		std::vector<std::string> slow; // Paths whose probes take slowMs
+		int slowMs = 0;
+		bool releaseOnCancel = false; // CancelProbes lets the hung probes go
+		std::atomic<int> hungProbes{ 0 }; // Probes that reached a hung path
+		std::atomic<int> cancels{ 0 };
+
+		void Probe(HidDeviceRecord& record, uint32_t fields) override {
+			if (std::find(hung.begin(), hung.end(), record.path) != hung.end()) {
+				hungProbes++;
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_released.wait(lock, [this] { return m_release; });
+			}
+			if (std::find(slow.begin(), slow.end(), record.path) != slow.end()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(slowMs));
+			}
+			ScriptedHidEnumerator::Probe(record, fields);
+		}
+
+		void Release() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_release = true;
+			m_released.notify_all();
+		}
+
+		void CancelProbes() override {
+			cancels++;
+			if (releaseOnCancel) {
+				Release();
+			}
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_released;
+		bool m_release = false;
+	};
+
+	// Snapshot cache driven by a scripted enumerator instead of SetupDi
+	TEST_CLASS(HidDeviceCacheTests)
+	{
+	public:
+		TEST_METHOD(TestSnapshotIsReusedUntilInvalidated)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1", "hid#046d&c52b#1" };
+			HidDeviceCache cache;
+
+			auto first = cache.Get(enumerator);
+			Assert::IsTrue(first != nullptr);
+			Assert::AreEqual((size_t)3, first->devices.size());
+			Assert::AreEqual((uint64_t)1, first->generation);
+
+			for (int i = 0; i < 10; i++) {
+				Assert::IsTrue(cache.Get(enumerator) == first);
+			}
+			Assert::AreEqual(1, enumerator->enumerations);
+			Assert::AreEqual(3, enumerator->probes.load());
+
+			// The initial snapshot is not reported as arrivals
+			HidDeviceChange change;
+			Assert::AreEqual((size_t)0, cache.PopChanges(&change, 1));
+
+			// A notification without a real change keeps the generation
+			cache.Invalidate();
+			auto same = cache.Get(enumerator);
+			Assert::AreEqual(2, enumerator->enumerations);
+			Assert::AreEqual(3, enumerator->probes.load());
+			Assert::AreEqual((uint64_t)1, same->generation);
+		}
+
+		TEST_METHOD(TestArrivalAndRemovalEvents)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1", "hid#046d&c52b#1" };
+			HidDeviceCache cache;
+			cache.Get(enumerator);
+
+			// Unplug the second device and plug in a new one
+			enumerator->paths = { "hid#04d8&005e#1", "hid#046d&c52b#1", "hid#1dd2&1001#1" };
+			cache.Invalidate();
+			auto snapshot = cache.Get(enumerator);
+			Assert::AreEqual((uint64_t)2, snapshot->generation);
+			Assert::AreEqual((uint64_t)2, cache.Generation());
+			Assert::AreEqual(4, enumerator->probes.load()); // Only the new device was probed
+
+			HidDeviceChange changes[4];
+			Assert::AreEqual((size_t)2, cache.PopChanges(changes, 4));
+			Assert::AreEqual((int)HidDeviceRemoval, changes[0].kind);
+			Assert::AreEqual(1, changes[0].index);
+			Assert::AreEqual((int)0x0FC5, (int)changes[0].device.vendorID);
+			Assert::AreEqual((int)HidDeviceArrival, changes[1].kind);
+			Assert::AreEqual(2, changes[1].index);
+			Assert::AreEqual((int)0x1DD2, (int)snapshot->devices[changes[1].index].vendorID);
+			Assert::AreEqual((uint64_t)2, changes[1].generation);
+			Assert::AreEqual(1, snapshot->Find("hid#046d&c52b#1"));
+		}
+
+		TEST_METHOD(TestLookupBySerialAndPath)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->paths = { "hid#046d&c52b#1", "hid#0fc5&b080#A1", "hid#0fc5&b080#B2" };
+			HidDeviceCache cache;
+			auto snapshot = cache.Get(enumerator);
+
+			Assert::AreEqual(1, snapshot->FindByVendorAndProductID(0x0FC5, 0xB080));
+			Assert::AreEqual(2, snapshot->FindBySerialNumber(0x0FC5, 0xB080, "B2"));
+			Assert::AreEqual(-1, snapshot->FindBySerialNumber(0x0FC5, 0xB080, "C3"));
+			Assert::AreEqual(-1, snapshot->FindBySerialNumber(0x046D, 0xB080, "B2"));
+			Assert::AreEqual(1, snapshot->FindByProductString("  Device hid#0fc5&b080#A1 \t"));
+			std::string path = snapshot->devices[2].path;
+
+			// An index goes stale when an earlier device is unplugged; the path does not
+			enumerator->paths = { "hid#0fc5&b080#A1", "hid#0fc5&b080#B2" };
+			cache.Invalidate();
+			snapshot = cache.Get(enumerator);
+			Assert::AreEqual(1, snapshot->Find(path));
+			Assert::AreEqual(1, snapshot->FindBySerialNumber(0x0FC5, 0xB080, "B2"));
+		}
+
+		TEST_METHOD(TestFailedEnumerationKeepsSnapshot)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->fail = true;
+			HidDeviceCache cache;
+			Assert::IsTrue(cache.Get(enumerator) == nullptr);
+
+			enumerator->fail = false;
+			enumerator->paths = { "hid#04d8&005e#1" };
+			auto snapshot = cache.Get(enumerator);
+			Assert::IsTrue(snapshot != nullptr);
+
+			enumerator->fail = true;
+			cache.Invalidate();
+			Assert::IsTrue(cache.Get(enumerator) == snapshot);
+			// Still stale, so the next call retries
+			enumerator->fail = false;
+			enumerator->paths = {};
+			Assert::AreEqual((size_t)0, cache.Get(enumerator)->devices.size());
+		}
+
+		TEST_METHOD(TestFieldsAreProbedOnDemand)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#A1" };
+			HidDeviceCache cache;
+
+			auto paths = cache.Get(enumerator, HidFieldPath);
+			Assert::AreEqual(0, enumerator->probes.load());
+			Assert::IsFalse(paths->devices[0].hasAttributes);
+
+			auto ids = cache.Get(enumerator, HidFieldAttributes);
+			Assert::AreEqual(2, enumerator->probes.load());
+			Assert::AreEqual((int)0x04D8, (int)ids->devices[0].vendorID);
+			Assert::IsTrue(ids->devices[0].product.empty());
+			Assert::AreEqual((uint64_t)1, ids->generation);
+
+			// Already probed groups are not queried again
+			cache.Get(enumerator, HidFieldPath | HidFieldAttributes);
+			Assert::AreEqual(2, enumerator->probes.load());
+
+			auto names = cache.Get(enumerator, HidFieldProduct);
+			Assert::AreEqual(4, enumerator->probes.load());
+			Assert::AreEqual(std::string("Device hid#04d8&005e#1"), names->devices[0].product);
+
+			// An arrival gets every group the others already have
+			enumerator->paths.push_back("hid#046d&c52b#1");
+			cache.Invalidate();
+			auto next = cache.Get(enumerator, HidFieldPath);
+			Assert::AreEqual(5, enumerator->probes.load());
+			Assert::IsTrue(next->devices[2].hasAttributes);
+			Assert::IsFalse(next->devices[2].product.empty());
+		}
+
+		TEST_METHOD(TestParallelProbeKeepsOrder)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			for (int i = 0; i < 40; i++) {
+				char path[32];
+				snprintf(path, sizeof(path), "hid#%04x&%04x#%d", 0x1000 + i, 0x2000 + i, i);
+				enumerator->paths.push_back(path);
+			}
+			HidDeviceCache serial;
+			serial.SetProbeThreads(1);
+			HidDeviceCache parallel;
+			parallel.SetProbeThreads(8);
+
+			auto expected = serial.Get(enumerator);
+			auto actual = parallel.Get(enumerator);
+			Assert::AreEqual(expected->devices.size(), actual->devices.size());
+			for (size_t i = 0; i < actual->devices.size(); i++) {
+				Assert::AreEqual(expected->devices[i].path, actual->devices[i].path);
+				Assert::AreEqual((int)expected->devices[i].vendorID, (int)actual->devices[i].vendorID);
+				Assert::AreEqual(expected->devices[i].product, actual->devices[i].product);
+				Assert::AreEqual((int)(0x1000 + i), (int)actual->devices[i].vendorID);
+			}
+			Assert::AreEqual(80, enumerator->probes.load());
+		}
+
+		TEST_METHOD(TestReadWriteDenialIsRemembered)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->paths = { "hid#046d&c31c#kbd", "hid#04d8&005e#1" };
+			enumerator->locked = { "hid#046d&c31c#kbd" };
+			HidDeviceCache cache;
+
+			auto snapshot = cache.Get(enumerator, HidFieldProduct);
+			Assert::IsTrue(snapshot->devices[0].readWriteDenied);
+			Assert::IsFalse(snapshot->devices[1].readWriteDenied);
+			Assert::AreEqual(1, enumerator->readWriteOpens.load());
+
+			// Later enumerations and field groups reuse the record, denial included
+			enumerator->paths.push_back("hid#0fc5&b080#1");
+			cache.Invalidate();
+			snapshot = cache.Get(enumerator, HidFieldProduct | HidFieldManufacturer);
+			Assert::IsTrue(snapshot->devices[0].readWriteDenied);
+			Assert::AreEqual(1, enumerator->readWriteOpens.load());
+		}
+
+		TEST_METHOD(TestHungProbeIsReportedIncomplete)
+		{
+			auto enumerator = std::make_shared<StallingHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1", "hid#046d&c52b#1", "hid#1dd2&1001#1" };
+			enumerator->hung = { "hid#0fc5&b080#1" };
+			enumerator->slow = { "hid#046d&c52b#1" };
+			enumerator->slowMs = 20;
+			HidDeviceCache cache;
+			cache.SetProbeDeadline(100);
+
+			auto start = std::chrono::steady_clock::now();
+			auto snapshot = cache.Get(enumerator, HidFieldAttributes);
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			Assert::IsTrue(ms < 2000);
+			Assert::AreEqual((size_t)4, snapshot->devices.size());
+			Assert::IsTrue(snapshot->devices[1].incomplete);
+			Assert::IsFalse(snapshot->devices[1].hasAttributes);
+			for (size_t i : { 0, 2, 3 }) {
+				Assert::IsFalse(snapshot->devices[i].incomplete);
+				Assert::IsTrue(snapshot->devices[i].hasAttributes);
+			}
+			Assert::AreEqual((size_t)1, cache.LateProbes());
+
+			// The hung device is not probed again while its probe is still running
+			cache.Invalidate();
+			snapshot = cache.Get(enumerator, HidFieldAttributes);
+			Assert::IsTrue(snapshot->devices[1].incomplete);
+			Assert::AreEqual(3, enumerator->probes.load()); // The hung probe counts once it returns
+
+			// Once it answers, the late result lands in the same generation
+			enumerator->Release();
+			for (int i = 0; i < 200 && snapshot->devices[1].incomplete; i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				snapshot = cache.Get(enumerator, HidFieldAttributes);
+			}
+			Assert::IsFalse(snapshot->devices[1].incomplete);
+			Assert::IsTrue(snapshot->devices[1].hasAttributes);
+			Assert::AreEqual((uint16_t)0xb080, snapshot->devices[1].productID);
+			Assert::AreEqual((uint64_t)1, snapshot->generation);
+			Assert::AreEqual((size_t)0, cache.LateProbes());
+		}
+
+		TEST_METHOD(TestHungProbeDoesNotStallQueue)
+		{
+			// The other thread probes the devices queued behind the hung one
+			auto enumerator = std::make_shared<StallingHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1", "hid#046d&c52b#1", "hid#1dd2&1001#1" };
+			enumerator->hung = { "hid#04d8&005e#1" };
+			enumerator->slow = { "hid#0fc5&b080#1", "hid#046d&c52b#1", "hid#1dd2&1001#1" };
+			enumerator->slowMs = 10;
+			HidDeviceCache cache;
+			cache.SetProbeThreads(2);
+			cache.SetProbeDeadline(100);
+
+			auto snapshot = cache.Get(enumerator, HidFieldAttributes);
+			Assert::IsTrue(snapshot->devices[0].incomplete);
+			for (size_t i = 1; i < snapshot->devices.size(); i++) {
+				Assert::IsFalse(snapshot->devices[i].incomplete);
+				Assert::IsTrue(snapshot->devices[i].hasAttributes);
+			}
+
+			// Fields asked for while the probe is hung are probed after it finishes
+			snapshot = cache.Get(enumerator, HidFieldAttributes | HidFieldProduct);
+			Assert::IsTrue(snapshot->devices[0].product.empty());
+			enumerator->Release();
+			for (int i = 0; i < 200 && snapshot->devices[0].product.empty(); i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				snapshot = cache.Get(enumerator, HidFieldAttributes | HidFieldProduct);
+			}
+			Assert::IsFalse(snapshot->devices[0].incomplete);
+			Assert::AreEqual(std::string("Device hid#04d8&005e#1"), snapshot->devices[0].product);
+		}
+
+		TEST_METHOD(TestBusyPoolDoesNotStallCaller)
+		{
+			// With the only thread hung, the queued devices are reported incomplete
+			// after a deadline instead of waiting for it
+			auto enumerator = std::make_shared<StallingHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1", "hid#046d&c52b#1" };
+			enumerator->hung = { "hid#04d8&005e#1" };
+			HidDeviceCache cache;
+			cache.SetProbeThreads(1);
+			cache.SetProbeDeadline(100);
+
+			auto start = std::chrono::steady_clock::now();
+			auto snapshot = cache.Get(enumerator, HidFieldAttributes);
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			Assert::IsTrue(ms < 2000);
+			for (const auto& device : snapshot->devices) {
+				Assert::IsTrue(device.incomplete);
+			}
+			Assert::AreEqual((size_t)1, cache.LateProbes());
+
+			// The hung probe already missed its deadline, so Shutdown does not wait for it
+			start = std::chrono::steady_clock::now();
+			Assert::AreEqual((size_t)1, cache.Shutdown(10000));
+			ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			Assert::IsTrue(ms < 2000);
+			Assert::AreEqual(1, enumerator->cancels.load());
+
+			// The thread left behind still hands its result to the next Get
+			enumerator->Release();
+			for (int i = 0; i < 200 && cache.LateProbes() != 0; i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			Assert::AreEqual((size_t)0, cache.LateProbes());
+			snapshot = cache.Get(enumerator, HidFieldAttributes);
+			Assert::IsFalse(snapshot->devices[0].incomplete);
+		}
+
+		TEST_METHOD(TestPeekDoesNotWaitForProbes)
+		{
+			auto enumerator = std::make_shared<StallingHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1" };
+			enumerator->hung = { "hid#0fc5&b080#1" };
+			HidDeviceCache cache;
+			cache.SetProbeThreads(2);
+			cache.SetProbeDeadline(0);
+			auto first = cache.Get(enumerator, HidFieldPath);
+
+			std::shared_ptr<const HidSnapshot> snapshot;
+			std::thread caller([&] { snapshot = cache.Get(enumerator, HidFieldAttributes); });
+			for (int i = 0; i < 200 && enumerator->hungProbes.load() == 0; i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			// The caller holds the cache lock while it waits for the hung probe
+			auto start = std::chrono::steady_clock::now();
+			Assert::IsTrue(cache.Peek() == first);
+			Assert::AreEqual((uint64_t)1, cache.Generation());
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			Assert::IsTrue(ms < 2000);
+
+			enumerator->Release();
+			caller.join();
+			Assert::IsTrue(cache.Peek() == snapshot);
+			Assert::IsTrue(snapshot->devices[1].hasAttributes);
+		}
+
+		TEST_METHOD(TestShutdownCancelsRunningProbe)
+		{
+			// Without a deadline the caller waits for the probe until Shutdown cancels it
+			auto enumerator = std::make_shared<StallingHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1" };
+			enumerator->hung = { "hid#0fc5&b080#1" };
+			enumerator->releaseOnCancel = true;
+			HidDeviceCache cache;
+			cache.SetProbeThreads(2);
+			cache.SetProbeDeadline(0);
+
+			std::shared_ptr<const HidSnapshot> snapshot;
+			std::thread caller([&] { snapshot = cache.Get(enumerator, HidFieldAttributes); });
+			for (int i = 0; i < 200 && enumerator->hungProbes.load() == 0; i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			Assert::AreEqual((size_t)0, cache.Shutdown(10000));
+			caller.join();
+			Assert::AreEqual(1, enumerator->cancels.load());
+			Assert::AreEqual((size_t)2, snapshot->devices.size());
+			Assert::IsFalse(snapshot->devices[1].incomplete);
+		}
+
+		TEST_METHOD(TestShutdownLeavesHungProbe)
+		{
+			// A probe that ignores the cancel is waited for only as long as asked
+			auto enumerator = std::make_shared<StallingHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1" };
+			enumerator->hung = { "hid#0fc5&b080#1" };
+			HidDeviceCache cache;
+			cache.SetProbeThreads(2);
+			cache.SetProbeDeadline(0);
+
+			std::shared_ptr<const HidSnapshot> snapshot;
+			std::thread caller([&] { snapshot = cache.Get(enumerator, HidFieldAttributes); });
+			for (int i = 0; i < 200 && enumerator->hungProbes.load() == 0; i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			auto start = std::chrono::steady_clock::now();
+			Assert::AreEqual((size_t)1, cache.Shutdown(50));
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			Assert::IsTrue(ms < 2000);
+
+			// The detached thread finishes the probe for the caller still waiting on it
+			enumerator->Release();
+			caller.join();
+			Assert::IsFalse(snapshot->devices[1].incomplete);
+			Assert::IsTrue(snapshot->devices[1].hasAttributes);
+		}
+
+		TEST_METHOD(TestIncompleteRecordsAreRetried)
+		{
+			// The slow probe holds the only thread past the deadline, so the two
+			// queued behind it are reported incomplete without being probed
+			auto enumerator = std::make_shared<StallingHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#1", "hid#046d&c52b#1" };
+			enumerator->slow = { "hid#04d8&005e#1" };
+			enumerator->slowMs = 150;
+			HidDeviceCache cache;
+			cache.SetProbeThreads(1);
+			cache.SetProbeDeadline(100);
+			cache.SetProbeRetryDelay(200);
+
+			auto snapshot = cache.Get(enumerator, HidFieldAttributes);
+			for (const auto& device : snapshot->devices) {
+				Assert::IsTrue(device.incomplete);
+			}
+			uint64_t probes = cache.Probes();
+
+			// Not before the retry is due, even across a refresh
+			cache.Invalidate();
+			snapshot = cache.Get(enumerator, HidFieldAttributes);
+			Assert::AreEqual(probes, cache.Probes());
+			Assert::IsTrue(snapshot->devices[2].incomplete);
+
+			// Once due, the two are probed again and the slow one's late result
+			// is merged instead of probing it a second time
+			std::this_thread::sleep_for(std::chrono::milliseconds(250));
+			snapshot = cache.Get(enumerator, HidFieldAttributes);
+			Assert::AreEqual(probes + 2, cache.Probes());
+			for (const auto& device : snapshot->devices) {
+				Assert::IsFalse(device.incomplete);
+				Assert::IsTrue(device.hasAttributes);
+			}
+			Assert::AreEqual((uint64_t)1, snapshot->generation);
+			Assert::AreEqual(3, enumerator->probes.load());
+		}
+	};
+
+
+	// Reference DOM for the list, built the way GetHIDDeviceList used to
+	static nlohmann::json HidDeviceListDom(const HidSnapshot& snapshot, uint32_t fields) {
+		auto hex = [](bool valid, uint16_t value) -> std::string {
+			char text[8];
+			snprintf(text, sizeof(text), "0x%04x", value);
+			return valid ? text : "";
+		};
+		nlohmann::json list = nlohmann::json::array();
+		for (size_t i = 0; i < snapshot.devices.size(); i++) {
+			const HidDeviceRecord& record = snapshot.devices[i];
+			nlohmann::json device;
+			device["index"] = i;
+			if (record.incomplete) device["incomplete"] = true;
+			if (fields & HidFieldPath) device["path"] = (record.opened || (fields & HidFieldsOpened) == 0) ? record.path : "";
+			if (fields & HidFieldAttributes) {
+				device["vendorID"] = hex(record.hasAttributes, record.vendorID);
+				device["productID"] = hex(record.hasAttributes, record.productID);
+				device["versionNumber"] = hex(record.hasAttributes, record.versionNumber);
+			}
+			if (fields & HidFieldProduct) device["product"] = record.product;
+			if (fields & HidFieldManufacturer) device["manufacturer"] = record.manufacturer;
+			if (fields & HidFieldSerialNumber) device["serialNumber"] = record.serialNumber;
+			if (fields & HidFieldCaps) {
+				device["usage"] = hex(record.hasCaps, record.usage);
+				device["usagePage"] = hex(record.hasCaps, record.usagePage);
+				device["inputReportByteLength"] = record.inputReportByteLength;
+				device["outputReportByteLength"] = record.outputReportByteLength;
+				device["featureReportByteLength"] = record.featureReportByteLength;
+				device["numberOfLinkCollectionNodes"] = record.numberOfLinkCollectionNodes;
+				device["numberOfInputButtonCaps"] = record.numberOfInputButtonCaps;
+				device["numberOfInputValueCaps"] = record.numberOfInputValueCaps;
+				device["numberOfInputDataIndices"] = record.numberOfInputDataIndices;
+				device["numberOfOutputButtonCaps"] = record.numberOfOutputButtonCaps;
+				device["numberOfOutputValueCaps"] = record.numberOfOutputValueCaps;
+				device["numberOfOutputDataIndices"] = record.numberOfOutputDataIndices;
+				device["numberOfFeatureButtonCaps"] = record.numberOfFeatureButtonCaps;
+				device["numberOfFeatureValueCaps"] = record.numberOfFeatureValueCaps;
+				device["numberOfFeatureDataIndices"] = record.numberOfFeatureDataIndices;
+			}
+			if (fields & HidFieldAxes) {
+				device["axesTotal"] = record.axesTotal;
+				device["povTotal"] = record.povTotal;
+			}
+			if (fields & HidFieldButtons) device["buttonsTotal"] = record.buttonsTotal;
+			list.push_back(device);
+		}
+		return list;
+	}
+
+	// Same layout as ButtonRawDeviceInfo; ButtonControllerRawTest --check fills the real one
+	struct TestDeviceInfo {
+		int32_t index;
+		uint32_t flags;
+		uint16_t vendorID, productID, versionNumber, usage, usagePage;
+		uint16_t inputReportByteLength, outputReportByteLength, featureReportByteLength;
+		uint16_t numberOfLinkCollectionNodes;
+		uint16_t numberOfInputButtonCaps, numberOfInputValueCaps, numberOfInputDataIndices;
+		uint16_t numberOfOutputButtonCaps, numberOfOutputValueCaps, numberOfOutputDataIndices;
+		uint16_t numberOfFeatureButtonCaps, numberOfFeatureValueCaps, numberOfFeatureDataIndices;
+		int32_t axesTotal, buttonsTotal, povTotal;
+		char path[260];
+		char product[256];
+		char manufacturer[256];
+		char serialNumber[256];
+	};
+
+	static HidSnapshot SampleHidSnapshot(int count) {
+		HidSnapshot snapshot;
+		snapshot.fields = HidFieldAll;
+		for (int i = 0; i < count; i++) {
+			HidDeviceRecord record;
+			record.path = "\\\\?\\hid#vid_0fc5&pid_b080#" + std::to_string(i) + "&0000#{4d1e55b2-f16f-11cf-88cb-001111000030}";
+			record.opened = i % 5 != 4;
+			record.incomplete = i % 7 == 6;
+			record.hasAttributes = record.opened;
+			record.vendorID = 0x0fc5;
+			record.productID = static_cast<uint16_t>(0xb080 + i);
+			record.versionNumber = 0x0100;
+			record.product = i % 3 == 0 ? "Three Button \"Controller\"\t" : "USB FS IO \xc3\xa9";
+			record.manufacturer = std::string("Delcom\x01\\", 8);
+			record.serialNumber = std::to_string(100000 + i);
+			record.hasCaps = record.opened;
+			record.usage = 0x04;
+			record.usagePage = 0x01;
+			record.inputReportByteLength = 9;
+			record.numberOfInputButtonCaps = 1;
+			record.numberOfLinkCollectionNodes = 2;
+			record.axesTotal = i % 4;
+			record.povTotal = 1;
+			record.buttonsTotal = 3 + i;
+			snapshot.devices.push_back(record);
+		}
+		return snapshot;
+	}
+
+	// Device list JSON written straight into a buffer
+	TEST_CLASS(HidDeviceJsonTests)
+	{
+	public:
+		TEST_METHOD(TestMatchesDomDump)
+		{
+			HidSnapshot snapshot = SampleHidSnapshot(24);
+			uint32_t masks[] = { HidFieldAll, HidFieldPath, HidFieldPath | HidFieldAttributes,
+				HidFieldProduct | HidFieldCaps, HidFieldAxes | HidFieldButtons | HidFieldSerialNumber };
+			for (uint32_t fields : masks) {
+				std::string expected = HidDeviceListDom(snapshot, fields).dump(-1);
+				std::vector<char> buffer(expected.size() + 1);
+				JsonBufferAdapter output(buffer.data(), buffer.size());
+				WriteHidDeviceList(output, snapshot, fields);
+				Assert::IsTrue(output.Terminate());
+				Assert::AreEqual(expected, std::string(buffer.data()));
+			}
+		}
+
+		TEST_METHOD(TestSizeQueryAndShortBuffer)
+		{
+			HidSnapshot snapshot = SampleHidSnapshot(8);
+			JsonBufferAdapter sizing(nullptr, 0);
+			WriteHidDeviceList(sizing, snapshot, HidFieldAll);
+			size_t required = sizing.Size() + 1;
+
+			// One byte short: nothing is written past the buffer and there is no null
+			std::vector<char> buffer(required + 16, '#');
+			JsonBufferAdapter shortOutput(buffer.data(), required - 1);
+			WriteHidDeviceList(shortOutput, snapshot, HidFieldAll);
+			Assert::IsFalse(shortOutput.Terminate());
+			Assert::AreEqual(required - 1, shortOutput.Size());
+			Assert::AreEqual('#', buffer[required - 1]);
+
+			JsonBufferAdapter output(buffer.data(), required);
+			WriteHidDeviceList(output, snapshot, HidFieldAll);
+			Assert::IsTrue(output.Terminate());
+			Assert::AreEqual(required - 1, strlen(buffer.data()));
+			Assert::IsFalse(nlohmann::json::parse(buffer.data(), nullptr, false).is_discarded());
+		}
+
+		TEST_METHOD(TestBinaryFormatsRoundTrip)
+		{
+			HidSnapshot snapshot = SampleHidSnapshot(12);
+			nlohmann::json expected = HidDeviceListDocument(snapshot, HidFieldAll);
+			Assert::IsTrue(expected[4]["vendorID"].is_null()); // Not opened
+			Assert::AreEqual(0xb080, expected[0]["productID"].get<int>());
+
+			for (int format : { HidFormatCbor, HidFormatMsgPack }) {
+				std::vector<char> buffer(16 * 1024);
+				auto output = std::make_shared<JsonBufferAdapter>(buffer.data(), buffer.size());
+				Assert::IsTrue(WriteHidDeviceListBinary(output, snapshot, HidFieldAll, format));
+				buffer.resize(output->Size());
+				nlohmann::json decoded = format == HidFormatCbor ?
+					nlohmann::json::from_cbor(buffer) : nlohmann::json::from_msgpack(buffer);
+				Assert::IsTrue(decoded == expected);
+			}
+			auto output = std::make_shared<JsonBufferAdapter>(nullptr, 0);
+			Assert::IsFalse(WriteHidDeviceListBinary(output, snapshot, HidFieldAll, 3));
+		}
+	};
+
+	// Hash indexes over a snapshot
+	TEST_CLASS(HidSnapshotIndexTests)
+	{
+	public:
+		TEST_METHOD(TestIndexMatchesLinearSearch)
+		{
+			HidSnapshot linear = SampleHidSnapshot(20);
+			linear.devices[3].productID = linear.devices[9].productID; // Duplicate VID/PID
+			linear.devices[12].serialNumber = " 100003 ";
+			linear.devices[12].productID = linear.devices[3].productID;
+			linear.devices[7].usage = 0x05;
+			HidSnapshot indexed = linear;
+			indexed.BuildIndex();
+
+			for (const auto& device : linear.devices) {
+				Assert::AreEqual(linear.Find(device.path), indexed.Find(device.path));
+				Assert::AreEqual(linear.FindByVendorAndProductID(device.vendorID, device.productID),
+					indexed.FindByVendorAndProductID(device.vendorID, device.productID));
+				Assert::AreEqual(linear.FindByUsage(device.vendorID, device.productID, 0x01, 0x05),
+					indexed.FindByUsage(device.vendorID, device.productID, 0x01, 0x05));
+				Assert::AreEqual(linear.FindByProductString(device.product + "\n"),
+					indexed.FindByProductString(device.product + "\n"));
+				Assert::AreEqual(linear.FindBySerialNumber(device.vendorID, device.productID, device.serialNumber),
+					indexed.FindBySerialNumber(device.vendorID, device.productID, device.serialNumber));
+			}
+			Assert::AreEqual(3, indexed.FindByVendorAndProductID(0x0fc5, linear.devices[9].productID));
+			Assert::AreEqual(7, indexed.FindByUsage(0x0fc5, linear.devices[7].productID, 0x01, 0x05));
+			Assert::AreEqual(-1, indexed.FindByVendorAndProductID(0x0fc5, 0x0001));
+			Assert::AreEqual(-1, indexed.FindByProductString("Missing"));
+			// Unopened interfaces are not found by product string
+			Assert::AreEqual(-1, indexed.FindBySerialNumber(0x0fc5, linear.devices[4].productID, "100004"));
+		}
+
+		TEST_METHOD(TestCachePublishesIndexedSnapshots)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#0fc5&b080#A1" };
+			HidDeviceCache cache;
+			auto snapshot = cache.Get(enumerator, HidFieldPath);
+			Assert::IsTrue(snapshot->indexed);
+			Assert::AreEqual(-1, snapshot->FindByVendorAndProductID(0x0fc5, 0xb080));
+
+			// Completing a field group rebuilds the indexes
+			snapshot = cache.Get(enumerator, HidFieldAttributes | HidFieldSerialNumber);
+			Assert::AreEqual(1, snapshot->FindByVendorAndProductID(0x0fc5, 0xb080));
+			Assert::AreEqual(1, snapshot->FindBySerialNumber(0x0fc5, 0xb080, "A1"));
+
+			enumerator->paths.insert(enumerator->paths.begin(), "hid#046d&c52b#1");
+			cache.Invalidate();
+			snapshot = cache.Get(enumerator, HidFieldAttributes);
+			Assert::AreEqual(2, snapshot->FindByVendorAndProductID(0x0fc5, 0xb080));
+			Assert::AreEqual(0, snapshot->Find("hid#046d&c52b#1"));
+		}
+	};
+
+	// Saved device records for a fast cold start
+	TEST_CLASS(HidDeviceStoreTests)
+	{
+	public:
+		TEST_METHOD(TestRoundTrip)
+		{
+			HidSnapshot snapshot = SampleHidSnapshot(12);
+			std::vector<HidDeviceRecord> loaded;
+			Assert::IsTrue(LoadHidDeviceRecords(SaveHidDeviceRecords(snapshot.devices), loaded));
+
+			size_t next = 0;
+			for (const auto& record : snapshot.devices) {
+				if (record.incomplete) {
+					continue; // Never saved, it is probed again
+				}
+				Assert::IsTrue(next < loaded.size());
+				const HidDeviceRecord& copy = loaded[next++];
+				Assert::AreEqual(record.path, copy.path);
+				Assert::AreEqual(record.fields | HidFieldPath, copy.fields);
+				Assert::AreEqual(record.opened, copy.opened);
+				Assert::AreEqual(record.hasCaps, copy.hasCaps);
+				Assert::AreEqual(record.productID, copy.productID);
+				Assert::AreEqual(record.product, copy.product);
+				Assert::AreEqual(record.manufacturer, copy.manufacturer);
+				Assert::AreEqual(record.serialNumber, copy.serialNumber);
+				Assert::AreEqual(record.inputReportByteLength, copy.inputReportByteLength);
+				Assert::AreEqual(record.axesTotal, copy.axesTotal);
+				Assert::AreEqual(record.buttonsTotal, copy.buttonsTotal);
+			}
+			Assert::AreEqual(next, loaded.size());
+		}
+
+		TEST_METHOD(TestDamagedDataIsRejected)
+		{
+			std::string data = SaveHidDeviceRecords(SampleHidSnapshot(6).devices);
+			std::vector<HidDeviceRecord> loaded;
+
+			Assert::IsFalse(LoadHidDeviceRecords(data.substr(0, data.size() - 1), loaded));
+			Assert::IsFalse(LoadHidDeviceRecords(data.substr(0, 10), loaded));
+			std::string corrupt = data;
+			corrupt[corrupt.size() / 2] ^= 0x20;
+			Assert::IsFalse(LoadHidDeviceRecords(corrupt, loaded));
+			std::string otherVersion = data;
+			otherVersion[4] = HID_DEVICE_STORE_VERSION + 1;
+			Assert::IsFalse(LoadHidDeviceRecords(otherVersion, loaded));
+			Assert::IsTrue(loaded.empty());
+			Assert::IsTrue(LoadHidDeviceRecords(data, loaded));
+		}
+
+		TEST_METHOD(TestSeedsAreCheckedBeforeUse)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			enumerator->paths = { "hid#04d8&005e#1", "hid#04d8&005e#2", "hid#0fc5&b080#3" };
+			HidDeviceCache cold;
+			cold.SetProbeThreads(1);
+			auto saved = cold.Get(enumerator);
+
+			std::vector<HidDeviceRecord> records;
+			Assert::IsTrue(LoadHidDeviceRecords(SaveHidDeviceRecords(saved->devices), records));
+			records[1].vendorID = 0x1234; // Another device on that path now
+			records[1].product = "Stale";
+
+			HidDeviceCache warm;
+			warm.SetProbeThreads(1);
+			warm.Seed(records);
+			enumerator->probes = 0;
+			auto snapshot = warm.Get(enumerator);
+			Assert::AreEqual((uint64_t)3, warm.SeedsAdopted());
+			Assert::AreEqual(0, enumerator->probes.load()); // Nothing is opened until used
+			Assert::IsTrue(snapshot->devices[1].seeded);
+			Assert::AreEqual(std::string("Stale"), snapshot->devices[1].product);
+
+			for (const auto& device : saved->devices) {
+				snapshot = warm.Verify(enumerator, device.path);
+			}
+			// One attributes check each, plus a full probe of the mismatch
+			Assert::AreEqual(4, enumerator->probes.load());
+			Assert::AreEqual((uint64_t)1, snapshot->generation);
+			for (size_t i = 0; i < saved->devices.size(); i++) {
+				Assert::IsFalse(snapshot->devices[i].seeded);
+				Assert::AreEqual(saved->devices[i].vendorID, snapshot->devices[i].vendorID);
+				Assert::AreEqual(saved->devices[i].product, snapshot->devices[i].product);
+				Assert::AreEqual(saved->devices[i].serialNumber, snapshot->devices[i].serialNumber);
+			}
+			Assert::AreEqual(1, snapshot->FindBySerialNumber(0x04d8, 0x005e, "2"));
+		}
+	};
+
+#ifdef BUTTON_BENCHMARKS
+	// Snapshot, list and store timings on scripted and simulated devices
+	TEST_CLASS(HidDeviceBenchmarks)
+	{
+	public:
+		TEST_METHOD(BenchmarkListTimeByFieldMask)
+		{
+			const uint32_t masks[] = {
+				HidFieldPath,
+				HidFieldPath | HidFieldAttributes,
+				HidFieldPath | HidFieldAttributes | HidFieldProduct,
+				HidFieldAll,
+			};
+			const char* names[] = { "path", "path+ids", "path+ids+product", "all" };
+			const int counts[] = { 8, 24, 48 };
+
+			for (int count : counts) {
+				std::string report = std::to_string(count) + " devices:";
+				for (int m = 0; m < 4; m++) {
+					auto enumerator = std::make_shared<SimulatedHidEnumerator>();
+					enumerator->devices = count;
+					HidDeviceCache cache;
+					auto start = std::chrono::steady_clock::now();
+					auto snapshot = cache.Get(enumerator, masks[m]);
+					double ms = std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - start).count();
+					Assert::AreEqual((size_t)count, snapshot->devices.size());
+					report += std::string(" ") + names[m] + " " + std::to_string(ms) + " ms";
+				}
+				Logger::WriteMessage(report.c_str());
+			}
+		}
+
+		TEST_METHOD(BenchmarkParallelProbing)
+		{
+			const unsigned threadCounts[] = { 1, 2, 4, 8 };
+			std::string report = "Probe 24 devices, 1 ms per query:";
+			double serialMs = 0;
+			for (unsigned threads : threadCounts) {
+				auto enumerator = std::make_shared<SimulatedHidEnumerator>();
+				enumerator->devices = 24;
+				enumerator->blocking = true;
+				enumerator->openUs = 1000;
+				enumerator->attributesUs = 1000;
+				enumerator->stringUs = 1000;
+				enumerator->preparsedUs = 1000;
+				HidDeviceCache cache;
+				cache.SetProbeThreads(threads);
+
+				auto start = std::chrono::steady_clock::now();
+				auto snapshot = cache.Get(enumerator, HidFieldPath | HidFieldAttributes | HidFieldProduct);
+				double ms = std::chrono::duration<double, std::milli>(
+					std::chrono::steady_clock::now() - start).count();
+				Assert::AreEqual((size_t)24, snapshot->devices.size());
+				Assert::AreEqual(24 * 3, enumerator->calls.load());
+				if (threads == 1) {
+					serialMs = ms;
+				}
+				report += " " + std::to_string(threads) + " threads " + std::to_string(ms) +
+					" ms (x" + std::to_string(serialMs / ms) + ")";
+			}
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkCachedLookup)
+		{
+			auto enumerator = std::make_shared<ScriptedHidEnumerator>();
+			for (int i = 0; i < 48; i++) {
+				enumerator->paths.push_back("hid#" + std::to_string(1000 + i) + "&0001#1");
+			}
+			HidDeviceCache cache;
+			cache.Get(enumerator);
+
+			const int lookups = 100000;
+			int found = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < lookups; i++) {
+				auto snapshot = cache.Get(enumerator);
+				found += snapshot->devices[i % snapshot->devices.size()].hasAttributes ? 1 : 0;
+			}
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			Assert::AreEqual(lookups, found);
+			Assert::AreEqual(1, enumerator->enumerations);
+
+			std::string report = "Cached snapshot lookup over 48 interfaces: " +
+				std::to_string(ns / lookups) + " ns per call";
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkDirectVersusDom)
+		{
+			HidSnapshot snapshot = SampleHidSnapshot(48);
+			std::vector<char> buffer(64 * 1024);
+			const int rounds = 200;
+
+			auto start = std::chrono::steady_clock::now();
+			size_t domBytes = 0;
+			for (int r = 0; r < rounds; r++) {
+				std::string text = HidDeviceListDom(snapshot, HidFieldAll).dump(-1);
+				memcpy(buffer.data(), text.c_str(), text.size() + 1);
+				domBytes += text.size();
+			}
+			auto domUs = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			size_t directBytes = 0;
+			for (int r = 0; r < rounds; r++) {
+				JsonBufferAdapter output(buffer.data(), buffer.size());
+				WriteHidDeviceList(output, snapshot, HidFieldAll);
+				output.Terminate();
+				directBytes += output.Size();
+			}
+			auto directUs = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			Assert::AreEqual(domBytes, directBytes);
+
+			std::string report = "Device list of 48 interfaces: DOM " + std::to_string(domUs / rounds) +
+				" us, direct " + std::to_string(directUs / rounds) + " us";
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkProducerAndConsumer)
+		{
+			// Produce the list, then read every VID/PID the way a caller would
+			HidSnapshot snapshot = SampleHidSnapshot(48);
+			std::vector<char> buffer(64 * 1024);
+			std::vector<TestDeviceInfo> infos(snapshot.devices.size());
+			const int rounds = 200;
+			uint64_t sums[4] = { 0, 0, 0, 0 };
+			long long us[4];
+
+			auto start = std::chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++) {
+				JsonBufferAdapter output(buffer.data(), buffer.size());
+				WriteHidDeviceList(output, snapshot, HidFieldAll);
+				output.Terminate();
+				for (const auto& device : nlohmann::json::parse(buffer.data())) {
+					if (device["vendorID"].get<std::string>().empty()) continue;
+					sums[0] += std::stoul(device["vendorID"].get<std::string>(), nullptr, 16) +
+						std::stoul(device["productID"].get<std::string>(), nullptr, 16);
+				}
+			}
+			us[0] = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+			for (int format : { HidFormatCbor, HidFormatMsgPack }) {
+				int slot = format == HidFormatCbor ? 1 : 2;
+				start = std::chrono::steady_clock::now();
+				for (int r = 0; r < rounds; r++) {
+					auto output = std::make_shared<JsonBufferAdapter>(buffer.data(), buffer.size());
+					WriteHidDeviceListBinary(output, snapshot, HidFieldAll, format);
+					const uint8_t* bytes = reinterpret_cast<const uint8_t*>(buffer.data());
+					nlohmann::json list = format == HidFormatCbor ?
+						nlohmann::json::from_cbor(bytes, bytes + output->Size()) :
+						nlohmann::json::from_msgpack(bytes, bytes + output->Size());
+					for (const auto& device : list) {
+						if (device["vendorID"].is_null()) continue;
+						sums[slot] += device["vendorID"].get<uint32_t>() + device["productID"].get<uint32_t>();
+					}
+				}
+				us[slot] = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			start = std::chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++) {
+				for (size_t i = 0; i < snapshot.devices.size(); i++) {
+					FillHidDeviceInfo(snapshot.devices[i], i, infos[i]);
+				}
+				for (const auto& info : infos) {
+					if (info.flags & HidInfoHasAttributes) {
+						sums[3] += info.vendorID + info.productID;
+					}
+				}
+			}
+			us[3] = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+			Assert::IsTrue(sums[0] == sums[1] && sums[1] == sums[2] && sums[2] == sums[3]);
+			std::string report = "List and read 48 interfaces: JSON " + std::to_string(us[0] / rounds) +
+				" us, CBOR " + std::to_string(us[1] / rounds) + " us, MessagePack " + std::to_string(us[2] / rounds) +
+				" us, structs " + std::to_string(us[3] / rounds) + " us";
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkResolveSixControllers)
+		{
+			HidSnapshot linear = SampleHidSnapshot(64);
+			HidSnapshot indexed = linear;
+			indexed.BuildIndex();
+			const int rounds = 20000;
+			int found[2] = { 0, 0 };
+			long long ns[2];
+			const HidSnapshot* snapshots[2] = { &linear, &indexed };
+			for (int s = 0; s < 2; s++) {
+				auto start = std::chrono::steady_clock::now();
+				for (int r = 0; r < rounds; r++) {
+					// Six stations near the end of the list, as the worst case for a walk
+					for (int c : { 63, 62, 61, 60, 58, 57 }) {
+						const HidDeviceRecord& wanted = linear.devices[c];
+						found[s] += snapshots[s]->FindBySerialNumber(wanted.vendorID, wanted.productID,
+							wanted.serialNumber) >= 0 ? 1 : 0;
+					}
+				}
+				ns[s] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count() / rounds;
+			}
+			Assert::AreEqual(found[0], found[1]);
+			Assert::AreEqual(rounds * 6, found[1]);
+
+			std::string report = "Resolve 6 serials among 64 interfaces: linear " + std::to_string(ns[0]) +
+				" ns, indexed " + std::to_string(ns[1]) + " ns";
+			Logger::WriteMessage(report.c_str());
+		}
+
+		TEST_METHOD(BenchmarkColdAndWarmStart)
+		{
+			const int counts[] = { 8, 32, 64 };
+			for (int count : counts) {
+				auto enumerator = std::make_shared<SimulatedHidEnumerator>();
+				enumerator->devices = count;
+
+				HidDeviceCache cold;
+				auto start = std::chrono::steady_clock::now();
+				auto snapshot = cold.Get(enumerator);
+				double coldMs = std::chrono::duration<double, std::milli>(
+					std::chrono::steady_clock::now() - start).count();
+				int coldCalls = enumerator->calls.exchange(0);
+				std::string data = SaveHidDeviceRecords(snapshot->devices);
+
+				HidDeviceCache warm;
+				start = std::chrono::steady_clock::now();
+				std::vector<HidDeviceRecord> records;
+				Assert::IsTrue(LoadHidDeviceRecords(data, records));
+				warm.Seed(records);
+				auto seeded = warm.Get(enumerator);
+				double warmMs = std::chrono::duration<double, std::milli>(
+					std::chrono::steady_clock::now() - start).count();
+				int warmCalls = enumerator->calls.load();
+
+				Assert::AreEqual((size_t)count, seeded->devices.size());
+				Assert::AreEqual((uint64_t)count, warm.SeedsAdopted());
+				Assert::AreEqual(0, warmCalls); // Checked only when a lookup uses them
+				Assert::IsTrue(coldCalls > 0);
+				std::string report = std::to_string(count) + " devices: cold " + std::to_string(coldMs) +
+					" ms, warm " + std::to_string(warmMs) + " ms, " + std::to_string(data.size()) + " bytes";
+				Logger::WriteMessage(report.c_str());
+			}
+		}
+	};
+#endif
+}